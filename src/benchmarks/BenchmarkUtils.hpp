@@ -0,0 +1,71 @@
+#ifndef BENCHMARKUTILS_HPP_
+#define BENCHMARKUTILS_HPP_
+
+#include "renderer/TraceableScene.hpp"
+
+#include "io/DirectoryChange.hpp"
+#include "io/Scene.hpp"
+
+#include "Timer.hpp"
+
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Tungsten {
+
+namespace BenchmarkUtils {
+
+// Renders all passes of a scene and returns the time spent rendering in
+// seconds. Building the traceable scene is not included
+inline double timeRender(Scene &scene, uint32 seed = 0xBA5EBA11)
+{
+    std::unique_ptr<TraceableScene> flattenedScene;
+    {
+        DirectoryChange context(scene.path().parent());
+        flattenedScene.reset(scene.makeTraceable(seed));
+    }
+
+    Integrator &integrator = flattenedScene->integrator();
+    Timer timer;
+    while (!integrator.done()) {
+        integrator.startRender([](){});
+        integrator.waitForCompletion();
+    }
+    timer.stop();
+
+    return timer.elapsed();
+}
+
+inline double samplesPerSecond(const Scene &scene, double seconds)
+{
+    return double(scene.camera()->resolution().product())*scene.rendererSettings().spp()/seconds;
+}
+
+// Serializes a JSON value, e.g. to pass a modified copy of the settings of
+// a scene object back into its fromJson
+inline std::string jsonString(const rapidjson::Value &value)
+{
+    rapidjson::GenericStringBuffer<rapidjson::UTF8<>> buffer;
+    rapidjson::Writer<rapidjson::GenericStringBuffer<rapidjson::UTF8<>>> jsonWriter(buffer);
+    value.Accept(jsonWriter);
+    return buffer.GetString();
+}
+
+inline double median(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    size_t n = values.size();
+    if (n == 0)
+        return 0.0;
+    return n % 2 ? values[n/2] : (values[n/2 - 1] + values[n/2])*0.5;
+}
+
+}
+
+}
+
+#endif /* BENCHMARKUTILS_HPP_ */
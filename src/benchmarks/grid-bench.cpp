@@ -0,0 +1,259 @@
+#include "BenchmarkUtils.hpp"
+
+#include "grids/BrickGrid.hpp"
+#include "grids/GridDda.hpp"
+
+#include "sampling/UniformPathSampler.hpp"
+#include "sampling/UniformSampler.hpp"
+#include "sampling/SampleWarp.hpp"
+
+#include "io/CliParser.hpp"
+
+#include "Timer.hpp"
+
+#include <tinyformat/tinyformat.hpp>
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <cmath>
+
+using namespace Tungsten;
+
+static const int OPT_RESOLUTION = 1;
+static const int OPT_PUFFS      = 2;
+static const int OPT_RAYS       = 3;
+static const int OPT_RUNS       = 4;
+static const int OPT_HELP       = 5;
+
+// Dense float volume with the same voxel conventions as BrickGrid. This is
+// what a voxel medium needs without any sparse data structure
+struct DenseGrid
+{
+    Vec3i resolution;
+    std::vector<float> density;
+
+    float voxel(int x, int y, int z) const
+    {
+        if (uint32(x) >= uint32(resolution.x()) || uint32(y) >= uint32(resolution.y())
+                || uint32(z) >= uint32(resolution.z()))
+            return 0.0f;
+        return density[x + size_t(resolution.x())*(y + size_t(resolution.y())*z)];
+    }
+
+    float lookup(Vec3f p) const
+    {
+        Vec3f q = p - 0.5f;
+        int ix = int(std::floor(q.x())), iy = int(std::floor(q.y())), iz = int(std::floor(q.z()));
+        Vec3f f = q - Vec3f(float(ix), float(iy), float(iz));
+
+        float v000, v100, v010, v110, v001, v101, v011, v111;
+        if (ix >= 0 && iy >= 0 && iz >= 0 && ix + 1 < resolution.x() && iy + 1 < resolution.y() && iz + 1 < resolution.z()) {
+            size_t rowStride = resolution.x(), sliceStride = rowStride*resolution.y();
+            const float *d = density.data() + ix + rowStride*iy + sliceStride*iz;
+            v000 = d[0];                  v100 = d[1];
+            v010 = d[rowStride];          v110 = d[rowStride + 1];
+            v001 = d[sliceStride];        v101 = d[sliceStride + 1];
+            v011 = d[sliceStride + rowStride]; v111 = d[sliceStride + rowStride + 1];
+        } else {
+            v000 = voxel(ix, iy,     iz    ); v100 = voxel(ix + 1, iy,     iz    );
+            v010 = voxel(ix, iy + 1, iz    ); v110 = voxel(ix + 1, iy + 1, iz    );
+            v001 = voxel(ix, iy,     iz + 1); v101 = voxel(ix + 1, iy,     iz + 1);
+            v011 = voxel(ix, iy + 1, iz + 1); v111 = voxel(ix + 1, iy + 1, iz + 1);
+        }
+
+        float v00 = lerp(v000, v001, f.z()), v10 = lerp(v100, v101, f.z());
+        float v01 = lerp(v010, v011, f.z()), v11 = lerp(v110, v111, f.z());
+        return lerp(lerp(v00, v01, f.y()), lerp(v10, v11, f.y()), f.x());
+    }
+
+    // Nearest neighbor optical depth, stepping through every voxel
+    float opticalDepth(Vec3f p, Vec3f w, float t0, float t1) const
+    {
+        float integral = 0.0f;
+        GridDda::march(p, w, t0, t1, Vec3i(0), resolution, [&](Vec3i cell, float ta, float tb) {
+            integral += density[cell.x() + size_t(resolution.x())*(cell.y() + size_t(resolution.y())*cell.z())]*(tb - ta);
+            return false;
+        });
+        return integral;
+    }
+};
+
+// A cloud made of randomly placed, noisy spherical puffs. Most of the
+// volume stays empty, similar to production smoke and cloud assets
+static void generateCloud(int resolution, int numPuffs, DenseGrid &grid)
+{
+    UniformSampler sampler(0xBA5EBA11);
+
+    grid.resolution = Vec3i(resolution);
+    grid.density.assign(size_t(resolution)*resolution*resolution, 0.0f);
+
+    for (int i = 0; i < numPuffs; ++i) {
+        Vec3f center = Vec3f(0.2f) + Vec3f(sampler.next1D(), sampler.next1D(), sampler.next1D())*0.6f;
+        center *= float(resolution);
+        float radius = resolution*(0.03f + 0.07f*sampler.next1D());
+
+        Vec3i lo = max(Vec3i(center - radius), Vec3i(0));
+        Vec3i hi = min(Vec3i(center + radius) + 1, Vec3i(resolution));
+        for (int z = lo.z(); z < hi.z(); ++z) {
+            for (int y = lo.y(); y < hi.y(); ++y) {
+                for (int x = lo.x(); x < hi.x(); ++x) {
+                    float r2 = (Vec3f(Vec3i(x, y, z)) + 0.5f - center).lengthSq()/(radius*radius);
+                    if (r2 >= 1.0f)
+                        continue;
+                    float falloff = (1.0f - r2)*(1.0f - r2);
+                    float noise = 0.75f + 0.25f*std::sin(x*0.7f)*std::sin(y*0.9f + z*0.4f);
+                    float &d = grid.density[x + size_t(resolution)*(y + size_t(resolution)*z)];
+                    d = max(d, falloff*noise);
+                }
+            }
+        }
+    }
+}
+
+struct Segment
+{
+    Vec3f p, w;
+    float tMax;
+};
+
+// Segments start at a random point inside the volume and end where they leave it
+static std::vector<Segment> generateSegments(int numRays, Vec3i resolution, UniformSampler &sampler)
+{
+    Vec3f size(resolution);
+    std::vector<Segment> rays(numRays);
+    for (Segment &ray : rays) {
+        ray.p = Vec3f(sampler.next1D(), sampler.next1D(), sampler.next1D())*size;
+        ray.w = SampleWarp::uniformSphere(sampler.next2D());
+        ray.tMax = std::numeric_limits<float>::infinity();
+        for (int i = 0; i < 3; ++i) {
+            if (ray.w[i] > 0.0f)
+                ray.tMax = min(ray.tMax, (size[i] - ray.p[i])/ray.w[i]);
+            else if (ray.w[i] < 0.0f)
+                ray.tMax = min(ray.tMax, -ray.p[i]/ray.w[i]);
+        }
+    }
+    return rays;
+}
+
+// Lookup positions of delta tracking along the given rays, with a mean free
+// path of one voxel. This is the access pattern of VoxelMedium::sampleDistance
+// without majorant grid, where every tentative collision looks up the
+// density of the grid
+static std::vector<Vec3f> trackingPoints(const std::vector<Segment> &rays, UniformSampler &sampler)
+{
+    std::vector<Vec3f> points;
+    for (const Segment &ray : rays)
+        for (float t = -std::log(1.0f - sampler.next1D()); t < ray.tMax; t -= std::log(1.0f - sampler.next1D()))
+            points.push_back(ray.p + ray.w*t);
+    return points;
+}
+
+template<typename Lookup>
+static double timeLookups(const std::vector<Vec3f> &points, int runs, double &sink, Lookup lookup)
+{
+    std::vector<double> times;
+    for (int i = 0; i < runs; ++i) {
+        Timer timer;
+        float sum = 0.0f;
+        for (const Vec3f &p : points)
+            sum += lookup(p);
+        timer.stop();
+        sink += sum;
+        times.push_back(timer.elapsed()/points.size());
+    }
+    return BenchmarkUtils::median(times);
+}
+
+template<typename Integrate>
+static double timeRays(const std::vector<Segment> &rays, int runs, double &sink, Integrate integrate)
+{
+    std::vector<double> times;
+    for (int i = 0; i < runs; ++i) {
+        Timer timer;
+        float sum = 0.0f;
+        for (const Segment &ray : rays)
+            sum += integrate(ray);
+        timer.stop();
+        sink += sum;
+        times.push_back(timer.elapsed()/rays.size());
+    }
+    return BenchmarkUtils::median(times);
+}
+
+// Compares memory use and lookup cost of BrickGrid against a dense float
+// grid of the same procedural cloud. OpenVDB is not part of this build, so
+// the dense grid is the baseline a voxel medium would otherwise need
+int main(int argc, const char *argv[])
+{
+    CliParser parser("grid_bench", "[options]");
+    parser.addOption('h', "help", "Prints this help text", false, OPT_HELP);
+    parser.addOption('\0', "resolution", "Resolution of the cubic test volume (default: 256)", true, OPT_RESOLUTION);
+    parser.addOption('p', "puffs", "Number of puffs the test cloud is made of (default: 64)", true, OPT_PUFFS);
+    parser.addOption('n', "rays", "Number of rays per measurement (default: 65536)", true, OPT_RAYS);
+    parser.addOption('r', "runs", "Number of runs per measurement (default: 5)", true, OPT_RUNS);
+    parser.parse(argc, argv);
+
+    if (parser.isPresent(OPT_HELP)) {
+        parser.printHelpText();
+        return 0;
+    }
+
+    auto intParam = [&](int option, int defaultValue) {
+        return parser.isPresent(option) ? std::max(std::atoi(parser.param(option).c_str()), 1) : defaultValue;
+    };
+    int resolution = intParam(OPT_RESOLUTION, 256);
+    int numPuffs = intParam(OPT_PUFFS, 64);
+    int numRays = intParam(OPT_RAYS, 1 << 16);
+    int runs = intParam(OPT_RUNS, 5);
+
+    DenseGrid dense;
+    generateCloud(resolution, numPuffs, dense);
+    BrickGrid bricks;
+    bricks.buildFromDense(dense.resolution, dense.density.data(), nullptr);
+
+    size_t numVoxels = dense.density.size();
+    size_t occupied = numVoxels - std::count(dense.density.begin(), dense.density.end(), 0.0f);
+    Vec3i brickCount = (dense.resolution + BrickGrid::BrickSize - 1)/BrickGrid::BrickSize;
+    std::cout << tfm::format("%d^3 voxels, %.1f%% occupied, %d of %d bricks allocated, %d runs", resolution,
+            occupied*100.0/numVoxels, bricks.brickCount(), brickCount.product(), runs) << std::endl;
+    std::cout << tfm::format("Memory: brick %.2f MB, dense %.2f MB",
+            bricks.memoryUsage()*1e-6, numVoxels*sizeof(float)*1e-6) << std::endl;
+
+    UniformSampler sampler(0xDEADBEEF);
+    std::vector<Segment> rays = generateSegments(numRays, dense.resolution, sampler);
+    std::vector<Vec3f> tracking = trackingPoints(rays, sampler);
+    std::vector<Vec3f> random(tracking.size());
+    for (Vec3f &p : random)
+        p = Vec3f(sampler.next1D(), sampler.next1D(), sampler.next1D())*Vec3f(dense.resolution);
+
+    double sink = 0.0;
+    UniformPathSampler pathSampler(0);
+
+    std::cout << "                                  brick       dense  speedup" << std::endl;
+    auto print = [](const char *name, const char *unit, double brickTime, double denseTime) {
+        std::cout << tfm::format("%-22s %s  %8.2f  %10.2f  %6.2fx", name, unit,
+                brickTime*1e9, denseTime*1e9, denseTime/brickTime) << std::endl;
+    };
+
+    print("Delta tracking lookups", "ns", timeLookups(tracking, runs, sink, [&](Vec3f p) {
+        return bricks.density(p);
+    }), timeLookups(tracking, runs, sink, [&](Vec3f p) {
+        return dense.lookup(p);
+    }));
+    print("Random lookups", "ns", timeLookups(random, runs, sink, [&](Vec3f p) {
+        return bricks.density(p);
+    }), timeLookups(random, runs, sink, [&](Vec3f p) {
+        return dense.lookup(p);
+    }));
+    print("Optical depth per ray", "ns", timeRays(rays, runs, sink, [&](const Segment &ray) {
+        return bricks.opticalDepth(pathSampler, ray.p, ray.w, 0.0f, ray.tMax);
+    }), timeRays(rays, runs, sink, [&](const Segment &ray) {
+        return dense.opticalDepth(ray.p, ray.w, 0.0f, ray.tMax);
+    }));
+
+    // Printing the checksum keeps the lookups observable
+    std::cout << tfm::format("Checksum: %f", sink) << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,182 @@
+#include "BenchmarkUtils.hpp"
+
+#include "primitives/EmbreeUtil.hpp"
+#include "primitives/Curves.hpp"
+
+#include "sampling/UniformSampler.hpp"
+#include "sampling/SampleWarp.hpp"
+
+#include "math/TangentFrame.hpp"
+#include "math/Angle.hpp"
+
+#include "thread/ThreadUtils.hpp"
+
+#include "io/JsonDocument.hpp"
+#include "io/CliParser.hpp"
+#include "io/CurveIO.hpp"
+#include "io/Scene.hpp"
+
+#include <rapidjson/document.h>
+#include <tinyformat/tinyformat.hpp>
+#include <iostream>
+#include <cstdlib>
+
+using namespace Tungsten;
+
+static const int OPT_THREADS  = 1;
+static const int OPT_SPP      = 2;
+static const int OPT_RUNS     = 3;
+static const int OPT_STRANDS  = 4;
+static const int OPT_GENERATE = 5;
+static const int OPT_HELP     = 6;
+
+static const uint32 NodesPerStrand = 24;
+
+// Generates a ball of curly hair: Strands grow out of the upper part of a
+// unit sphere, droop under gravity and curl around their axis with a
+// random radius and phase. The model only depends on the strand count, so
+// every run of the benchmark traces the same curves
+static void generateCurlyHair(uint32 strandCount, std::vector<uint32> &curveEnds, std::vector<Vec4f> &nodeData)
+{
+    UniformSampler sampler(0xBA5EBA11);
+
+    curveEnds.clear();
+    nodeData.clear();
+    curveEnds.reserve(strandCount);
+    nodeData.reserve(strandCount*NodesPerStrand);
+
+    const Vec3f gravity(0.0f, -1.0f, 0.0f);
+    const float segmentLength = 0.09f;
+    const float width = 0.004f;
+
+    for (uint32 i = 0; i < strandCount; ++i) {
+        Vec3f root;
+        do {
+            root = SampleWarp::uniformSphere(sampler.next2D());
+        } while (root.y() < -0.3f);
+
+        float curlRadius = 0.03f + 0.05f*sampler.next1D();
+        float curlFrequency = 1.5f + sampler.next1D();
+        float phase = TWO_PI*sampler.next1D();
+
+        Vec3f axis = root;
+        Vec3f dir = root;
+        for (uint32 t = 0; t < NodesPerStrand; ++t) {
+            TangentFrame frame(dir);
+            float angle = phase + curlFrequency*t;
+            // Curls start small at the root, so that strands don't leave the scalp
+            float radius = curlRadius*std::min(t/4.0f, 1.0f);
+            Vec3f p = axis + radius*(std::cos(angle)*frame.tangent + std::sin(angle)*frame.bitangent);
+            nodeData.emplace_back(p.x(), p.y(), p.z(), width);
+
+            axis += dir*segmentLength;
+            dir = (dir + gravity*0.12f).normalized();
+        }
+        curveEnds.push_back(uint32(nodeData.size()));
+    }
+}
+
+// Reconfigures the curves through their JSON representation, which is the
+// only interface that exposes the intersection mode
+static void configureCurves(Curves &curves, const Scene &scene, const char *mode, bool useEmbree)
+{
+    rapidjson::Document document;
+    rapidjson::Value value = curves.toJson(document.GetAllocator());
+    value["mode"].SetString(mode, document.GetAllocator());
+    value["use_embree"].SetBool(useEmbree);
+
+    JsonDocument json(scene.path(), BenchmarkUtils::jsonString(value));
+    curves.fromJson(json, scene);
+}
+
+// Compares the internal curve BVH with Embree's native curves for the
+// cylinder modes of the first curves primitive in the scene. If the curve
+// file of the primitive doesn't exist yet (or --generate is passed), a
+// procedural curly hair model is written to it first
+int main(int argc, const char *argv[])
+{
+    CliParser parser("hair_bench", "[options] scene");
+    parser.addOption('h', "help", "Prints this help text", false, OPT_HELP);
+    parser.addOption('t', "threads", "Number of render threads (default: number of cores)", true, OPT_THREADS);
+    parser.addOption('\0', "spp", "Samples per pixel to render in every run. Overrides the setting in the scene file", true, OPT_SPP);
+    parser.addOption('r', "runs", "Number of runs per configuration (default: 3)", true, OPT_RUNS);
+    parser.addOption('s', "strands", "Number of strands of the generated hair model (default: 20000)", true, OPT_STRANDS);
+    parser.addOption('g', "generate", "Regenerates the hair model even if the curve file already exists", false, OPT_GENERATE);
+    parser.parse(argc, argv);
+
+    if (parser.operands().size() != 1 || parser.isPresent(OPT_HELP)) {
+        parser.printHelpText();
+        return 0;
+    }
+
+    uint32 threadCount = ThreadUtils::idealThreadCount();
+    if (parser.isPresent(OPT_THREADS))
+        threadCount = std::max(std::atoi(parser.param(OPT_THREADS).c_str()), 1);
+    int runs = parser.isPresent(OPT_RUNS) ? std::max(std::atoi(parser.param(OPT_RUNS).c_str()), 1) : 3;
+    uint32 strandCount = parser.isPresent(OPT_STRANDS) ? std::max(std::atoi(parser.param(OPT_STRANDS).c_str()), 1) : 20000;
+
+    EmbreeUtil::initDevice();
+    ThreadUtils::startThreads(threadCount);
+
+    std::unique_ptr<Scene> scene;
+    std::shared_ptr<Curves> curves;
+    try {
+        scene.reset(Scene::load(Path(parser.operands()[0])));
+        for (const std::shared_ptr<Primitive> &prim : scene->primitives()) {
+            curves = std::dynamic_pointer_cast<Curves>(prim);
+            if (curves)
+                break;
+        }
+        if (!curves || !curves->path()) {
+            std::cerr << "Scene does not contain a curves primitive with a curve file" << std::endl;
+            return 1;
+        }
+
+        DirectoryChange context(scene->path().parent());
+        Path curvePath = curves->path()->absolute();
+        if (parser.isPresent(OPT_GENERATE) || !curvePath.exists()) {
+            std::vector<uint32> curveEnds;
+            std::vector<Vec4f> nodeData;
+            generateCurlyHair(strandCount, curveEnds, nodeData);
+
+            CurveIO::CurveData data;
+            data.curveEnds = &curveEnds;
+            data.nodeData = &nodeData;
+            if (!CurveIO::save(curvePath, data)) {
+                std::cerr << tfm::format("Unable to write hair model to %s", curvePath) << std::endl;
+                return 1;
+            }
+            std::cout << tfm::format("Wrote %d strands (%d nodes) to %s", strandCount, nodeData.size(), curvePath) << std::endl;
+        }
+
+        scene->loadResources();
+    } catch (const std::runtime_error &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    if (parser.isPresent(OPT_SPP))
+        scene->rendererSettings().setSpp(std::atoi(parser.param(OPT_SPP).c_str()));
+
+    std::cout << tfm::format("%d threads, %d spp, %d runs per configuration", threadCount,
+            scene->rendererSettings().spp(), runs) << std::endl;
+
+    const char *modes[] = {"bcsdf_cylinder", "half_cylinder", "cylinder"};
+    for (const char *mode : modes) {
+        std::vector<double> bvhTimes, embreeTimes;
+        for (int i = 0; i < runs; ++i) {
+            configureCurves(*curves, *scene, mode, false);
+            bvhTimes.push_back(BenchmarkUtils::timeRender(*scene));
+            configureCurves(*curves, *scene, mode, true);
+            embreeTimes.push_back(BenchmarkUtils::timeRender(*scene));
+        }
+
+        double bvhTime = BenchmarkUtils::median(bvhTimes);
+        double embreeTime = BenchmarkUtils::median(embreeTimes);
+        std::cout << tfm::format("%-14s  BVH %.3fs (%.3f Msamples/s), Embree %.3fs (%.3f Msamples/s), speedup %.2fx",
+                mode, bvhTime, BenchmarkUtils::samplesPerSecond(*scene, bvhTime)*1e-6,
+                embreeTime, BenchmarkUtils::samplesPerSecond(*scene, embreeTime)*1e-6,
+                bvhTime/embreeTime) << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,181 @@
+#include "BenchmarkUtils.hpp"
+
+#include "primitives/MeshBuffer.hpp"
+
+#include "math/MathUtil.hpp"
+#include "math/Angle.hpp"
+#include "math/Box.hpp"
+
+#include "io/FileUtils.hpp"
+#include "io/CliParser.hpp"
+#include "io/MeshIO.hpp"
+
+#include "Timer.hpp"
+
+#include <tinyformat/tinyformat.hpp>
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+
+using namespace Tungsten;
+
+static const int OPT_TRIANGLES = 1;
+static const int OPT_RUNS      = 2;
+static const int OPT_DIRECTORY = 3;
+static const int OPT_HELP      = 4;
+
+// Tessellated unit sphere with at least the requested number of triangles
+static void generateSphere(uint32 minTriangles, std::vector<Vertex> &verts, std::vector<TriangleI> &tris)
+{
+    uint32 rings = std::max(uint32(std::ceil(std::sqrt(minTriangles*0.25f))), 2u);
+    uint32 segments = 2*rings;
+
+    for (uint32 i = 0; i <= rings; ++i) {
+        float theta = PI*i/rings;
+        for (uint32 j = 0; j <= segments; ++j) {
+            float phi = TWO_PI*j/segments;
+            Vec3f n(std::sin(theta)*std::cos(phi), std::cos(theta), std::sin(theta)*std::sin(phi));
+            verts.emplace_back(n, n, Vec2f(float(j)/segments, float(i)/rings));
+        }
+    }
+    for (uint32 i = 0; i < rings; ++i) {
+        for (uint32 j = 0; j < segments; ++j) {
+            uint32 v0 = i*(segments + 1) + j;
+            uint32 v1 = v0 + segments + 1;
+            tris.emplace_back(v0, v1, v0 + 1);
+            tris.emplace_back(v0 + 1, v1, v1 + 1);
+        }
+    }
+}
+
+// Stands in for what the renderer does with a freshly loaded mesh: It reads
+// every vertex and triangle once when it builds the acceleration structure,
+// which is also what makes a memory mapped file page in. Bounds and the
+// triangle areas are only computed if the file didn't store them
+static double useMesh(const MeshBuffer<Vertex> &verts, const MeshBuffer<TriangleI> &tris,
+        const MeshIO::MeshMetadata &metadata)
+{
+    double checksum = 0.0;
+    for (const Vertex &v : verts)
+        checksum += v.pos().x();
+    for (const TriangleI &t : tris)
+        checksum += t.v0;
+
+    Box3f bounds = metadata.bounds;
+    if (!metadata.hasBounds)
+        for (const Vertex &v : verts)
+            bounds.grow(v.pos());
+
+    float totalArea = metadata.totalArea;
+    if (!metadata.hasAreaCdf) {
+        std::vector<float> cdf(tris.size() + 1);
+        cdf[0] = totalArea = 0.0f;
+        for (size_t i = 0; i < tris.size(); ++i) {
+            const TriangleI &t = tris[i];
+            totalArea += MathUtil::triangleArea(verts[t.v0].pos(), verts[t.v1].pos(), verts[t.v2].pos());
+            cdf[i + 1] = totalArea;
+        }
+        checksum += cdf[tris.size()/2];
+    }
+
+    return checksum + totalArea + bounds.diagonal().x();
+}
+
+struct Timings
+{
+    std::vector<double> load;
+    std::vector<double> total;
+};
+
+static void timeLoad(const Path &path, Timings &timings, double &sink)
+{
+    MeshBuffer<Vertex> verts;
+    MeshBuffer<TriangleI> tris;
+    MeshIO::MeshMetadata metadata;
+
+    Timer timer;
+    if (!MeshIO::load(path, verts, tris, metadata))
+        throw std::runtime_error(tfm::format("Unable to load mesh file %s", path));
+    timer.stop();
+    timings.load.push_back(timer.elapsed());
+    timer.start();
+    sink += useMesh(verts, tris, metadata);
+    timer.stop();
+    timings.total.push_back(timings.load.back() + timer.elapsed());
+}
+
+// Compares loading a mesh from a .wo3 file with loading it from a memory
+// mapped .wo4 file. The mesh is either the operand (any format MeshIO can
+// read) or a generated sphere. Both files are written to the output
+// directory first and deleted afterwards, and both are read from a warm
+// file cache, so this measures parsing and copying rather than disk speed
+int main(int argc, const char *argv[])
+{
+    CliParser parser("mesh_bench", "[options] [mesh]");
+    parser.addOption('h', "help", "Prints this help text", false, OPT_HELP);
+    parser.addOption('n', "triangles", "Triangle count of the generated mesh if none is given (default: 4194304)", true, OPT_TRIANGLES);
+    parser.addOption('r', "runs", "Number of runs per format (default: 5)", true, OPT_RUNS);
+    parser.addOption('d', "directory", "Directory to write the test files to (default: current directory)", true, OPT_DIRECTORY);
+    parser.parse(argc, argv);
+
+    if (parser.operands().size() > 1 || parser.isPresent(OPT_HELP)) {
+        parser.printHelpText();
+        return 0;
+    }
+
+    uint32 numTriangles = parser.isPresent(OPT_TRIANGLES) ? std::max(std::atoi(parser.param(OPT_TRIANGLES).c_str()), 1) : 1 << 22;
+    int runs = parser.isPresent(OPT_RUNS) ? std::max(std::atoi(parser.param(OPT_RUNS).c_str()), 1) : 5;
+    Path directory = parser.isPresent(OPT_DIRECTORY) ? Path(parser.param(OPT_DIRECTORY)) : FileUtils::getCurrentDir();
+
+    std::vector<Vertex> verts;
+    std::vector<TriangleI> tris;
+    if (parser.operands().empty()) {
+        generateSphere(numTriangles, verts, tris);
+    } else if (!MeshIO::load(Path(parser.operands()[0]), verts, tris)) {
+        std::cerr << tfm::format("Unable to load mesh file %s", parser.operands()[0]) << std::endl;
+        return 1;
+    }
+
+    Path wo3Path = directory/"mesh_bench.wo3";
+    Path wo4Path = directory/"mesh_bench.wo4";
+    if (!MeshIO::save(wo3Path, verts, tris) || !MeshIO::save(wo4Path, verts, tris)) {
+        std::cerr << tfm::format("Unable to write test files to %s", directory) << std::endl;
+        return 1;
+    }
+
+    std::cout << tfm::format("%d vertices, %d triangles, %.1f MB (.wo3), %.1f MB (.wo4), %d runs per format",
+            verts.size(), tris.size(), FileUtils::fileSize(wo3Path)*1e-6, FileUtils::fileSize(wo4Path)*1e-6,
+            runs) << std::endl;
+    verts.clear();
+    verts.shrink_to_fit();
+    tris.clear();
+    tris.shrink_to_fit();
+
+    double sink = 0.0;
+    Timings wo3Times, wo4Times;
+    try {
+        // Formats are interleaved, so that both see the same state of the
+        // file cache and allocator
+        for (int i = 0; i < runs; ++i) {
+            timeLoad(wo3Path, wo3Times, sink);
+            timeLoad(wo4Path, wo4Times, sink);
+        }
+    } catch (const std::runtime_error &e) {
+        std::cerr << e.what() << std::endl;
+    }
+    FileUtils::deleteFile(wo3Path);
+    FileUtils::deleteFile(wo4Path);
+    if (wo4Times.total.size() < size_t(runs))
+        return 1;
+
+    double wo3Load = BenchmarkUtils::median(wo3Times.load), wo3Total = BenchmarkUtils::median(wo3Times.total);
+    double wo4Load = BenchmarkUtils::median(wo4Times.load), wo4Total = BenchmarkUtils::median(wo4Times.total);
+    std::cout << "format  load ms  load + first use ms" << std::endl;
+    std::cout << tfm::format(".wo3    %7.2f  %19.2f", wo3Load*1e3, wo3Total*1e3) << std::endl;
+    std::cout << tfm::format(".wo4    %7.2f  %19.2f", wo4Load*1e3, wo4Total*1e3) << std::endl;
+    std::cout << tfm::format("Speedup %6.1fx  %18.1fx", wo3Load/wo4Load, wo3Total/wo4Total) << std::endl;
+    // Printing the checksum keeps the first use observable
+    std::cout << tfm::format("Checksum: %f", sink) << std::endl;
+
+    return 0;
+}
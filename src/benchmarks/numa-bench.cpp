@@ -0,0 +1,88 @@
+#include "BenchmarkUtils.hpp"
+
+#include "primitives/EmbreeUtil.hpp"
+
+#include "thread/ThreadUtils.hpp"
+#include "thread/ThreadPool.hpp"
+
+#include "io/CliParser.hpp"
+#include "io/Scene.hpp"
+
+#include <tinyformat/tinyformat.hpp>
+#include <iostream>
+#include <cstdlib>
+
+using namespace Tungsten;
+
+static const int OPT_THREADS = 1;
+static const int OPT_SPP     = 2;
+static const int OPT_RUNS    = 3;
+static const int OPT_HELP    = 4;
+
+// Compares render throughput with and without --numa style thread pinning.
+// Both configurations use a pool of the same size and render the same
+// scene in alternating runs, so that thermal and cache effects are spread
+// over both of them
+int main(int argc, const char *argv[])
+{
+    CliParser parser("numa_bench", "[options] scene");
+    parser.addOption('h', "help", "Prints this help text", false, OPT_HELP);
+    parser.addOption('t', "threads", "Number of render threads (default: number of cores)", true, OPT_THREADS);
+    parser.addOption('\0', "spp", "Samples per pixel to render in every run. Overrides the setting in the scene file", true, OPT_SPP);
+    parser.addOption('r', "runs", "Number of runs per configuration (default: 3)", true, OPT_RUNS);
+    parser.parse(argc, argv);
+
+    if (parser.operands().size() != 1 || parser.isPresent(OPT_HELP)) {
+        parser.printHelpText();
+        return 0;
+    }
+
+    uint32 threadCount = ThreadUtils::idealThreadCount();
+    if (parser.isPresent(OPT_THREADS))
+        threadCount = std::max(std::atoi(parser.param(OPT_THREADS).c_str()), 1);
+    int runs = parser.isPresent(OPT_RUNS) ? std::max(std::atoi(parser.param(OPT_RUNS).c_str()), 1) : 3;
+
+    EmbreeUtil::initDevice();
+
+    // ThreadPool::stop detaches its workers, so pools can't safely be
+    // destroyed and recreated. Instead, both pools stay alive, and the one
+    // that isn't used sleeps
+    ThreadUtils::startThreads(threadCount, false);
+    ThreadPool *unpinned = ThreadUtils::pool;
+    ThreadUtils::startThreads(threadCount, true);
+    ThreadPool *pinned = ThreadUtils::pool;
+
+    std::unique_ptr<Scene> scene;
+    try {
+        scene.reset(Scene::load(Path(parser.operands()[0])));
+        scene->loadResources();
+    } catch (const std::runtime_error &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    if (parser.isPresent(OPT_SPP))
+        scene->rendererSettings().setSpp(std::atoi(parser.param(OPT_SPP).c_str()));
+
+    std::cout << tfm::format("%d threads across %d NUMA node(s), %d spp, %d runs per configuration",
+            threadCount, ThreadUtils::numaNodeCount(), scene->rendererSettings().spp(), runs) << std::endl;
+
+    std::vector<double> unpinnedTimes, pinnedTimes;
+    for (int i = 0; i < runs; ++i) {
+        ThreadUtils::pool = unpinned;
+        unpinnedTimes.push_back(BenchmarkUtils::timeRender(*scene));
+        ThreadUtils::pool = pinned;
+        pinnedTimes.push_back(BenchmarkUtils::timeRender(*scene));
+        std::cout << tfm::format("Run %d: unpinned %.3fs, pinned %.3fs", i + 1,
+                unpinnedTimes.back(), pinnedTimes.back()) << std::endl;
+    }
+
+    double unpinnedTime = BenchmarkUtils::median(unpinnedTimes);
+    double pinnedTime = BenchmarkUtils::median(pinnedTimes);
+    std::cout << tfm::format("Unpinned: %.3fs (%.3f Msamples/s)", unpinnedTime,
+            BenchmarkUtils::samplesPerSecond(*scene, unpinnedTime)*1e-6) << std::endl;
+    std::cout << tfm::format("Pinned:   %.3fs (%.3f Msamples/s)", pinnedTime,
+            BenchmarkUtils::samplesPerSecond(*scene, pinnedTime)*1e-6) << std::endl;
+    std::cout << tfm::format("Speedup from pinning: %.3fx", unpinnedTime/pinnedTime) << std::endl;
+
+    return 0;
+}
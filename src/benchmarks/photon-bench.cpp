@@ -0,0 +1,201 @@
+#include "BenchmarkUtils.hpp"
+
+#include "integrators/photon_map/HashGrid.hpp"
+#include "integrators/photon_map/Photon.hpp"
+#include "integrators/photon_map/KdTree.hpp"
+
+#include "sampling/UniformSampler.hpp"
+#include "sampling/SampleWarp.hpp"
+
+#include "thread/ThreadUtils.hpp"
+
+#include "io/CliParser.hpp"
+
+#include "Timer.hpp"
+
+#include <tinyformat/tinyformat.hpp>
+#include <iostream>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+
+using namespace Tungsten;
+
+static const int OPT_THREADS = 1;
+static const int OPT_PHOTONS = 2;
+static const int OPT_RADIUS  = 3;
+static const int OPT_K       = 4;
+static const int OPT_QUERIES = 5;
+static const int OPT_BEAMS   = 6;
+static const int OPT_RUNS    = 7;
+static const int OPT_HELP    = 8;
+
+// Uniformly distributed point on the surface of the unit cube
+static Vec3f sampleCubeSurface(UniformSampler &sampler)
+{
+    int face = min(int(sampler.next1D()*6.0f), 5);
+    Vec3f p(sampler.next1D(), sampler.next1D(), sampler.next1D());
+    p[face % 3] = face < 3 ? 0.0f : 1.0f;
+    return p;
+}
+
+struct Beam
+{
+    Vec3f pos, dir;
+    float farT;
+};
+
+struct Timings
+{
+    std::vector<double> build;
+    std::vector<double> query;
+};
+
+// Builds the accelerator over a fresh copy of the photons (both reorder
+// them in place) and runs all queries on it. Returns a checksum of the
+// query results, so that both accelerators can be checked for agreement
+template<typename Accel, typename PhotonType, typename Build, typename Query>
+static uint64 timeAccel(const std::vector<PhotonType> &photons, Timings &timings, Build build, Query query)
+{
+    std::vector<PhotonType> copy(photons);
+
+    Timer timer;
+    std::unique_ptr<Accel> accel(build(copy));
+    timer.stop();
+    timings.build.push_back(timer.elapsed());
+
+    timer.start();
+    uint64 checksum = query(*accel);
+    timer.stop();
+    timings.query.push_back(timer.elapsed());
+
+    return checksum;
+}
+
+static void printTimings(const char *name, const Timings &kdTree, const Timings &hashGrid)
+{
+    double kdBuild = BenchmarkUtils::median(kdTree.build), kdQuery = BenchmarkUtils::median(kdTree.query);
+    double gridBuild = BenchmarkUtils::median(hashGrid.build), gridQuery = BenchmarkUtils::median(hashGrid.query);
+    std::cout << tfm::format("%-14s  build %.3fs -> %.3fs (%.2fx), query %.3fs -> %.3fs (%.2fx)", name,
+            kdBuild, gridBuild, kdBuild/gridBuild, kdQuery, gridQuery, kdQuery/gridQuery) << std::endl;
+}
+
+// Compares the KdTree with the hash grid for the two query types of the
+// photon map integrators: k nearest neighbour gathers within the gather
+// radius on surfaces, and fixed radius beam queries through volume photons.
+// Surface photons and gather points lie on the faces of the unit cube,
+// volume photons fill its inside and beams cross it
+int main(int argc, const char *argv[])
+{
+    CliParser parser("photon_bench", "[options]");
+    parser.addOption('h', "help", "Prints this help text", false, OPT_HELP);
+    parser.addOption('t', "threads", "Number of threads used to build the accelerators (default: number of cores)", true, OPT_THREADS);
+    parser.addOption('n', "photons", "Number of surface and of volume photons (default: 1000000)", true, OPT_PHOTONS);
+    parser.addOption('\0', "radius", "Gather radius (default: 0.005)", true, OPT_RADIUS);
+    parser.addOption('k', "k", "Maximum number of photons per gather (default: 20)", true, OPT_K);
+    parser.addOption('q', "queries", "Number of surface gathers (default: 500000)", true, OPT_QUERIES);
+    parser.addOption('b', "beams", "Number of beam queries through the volume photons (default: 20000)", true, OPT_BEAMS);
+    parser.addOption('r', "runs", "Number of runs per accelerator (default: 3)", true, OPT_RUNS);
+    parser.parse(argc, argv);
+
+    if (parser.isPresent(OPT_HELP)) {
+        parser.printHelpText();
+        return 0;
+    }
+
+    auto intParam = [&](int option, int defaultValue) {
+        return parser.isPresent(option) ? std::max(std::atoi(parser.param(option).c_str()), 1) : defaultValue;
+    };
+    uint32 threadCount = intParam(OPT_THREADS, ThreadUtils::idealThreadCount());
+    uint32 numPhotons = intParam(OPT_PHOTONS, 1000000);
+    float radius = parser.isPresent(OPT_RADIUS) ? float(std::atof(parser.param(OPT_RADIUS).c_str())) : 0.005f;
+    int k = intParam(OPT_K, 20);
+    uint32 numQueries = intParam(OPT_QUERIES, 500000);
+    uint32 numBeams = intParam(OPT_BEAMS, 20000);
+    int runs = intParam(OPT_RUNS, 3);
+    if (!(radius > 0.0f)) {
+        std::cerr << "The gather radius has to be positive" << std::endl;
+        return 1;
+    }
+
+    ThreadUtils::startThreads(threadCount);
+
+    UniformSampler sampler(0xBA5EBA11);
+    std::vector<Photon> surfacePhotons(numPhotons);
+    for (Photon &p : surfacePhotons)
+        p.pos = sampleCubeSurface(sampler);
+    std::vector<Vec3f> queries(numQueries);
+    for (Vec3f &q : queries)
+        q = sampleCubeSurface(sampler);
+
+    std::vector<VolumePhoton> volumePhotons(numPhotons);
+    for (VolumePhoton &p : volumePhotons) {
+        p.pos = Vec3f(sampler.next1D(), sampler.next1D(), sampler.next1D());
+        p.radiusSq = radius*radius;
+    }
+    std::vector<Beam> beams(numBeams);
+    for (Beam &beam : beams) {
+        beam.pos = Vec3f(sampler.next1D(), sampler.next1D(), sampler.next1D());
+        beam.dir = SampleWarp::uniformSphere(sampler.next2D());
+        beam.farT = std::numeric_limits<float>::infinity();
+        for (int i = 0; i < 3; ++i) {
+            if (beam.dir[i] > 0.0f)
+                beam.farT = min(beam.farT, (1.0f - beam.pos[i])/beam.dir[i]);
+            else if (beam.dir[i] < 0.0f)
+                beam.farT = min(beam.farT, -beam.pos[i]/beam.dir[i]);
+        }
+    }
+
+    std::cout << tfm::format("%d threads, %d photons, radius %g, k=%d, %d gathers, %d beams, %d runs", threadCount,
+            numPhotons, radius, k, numQueries, numBeams, runs) << std::endl;
+
+    std::unique_ptr<const Photon *[]> result(new const Photon *[k]);
+    std::unique_ptr<float[]> distSq(new float[k]);
+    auto gather = [&](const auto &accel) {
+        uint64 checksum = 0;
+        for (const Vec3f &q : queries)
+            checksum += accel.nearestNeighbours(q, result.get(), distSq.get(), k, radius);
+        return checksum;
+    };
+    auto beamQueries = [&](const auto &accel) {
+        uint64 checksum = 0;
+        for (const Beam &beam : beams)
+            accel.beamQuery(beam.pos, beam.dir, beam.farT, [&](const VolumePhoton &, float, float) {
+                checksum++;
+            });
+        return checksum;
+    };
+
+    // Accelerators are interleaved, so that thermal and cache effects are
+    // spread over both of them
+    Timings surfaceTree, surfaceGrid, volumeTree, volumeGrid;
+    uint64 treeGathered = 0, gridGathered = 0, treeBeamHits = 0, gridBeamHits = 0;
+    for (int i = 0; i < runs; ++i) {
+        treeGathered = timeAccel<KdTree<Photon>>(surfacePhotons, surfaceTree, [&](std::vector<Photon> &photons) {
+            return new KdTree<Photon>(photons.data(), uint32(photons.size()));
+        }, gather);
+        gridGathered = timeAccel<HashGrid<Photon>>(surfacePhotons, surfaceGrid, [&](std::vector<Photon> &photons) {
+            return new HashGrid<Photon>(photons.data(), uint32(photons.size()), radius);
+        }, gather);
+        treeBeamHits = timeAccel<KdTree<VolumePhoton>>(volumePhotons, volumeTree, [&](std::vector<VolumePhoton> &photons) {
+            KdTree<VolumePhoton> *tree = new KdTree<VolumePhoton>(photons.data(), uint32(photons.size()));
+            tree->buildVolumeHierarchy(true, radius);
+            return tree;
+        }, beamQueries);
+        gridBeamHits = timeAccel<HashGrid<VolumePhoton>>(volumePhotons, volumeGrid, [&](std::vector<VolumePhoton> &photons) {
+            return new HashGrid<VolumePhoton>(photons.data(), uint32(photons.size()), radius);
+        }, beamQueries);
+    }
+
+    std::cout << "KdTree -> hash grid" << std::endl;
+    printTimings("Surface gather", surfaceTree, surfaceGrid);
+    printTimings("Volume beams", volumeTree, volumeGrid);
+    std::cout << tfm::format("Photons gathered: %d (KdTree), %d (hash grid)", treeGathered, gridGathered) << std::endl;
+    std::cout << tfm::format("Beam hits: %d (KdTree), %d (hash grid)", treeBeamHits, gridBeamHits) << std::endl;
+    if (treeGathered != gridGathered || treeBeamHits != gridBeamHits) {
+        std::cerr << "Accelerators disagree on the query results" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include "BenchmarkUtils.hpp"
+
+#include "sampling/UniformSampler.hpp"
+#include "sampling/Distribution1D.hpp"
+
+#include "io/CliParser.hpp"
+
+#include "Timer.hpp"
+
+#include <tinyformat/tinyformat.hpp>
+#include <algorithm>
+#include <iostream>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+
+using namespace Tungsten;
+
+static const int OPT_MIN_SIZE = 1;
+static const int OPT_MAX_SIZE = 2;
+static const int OPT_SAMPLES  = 3;
+static const int OPT_RUNS     = 4;
+static const int OPT_HELP     = 5;
+
+// Weights with a long tail, similar to the luminance of an environment
+// map: most entries are dim, a few are orders of magnitude brighter
+static std::vector<float> makeWeights(uint32 n, UniformSampler &sampler)
+{
+    std::vector<float> weights(n);
+    for (float &w : weights) {
+        float x = sampler.next1D();
+        w = x*x*x*x;
+        if (sampler.next1D() < 0.001f)
+            w *= 1000.0f;
+    }
+    return weights;
+}
+
+// Returns the time per sample in seconds. The indices are summed up so
+// that the compiler can't drop the lookups
+template<typename Warp>
+static double timeWarp(const std::vector<float> &us, int runs, uint64 &sink, Warp warp)
+{
+    std::vector<double> times;
+    for (int i = 0; i < runs; ++i) {
+        Timer timer;
+        uint64 sum = 0;
+        for (float u : us) {
+            int idx;
+            warp(u, idx);
+            sum += idx;
+        }
+        timer.stop();
+        sink += sum;
+        times.push_back(timer.elapsed()/us.size());
+    }
+    return BenchmarkUtils::median(times);
+}
+
+// Compares the cost of sampling a Distribution1D with the alias table, the
+// guided CDF and a plain binary search over the CDF, which is what sampling
+// cost before the alias and guide tables were added. Alias tables are built
+// at every size here, even beyond the size at which Distribution1D stops
+// using them for precision reasons
+int main(int argc, const char *argv[])
+{
+    CliParser parser("sampling_bench", "[options]");
+    parser.addOption('h', "help", "Prints this help text", false, OPT_HELP);
+    parser.addOption('\0', "min-size", "Smallest distribution size (default: 1024)", true, OPT_MIN_SIZE);
+    parser.addOption('\0', "max-size", "Largest distribution size (default: 16777216)", true, OPT_MAX_SIZE);
+    parser.addOption('s', "samples", "Number of samples per measurement (default: 4194304)", true, OPT_SAMPLES);
+    parser.addOption('r', "runs", "Number of runs per measurement (default: 5)", true, OPT_RUNS);
+    parser.parse(argc, argv);
+
+    if (parser.isPresent(OPT_HELP)) {
+        parser.printHelpText();
+        return 0;
+    }
+
+    auto intParam = [&](int option, int defaultValue) {
+        return parser.isPresent(option) ? std::max(std::atoi(parser.param(option).c_str()), 1) : defaultValue;
+    };
+    uint32 minSize = intParam(OPT_MIN_SIZE, 1 << 10);
+    uint32 maxSize = intParam(OPT_MAX_SIZE, 1 << 24);
+    uint32 numSamples = intParam(OPT_SAMPLES, 1 << 22);
+    int runs = intParam(OPT_RUNS, 5);
+
+    UniformSampler sampler(0xBA5EBA11);
+    std::vector<float> us(numSamples);
+    for (float &u : us)
+        u = sampler.next1D();
+
+    std::cout << tfm::format("%d random samples per measurement, %d runs", numSamples, runs) << std::endl;
+    std::cout << "    entries  alias ns/sample  guided CDF ns/sample  binary search ns/sample" << std::endl;
+
+    uint64 sink = 0;
+    for (uint32 n = minSize; n <= maxSize; n *= 4) {
+        Distribution1D distribution(makeWeights(n, sampler), std::numeric_limits<size_t>::max());
+        std::vector<float> cdf(n + 1);
+        for (uint32 i = 0; i <= n; ++i)
+            cdf[i] = distribution.cdf(i);
+
+        double aliasTime = timeWarp(us, runs, sink, [&](float u, int &idx) {
+            distribution.warp(u, idx);
+        });
+        double guideTime = timeWarp(us, runs, sink, [&](float u, int &idx) {
+            distribution.warpInvertible(u, idx);
+        });
+        double searchTime = timeWarp(us, runs, sink, [&](float u, int &idx) {
+            idx = int(std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin()) - 1;
+            idx = clamp(idx, 0, int(n) - 1);
+        });
+
+        std::cout << tfm::format("%11d  %15.2f  %20.2f  %23.2f", n, aliasTime*1e9, guideTime*1e9, searchTime*1e9) << std::endl;
+
+        if (n > maxSize/4)
+            break;
+    }
+    // Printing the checksum keeps the lookups observable
+    std::cout << tfm::format("Checksum: %d", sink) << std::endl;
+
+    return 0;
+}
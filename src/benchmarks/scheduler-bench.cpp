@@ -0,0 +1,123 @@
+#include "BenchmarkUtils.hpp"
+
+#include "thread/ThreadUtils.hpp"
+#include "thread/ThreadPool.hpp"
+
+#include "io/CliParser.hpp"
+
+#include "Timer.hpp"
+
+#include <tinyformat/tinyformat.hpp>
+#include <iostream>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+using namespace Tungsten;
+
+static const int OPT_THREADS  = 1;
+static const int OPT_SUBTASKS = 2;
+static const int OPT_GROUPS   = 3;
+static const int OPT_WORK     = 4;
+static const int OPT_RUNS     = 5;
+static const int OPT_HELP     = 6;
+
+// Simulated work per subtask, in iterations of a dependent integer chain
+static uint32 busyWork(uint32 iterations, uint32 seed)
+{
+    uint32 x = seed;
+    for (uint32 i = 0; i < iterations; ++i)
+        x = x*1664525u + 1013904223u;
+    return x;
+}
+
+// A single task group with many subtasks, like the tiles of a frame or the
+// nodes of a KdTree build level. Returns the time per subtask in seconds
+static double timeLargeGroup(ThreadPool &pool, uint32 numSubtasks, uint32 work)
+{
+    std::vector<uint32> sinks(pool.threadCount() + 1, 0);
+
+    Timer timer;
+    auto task = pool.enqueue([&](uint32 id, uint32, uint32 threadId) {
+        sinks[threadId] += busyWork(work, id);
+    }, numSubtasks);
+    pool.yield(*task);
+    timer.stop();
+
+    return timer.elapsed()/numSubtasks;
+}
+
+// Many task groups with a single subtask each, enqueued back to back.
+// Measures enqueue cost as well as dispatch. Returns the time per group
+static double timeManyGroups(ThreadPool &pool, uint32 numGroups, uint32 work)
+{
+    std::vector<uint32> sinks(pool.threadCount() + 1, 0);
+    std::vector<std::shared_ptr<TaskGroup>> tasks;
+    tasks.reserve(numGroups);
+
+    Timer timer;
+    for (uint32 i = 0; i < numGroups; ++i) {
+        tasks.emplace_back(pool.enqueue([&](uint32 id, uint32, uint32 threadId) {
+            sinks[threadId] += busyWork(work, id);
+        }));
+    }
+    for (const auto &task : tasks)
+        pool.yield(*task);
+    timer.stop();
+
+    return timer.elapsed()/numGroups;
+}
+
+// Measures the cost of handing out subtasks for thread counts from 1 up to
+// the requested count, doubling each step
+int main(int argc, const char *argv[])
+{
+    CliParser parser("scheduler_bench", "[options]");
+    parser.addOption('h', "help", "Prints this help text", false, OPT_HELP);
+    parser.addOption('t', "threads", "Maximum number of worker threads (default: number of cores)", true, OPT_THREADS);
+    parser.addOption('s', "subtasks", "Number of subtasks of the large task group (default: 1048576)", true, OPT_SUBTASKS);
+    parser.addOption('g', "groups", "Number of single subtask groups (default: 65536)", true, OPT_GROUPS);
+    parser.addOption('w', "work", "Iterations of busy work per subtask (default: 0)", true, OPT_WORK);
+    parser.addOption('r', "runs", "Number of runs per configuration (default: 5)", true, OPT_RUNS);
+    parser.parse(argc, argv);
+
+    if (parser.isPresent(OPT_HELP)) {
+        parser.printHelpText();
+        return 0;
+    }
+
+    auto intParam = [&](int option, int defaultValue) {
+        return parser.isPresent(option) ? std::max(std::atoi(parser.param(option).c_str()), 0) : defaultValue;
+    };
+    uint32 maxThreads = std::max(intParam(OPT_THREADS, ThreadUtils::idealThreadCount()), 1);
+    uint32 numSubtasks = std::max(intParam(OPT_SUBTASKS, 1 << 20), 1);
+    uint32 numGroups = std::max(intParam(OPT_GROUPS, 1 << 16), 1);
+    uint32 work = intParam(OPT_WORK, 0);
+    int runs = std::max(intParam(OPT_RUNS, 5), 1);
+
+    std::vector<uint32> threadCounts;
+    for (uint32 i = 1; i < maxThreads; i *= 2)
+        threadCounts.push_back(i);
+    threadCounts.push_back(maxThreads);
+
+    std::cout << tfm::format("%d subtasks in one group, %d single subtask groups, %d iterations of work, %d runs",
+            numSubtasks, numGroups, work, runs) << std::endl;
+    std::cout << "threads  ns/subtask (large group)  ns/group (single subtask groups)" << std::endl;
+
+    for (uint32 threadCount : threadCounts) {
+        // ThreadPool::stop detaches its workers, so pools can't safely be
+        // destroyed. Pools of previous thread counts stay alive and sleep
+        ThreadPool *pool = new ThreadPool(threadCount);
+
+        std::vector<double> largeTimes, groupTimes;
+        for (int i = 0; i < runs; ++i) {
+            largeTimes.push_back(timeLargeGroup(*pool, numSubtasks, work));
+            groupTimes.push_back(timeManyGroups(*pool, numGroups, work));
+        }
+
+        std::cout << tfm::format("%7d  %24.1f  %32.1f", threadCount,
+                BenchmarkUtils::median(largeTimes)*1e9, BenchmarkUtils::median(groupTimes)*1e9) << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,126 @@
+#include "BenchmarkUtils.hpp"
+
+#include "primitives/EmbreeUtil.hpp"
+
+#include "thread/ThreadUtils.hpp"
+
+#include "io/JsonDocument.hpp"
+#include "io/CliParser.hpp"
+#include "io/Scene.hpp"
+
+#include <rapidjson/document.h>
+#include <tinyformat/tinyformat.hpp>
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+
+using namespace Tungsten;
+
+static const int OPT_THREADS     = 1;
+static const int OPT_SPP         = 2;
+static const int OPT_RUNS        = 3;
+static const int OPT_MAX_BOUNCES = 4;
+static const int OPT_HELP        = 5;
+
+struct Configuration
+{
+    const char *name;
+    const char *integrator;
+    bool enableRayStreams;
+};
+
+// Replaces the integrator of the scene with one that has the settings of
+// the original path tracer, plus the given configuration. Settings the
+// integrator doesn't know are ignored
+static void configureIntegrator(Scene &scene, const rapidjson::Value &baseSettings,
+        const Configuration &config, int maxBounces)
+{
+    rapidjson::Document document;
+    document.SetObject();
+    rapidjson::Value settings(baseSettings, document.GetAllocator());
+    settings["type"].SetString(config.integrator, document.GetAllocator());
+    settings["enable_ray_streams"].SetBool(config.enableRayStreams);
+    if (maxBounces > 0)
+        settings["max_bounces"].SetInt(maxBounces);
+    document.AddMember("integrator", settings, document.GetAllocator());
+
+    JsonDocument json(scene.path(), BenchmarkUtils::jsonString(document));
+    scene.fromJson(json, scene);
+}
+
+// Compares the regular path tracer with its streamed mode, which intersects
+// the primary rays of a tile as one ray stream, and with the wavefront path
+// tracer, which streams all rays. The scene has to use the path_tracer
+// integrator; all of its other settings are kept
+int main(int argc, const char *argv[])
+{
+    CliParser parser("stream_bench", "[options] scene");
+    parser.addOption('h', "help", "Prints this help text", false, OPT_HELP);
+    parser.addOption('t', "threads", "Number of render threads (default: number of cores)", true, OPT_THREADS);
+    parser.addOption('\0', "spp", "Samples per pixel to render in every run. Overrides the setting in the scene file", true, OPT_SPP);
+    parser.addOption('r', "runs", "Number of runs per configuration (default: 3)", true, OPT_RUNS);
+    parser.addOption('b', "max-bounces", "Overrides the maximum number of bounces of the integrator. "
+            "A value of 1 only traces camera rays and their shadow rays", true, OPT_MAX_BOUNCES);
+    parser.parse(argc, argv);
+
+    if (parser.operands().size() != 1 || parser.isPresent(OPT_HELP)) {
+        parser.printHelpText();
+        return 0;
+    }
+
+    uint32 threadCount = ThreadUtils::idealThreadCount();
+    if (parser.isPresent(OPT_THREADS))
+        threadCount = std::max(std::atoi(parser.param(OPT_THREADS).c_str()), 1);
+    int runs = parser.isPresent(OPT_RUNS) ? std::max(std::atoi(parser.param(OPT_RUNS).c_str()), 1) : 3;
+    int maxBounces = parser.isPresent(OPT_MAX_BOUNCES) ? std::max(std::atoi(parser.param(OPT_MAX_BOUNCES).c_str()), 1) : 0;
+
+    EmbreeUtil::initDevice();
+    ThreadUtils::startThreads(threadCount);
+
+    std::unique_ptr<Scene> scene;
+    try {
+        scene.reset(Scene::load(Path(parser.operands()[0])));
+        scene->loadResources();
+    } catch (const std::runtime_error &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    if (parser.isPresent(OPT_SPP))
+        scene->rendererSettings().setSpp(std::atoi(parser.param(OPT_SPP).c_str()));
+
+    rapidjson::Document baseDocument;
+    rapidjson::Value baseSettings = scene->integrator()->toJson(baseDocument.GetAllocator());
+    if (std::strcmp(baseSettings["type"].GetString(), "path_tracer") != 0) {
+        std::cerr << "stream_bench requires a scene with the path_tracer integrator" << std::endl;
+        return 1;
+    }
+
+    std::cout << tfm::format("%d threads, %d spp, %d runs per configuration", threadCount,
+            scene->rendererSettings().spp(), runs) << std::endl;
+
+    const Configuration configs[] = {
+        {"scalar",    "path_tracer",           false},
+        {"streamed",  "path_tracer",           true},
+        {"wavefront", "wavefront_path_tracer", false},
+    };
+    const int numConfigs = sizeof(configs)/sizeof(configs[0]);
+
+    // Configurations are interleaved, so that thermal and cache effects are
+    // spread over all of them
+    std::vector<double> times[numConfigs];
+    for (int i = 0; i < runs; ++i) {
+        for (int j = 0; j < numConfigs; ++j) {
+            configureIntegrator(*scene, baseSettings, configs[j], maxBounces);
+            times[j].push_back(BenchmarkUtils::timeRender(*scene));
+        }
+    }
+
+    double baseTime = BenchmarkUtils::median(times[0]);
+    for (int j = 0; j < numConfigs; ++j) {
+        double time = BenchmarkUtils::median(times[j]);
+        std::cout << tfm::format("%-9s %.3fs (%.3f Msamples/s), %.2fx", configs[j].name, time,
+                BenchmarkUtils::samplesPerSecond(*scene, time)*1e-6, baseTime/time) << std::endl;
+    }
+
+    return 0;
+}
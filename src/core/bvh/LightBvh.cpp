@@ -0,0 +1,190 @@
+#include "LightBvh.hpp"
+
+#include "math/MathUtil.hpp"
+#include "math/Angle.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Tungsten {
+
+namespace Bvh {
+
+static float angleBetween(const Vec3f &a, const Vec3f &b)
+{
+    return std::acos(clamp(a.dot(b), -1.0f, 1.0f));
+}
+
+// Smallest cone (approximately) containing the cones a and b
+static void mergeCones(Vec3f axisA, float thetaA, Vec3f axisB, float thetaB, Vec3f &axis, float &theta)
+{
+    if (thetaA < thetaB) {
+        std::swap(axisA, axisB);
+        std::swap(thetaA, thetaB);
+    }
+
+    float thetaD = angleBetween(axisA, axisB);
+    if (min(thetaD + thetaB, PI) <= thetaA) {
+        axis = axisA;
+        theta = thetaA;
+        return;
+    }
+
+    float thetaO = (thetaA + thetaD + thetaB)*0.5f;
+    Vec3f ortho = axisB - axisA*axisA.dot(axisB);
+    if (thetaO >= PI || ortho.lengthSq() < 1e-12f) {
+        axis = axisA;
+        theta = PI;
+        return;
+    }
+
+    float thetaR = thetaO - thetaA;
+    axis = (axisA*std::cos(thetaR) + ortho.normalized()*std::sin(thetaR)).normalized();
+    theta = thetaO;
+}
+
+LightBvh::LightBvh(std::vector<Emitter> emitters)
+: _emitterToLeaf(emitters.size())
+{
+    if (emitters.empty())
+        return;
+
+    std::vector<uint32> ids(emitters.size());
+    for (uint32 i = 0; i < ids.size(); ++i)
+        ids[i] = i;
+
+    _nodes.reserve(2*emitters.size() - 1);
+    _nodes.emplace_back();
+    _nodes[0].parent = 0;
+    build(emitters, ids, 0, ids.size(), 0);
+}
+
+// Top-down build that splits at the centroid median along the largest
+// extent. Nodes are written to _nodes[index], with both children allocated
+// next to each other before recursing
+uint32 LightBvh::build(std::vector<Emitter> &emitters, std::vector<uint32> &ids, uint32 start, uint32 end, uint32 index)
+{
+    if (end - start == 1) {
+        const Emitter &e = emitters[ids[start]];
+        Node &node = _nodes[index];
+        node.bounds = e.bounds;
+        node.axis = e.axis;
+        node.theta = e.theta;
+        node.power = e.power;
+        node.child = ids[start];
+        node.isLeaf = true;
+        _emitterToLeaf[ids[start]] = index;
+        return index;
+    }
+
+    Box3f centroids;
+    for (uint32 i = start; i < end; ++i)
+        centroids.grow(emitters[ids[i]].bounds.center());
+    int dim = centroids.diagonal().maxDim();
+
+    uint32 mid = (start + end)/2;
+    std::nth_element(ids.begin() + start, ids.begin() + mid, ids.begin() + end, [&](uint32 a, uint32 b) {
+        return emitters[a].bounds.center()[dim] < emitters[b].bounds.center()[dim];
+    });
+
+    uint32 child = _nodes.size();
+    _nodes.emplace_back();
+    _nodes.emplace_back();
+    _nodes[child + 0].parent = index;
+    _nodes[child + 1].parent = index;
+    build(emitters, ids, start, mid, child + 0);
+    build(emitters, ids, mid, end, child + 1);
+
+    const Node &l = _nodes[child + 0];
+    const Node &r = _nodes[child + 1];
+    Node &node = _nodes[index];
+    node.bounds = l.bounds;
+    node.bounds.grow(r.bounds);
+    mergeCones(l.axis, l.theta, r.axis, r.theta, node.axis, node.theta);
+    node.power = l.power + r.power;
+    node.child = child;
+    node.isLeaf = false;
+
+    return index;
+}
+
+// Bounds the irradiance at p by assuming all power is emitted from the
+// closest point of the node's bounding sphere, at the smallest angle to the
+// emission cone that is possible for any light in the node
+float LightBvh::importance(const Node &node, const Vec3f &p) const
+{
+    if (node.power == 0.0f)
+        return 0.0f;
+
+    Vec3f d = p - node.bounds.center();
+    float radiusSq = node.bounds.diagonal().lengthSq()*0.25f;
+    float distSq = d.lengthSq();
+    if (distSq <= radiusSq)
+        return node.power*INV_PI/max(distSq, radiusSq*0.25f);
+
+    float cosTheta = 1.0f;
+    if (node.theta < PI) {
+        float dist = std::sqrt(distSq);
+        float thetaU = std::asin(min(std::sqrt(radiusSq)/dist, 1.0f));
+        float theta = angleBetween(node.axis, d/dist);
+        float thetaPrime = max(theta - node.theta - thetaU, 0.0f);
+        if (thetaPrime >= PI_HALF)
+            return 0.0f;
+        cosTheta = std::cos(thetaPrime);
+    }
+
+    return node.power*cosTheta*INV_PI/distSq;
+}
+
+int LightBvh::sample(const Vec3f &p, float u, float &pdf) const
+{
+    pdf = 1.0f;
+    if (_nodes.empty())
+        return -1;
+
+    const Node *node = &_nodes[0];
+    while (!node->isLeaf) {
+        const Node *l = &_nodes[node->child + 0];
+        const Node *r = &_nodes[node->child + 1];
+        float wl = importance(*l, p);
+        float wr = importance(*r, p);
+        float total = wl + wr;
+        if (total == 0.0f)
+            return -1;
+
+        float pl = wl/total;
+        if (u < pl) {
+            u = min(u/pl, 1.0f - 1e-7f);
+            pdf *= pl;
+            node = l;
+        } else {
+            u = min((u - pl)/(1.0f - pl), 1.0f - 1e-7f);
+            pdf *= 1.0f - pl;
+            node = r;
+        }
+    }
+
+    return node->child;
+}
+
+float LightBvh::pdf(const Vec3f &p, uint32 emitter) const
+{
+    float result = 1.0f;
+    uint32 index = _emitterToLeaf[emitter];
+    while (index != 0) {
+        uint32 parent = _nodes[index].parent;
+        uint32 child = _nodes[parent].child;
+        float wl = importance(_nodes[child + 0], p);
+        float wr = importance(_nodes[child + 1], p);
+        float w = index == child ? wl : wr;
+        if (w == 0.0f)
+            return 0.0f;
+        result *= w/(wl + wr);
+        index = parent;
+    }
+    return result;
+}
+
+}
+
+}
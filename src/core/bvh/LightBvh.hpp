@@ -0,0 +1,81 @@
+#ifndef LIGHTBVH_HPP_
+#define LIGHTBVH_HPP_
+
+#include "math/Box.hpp"
+#include "math/Vec.hpp"
+
+#include "IntTypes.hpp"
+
+#include <vector>
+
+namespace Tungsten {
+
+namespace Bvh {
+
+// Bounding cone hierarchy over finite light sources, following Conty and
+// Kulla's "Importance Sampling of Many Lights with Adaptive Tree Splitting".
+// Every node bounds the position, emission direction and power of the
+// lights below it, which gives a conservative estimate of the irradiance
+// its lights contribute at a shading point. Lights are selected by walking
+// down from the root and picking children proportional to that estimate,
+// in O(log N) time. The probability of selecting a given light can be
+// queried by walking the same path back up from its leaf
+class LightBvh
+{
+public:
+    struct Emitter
+    {
+        Box3f bounds;
+        // Axis and half angle of the cone containing the surface normals of
+        // the emitter. Emitters that radiate in all directions use an angle of PI
+        Vec3f axis;
+        float theta;
+        float power;
+    };
+
+private:
+    struct Node
+    {
+        Box3f bounds;
+        Vec3f axis;
+        float theta;
+        float power;
+        uint32 parent;
+        // Index of the first child for interior nodes (the second child
+        // follows it directly), or index of the emitter for leaves
+        uint32 child;
+        bool isLeaf;
+    };
+
+    std::vector<Node> _nodes;
+    std::vector<uint32> _emitterToLeaf;
+
+    uint32 build(std::vector<Emitter> &emitters, std::vector<uint32> &ids, uint32 start, uint32 end, uint32 index);
+
+    float importance(const Node &node, const Vec3f &p) const;
+
+public:
+    LightBvh(std::vector<Emitter> emitters);
+
+    // Conservative estimate of the irradiance received at p from all lights
+    float rootImportance(const Vec3f &p) const
+    {
+        return _nodes.empty() ? 0.0f : importance(_nodes[0], p);
+    }
+
+    // Returns the index of the selected emitter or -1 if no emitter
+    // contributes to p, along with the probability of selecting it
+    int sample(const Vec3f &p, float u, float &pdf) const;
+    float pdf(const Vec3f &p, uint32 emitter) const;
+
+    uint32 size() const
+    {
+        return _emitterToLeaf.size();
+    }
+};
+
+}
+
+}
+
+#endif /* LIGHTBVH_HPP_ */
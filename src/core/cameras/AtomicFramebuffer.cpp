@@ -0,0 +1,121 @@
+#include "AtomicFramebuffer.hpp"
+
+#include <cstring>
+
+namespace Tungsten {
+
+CONSTEXPR uint32 AtomicFramebuffer::TileSize;
+CONSTEXPR uint32 AtomicFramebuffer::MergeInterval;
+
+int32 AtomicFramebuffer::acquireTile(LocalCache &cache, uint32 tile)
+{
+    int32 slot;
+    if (_maxCachedTiles == 0 || cache.tiles.size() < _maxCachedTiles) {
+        slot = cache.tiles.size();
+        cache.tiles.emplace_back(CachedTile{tile, 0, std::unique_ptr<Vec3d[]>(new Vec3d[TileSize*TileSize])});
+        std::memset(cache.tiles.back().data.get(), 0, TileSize*TileSize*sizeof(Vec3d));
+    } else {
+        slot = 0;
+        for (size_t i = 1; i < cache.tiles.size(); ++i)
+            if (cache.tiles[i].lastUse < cache.tiles[slot].lastUse)
+                slot = i;
+
+        CachedTile &evicted = cache.tiles[slot];
+        mergeTile(evicted);
+        cache.slots[evicted.tile] = -1;
+        evicted.tile = tile;
+    }
+    cache.slots[tile] = slot;
+
+    return slot;
+}
+
+void AtomicFramebuffer::mergeTile(CachedTile &tile)
+{
+    uint32 x0 = (tile.tile % _tilesX)*TileSize;
+    uint32 y0 = (tile.tile / _tilesX)*TileSize;
+    uint32 x1 = min(x0 + TileSize, _w);
+    uint32 y1 = min(y0 + TileSize, _h);
+
+    std::unique_lock<std::mutex> lock(_tileLocks[tile.tile]);
+    for (uint32 y = y0; y < y1; ++y) {
+        for (uint32 x = x0; x < x1; ++x) {
+            Vec3d &src = tile.data[(x - x0) + (y - y0)*TileSize];
+            _merged[x + y*_w] += src;
+            src = Vec3d(0.0);
+        }
+    }
+}
+
+void AtomicFramebuffer::mergeCache(LocalCache &cache)
+{
+    for (CachedTile &tile : cache.tiles)
+        mergeTile(tile);
+    cache.splatsSinceMerge = 0;
+}
+
+void AtomicFramebuffer::enableLocalAccumulation(uint32 maxCachedTiles)
+{
+    _localAccumulation = true;
+    _maxCachedTiles = maxCachedTiles;
+
+    _merged.reset(new Vec3d[_w*_h]);
+    ThreadUtils::zeroMemory(_merged.get(), _w*_h*sizeof(Vec3d));
+    _tileLocks.reset(new std::mutex[_tilesX*_tilesY]);
+
+    _caches.resize(ThreadUtils::pool->threadCount());
+    for (auto &cache : _caches) {
+        cache.reset(new LocalCache());
+        cache->slots.resize(_tilesX*_tilesY, -1);
+        cache->clock = 0;
+        cache->splatsSinceMerge = 0;
+    }
+}
+
+void AtomicFramebuffer::flush()
+{
+    for (auto &cache : _caches)
+        mergeCache(*cache);
+}
+
+void AtomicFramebuffer::unsafeReset()
+{
+    std::memset(&_buffer[0].x(), 0, _w*_h*sizeof(Vec3fa));
+    if (_merged)
+        std::memset(_merged.get(), 0, _w*_h*sizeof(Vec3d));
+    for (auto &cache : _caches)
+        for (CachedTile &tile : cache->tiles)
+            std::memset(tile.data.get(), 0, TileSize*TileSize*sizeof(Vec3d));
+}
+
+void AtomicFramebuffer::serialize(OutputStreamHandle &out)
+{
+    flush();
+
+    std::unique_ptr<Vec3d[]> data(new Vec3d[_w*_h]);
+    for (uint32 i = 0; i < _w*_h; ++i) {
+        data[i] = Vec3d(double(_buffer[i].x()), double(_buffer[i].y()), double(_buffer[i].z()));
+        if (_merged)
+            data[i] += _merged[i];
+    }
+    FileUtils::streamWrite(out, data.get(), _w*_h);
+}
+
+void AtomicFramebuffer::deserialize(InputStreamHandle &in)
+{
+    std::unique_ptr<Vec3d[]> data(new Vec3d[_w*_h]);
+    FileUtils::streamRead(in, data.get(), _w*_h);
+
+    unsafeReset();
+    for (uint32 i = 0; i < _w*_h; ++i) {
+        if (_merged) {
+            _merged[i] = data[i];
+        } else {
+            _buffer[i].x() = float(data[i].x());
+            _buffer[i].y() = float(data[i].y());
+            _buffer[i].z() = float(data[i].z());
+        }
+    }
+}
+
+}
@@ -5,11 +5,26 @@
 
 #include "math/Vec.hpp"
 
+#include "io/FileUtils.hpp"
+
+#include "thread/ThreadUtils.hpp"
+#include "thread/ThreadPool.hpp"
+
 #include <memory>
 #include <atomic>
+#include <vector>
+#include <mutex>
 
 namespace Tungsten {
 
+// Framebuffer that many threads can splat into concurrently. By default,
+// every splat is added to the shared buffer with atomic operations.
+//
+// With local accumulation enabled, every pool worker instead sums its splats
+// in double precision tiles of its own, which are merged into a shared
+// double precision buffer when they are evicted, after a fixed number of
+// splats, or when flush() is called at the end of a render segment. This
+// avoids contention on bright pixels that many threads splat into at once.
 class AtomicFramebuffer
 {
     typedef Vec<std::atomic<float>, 3> Vec3fa;
@@ -17,12 +32,37 @@ class AtomicFramebuffer
     static_assert(sizeof(std::atomic<float>) == 4, "std::atomic<float> is not a simple type! "
             "This will break a lot of things");
 
+    static CONSTEXPR uint32 MergeInterval = 1 << 20;
+
+    struct CachedTile
+    {
+        uint32 tile;
+        uint64 lastUse;
+        std::unique_ptr<Vec3d[]> data;
+    };
+
+    struct alignas(64) LocalCache
+    {
+        std::vector<int32> slots;
+        std::vector<CachedTile> tiles;
+        uint64 clock;
+        uint32 splatsSinceMerge;
+    };
+
     uint32 _w;
     uint32 _h;
     ReconstructionFilter _filter;
 
     std::unique_ptr<Vec3fa[]> _buffer;
 
+    bool _localAccumulation;
+    uint32 _maxCachedTiles;
+    uint32 _tilesX;
+    uint32 _tilesY;
+    std::unique_ptr<Vec3d[]> _merged;
+    std::unique_ptr<std::mutex[]> _tileLocks;
+    std::vector<std::unique_ptr<LocalCache>> _caches;
+
     void atomicAdd(std::atomic<float> &dst, float add){
          float current = dst.load();
          float desired = current + add;
@@ -30,23 +70,66 @@ class AtomicFramebuffer
               desired = current + add;
     }
 
+    int32 acquireTile(LocalCache &cache, uint32 tile);
+    void mergeTile(CachedTile &tile);
+    void mergeCache(LocalCache &cache);
+
+    inline void splatLocal(LocalCache &cache, Vec2u pixel, Vec3f w)
+    {
+        uint32 tile = pixel.x()/TileSize + (pixel.y()/TileSize)*_tilesX;
+        int32 slot = cache.slots[tile];
+        if (slot < 0)
+            slot = acquireTile(cache, tile);
+
+        CachedTile &cached = cache.tiles[slot];
+        cached.lastUse = cache.clock++;
+        cached.data[pixel.x() % TileSize + (pixel.y() % TileSize)*TileSize] += Vec3d(w);
+
+        if (++cache.splatsSinceMerge >= MergeInterval)
+            mergeCache(cache);
+    }
+
 public:
+    // Edge length of the tiles threads accumulate into locally
+    static CONSTEXPR uint32 TileSize = 16;
+
     AtomicFramebuffer(uint32 w, uint32 h, const ReconstructionFilter &filter)
     : _w(w),
       _h(h),
       _filter(filter),
-      _buffer(new Vec3fa[w*h])
+      _buffer(new Vec3fa[w*h]),
+      _localAccumulation(false),
+      _maxCachedTiles(0),
+      _tilesX((w + TileSize - 1)/TileSize),
+      _tilesY((h + TileSize - 1)/TileSize)
     {
-        unsafeReset();
+        ThreadUtils::zeroMemory(_buffer.get(), _w*_h*sizeof(Vec3fa));
     }
     AtomicFramebuffer(AtomicFramebuffer &&o)
     : _w(o._w),
       _h(o._h),
       _filter(o._filter),
-      _buffer(std::move(o._buffer))
+      _buffer(std::move(o._buffer)),
+      _localAccumulation(o._localAccumulation),
+      _maxCachedTiles(o._maxCachedTiles),
+      _tilesX(o._tilesX),
+      _tilesY(o._tilesY),
+      _merged(std::move(o._merged)),
+      _tileLocks(std::move(o._tileLocks)),
+      _caches(std::move(o._caches))
     {
     }
 
+    // Switches to per-thread accumulation. maxCachedTiles bounds the number
+    // of tiles every thread keeps at once (0 for no limit); the least
+    // recently used tile is merged into the shared buffer to make room.
+    // Must be called before any splats are made
+    void enableLocalAccumulation(uint32 maxCachedTiles);
+
+    // Merges the tiles of all threads into the shared buffer. Must not be
+    // called while other threads are splatting
+    void flush();
+
     inline void splatFiltered(Vec2f pixel, Vec3f w)
     {
         if (_filter.isDirac()) {
@@ -80,25 +163,44 @@ public:
         if (std::isnan(w) || std::isinf(w))
             return;
 
+        if (_localAccumulation) {
+            uint32 threadId = ThreadUtils::pool->currentThreadId();
+            if (threadId < _caches.size()) {
+                splatLocal(*_caches[threadId], pixel, w);
+                return;
+            }
+        }
+
         uint32 idx = pixel.x() + pixel.y()*_w;
         atomicAdd(_buffer[idx].x(), w.x());
         atomicAdd(_buffer[idx].y(), w.y());
         atomicAdd(_buffer[idx].z(), w.z());
     }
 
+    // Safe to call while other threads splat. Splats that are still in a
+    // thread's local tiles only show up once they are merged
     inline Vec3f get(int x, int y) const
     {
-        return Vec3f(
+        Vec3f result(
             _buffer[x + y*_w].x(),
             _buffer[x + y*_w].y(),
             _buffer[x + y*_w].z()
         );
+        if (_merged) {
+            std::unique_lock<std::mutex> lock(_tileLocks[x/TileSize + (y/TileSize)*_tilesX]);
+            result += Vec3f(_merged[x + y*_w]);
+        }
+        return result;
     }
 
-    void unsafeReset()
-    {
-        std::memset(&_buffer[0].x(), 0, _w*_h*sizeof(Vec3fa));
-    }
+    void unsafeReset();
+
+    // Writes the accumulated splats in double precision. Flushes first, so
+    // the same restrictions as for flush() apply
+    void serialize(OutputStreamHandle &out);
+    // Replaces the buffer contents with data written by serialize(). Works
+    // regardless of whether local accumulation was enabled when saving
+    void deserialize(InputStreamHandle &in);
 };
 
 }
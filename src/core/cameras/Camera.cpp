@@ -172,12 +172,22 @@ void Camera::requestColorBuffer() {
     _colorBufferWeight = 1.0;
 }
 
-void Camera::requestSplatBuffer() {
+void Camera::requestSplatBuffer(const RendererSettings &settings) {
     _splatBuffer = std::make_unique<AtomicFramebuffer>(_res.x(), _res.y(), _filter);
+    if (settings.localSplatAccumulation()) {
+        _splatBuffer->enableLocalAccumulation(settings.splatCacheTiles());
+    }
     _splatWeight = 1.0;
 }
 
+void Camera::flushSplatBuffer() {
+    if (_splatBuffer) {
+        _splatBuffer->flush();
+    }
+}
+
 void Camera::blitSplatBuffer() {
+    _splatBuffer->flush();
     for (uint32 y = 0; y < _res.y(); ++y) {
         for (uint32 x = 0; x < _res.x(); ++x) {
             _colorBuffer->addSample(Vec2u(x, y), _splatBuffer->get(x, y));
@@ -230,6 +240,8 @@ void Camera::serializeOutputBuffers(OutputStreamHandle &out) const {
     if (_normalBuffer) { _normalBuffer->serialize(out); }
     if (_albedoBuffer) { _albedoBuffer->serialize(out); }
     if (_visibilityBuffer) { _visibilityBuffer->serialize(out); }
+
+    if (_splatBuffer) { _splatBuffer->serialize(out); }
 }
 
 void Camera::deserializeOutputBuffers(InputStreamHandle &in) {
@@ -240,6 +252,8 @@ void Camera::deserializeOutputBuffers(InputStreamHandle &in) {
     if (_normalBuffer) { _normalBuffer->deserialize(in); }
     if (_albedoBuffer) { _albedoBuffer->deserialize(in); }
     if (_visibilityBuffer) { _visibilityBuffer->deserialize(in); }
+
+    if (_splatBuffer) { _splatBuffer->deserialize(in); }
 }
 
 }
@@ -28,6 +28,7 @@ class Ray;
 class Scene;
 class Medium;
 class Renderer;
+class RendererSettings;
 class SampleGenerator;
 
 class Camera : public JsonSerializable {
@@ -88,13 +89,19 @@ public:
     virtual bool isDirac() const = 0;
     
     virtual float approximateFov() const = 0;
+    // Angle subtended by a single pixel, used for texture filtering
+    virtual float approximatePixelSpread() const
+    {
+        return approximateFov()/_res.x();
+    }
     
     virtual void prepareForRender();
     virtual void teardownAfterRender();
     
     void requestOutputBuffers(const std::vector<OutputBufferSettings> &settings);
     void requestColorBuffer();
-    void requestSplatBuffer();
+    void requestSplatBuffer(const RendererSettings &settings);
+    void flushSplatBuffer();
     void blitSplatBuffer();
     
     void setTransform(const Vec3f &pos, const Vec3f &lookAt, const Vec3f &up);
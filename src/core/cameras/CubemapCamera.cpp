@@ -218,6 +218,11 @@ float CubemapCamera::approximateFov() const
     return 90.0f;
 }
 
+float CubemapCamera::approximatePixelSpread() const
+{
+    return PI_HALF/(_faceSize.x()*_res.x());
+}
+
 void CubemapCamera::prepareForRender()
 {
     _rot = _transform.extractRotation();
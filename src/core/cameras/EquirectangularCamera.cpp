@@ -124,6 +124,11 @@ float EquirectangularCamera::approximateFov() const
     return 90.0f;
 }
 
+float EquirectangularCamera::approximatePixelSpread() const
+{
+    return TWO_PI/_res.x();
+}
+
 void EquirectangularCamera::prepareForRender()
 {
     _rot = _transform.extractRotation();
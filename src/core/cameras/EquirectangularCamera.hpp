@@ -34,6 +34,7 @@ public:
     virtual bool isDirac() const override;
 
     virtual float approximateFov() const override;
+    virtual float approximatePixelSpread() const override;
 
     virtual void prepareForRender() override;
 };
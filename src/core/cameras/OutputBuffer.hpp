@@ -10,23 +10,62 @@
 #include "io/FileUtils.hpp"
 #include "io/ImageIO.hpp"
 
+#include "thread/ThreadUtils.hpp"
+
 #include "Memory.hpp"
 
 #include <memory>
+#include <atomic>
 
 namespace Tungsten {
 
 template<typename T>
 class OutputBuffer
 {
+    // Concurrent writes are guarded by a fixed number of striped locks,
+    // with pixel i using lock i % LockCount
+    static CONSTEXPR uint32 LockCount = 256;
+
+    struct alignas(64) PixelLock
+    {
+        std::atomic_flag flag = ATOMIC_FLAG_INIT;
+    };
+
     Vec2u _res;
 
     std::unique_ptr<T[]> _bufferA, _bufferB;
     std::unique_ptr<T[]> _variance;
     std::unique_ptr<uint32[]> _sampleCount;
+    std::unique_ptr<PixelLock[]> _locks;
 
     const OutputBufferSettings &_settings;
 
+    inline void accumulate(int idx, T c)
+    {
+        uint32 sampleIdx = _sampleCount[idx]++;
+        if (_variance) {
+            T curr;
+            if (_bufferB && sampleIdx > 0) {
+                uint32 sampleCountA = (sampleIdx + 1)/2;
+                uint32 sampleCountB = sampleIdx/2;
+                curr = (_bufferA[idx]*sampleCountA + _bufferB[idx]*sampleCountB)/sampleIdx;
+            } else {
+                curr = _bufferA[idx];
+            }
+            T delta = c - curr;
+            curr += delta/(sampleIdx + 1);
+            _variance[idx] += delta*(c - curr);
+        }
+
+        if (_bufferB) {
+            T *feature = (sampleIdx & 1) ? _bufferB.get() : _bufferA.get();
+            uint32 perBufferSampleCount = sampleIdx/2 + 1;
+            feature[idx] += (c - feature[idx])/perBufferSampleCount;
+        } else {
+            _bufferA[idx] += (c - _bufferA[idx])/(sampleIdx + 1);
+        }
+    }
+
     inline float average(float x) const
     {
         return x;
@@ -93,42 +132,44 @@ public:
     {
         size_t numPixels = res.product();
 
-        _bufferA = zeroAlloc<T>(numPixels);
+        // With pinned threads, every render thread zeroes (and thereby first
+        // touches) one band of each buffer, which spreads the pages evenly
+        // over the NUMA nodes instead of placing them all on the node of the
+        // main thread. Tiles are scheduled dynamically, so a band is not
+        // necessarily rendered by the thread that touched it
+        _bufferA = ThreadUtils::distributedZeroAlloc<T>(numPixels);
         if (settings.twoBufferVariance())
-            _bufferB = zeroAlloc<T>(numPixels);
+            _bufferB = ThreadUtils::distributedZeroAlloc<T>(numPixels);
         if (settings.sampleVariance())
-            _variance = zeroAlloc<T>(numPixels);
-        _sampleCount = zeroAlloc<uint32>(numPixels);
+            _variance = ThreadUtils::distributedZeroAlloc<T>(numPixels);
+        _sampleCount = ThreadUtils::distributedZeroAlloc<uint32>(numPixels);
+        _locks.reset(new PixelLock[LockCount]);
     }
 
+    // Only safe if no other thread writes to the same pixel at the same time,
+    // e.g. when every pixel belongs to exactly one image tile
     void addSample(Vec2u pixel, T c)
     {
         if (std::isnan(c) || std::isinf(c))
             return;
 
-        int idx = pixel.x() + pixel.y()*_res.x();
-        uint32 sampleIdx = _sampleCount[idx]++;
-        if (_variance) {
-            T curr;
-            if (_bufferB && sampleIdx > 0) {
-                uint32 sampleCountA = (sampleIdx + 1)/2;
-                uint32 sampleCountB = sampleIdx/2;
-                curr = (_bufferA[idx]*sampleCountA + _bufferB[idx]*sampleCountB)/sampleIdx;
-            } else {
-                curr = _bufferA[idx];
-            }
-            T delta = c - curr;
-            curr += delta/(sampleIdx + 1);
-            _variance[idx] += delta*(c - curr);
-        }
+        accumulate(pixel.x() + pixel.y()*_res.x(), c);
+    }
 
-        if (_bufferB) {
-            T *feature = (sampleIdx & 1) ? _bufferB.get() : _bufferA.get();
-            uint32 perBufferSampleCount = sampleIdx/2 + 1;
-            feature[idx] += (c - feature[idx])/perBufferSampleCount;
-        } else {
-            _bufferA[idx] += (c - _bufferA[idx])/(sampleIdx + 1);
-        }
+    // Safe to call from any number of threads for any pixel. The sample is
+    // accumulated exactly as in addSample while holding the pixel's lock
+    // stripe, so the A/B buffers and variance estimates behave the same
+    void addSampleConcurrent(Vec2u pixel, T c)
+    {
+        if (std::isnan(c) || std::isinf(c))
+            return;
+
+        int idx = pixel.x() + pixel.y()*_res.x();
+        std::atomic_flag &lock = _locks[idx % LockCount].flag;
+        while (lock.test_and_set(std::memory_order_acquire))
+            ;
+        accumulate(idx, c);
+        lock.clear(std::memory_order_release);
     }
 
     inline T operator[](uint32 idx) const
@@ -0,0 +1,518 @@
+#include "BrickGrid.hpp"
+#include "SparseVoxelRange.hpp"
+#include "GridDda.hpp"
+
+#include "sampling/PathSampleGenerator.hpp"
+
+#include "sse/SimdFloat.hpp"
+
+#include "io/JsonObject.hpp"
+#include "io/FileUtils.hpp"
+#include "io/Scene.hpp"
+
+#include "Debug.hpp"
+
+#include <cstring>
+#include <limits>
+#include <cmath>
+
+namespace Tungsten {
+
+static const char BrickGridMagic[4] = {'B', 'G', 'R', 'D'};
+static const uint32 BrickGridVersion = 1;
+
+enum BrickGridFlags
+{
+    BrickGridHasEmission = (1 << 0),
+};
+
+// Trilinear interpolation of two 2x2 slices of voxels. Each slice holds
+// the values at (x, y), (x + 1, y), (x, y + 1) and (x + 1, y + 1)
+static inline float trilinear(float4 z0, float4 z1, Vec3f f)
+{
+    float4 xy = z0 + (z1 - z0)*float4(f.z());
+    float4 x = xy + (float4(_mm_movehl_ps(xy.raw(), xy.raw())) - xy)*float4(f.y());
+    return x[0] + (x[1] - x[0])*f.x();
+}
+
+std::string BrickGrid::lookupMethodToString(LookupMethod method)
+{
+    switch (method) {
+    default:
+    case LookupMethod::ExactNearest: return "exact_nearest";
+    case LookupMethod::ExactLinear:  return "exact_linear";
+    }
+}
+
+BrickGrid::LookupMethod BrickGrid::stringToLookupMethod(const std::string &name)
+{
+    if (name == "exact_nearest")
+        return LookupMethod::ExactNearest;
+    else if (name == "exact_linear")
+        return LookupMethod::ExactLinear;
+    FAIL("Invalid integration/sample method: '%s'", name);
+}
+
+BrickGrid::BrickGrid()
+: _integrationString("exact_nearest"),
+  _sampleString("exact_nearest"),
+  _densityScale(1.0f),
+  _emissionScale(1.0f),
+  _scaleEmissionByDensity(true),
+  _normalizeSize(true),
+  _resolution(0),
+  _brickCount(0)
+{
+    _integrationMethod = stringToLookupMethod(_integrationString);
+    _sampleMethod = stringToLookupMethod(_sampleString);
+}
+
+inline float BrickGrid::voxelDensity(int x, int y, int z) const
+{
+    int bx = x >> BrickSizeLog, by = y >> BrickSizeLog, bz = z >> BrickSizeLog;
+    if (!brickInside(bx, by, bz))
+        return 0.0f;
+    uint32 entry = indexEntry(bx, by, bz);
+    if (entry & TileFlag)
+        return _tileDensity[entry & ~TileFlag];
+
+    const int Mask = BrickSize - 1;
+    return _brickDensity[size_t(entry)*BrickVoxels + (x & Mask) + ((y & Mask) << BrickSizeLog)
+            + ((z & Mask) << (2*BrickSizeLog))];
+}
+
+inline Vec3f BrickGrid::voxelEmission(int x, int y, int z) const
+{
+    int bx = x >> BrickSizeLog, by = y >> BrickSizeLog, bz = z >> BrickSizeLog;
+    if (!brickInside(bx, by, bz))
+        return Vec3f(0.0f);
+    uint32 entry = indexEntry(bx, by, bz);
+    if (entry & TileFlag)
+        return _tileEmission[entry & ~TileFlag];
+
+    const int Mask = BrickSize - 1;
+    return _brickEmission[size_t(entry)*BrickVoxels + (x & Mask) + ((y & Mask) << BrickSizeLog)
+            + ((z & Mask) << (2*BrickSizeLog))];
+}
+
+void BrickGrid::buildConstantTables()
+{
+    auto brickConstant = [&](int bx, int by, int bz) {
+        if (!brickInside(bx, by, bz))
+            return 0.0f;
+        uint32 entry = indexEntry(bx, by, bz);
+        if (entry & TileFlag)
+            return _tileDensity[entry & ~TileFlag];
+        return std::numeric_limits<float>::quiet_NaN();
+    };
+
+    _nearestConstants.origin = Vec3i(0);
+    _nearestConstants.size = _brickCount;
+    _nearestConstants.values.resize(_brickCount.product());
+    for (int z = 0, idx = 0; z < _brickCount.z(); ++z)
+        for (int y = 0; y < _brickCount.y(); ++y)
+            for (int x = 0; x < _brickCount.x(); ++x, ++idx)
+                _nearestConstants.values[idx] = brickConstant(x, y, z);
+
+    // Trilinear cells are shifted by half a voxel, so the cells of one brick
+    // also reach into the bricks after it along each axis. An additional
+    // layer of bricks on each side covers the border of the volume
+    _linearConstants.origin = Vec3i(-1);
+    _linearConstants.size = _brickCount + 2;
+    _linearConstants.values.resize(_linearConstants.size.product());
+    for (int z = -1, idx = 0; z <= _brickCount.z(); ++z) {
+        for (int y = -1; y <= _brickCount.y(); ++y) {
+            for (int x = -1; x <= _brickCount.x(); ++x, ++idx) {
+                float value = brickConstant(x, y, z);
+                for (int i = 1; i < 8 && !std::isnan(value); ++i)
+                    if (brickConstant(x + (i & 1), y + ((i >> 1) & 1), z + (i >> 2)) != value)
+                        value = std::numeric_limits<float>::quiet_NaN();
+                _linearConstants.values[idx] = value;
+            }
+        }
+    }
+}
+
+void BrickGrid::fromJson(JsonPtr value, const Scene &scene)
+{
+    if (auto path = value["file"]) _path = scene.fetchResource(path);
+    value.getField("density_scale", _densityScale);
+    value.getField("emission_scale", _emissionScale);
+    value.getField("scale_emission_by_density", _scaleEmissionByDensity);
+    value.getField("normalize_size", _normalizeSize);
+    value.getField("integration_method", _integrationString);
+    value.getField("sampling_method", _sampleString);
+    value.getField("transform", _configTransform);
+
+    _integrationMethod = stringToLookupMethod(_integrationString);
+    _sampleMethod = stringToLookupMethod(_sampleString);
+}
+
+rapidjson::Value BrickGrid::toJson(Allocator &allocator) const
+{
+    JsonObject result{Grid::toJson(allocator), allocator,
+        "type", "brick",
+        "density_scale", _densityScale,
+        "emission_scale", _emissionScale,
+        "scale_emission_by_density", _scaleEmissionByDensity,
+        "normalize_size", _normalizeSize,
+        "integration_method", _integrationString,
+        "sampling_method", _sampleString,
+        "transform", _configTransform
+    };
+    if (_path)
+        result.add("file", *_path);
+
+    return result;
+}
+
+void BrickGrid::loadResources()
+{
+    if (!_path)
+        FAIL("No file specified for brick grid");
+
+    InputStreamHandle in = FileUtils::openInputStream(*_path);
+    if (!in)
+        FAIL("Failed to open brick grid at '%s'", *_path);
+
+    char magic[4];
+    uint32 version, flags;
+    uint64 numTiles, numBricks;
+    FileUtils::streamRead(in, magic, 4);
+    FileUtils::streamRead(in, version);
+    if (!*in || std::memcmp(magic, BrickGridMagic, 4) != 0 || version != BrickGridVersion)
+        FAIL("Brick grid at '%s' is invalid or has an unsupported version", *_path);
+
+    FileUtils::streamRead(in, flags);
+    FileUtils::streamRead(in, _resolution);
+    FileUtils::streamRead(in, numTiles);
+    FileUtils::streamRead(in, numBricks);
+    _brickCount = (_resolution + BrickSize - 1)/BrickSize;
+
+    bool hasEmission = (flags & BrickGridHasEmission) != 0;
+    _index.resize(_brickCount.product());
+    _tileDensity.resize(size_t(numTiles));
+    _tileEmission.resize(hasEmission ? size_t(numTiles) : 0);
+    _brickDensity.resize(size_t(numBricks)*BrickVoxels);
+    _brickEmission.resize(hasEmission ? size_t(numBricks)*BrickVoxels : 0);
+    FileUtils::streamRead(in, _index.data(), _index.size());
+    FileUtils::streamRead(in, _tileDensity.data(), _tileDensity.size());
+    FileUtils::streamRead(in, _tileEmission.data(), _tileEmission.size());
+    FileUtils::streamRead(in, _brickDensity.data(), _brickDensity.size());
+    FileUtils::streamRead(in, _brickEmission.data(), _brickEmission.size());
+    if (!*in)
+        FAIL("Brick grid at '%s' is truncated", *_path);
+
+    for (uint32 entry : _index)
+        if ((entry & TileFlag) ? (entry & ~TileFlag) >= numTiles : entry >= numBricks)
+            FAIL("Brick grid at '%s' contains an invalid brick index", *_path);
+
+    for (float &d : _tileDensity)
+        d *= _densityScale;
+    for (float &d : _brickDensity)
+        d *= _densityScale;
+
+    buildConstantTables();
+
+    Vec3f diag = Vec3f(_resolution);
+    float scale = 1.0f;
+    Vec3f center(0.0f);
+    if (_normalizeSize) {
+        scale = 1.0f/diag.max();
+        diag *= scale;
+        center = Vec3f(diag.x(), 0.0f, diag.z())*0.5f;
+    }
+
+    _transform = Mat4f::translate(-center)*Mat4f::scale(Vec3f(scale));
+    _invTransform = Mat4f::scale(Vec3f(1.0f/scale))*Mat4f::translate(center);
+    if (_sampleMethod == LookupMethod::ExactLinear || _integrationMethod == LookupMethod::ExactLinear)
+        _bounds = Box3f(Vec3f(-0.5f), Vec3f(_resolution) + 0.5f);
+    else
+        _bounds = Box3f(Vec3f(0.0f), Vec3f(_resolution));
+
+    _invConfigTransform = _configTransform.invert();
+}
+
+void BrickGrid::buildFromDense(Vec3i resolution, const float *density, const Vec3f *emission)
+{
+    _resolution = resolution;
+    _brickCount = (_resolution + BrickSize - 1)/BrickSize;
+    _index.resize(_brickCount.product());
+    _tileDensity.clear();
+    _tileEmission.clear();
+    _brickDensity.clear();
+    _brickEmission.clear();
+
+    // Tile 0 is always empty space
+    _tileDensity.push_back(0.0f);
+    if (emission)
+        _tileEmission.push_back(Vec3f(0.0f));
+
+    float brickDensity[BrickVoxels];
+    Vec3f brickEmission[BrickVoxels];
+    for (int bz = 0, idx = 0; bz < _brickCount.z(); ++bz) {
+        for (int by = 0; by < _brickCount.y(); ++by) {
+            for (int bx = 0; bx < _brickCount.x(); ++bx, ++idx) {
+                for (int z = 0, i = 0; z < BrickSize; ++z) {
+                    for (int y = 0; y < BrickSize; ++y) {
+                        for (int x = 0; x < BrickSize; ++x, ++i) {
+                            Vec3i v = Vec3i(bx, by, bz)*BrickSize + Vec3i(x, y, z);
+                            bool inside = v.x() < _resolution.x() && v.y() < _resolution.y() && v.z() < _resolution.z();
+                            size_t src = v.x() + size_t(_resolution.x())*(v.y() + size_t(_resolution.y())*v.z());
+                            brickDensity[i] = inside ? density[src] : 0.0f;
+                            brickEmission[i] = inside && emission ? emission[src] : Vec3f(0.0f);
+                        }
+                    }
+                }
+
+                bool constant = true;
+                for (int i = 1; i < BrickVoxels && constant; ++i)
+                    constant = brickDensity[i] == brickDensity[0] && brickEmission[i] == brickEmission[0];
+
+                if (constant && brickDensity[0] == 0.0f && brickEmission[0] == 0.0f) {
+                    _index[idx] = TileFlag;
+                } else if (constant) {
+                    _index[idx] = TileFlag | uint32(_tileDensity.size());
+                    _tileDensity.push_back(brickDensity[0]);
+                    if (emission)
+                        _tileEmission.push_back(brickEmission[0]);
+                } else {
+                    _index[idx] = uint32(_brickDensity.size()/BrickVoxels);
+                    _brickDensity.insert(_brickDensity.end(), brickDensity, brickDensity + BrickVoxels);
+                    if (emission)
+                        _brickEmission.insert(_brickEmission.end(), brickEmission, brickEmission + BrickVoxels);
+                }
+            }
+        }
+    }
+
+    buildConstantTables();
+}
+
+bool BrickGrid::saveBricks(const Path &path) const
+{
+    OutputStreamHandle out = FileUtils::openOutputStream(path);
+    if (!out)
+        return false;
+
+    bool hasEmission = !_tileEmission.empty() || !_brickEmission.empty();
+    FileUtils::streamWrite(out, BrickGridMagic, 4);
+    FileUtils::streamWrite(out, BrickGridVersion);
+    FileUtils::streamWrite(out, uint32(hasEmission ? BrickGridHasEmission : 0));
+    FileUtils::streamWrite(out, _resolution);
+    FileUtils::streamWrite(out, uint64(_tileDensity.size()));
+    FileUtils::streamWrite(out, uint64(_brickDensity.size()/BrickVoxels));
+    FileUtils::streamWrite(out, _index.data(), _index.size());
+    FileUtils::streamWrite(out, _tileDensity.data(), _tileDensity.size());
+    FileUtils::streamWrite(out, _tileEmission.data(), _tileEmission.size());
+    FileUtils::streamWrite(out, _brickDensity.data(), _brickDensity.size());
+    FileUtils::streamWrite(out, _brickEmission.data(), _brickEmission.size());
+
+    return bool(*out);
+}
+
+size_t BrickGrid::memoryUsage() const
+{
+    return _index.size()*sizeof(uint32)
+         + _tileDensity.size()*sizeof(float)
+         + _tileEmission.size()*sizeof(Vec3f)
+         + _brickDensity.size()*sizeof(float)
+         + _brickEmission.size()*sizeof(Vec3f)
+         + (_nearestConstants.values.size() + _linearConstants.values.size())*sizeof(float);
+}
+
+Mat4f BrickGrid::naturalTransform() const
+{
+    return _configTransform*_transform;
+}
+
+Mat4f BrickGrid::invNaturalTransform() const
+{
+    return _invTransform*_invConfigTransform;
+}
+
+Box3f BrickGrid::bounds() const
+{
+    return _bounds;
+}
+
+Vec2f BrickGrid::densityRange(const Box3f &region) const
+{
+    // Voxels touched by nearest and trilinear lookups anywhere in the region
+    Vec3i minV(int(std::floor(region.min().x() - 0.5f)), int(std::floor(region.min().y() - 0.5f)),
+            int(std::floor(region.min().z() - 0.5f)));
+    Vec3i maxV(int(std::floor(region.max().x() + 0.5f)), int(std::floor(region.max().y() + 0.5f)),
+            int(std::floor(region.max().z() + 0.5f)));
+
+    // Bricks outside of the data are empty space
+    return SparseVoxelRange::compute(minV, maxV, BrickSize, [&](Vec3i origin, float &value) {
+        Vec3i brick = origin >> BrickSizeLog;
+        if (!brickInside(brick.x(), brick.y(), brick.z())) {
+            value = 0.0f;
+            return true;
+        }
+        uint32 entry = indexEntry(brick.x(), brick.y(), brick.z());
+        if (entry & TileFlag)
+            value = _tileDensity[entry & ~TileFlag];
+        return (entry & TileFlag) != 0;
+    }, [&](Vec3i v) {
+        return voxelDensity(v.x(), v.y(), v.z());
+    });
+}
+
+template<typename ConstantVisitor, typename CellVisitor>
+bool BrickGrid::march(Vec3f p, Vec3f w, float t0, float t1, bool linear,
+        ConstantVisitor constantVisitor, CellVisitor cellVisitor) const
+{
+    // Traverses bricks first and only descends into the voxels of bricks
+    // whose values are not constant. Cells are voxels for nearest neighbor
+    // lookups, and the cells between voxel centers for trilinear lookups
+    const ConstantTable &constants = linear ? _linearConstants : _nearestConstants;
+    Vec3f q = linear ? p - 0.5f : p;
+    float invBrickSize = 1.0f/BrickSize;
+
+    return GridDda::march(q*invBrickSize, w*invBrickSize, t0, t1, constants.origin,
+            constants.origin + constants.size, [&](Vec3i brick, float ta, float tb) {
+        float value = constants.at(brick);
+        if (!std::isnan(value))
+            return constantVisitor(value, ta, tb);
+        return GridDda::march(q, w, ta, tb, brick*BrickSize, brick*BrickSize + BrickSize, cellVisitor);
+    });
+}
+
+float BrickGrid::density(Vec3f p) const
+{
+    Vec3f q = p - 0.5f;
+    int ix = int(std::floor(q.x())), iy = int(std::floor(q.y())), iz = int(std::floor(q.z()));
+    Vec3f f = q - Vec3f(float(ix), float(iy), float(iz));
+
+    const int Mask = BrickSize - 1;
+    int lx = ix & Mask, ly = iy & Mask, lz = iz & Mask;
+    int bx = ix >> BrickSizeLog, by = iy >> BrickSizeLog, bz = iz >> BrickSizeLog;
+
+    // Fast path: all eight voxels lie in the same brick
+    if (lx < Mask && ly < Mask && lz < Mask && brickInside(bx, by, bz)) {
+        uint32 entry = indexEntry(bx, by, bz);
+        if (entry & TileFlag)
+            return _tileDensity[entry & ~TileFlag];
+
+        const float *b = _brickDensity.data() + size_t(entry)*BrickVoxels
+                + lx + (ly << BrickSizeLog) + (lz << (2*BrickSizeLog));
+        const int RowStride = BrickSize, SliceStride = BrickSize*BrickSize;
+        __m128 z0 = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64 *>(b)),
+                reinterpret_cast<const __m64 *>(b + RowStride));
+        __m128 z1 = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64 *>(b + SliceStride)),
+                reinterpret_cast<const __m64 *>(b + SliceStride + RowStride));
+        return trilinear(float4(z0), float4(z1), f);
+    }
+
+    return trilinear(
+        float4(voxelDensity(ix, iy,     iz    ), voxelDensity(ix + 1, iy,     iz    ),
+               voxelDensity(ix, iy + 1, iz    ), voxelDensity(ix + 1, iy + 1, iz    )),
+        float4(voxelDensity(ix, iy,     iz + 1), voxelDensity(ix + 1, iy,     iz + 1),
+               voxelDensity(ix, iy + 1, iz + 1), voxelDensity(ix + 1, iy + 1, iz + 1)),
+        f
+    );
+}
+
+Vec3f BrickGrid::emission(Vec3f p) const
+{
+    if (_tileEmission.empty())
+        return Vec3f(0.0f);
+
+    Vec3f q = p - 0.5f;
+    int ix = int(std::floor(q.x())), iy = int(std::floor(q.y())), iz = int(std::floor(q.z()));
+    Vec3f f = q - Vec3f(float(ix), float(iy), float(iz));
+
+    Vec3f result(0.0f);
+    for (int i = 0; i < 8; ++i) {
+        int dx = i & 1, dy = (i >> 1) & 1, dz = i >> 2;
+        float weight = (dx ? f.x() : 1.0f - f.x())*(dy ? f.y() : 1.0f - f.y())*(dz ? f.z() : 1.0f - f.z());
+        result += weight*voxelEmission(ix + dx, iy + dy, iz + dz);
+    }
+    result *= _emissionScale;
+    if (_scaleEmissionByDensity)
+        result *= density(p);
+    return result;
+}
+
+float BrickGrid::opticalDepth(PathSampleGenerator &/*sampler*/, Vec3f p, Vec3f w, float t0, float t1) const
+{
+    float integral = 0.0f;
+    if (_integrationMethod == LookupMethod::ExactNearest) {
+        march(p, w, t0, t1, false, [&](float value, float ta, float tb) {
+            integral += value*(tb - ta);
+            return false;
+        }, [&](Vec3i voxel, float ta, float tb) {
+            integral += voxelDensity(voxel.x(), voxel.y(), voxel.z())*(tb - ta);
+            return false;
+        });
+    } else {
+        float fa = density(p + w*t0);
+        march(p, w, t0, t1, true, [&](float value, float ta, float tb) {
+            integral += value*(tb - ta);
+            fa = value;
+            return false;
+        }, [&](Vec3i /*cell*/, float ta, float tb) {
+            float fb = density(p + w*tb);
+            integral += (fa + fb)*0.5f*(tb - ta);
+            fa = fb;
+            return false;
+        });
+    }
+    return integral;
+}
+
+Vec2f BrickGrid::inverseOpticalDepth(PathSampleGenerator &/*sampler*/, Vec3f p, Vec3f w, float t0, float t1, float tau) const
+{
+    float integral = 0.0f;
+    Vec2f result(t1, 0.0f);
+
+    auto constantSegment = [&](float value, float ta, float tb) {
+        float delta = value*(tb - ta);
+        if (delta > 0.0f && integral + delta >= tau) {
+            result = Vec2f(ta + (tau - integral)/value, value);
+            return true;
+        }
+        integral += delta;
+        return false;
+    };
+
+    bool hit;
+    if (_sampleMethod == LookupMethod::ExactNearest) {
+        hit = march(p, w, t0, t1, false, constantSegment, [&](Vec3i voxel, float ta, float tb) {
+            return constantSegment(voxelDensity(voxel.x(), voxel.y(), voxel.z()), ta, tb);
+        });
+    } else {
+        float fa = density(p + w*t0);
+        hit = march(p, w, t0, t1, true, [&](float value, float ta, float tb) {
+            fa = value;
+            return constantSegment(value, ta, tb);
+        }, [&](Vec3i /*cell*/, float ta, float tb) {
+            float fb = density(p + w*tb);
+            float delta = (fb + fa)*0.5f*(tb - ta);
+            if (delta > 0.0f && integral + delta >= tau) {
+                float a = (fb - fa);
+                float b = fa;
+                float c = (integral - tau)/(tb - ta);
+                float x1;
+                if (std::abs(a) < 1e-6f) {
+                    x1 = -c/b;
+                } else {
+                    float mantissa = max(b*b - 2.0f*a*c, 0.0f);
+                    x1 = (-b + std::sqrt(mantissa))/a;
+                }
+                x1 = clamp(x1, 0.0f, 1.0f);
+                result = Vec2f(ta + (tb - ta)*x1, fa + (fb - fa)*x1);
+                return true;
+            }
+            integral += delta;
+            fa = fb;
+            return false;
+        });
+    }
+
+    return hit ? result : Vec2f(t1, integral);
+}
+
+}
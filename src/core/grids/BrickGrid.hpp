@@ -0,0 +1,137 @@
+#ifndef BRICKGRID_HPP_
+#define BRICKGRID_HPP_
+
+#include "Grid.hpp"
+
+#include "io/Path.hpp"
+
+#include "IntTypes.hpp"
+
+#include <vector>
+
+namespace Tungsten {
+
+// Sparse voxel grid that does not depend on OpenVDB. The volume is split
+// into 8^3 voxel bricks, addressed through a dense top level index. Bricks
+// in which every voxel has the same value (in particular empty space) are
+// stored as a single tile value instead of a full brick.
+//
+// Voxel (x, y, z) covers [x, x + 1) x [y, y + 1) x [z, z + 1) in grid space
+class BrickGrid : public Grid
+{
+public:
+    static CONSTEXPR int BrickSizeLog = 3;
+    static CONSTEXPR int BrickSize = 1 << BrickSizeLog;
+    static CONSTEXPR int BrickVoxels = BrickSize*BrickSize*BrickSize;
+
+private:
+    enum class LookupMethod
+    {
+        ExactNearest,
+        ExactLinear,
+    };
+
+    // Index entries with this bit set refer to a tile value instead of a brick
+    static CONSTEXPR uint32 TileFlag = 0x80000000u;
+
+    // Per brick (or per group of trilinear cells) values that are constant
+    // over the whole brick, or NaN if the brick has to be traversed voxel
+    // by voxel. Used to skip bricks as a whole during integration
+    struct ConstantTable
+    {
+        Vec3i origin;
+        Vec3i size;
+        std::vector<float> values;
+
+        float at(Vec3i brick) const
+        {
+            brick -= origin;
+            return values[brick.x() + size.x()*(brick.y() + size.y()*brick.z())];
+        }
+    };
+
+    PathPtr _path;
+    std::string _integrationString;
+    std::string _sampleString;
+    float _densityScale;
+    float _emissionScale;
+    bool _scaleEmissionByDensity;
+    bool _normalizeSize;
+    Mat4f _configTransform;
+    Mat4f _invConfigTransform;
+
+    LookupMethod _integrationMethod;
+    LookupMethod _sampleMethod;
+
+    Vec3i _resolution;
+    Vec3i _brickCount;
+    std::vector<uint32> _index;
+    std::vector<float> _tileDensity;
+    std::vector<Vec3f> _tileEmission;
+    std::vector<float> _brickDensity;
+    std::vector<Vec3f> _brickEmission;
+
+    ConstantTable _nearestConstants;
+    ConstantTable _linearConstants;
+
+    Mat4f _transform;
+    Mat4f _invTransform;
+    Box3f _bounds;
+
+    static std::string lookupMethodToString(LookupMethod method);
+    static LookupMethod stringToLookupMethod(const std::string &name);
+
+    inline uint32 indexEntry(int bx, int by, int bz) const
+    {
+        return _index[bx + _brickCount.x()*(by + _brickCount.y()*bz)];
+    }
+
+    inline bool brickInside(int bx, int by, int bz) const
+    {
+        return uint32(bx) < uint32(_brickCount.x())
+            && uint32(by) < uint32(_brickCount.y())
+            && uint32(bz) < uint32(_brickCount.z());
+    }
+
+    inline float voxelDensity(int x, int y, int z) const;
+    inline Vec3f voxelEmission(int x, int y, int z) const;
+
+    void buildConstantTables();
+
+    template<typename ConstantVisitor, typename CellVisitor>
+    bool march(Vec3f p, Vec3f w, float t0, float t1, bool linear,
+            ConstantVisitor constantVisitor, CellVisitor cellVisitor) const;
+
+public:
+    BrickGrid();
+
+    virtual void fromJson(JsonPtr value, const Scene &scene) override;
+    virtual rapidjson::Value toJson(Allocator &allocator) const override;
+
+    virtual void loadResources() override;
+
+    // Builds the grid from dense voxel data (x varying fastest). The
+    // emission array may be null
+    void buildFromDense(Vec3i resolution, const float *density, const Vec3f *emission);
+    bool saveBricks(const Path &path) const;
+
+    size_t memoryUsage() const;
+    size_t brickCount() const
+    {
+        return _brickDensity.size()/BrickVoxels;
+    }
+
+    virtual Mat4f naturalTransform() const override;
+    virtual Mat4f invNaturalTransform() const override;
+    virtual Box3f bounds() const override;
+    virtual Vec2f densityRange(const Box3f &region) const override;
+
+    float density(Vec3f p) const override;
+    Vec3f emission(Vec3f p) const override;
+    float opticalDepth(PathSampleGenerator &sampler, Vec3f p, Vec3f w, float t0, float t1) const override;
+    Vec2f inverseOpticalDepth(PathSampleGenerator &sampler, Vec3f p, Vec3f w, float t0, float t1, float tau) const override;
+};
+
+}
+
+#endif /* BRICKGRID_HPP_ */
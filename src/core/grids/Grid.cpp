@@ -1,5 +1,8 @@
 #include "Grid.hpp"
 
+#include <limits>
+#include <cmath>
+
 namespace Tungsten {
 
 Mat4f Grid::naturalTransform() const
@@ -17,4 +20,27 @@ Box3f Grid::bounds() const
     return Box3f();
 }
 
+Vec2f Grid::densityRange(const Box3f &region) const
+{
+    // Voxels touched by nearest and trilinear lookups anywhere in the region.
+    // Interpolated values lie between those at the voxel centers, so every
+    // voxel only needs to be looked up once
+    Vec3i minV(int(std::floor(region.min().x() - 0.5f)), int(std::floor(region.min().y() - 0.5f)),
+            int(std::floor(region.min().z() - 0.5f)));
+    Vec3i maxV(int(std::floor(region.max().x() + 0.5f)), int(std::floor(region.max().y() + 0.5f)),
+            int(std::floor(region.max().z() + 0.5f)));
+
+    Vec2f result(std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity());
+    for (int z = minV.z(); z <= maxV.z(); ++z) {
+        for (int y = minV.y(); y <= maxV.y(); ++y) {
+            for (int x = minV.x(); x <= maxV.x(); ++x) {
+                float d = density(Vec3f(float(x), float(y), float(z)) + 0.5f);
+                result.x() = min(result.x(), d);
+                result.y() = max(result.y(), d);
+            }
+        }
+    }
+    return result;
+}
+
 }
@@ -19,6 +19,14 @@ public:
     virtual Mat4f invNaturalTransform() const;
     virtual Box3f bounds() const;
 
+    // Returns a lower and upper bound of the density inside a grid space
+    // region. The default snaps the region to the unit voxels around it and
+    // evaluates density() once at the center of each, which is exact for
+    // grids that interpolate voxels centered at half integer coordinates.
+    // Grids with a different layout or cheaper ways to bound their voxels
+    // should override this
+    virtual Vec2f densityRange(const Box3f &region) const;
+
     virtual float density(Vec3f p) const = 0;
     virtual Vec3f emission(Vec3f p) const = 0;
     virtual float opticalDepth(PathSampleGenerator &sampler, Vec3f p, Vec3f w, float t0, float t1) const = 0;
@@ -0,0 +1,68 @@
+#ifndef GRIDDDA_HPP_
+#define GRIDDDA_HPP_
+
+#include "math/MathUtil.hpp"
+#include "math/Vec.hpp"
+
+#include <limits>
+#include <cmath>
+
+namespace Tungsten {
+
+namespace GridDda {
+
+// Visits the unit sized cells in [minCell, maxCell) that are overlapped by
+// the ray segment p + w*t, t in [t0, t1], in front to back order. For every
+// cell, visitor(cell, ta, tb) is called with the parametric range of the
+// ray inside it. Traversal stops as soon as the visitor returns true, in
+// which case march returns true as well
+template<typename Visitor>
+bool march(Vec3f p, Vec3f w, float t0, float t1, Vec3i minCell, Vec3i maxCell, Visitor visitor)
+{
+    if (!(t0 < t1))
+        return false;
+
+    Vec3f start = p + w*t0;
+    Vec3i cell, step;
+    Vec3f tNext, tDelta;
+    for (int i = 0; i < 3; ++i) {
+        cell[i] = clamp(int(std::floor(start[i])), minCell[i], maxCell[i] - 1);
+        if (w[i] > 0.0f) {
+            step[i] = 1;
+            tDelta[i] = 1.0f/w[i];
+            tNext[i] = t0 + (float(cell[i] + 1) - start[i])*tDelta[i];
+        } else if (w[i] < 0.0f) {
+            step[i] = -1;
+            tDelta[i] = -1.0f/w[i];
+            tNext[i] = t0 + (start[i] - float(cell[i]))*tDelta[i];
+        } else {
+            step[i] = 0;
+            tDelta[i] = tNext[i] = std::numeric_limits<float>::infinity();
+        }
+    }
+
+    float ta = t0;
+    while (true) {
+        int axis = tNext.x() < tNext.y()
+            ? (tNext.x() < tNext.z() ? 0 : 2)
+            : (tNext.y() < tNext.z() ? 1 : 2);
+        float tb = min(max(tNext[axis], ta), t1);
+
+        if (visitor(cell, ta, tb))
+            return true;
+        if (tb >= t1)
+            return false;
+
+        cell[axis] += step[axis];
+        if (cell[axis] < minCell[axis] || cell[axis] >= maxCell[axis])
+            return false;
+        tNext[axis] += tDelta[axis];
+        ta = tb;
+    }
+}
+
+}
+
+}
+
+#endif /* GRIDDDA_HPP_ */
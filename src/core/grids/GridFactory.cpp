@@ -1,5 +1,6 @@
 #include "GridFactory.hpp"
 
+#include "BrickGrid.hpp"
 #include "VdbGrid.hpp"
 
 namespace Tungsten {
@@ -11,6 +12,7 @@ namespace Tungsten {
 #endif
 
 DEFINE_STRINGABLE_ENUM(GridFactory, "grid", ({
+    {"brick", std::make_shared<BrickGrid>},
     OPENVDB_ENTRY
 }))
 
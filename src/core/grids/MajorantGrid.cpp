@@ -0,0 +1,38 @@
+#include "MajorantGrid.hpp"
+
+#include "thread/ThreadUtils.hpp"
+#include "thread/ThreadPool.hpp"
+
+#include <cmath>
+
+namespace Tungsten {
+
+MajorantGrid::MajorantGrid()
+: _origin(0.0f),
+  _cellSize(1.0f),
+  _invCellSize(1.0f),
+  _resolution(0)
+{
+}
+
+void MajorantGrid::build(const Grid &grid, const Box3f &bounds, float cellSize)
+{
+    _origin = bounds.min();
+    _cellSize = cellSize;
+    _invCellSize = 1.0f/cellSize;
+    Vec3f diag = bounds.diagonal()*_invCellSize;
+    _resolution = Vec3i(int(std::ceil(diag.x())), int(std::ceil(diag.y())), int(std::ceil(diag.z())));
+    _resolution = max(_resolution, Vec3i(1));
+    _ranges.resize(_resolution.product());
+
+    uint32 slices = uint32(_resolution.z()*_resolution.y());
+    ThreadUtils::parallelFor(0, slices, min(slices, ThreadUtils::pool->threadCount()*4), [&](uint32 slice) {
+        int y = int(slice) % _resolution.y(), z = int(slice)/_resolution.y();
+        for (int x = 0; x < _resolution.x(); ++x) {
+            Vec3f minP = _origin + Vec3f(float(x), float(y), float(z))*_cellSize;
+            _ranges[x + _resolution.x()*slice] = grid.densityRange(Box3f(minP, minP + _cellSize));
+        }
+    });
+}
+
+}
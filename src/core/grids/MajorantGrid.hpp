@@ -0,0 +1,56 @@
+#ifndef MAJORANTGRID_HPP_
+#define MAJORANTGRID_HPP_
+
+#include "GridDda.hpp"
+#include "Grid.hpp"
+
+#include "math/Box.hpp"
+
+#include <vector>
+
+namespace Tungsten {
+
+// Coarse grid of conservative density bounds over the bounding box of a
+// Grid. Each cell stores the (min, max) density of the underlying grid
+// inside it. Medium tracking walks the cells along a ray so that null
+// collisions are taken against local rather than global bounds.
+class MajorantGrid
+{
+    Vec3f _origin;
+    float _cellSize;
+    float _invCellSize;
+    Vec3i _resolution;
+    std::vector<Vec2f> _ranges;
+
+public:
+    MajorantGrid();
+
+    // Cell size is in grid space units (voxels)
+    void build(const Grid &grid, const Box3f &bounds, float cellSize);
+
+    // Calls visitor(Vec2f range, ta, tb) for every cell overlapped by the
+    // grid space segment p + w*t, t in [t0, t1], front to back. Traversal
+    // stops when the visitor returns true, in which case march does too
+    template<typename Visitor>
+    bool march(Vec3f p, Vec3f w, float t0, float t1, Visitor visitor) const
+    {
+        return GridDda::march((p - _origin)*_invCellSize, w*_invCellSize, t0, t1, Vec3i(0), _resolution,
+                [&](Vec3i cell, float ta, float tb) {
+            return visitor(_ranges[cell.x() + _resolution.x()*(cell.y() + _resolution.y()*cell.z())], ta, tb);
+        });
+    }
+
+    Vec3i resolution() const
+    {
+        return _resolution;
+    }
+
+    size_t memoryUsage() const
+    {
+        return _ranges.size()*sizeof(Vec2f);
+    }
+};
+
+}
+
+#endif /* MAJORANTGRID_HPP_ */
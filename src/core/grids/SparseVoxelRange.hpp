@@ -0,0 +1,57 @@
+#ifndef SPARSEVOXELRANGE_HPP_
+#define SPARSEVOXELRANGE_HPP_
+
+#include "math/MathUtil.hpp"
+#include "math/Vec.hpp"
+
+#include <limits>
+
+namespace Tungsten {
+
+namespace SparseVoxelRange {
+
+// Returns the minimum and maximum of the voxels in [minV, maxV] (inclusive)
+// of a sparse grid made of blockSize^3 voxel blocks, with block origins at
+// multiples of blockSize. The block size has to be a power of two.
+//
+// blockConstant(origin, value) returns true and stores the value if every
+// voxel of the block at the given origin has the same value, e.g. because
+// it is a tile or not allocated at all. Voxels of all other blocks that lie
+// inside the range are looked up one at a time with voxel(v)
+template<typename BlockConstant, typename Voxel>
+Vec2f compute(Vec3i minV, Vec3i maxV, int blockSize, BlockConstant blockConstant, Voxel voxel)
+{
+    Vec2f result(std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity());
+    auto include = [&](float d) {
+        result.x() = min(result.x(), d);
+        result.y() = max(result.y(), d);
+    };
+
+    Vec3i blockMin(minV.x() & ~(blockSize - 1), minV.y() & ~(blockSize - 1), minV.z() & ~(blockSize - 1));
+    for (int bz = blockMin.z(); bz <= maxV.z(); bz += blockSize) {
+        for (int by = blockMin.y(); by <= maxV.y(); by += blockSize) {
+            for (int bx = blockMin.x(); bx <= maxV.x(); bx += blockSize) {
+                Vec3i origin(bx, by, bz);
+                float value;
+                if (blockConstant(origin, value)) {
+                    include(value);
+                    continue;
+                }
+
+                Vec3i lo = max(minV, origin);
+                Vec3i hi = min(maxV, origin + (blockSize - 1));
+                for (int z = lo.z(); z <= hi.z(); ++z)
+                    for (int y = lo.y(); y <= hi.y(); ++y)
+                        for (int x = lo.x(); x <= hi.x(); ++x)
+                            include(voxel(Vec3i(x, y, z)));
+            }
+        }
+    }
+    return result;
+}
+
+}
+
+}
+
+#endif /* SPARSEVOXELRANGE_HPP_ */
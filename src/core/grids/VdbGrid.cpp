@@ -2,6 +2,7 @@
 
 #if OPENVDB_AVAILABLE
 
+#include "SparseVoxelRange.hpp"
 #include "VdbRaymarcher.hpp"
 
 #include "sampling/PathSampleGenerator.hpp"
@@ -286,6 +287,29 @@ static inline float gridAt(TreeT &acc, Vec3f p)
     return openvdb::tools::BoxSampler::sample(acc, openvdb::Vec3R(p.x(), p.y(), p.z()));
 }
 
+Vec2f VdbGrid::densityRange(const Box3f &region) const
+{
+    // Voxels are centered on integer coordinates, and trilinear lookups
+    // anywhere in the region touch the voxels from floor(min) to floor(max) + 1
+    Vec3i minV(int(std::floor(region.min().x())), int(std::floor(region.min().y())),
+            int(std::floor(region.min().z())));
+    Vec3i maxV = Vec3i(int(std::floor(region.max().x())), int(std::floor(region.max().y())),
+            int(std::floor(region.max().z()))) + 1;
+
+    // Blocks without a leaf are covered by a single tile or background value
+    auto accessor = _densityGrid->getConstAccessor();
+    return SparseVoxelRange::compute(minV, maxV, int(openvdb::FloatTree::LeafNodeType::DIM),
+            [&](Vec3i origin, float &value) {
+        openvdb::Coord coord(origin.x(), origin.y(), origin.z());
+        if (accessor.probeConstLeaf(coord))
+            return false;
+        value = accessor.getValue(coord);
+        return true;
+    }, [&](Vec3i v) {
+        return accessor.getValue(openvdb::Coord(v.x(), v.y(), v.z()));
+    });
+}
+
 float VdbGrid::density(Vec3f p) const
 {
     return gridAt(_densityGrid->tree(), p);
@@ -75,6 +75,7 @@ public:
     virtual Mat4f invNaturalTransform() const override;
     virtual Box3f bounds() const override;
 
+    Vec2f densityRange(const Box3f &region) const override;
     float density(Vec3f p) const override;
     Vec3f emission(Vec3f p) const override;
     float opticalDepth(PathSampleGenerator &sampler, Vec3f p, Vec3f w, float t0, float t1) const override;
@@ -18,9 +18,13 @@
 #include <rapidjson/writer.h>
 #include <lodepng/lodepng.h>
 #include <algorithm>
+#include <sstream>
 
 namespace Tungsten {
 
+// Bumped whenever the binary layout of the render resume data changes
+static CONSTEXPR uint32 ResumeDataVersion = 2;
+
 static Path incrementalFilename(const Path &dstFile, const std::string &suffix, bool overwrite)
 {
     Path dstPath = (dstFile.stripExtension() + suffix) + dstFile.extension();
@@ -53,27 +57,43 @@ void Integrator::advanceSpp()
     _nextSpp = min(_currentSpp + _scene->rendererSettings().sppStep(), _scene->rendererSettings().spp());
 }
 
-void Integrator::writeBuffers(const std::string &suffix, bool overwrite)
+static std::unique_ptr<Vec3f[]> copyLinearFrame(const Camera &cam)
 {
-    Vec2u res = _scene->cam().resolution();
+    Vec2u res = cam.resolution();
     std::unique_ptr<Vec3f[]> hdr(new Vec3f[res.product()]);
-    std::unique_ptr<Vec3c[]> ldr(new Vec3c[res.product()]);
-
     for (uint32 y = 0; y < res.y(); ++y)
         for (uint32 x = 0; x < res.x(); ++x)
-            hdr[x + y*res.x()] = _scene->cam().getLinear(x, y);
+            hdr[x + y*res.x()] = cam.getLinear(x, y);
+    return hdr;
+}
 
-    for (uint32 i = 0; i < res.product(); ++i)
-        ldr[i] = Vec3c(clamp(Vec3i(_scene->cam().tonemap(hdr[i])*255.0f), Vec3i(0), Vec3i(255)));
+// Files with an empty path are skipped
+static void saveFrame(const Vec3f *hdr, Vec2u res, Tonemap::Type tonemapOp,
+        const Path &ldrFile, const Path &hdrFile)
+{
+    if (!ldrFile.empty()) {
+        std::unique_ptr<Vec3c[]> ldr(new Vec3c[res.product()]);
+        for (uint32 i = 0; i < res.product(); ++i)
+            ldr[i] = Vec3c(clamp(Vec3i(Tonemap::tonemap(tonemapOp, max(hdr[i], Vec3f(0.0f)))*255.0f),
+                    Vec3i(0), Vec3i(255)));
+        ImageIO::saveLdr(ldrFile, &ldr[0].x(), res.x(), res.y(), 3);
+    }
+    if (!hdrFile.empty())
+        ImageIO::saveHdr(hdrFile, hdr[0].data(), res.x(), res.y(), 3);
+}
 
+void Integrator::writeBuffers(const std::string &suffix, bool overwrite)
+{
     const RendererSettings &settings = _scene->rendererSettings();
 
+    Path ldrFile, hdrFile;
     if (!settings.outputFile().empty())
-        ImageIO::saveLdr(incrementalFilename(settings.outputFile(), suffix, overwrite),
-                &ldr[0].x(), res.x(), res.y(), 3);
+        ldrFile = incrementalFilename(settings.outputFile(), suffix, overwrite);
     if (!settings.hdrOutputFile().empty())
-        ImageIO::saveHdr(incrementalFilename(settings.hdrOutputFile(), suffix, overwrite),
-                &hdr[0].x(), res.x(), res.y(), 3);
+        hdrFile = incrementalFilename(settings.hdrOutputFile(), suffix, overwrite);
+
+    std::unique_ptr<Vec3f[]> hdr = copyLinearFrame(_scene->cam());
+    saveFrame(hdr.get(), _scene->cam().resolution(), _scene->cam().tonemapOp(), ldrFile, hdrFile);
 
     if (suffix.empty() && !settings.renderOutputs().empty())
         _scene->cam().saveOutputBuffers();
@@ -86,7 +106,45 @@ void Integrator::saveOutputs()
 
 void Integrator::saveCheckpoint()
 {
-    writeBuffers("_checkpoint", true);
+    snapshotCheckpoint(nullptr)();
+}
+
+std::function<void()> Integrator::snapshotCheckpoint(Scene *resumeScene)
+{
+    const RendererSettings &settings = _scene->rendererSettings();
+
+    // The job may run after the current directory has changed, so all paths
+    // are resolved now
+    Path ldrFile, hdrFile, resumeFile;
+    if (!settings.outputFile().empty())
+        ldrFile = incrementalFilename(settings.outputFile(), "_checkpoint", true).absolute();
+    if (!settings.hdrOutputFile().empty())
+        hdrFile = incrementalFilename(settings.hdrOutputFile(), "_checkpoint", true).absolute();
+
+    std::shared_ptr<std::stringstream> resumeData;
+    if (resumeScene) {
+        resumeFile = settings.resumeRenderFile().absolute();
+        resumeData = std::make_shared<std::stringstream>(std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+        OutputStreamHandle out = resumeData;
+        writeRenderResumeData(*resumeScene, out);
+    }
+
+    std::shared_ptr<Vec3f> hdr(copyLinearFrame(_scene->cam()).release(), std::default_delete<Vec3f[]>());
+    Vec2u res = _scene->cam().resolution();
+    Tonemap::Type tonemapOp = _scene->cam().tonemapOp();
+
+    return [=]() {
+        saveFrame(hdr.get(), res, tonemapOp, ldrFile, hdrFile);
+
+        if (resumeData) {
+            OutputStreamHandle out = FileUtils::openOutputStream(resumeFile);
+            if (!out) {
+                DBG("Failed to open render resume state at '%s'", resumeFile);
+                return;
+            }
+            *out << resumeData->rdbuf();
+        }
+    };
 }
 
 // Computes a hash of everything in the scene except the renderer settings
@@ -105,18 +163,11 @@ static uint64 sceneHash(Scene &scene)
     return BitManip::hash(buffer.GetString());
 }
 
-void Integrator::saveRenderResumeData(Scene &scene)
+void Integrator::writeRenderResumeData(Scene &scene, OutputStreamHandle &out)
 {
-    Path path = _scene->rendererSettings().resumeRenderFile();
-    OutputStreamHandle out = FileUtils::openOutputStream(path);
-    if (!out) {
-        DBG("Failed to open render resume state at '%s'", path);
-        return;
-    }
-
-    // TODO: Camera splat buffer not saved/reconstructed
     rapidjson::Document document;
     document.SetObject();
+    document.AddMember("version", ResumeDataVersion, document.GetAllocator());
     document.AddMember("current_spp", _currentSpp, document.GetAllocator());
     document.AddMember("adaptive_sampling", _scene->rendererSettings().useAdaptiveSampling(), document.GetAllocator());
     document.AddMember("stratified_sampler", _scene->rendererSettings().useSobol(), document.GetAllocator());
@@ -128,14 +179,29 @@ void Integrator::saveRenderResumeData(Scene &scene)
     saveState(out);
 }
 
+void Integrator::saveRenderResumeData(Scene &scene)
+{
+    Path path = _scene->rendererSettings().resumeRenderFile();
+    OutputStreamHandle out = FileUtils::openOutputStream(path);
+    if (!out) {
+        DBG("Failed to open render resume state at '%s'", path);
+        return;
+    }
+
+    writeRenderResumeData(scene, out);
+}
+
 bool Integrator::resumeRender(Scene &scene)
 {
-    const Path &file = _scene->rendererSettings().resumeRenderFile();
+    Path file = _scene->rendererSettings().resumeRenderFile();
     InputStreamHandle in = FileUtils::openInputStream(file);
     if (!in)
         return false;
 
     JsonDocument document(file, FileUtils::streamRead<std::string>(in));
+    uint32 version;
+    if (!document.getField("version", version) || version != ResumeDataVersion)
+        return false;
     bool adaptiveSampling, stratifiedSampler;
     if (!document.getField("adaptive_sampling", adaptiveSampling)
             || adaptiveSampling != _scene->rendererSettings().useAdaptiveSampling())
@@ -152,18 +218,36 @@ bool Integrator::resumeRender(Scene &scene)
     if (jsonHash != sceneHash(scene))
         return false;
 
-    _scene->cam().deserializeOutputBuffers(in);
-    loadState(in);
-
     _currentSpp = jsonSpp;
     advanceSpp();
 
+    _scene->cam().deserializeOutputBuffers(in);
+    loadState(in);
+
     return true;
 }
 
+void Integrator::saveThreadCount(OutputStreamHandle &out, uint32 threadCount) const
+{
+    FileUtils::streamWrite(out, threadCount);
+}
+
+void Integrator::loadThreadCount(InputStreamHandle &in, uint32 threadCount) const
+{
+    uint32 savedCount = FileUtils::streamRead<uint32>(in);
+    if (savedCount != threadCount)
+        FAIL("Render resume data was saved with %d threads, but %d threads are running. "
+             "Resume with %d threads or restart the render", savedCount, threadCount, savedCount);
+}
+
 bool Integrator::supportsResumeRender() const
 {
     return false;
 }
 
+std::vector<Integrator::StageTime> Integrator::stageTimes() const
+{
+    return std::vector<StageTime>();
+}
+
 }
@@ -7,6 +7,9 @@
 #include "IntTypes.hpp"
 
 #include <functional>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace Tungsten {
 
@@ -15,6 +18,9 @@ class Scene;
 
 class Integrator : public JsonSerializable
 {
+public:
+    typedef std::pair<std::string, double> StageTime;
+
 protected:
     const TraceableScene *_scene;
 
@@ -24,10 +30,16 @@ protected:
     void advanceSpp();
 
     void writeBuffers(const std::string &suffix, bool overwrite);
+    void writeRenderResumeData(Scene &scene, OutputStreamHandle &out);
 
     virtual void saveState(OutputStreamHandle &out) = 0;
     virtual void loadState(InputStreamHandle &in) = 0;
 
+    // Integrators with per-thread state (e.g. Markov chains) can only be
+    // resumed with the number of threads their state was saved with
+    void saveThreadCount(OutputStreamHandle &out, uint32 threadCount) const;
+    void loadThreadCount(InputStreamHandle &in, uint32 threadCount) const;
+
 public:
     Integrator();
     virtual ~Integrator();
@@ -42,10 +54,20 @@ public:
     virtual void saveOutputs();
     void saveCheckpoint();
 
+    // Copies the current frame and, if resumeScene is not null, the render
+    // resume data into memory. The returned job tonemaps, encodes and writes
+    // them to disk without touching the integrator or the scene again, so it
+    // can run on another thread while rendering continues
+    std::function<void()> snapshotCheckpoint(Scene *resumeScene);
+
     void saveRenderResumeData(Scene &scene);
     bool resumeRender(Scene &scene);
     virtual bool supportsResumeRender() const;
 
+    // Seconds spent in each stage of the render since prepareForRender, for
+    // integrators that split their segments into distinct stages
+    virtual std::vector<StageTime> stageTimes() const;
+
     bool done() const
     {
         return _currentSpp >= _nextSpp;
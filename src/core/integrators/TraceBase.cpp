@@ -8,7 +8,7 @@ TraceBase::TraceBase(TraceableScene *scene, const TraceSettings &settings, uint3
   _threadId(threadId)
 {
     _scene = scene;
-    _lightPdf.resize(scene->lights().size());
+    _lightPdf.resize(scene->unclusteredLights().size() + (scene->lightBvh() ? 1 : 0));
 
     std::vector<float> lightWeights(scene->lights().size());
     for (size_t i = 0; i < scene->lights().size(); ++i) {
@@ -162,6 +162,7 @@ Vec3f TraceBase::attenuatedEmission(PathSampleGenerator &sampler,
     }
     info.p = ray.pos() + ray.dir()*ray.farT();
     info.w = ray.dir();
+    info.footprint = info.uvScale = 0.0f;
     light.intersectionInfo(data, info);
 
     Vec3f shadow = generalizedShadowRay(sampler, ray, medium, &light, startsOnSurface, true, bounce);
@@ -244,6 +245,7 @@ bool TraceBase::surfaceLensSample(const Camera &camera,
 }
 
 Vec3f TraceBase::lightSample(const Primitive &light,
+                             float selectionPdf,
                              SurfaceScatterEvent &event,
                              const Medium *medium,
                              int bounce,
@@ -279,13 +281,60 @@ Vec3f TraceBase::lightSample(const Primitive &light,
     Vec3f lightF = f*e/sample.pdf;
 
     if (!light.isDirac())
-        lightF *= SampleWarp::powerHeuristic(sample.pdf, event.info->bsdf->pdf(event));
+        lightF *= SampleWarp::powerHeuristic(selectionPdf*sample.pdf, event.info->bsdf->pdf(event));
 
     return lightF;
 }
 
-Vec3f TraceBase::bsdfSample(const Primitive &light,
-                            SurfaceScatterEvent &event,
+// Emission picked up along a ray sampled from the BSDF or phase function at
+// a scattering vertex. This strategy does not depend on which light
+// chooseLight picked, so every light the ray reaches contributes, weighted
+// against the probability of reaching it by light selection and sampling.
+// Transparent surfaces are skipped to find lights behind them, and the
+// attenuation through them is part of the light's shadow ray
+Vec3f TraceBase::sampledEmission(PathSampleGenerator &sampler,
+                                 const Medium *medium,
+                                 int bounce,
+                                 bool startsOnSurface,
+                                 const Ray &ray,
+                                 float scatterPdf)
+{
+    auto emission = [&](const Primitive &light) {
+        Ray lightRay = ray;
+        IntersectionTemporary data;
+        IntersectionInfo info;
+        Vec3f e = attenuatedEmission(sampler, light, medium, -1.0f, data, info, bounce, startsOnSurface, lightRay, nullptr);
+        if (e == 0.0f)
+            return Vec3f(0.0f);
+        float pdf = lightPdf(&light, ray.pos())*light.directPdf(_threadId, data, info, ray.pos());
+        return e*SampleWarp::powerHeuristic(scatterPdf, pdf);
+    };
+
+    Vec3f result(0.0f);
+    Ray probe = ray;
+    IntersectionTemporary data;
+    IntersectionInfo info;
+    for (int i = bounce; i < _settings.maxBounces; ++i) {
+        if (!_scene->intersect(probe, data, info)) {
+            for (const auto &light : _scene->infiniteLights())
+                if (_scene->lightIndex(light.get()) >= 0)
+                    result += emission(*light);
+            break;
+        }
+        if (_scene->lightIndex(info.primitive) >= 0)
+            result += emission(*info.primitive);
+        if (!info.bsdf->lobes().hasForward())
+            break;
+
+        probe.setPos(probe.hitpoint());
+        probe.setNearT(info.epsilon);
+        probe.setFarT(Ray::infinity());
+    }
+
+    return result;
+}
+
+Vec3f TraceBase::bsdfSample(SurfaceScatterEvent &event,
                             const Medium *medium,
                             int bounce,
                             const Ray &parentRay)
@@ -306,23 +355,13 @@ Vec3f TraceBase::bsdfSample(const Primitive &light,
     Ray ray = parentRay.scatter(event.info->p, wo, event.info->epsilon);
     ray.setPrimaryRay(false);
 
-    IntersectionTemporary data;
-    IntersectionInfo info;
-    Vec3f e = attenuatedEmission(*event.sampler, light, medium, -1.0f, data, info, bounce, true, ray, nullptr);
-
-    if (e == Vec3f(0.0f))
-        return Vec3f(0.0f);
-
-    Vec3f bsdfF = e*event.weight;
-
-    bsdfF *= SampleWarp::powerHeuristic(event.pdf, light.directPdf(_threadId, data, info, event.info->p));
-
-    return bsdfF;
+    return sampledEmission(*event.sampler, medium, bounce, true, ray, event.pdf)*event.weight;
 }
 
 Vec3f TraceBase::volumeLightSample(PathSampleGenerator &sampler,
                     MediumSample &mediumSample,
                     const Primitive &light,
+                    float selectionPdf,
                     const Medium *medium,
                     int bounce,
                     const Ray &parentRay)
@@ -347,13 +386,12 @@ Vec3f TraceBase::volumeLightSample(PathSampleGenerator &sampler,
     Vec3f lightF = f*e/lightSample.pdf;
 
     if (!light.isDirac())
-        lightF *= SampleWarp::powerHeuristic(lightSample.pdf, mediumSample.phase->pdf(parentRay.dir(), lightSample.d));
+        lightF *= SampleWarp::powerHeuristic(selectionPdf*lightSample.pdf, mediumSample.phase->pdf(parentRay.dir(), lightSample.d));
 
     return lightF;
 }
 
-Vec3f TraceBase::volumePhaseSample(const Primitive &light,
-                    PathSampleGenerator &sampler,
+Vec3f TraceBase::volumePhaseSample(PathSampleGenerator &sampler,
                     MediumSample &mediumSample,
                     const Medium *medium,
                     int bounce,
@@ -366,71 +404,29 @@ Vec3f TraceBase::volumePhaseSample(const Primitive &light,
     Ray ray = parentRay.scatter(mediumSample.p, phaseSample.w, 0.0f);
     ray.setPrimaryRay(false);
 
-    IntersectionTemporary data;
-    IntersectionInfo info;
-    Vec3f e = attenuatedEmission(sampler, light, medium, -1.0f, data, info, bounce, false, ray, nullptr);
-
-    if (e == Vec3f(0.0f))
-        return Vec3f(0.0f);
-
-    Vec3f phaseF = e*phaseSample.weight;
-
-    phaseF *= SampleWarp::powerHeuristic(phaseSample.pdf, light.directPdf(_threadId, data, info, mediumSample.p));
-
-    return phaseF;
-}
-
-Vec3f TraceBase::sampleDirect(const Primitive &light,
-                              SurfaceScatterEvent &event,
-                              const Medium *medium,
-                              int bounce,
-                              const Ray &parentRay,
-                              Vec3f *transmittance)
-{
-    Vec3f result(0.0f);
-
-    if (event.info->bsdf->lobes().isPureSpecular() || event.info->bsdf->lobes().isForward())
-        return Vec3f(0.0f);
-
-    result += lightSample(light, event, medium, bounce, parentRay, transmittance);
-    if (!light.isDirac())
-        result += bsdfSample(light, event, medium, bounce, parentRay);
-
-    return result;
+    return sampledEmission(sampler, medium, bounce, false, ray, phaseSample.pdf)*phaseSample.weight;
 }
 
-Vec3f TraceBase::volumeSampleDirect(const Primitive &light,
-                    PathSampleGenerator &sampler,
-                    MediumSample &mediumSample,
-                    const Medium *medium,
-                    int bounce,
-                    const Ray &parentRay)
+// Fills _lightPdf with the selection weights at p and returns their sum.
+// Lights with unknown radiance get the average weight of the others
+float TraceBase::computeLightWeights(const Vec3f &p)
 {
-    Vec3f result = volumeLightSample(sampler, mediumSample, light, medium, bounce, parentRay);
-    if (!light.isDirac())
-        result += volumePhaseSample(light, sampler, mediumSample, medium, bounce, parentRay);
-
-    return result;
-}
-
-const Primitive *TraceBase::chooseLight(PathSampleGenerator &sampler, const Vec3f &p, float &weight)
-{
-    if (_scene->lights().empty())
-        return nullptr;
-    if (_scene->lights().size() == 1) {
-        weight = 1.0f;
-        return _scene->lights()[0].get();
-    }
+    const std::vector<uint32> &unclustered = _scene->unclusteredLights();
 
     float total = 0.0f;
     unsigned numNonNegative = 0;
-    for (size_t i = 0; i < _lightPdf.size(); ++i) {
-        _lightPdf[i] = _scene->lights()[i]->approximateRadiance(_threadId, p);
+    for (size_t i = 0; i < unclustered.size(); ++i) {
+        _lightPdf[i] = _scene->lights()[unclustered[i]]->approximateRadiance(_threadId, p);
         if (_lightPdf[i] >= 0.0f) {
             total += _lightPdf[i];
             numNonNegative++;
         }
     }
+    if (_scene->lightBvh()) {
+        _lightPdf.back() = _scene->lightBvh()->rootImportance(p);
+        total += _lightPdf.back();
+        numNonNegative++;
+    }
     if (numNonNegative == 0) {
         for (size_t i = 0; i < _lightPdf.size(); ++i)
             _lightPdf[i] = 1.0f;
@@ -444,13 +440,38 @@ const Primitive *TraceBase::chooseLight(PathSampleGenerator &sampler, const Vec3
             }
         }
     }
+    return total;
+}
+
+const Primitive *TraceBase::chooseLight(PathSampleGenerator &sampler, const Vec3f &p, float &weight)
+{
+    if (_scene->lights().empty())
+        return nullptr;
+    if (_scene->lights().size() == 1) {
+        weight = 1.0f;
+        return _scene->lights()[0].get();
+    }
+
+    float total = computeLightWeights(p);
     if (total == 0.0f)
         return nullptr;
     float t = sampler.next1D()*total;
     for (size_t i = 0; i < _lightPdf.size(); ++i) {
         if (t < _lightPdf[i] || i == _lightPdf.size() - 1) {
+            if (_lightPdf[i] == 0.0f)
+                return nullptr;
             weight = total/_lightPdf[i];
-            return _scene->lights()[i].get();
+            if (i < _scene->unclusteredLights().size())
+                return _scene->lights()[_scene->unclusteredLights()[i]].get();
+
+            // Reuse the remainder of the sample to walk down the light BVH
+            float u = min(t/_lightPdf[i], 1.0f - 1e-7f);
+            float bvhPdf;
+            int emitter = _scene->lightBvh()->sample(p, u, bvhPdf);
+            if (emitter < 0)
+                return nullptr;
+            weight /= bvhPdf;
+            return _scene->lights()[_scene->bvhLights()[emitter]].get();
         } else {
             t -= _lightPdf[i];
         }
@@ -458,6 +479,29 @@ const Primitive *TraceBase::chooseLight(PathSampleGenerator &sampler, const Vec3
     return nullptr;
 }
 
+float TraceBase::lightPdf(const Primitive *light, const Vec3f &p)
+{
+    int index = _scene->lightIndex(light);
+    if (index < 0)
+        return 0.0f;
+    if (_scene->lights().size() == 1)
+        return 1.0f;
+
+    float total = computeLightWeights(p);
+    if (total == 0.0f)
+        return 0.0f;
+
+    int emitter = _scene->lightEmitter(index);
+    if (emitter >= 0)
+        return _lightPdf.back()/total*_scene->lightBvh()->pdf(p, emitter);
+
+    const std::vector<uint32> &unclustered = _scene->unclusteredLights();
+    for (size_t i = 0; i < unclustered.size(); ++i)
+        if (unclustered[i] == uint32(index))
+            return _lightPdf[i]/total;
+    return 0.0f;
+}
+
 const Primitive *TraceBase::chooseLightAdjoint(PathSampleGenerator &sampler, float &pdf)
 {
     float u = sampler.next1D();
@@ -473,11 +517,17 @@ Vec3f TraceBase::volumeEstimateDirect(PathSampleGenerator &sampler,
                     int bounce,
                     const Ray &parentRay)
 {
+    Vec3f result(0.0f);
+
     float weight;
     const Primitive *light = chooseLight(sampler, mediumSample.p, weight);
-    if (light == nullptr)
-        return Vec3f(0.0f);
-    return volumeSampleDirect(*light, sampler, mediumSample, medium, bounce, parentRay)*weight;
+    if (light)
+        result += volumeLightSample(sampler, mediumSample, *light, 1.0f/weight, medium, bounce, parentRay)*weight;
+    // Phase function samples can never hit a point or directional light
+    if (!light || !light->isDirac() || _scene->lights().size() > 1)
+        result += volumePhaseSample(sampler, mediumSample, medium, bounce, parentRay);
+
+    return result;
 }
 
 Vec3f TraceBase::estimateDirect(SurfaceScatterEvent &event,
@@ -486,11 +536,20 @@ Vec3f TraceBase::estimateDirect(SurfaceScatterEvent &event,
                                 const Ray &parentRay,
                                 Vec3f *transmittance)
 {
+    if (event.info->bsdf->lobes().isPureSpecular() || event.info->bsdf->lobes().isForward())
+        return Vec3f(0.0f);
+
+    Vec3f result(0.0f);
+
     float weight;
     const Primitive *light = chooseLight(*event.sampler, event.info->p, weight);
-    if (light == nullptr)
-        return Vec3f(0.0f);
-    return sampleDirect(*light, event, medium, bounce, parentRay, transmittance)*weight;
+    if (light)
+        result += lightSample(*light, 1.0f/weight, event, medium, bounce, parentRay, transmittance)*weight;
+    // BSDF samples can never hit a point or directional light
+    if (!light || !light->isDirac() || _scene->lights().size() > 1)
+        result += bsdfSample(event, medium, bounce, parentRay);
+
+    return result;
 }
 
 bool TraceBase::handleVolume(PathSampleGenerator &sampler, MediumSample &mediumSample,
@@ -37,7 +37,8 @@ protected:
     TraceSettings _settings;
     uint32 _threadId;
 
-    // For computing direct lighting probabilities
+    // For computing direct lighting probabilities. Holds one weight per
+    // light outside the light BVH, followed by the weight of the BVH itself
     std::vector<float> _lightPdf;
     // For sampling light sources in adjoint light tracing
     std::unique_ptr<Distribution1D> _lightSampler;
@@ -86,14 +87,21 @@ protected:
                     Vec2f &pixel);
 
     Vec3f lightSample(const Primitive &light,
+                      float selectionPdf,
                       SurfaceScatterEvent &event,
                       const Medium *medium,
                       int bounce,
                       const Ray &parentRay,
                       Vec3f *transmittance);
 
-    Vec3f bsdfSample(const Primitive &light,
-                     SurfaceScatterEvent &event,
+    Vec3f sampledEmission(PathSampleGenerator &sampler,
+                          const Medium *medium,
+                          int bounce,
+                          bool startsOnSurface,
+                          const Ray &ray,
+                          float scatterPdf);
+
+    Vec3f bsdfSample(SurfaceScatterEvent &event,
                      const Medium *medium,
                      int bounce,
                      const Ray &parentRay);
@@ -101,32 +109,21 @@ protected:
     Vec3f volumeLightSample(PathSampleGenerator &sampler,
                         MediumSample &mediumSample,
                         const Primitive &light,
+                        float selectionPdf,
                         const Medium *medium,
                         int bounce,
                         const Ray &parentRay);
 
-    Vec3f volumePhaseSample(const Primitive &light,
-                        PathSampleGenerator &sampler,
-                        MediumSample &mediumSample,
-                        const Medium *medium,
-                        int bounce,
-                        const Ray &parentRay);
-
-    Vec3f sampleDirect(const Primitive &light,
-                       SurfaceScatterEvent &event,
-                       const Medium *medium,
-                       int bounce,
-                       const Ray &parentRay,
-                       Vec3f *transmittance);
-
-    Vec3f volumeSampleDirect(const Primitive &light,
-                        PathSampleGenerator &sampler,
+    Vec3f volumePhaseSample(PathSampleGenerator &sampler,
                         MediumSample &mediumSample,
                         const Medium *medium,
                         int bounce,
                         const Ray &parentRay);
 
+    float computeLightWeights(const Vec3f &p);
     const Primitive *chooseLight(PathSampleGenerator &sampler, const Vec3f &p, float &weight);
+    // Probability of chooseLight selecting the given light at p
+    float lightPdf(const Primitive *light, const Vec3f &p);
     const Primitive *chooseLightAdjoint(PathSampleGenerator &sampler, float &pdf);
 
     Vec3f volumeEstimateDirect(PathSampleGenerator &sampler,
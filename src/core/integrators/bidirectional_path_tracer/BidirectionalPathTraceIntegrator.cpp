@@ -66,12 +66,16 @@ void BidirectionalPathTraceIntegrator::saveState(OutputStreamHandle &out)
 {
     for (ImageTile &i : _tiles)
         i.sampler->saveState(out);
+    if (_imagePyramid)
+        _imagePyramid->serialize(out);
 }
 
 void BidirectionalPathTraceIntegrator::loadState(InputStreamHandle &in)
 {
     for (ImageTile &i : _tiles)
         i.sampler->loadState(in);
+    if (_imagePyramid)
+        _imagePyramid->deserialize(in);
 }
 
 void BidirectionalPathTraceIntegrator::fromJson(JsonPtr value, const Scene &/*scene*/)
@@ -94,10 +98,10 @@ void BidirectionalPathTraceIntegrator::prepareForRender(TraceableScene &scene, u
     _w = scene.cam().resolution().x();
     _h = scene.cam().resolution().y();
     scene.cam().requestColorBuffer();
-    scene.cam().requestSplatBuffer();
+    scene.cam().requestSplatBuffer(scene.rendererSettings());
 
     if (_settings.imagePyramid)
-        _imagePyramid.reset(new ImagePyramid(_settings.maxBounces, _scene->cam()));
+        _imagePyramid.reset(new ImagePyramid(_settings.maxBounces, _scene->cam(), scene.rendererSettings()));
 
     for (uint32 i = 0; i < ThreadUtils::pool->threadCount(); ++i)
         _tracers.emplace_back(new BidirectionalPathTracer(&scene, _settings, i, _imagePyramid.get()));
@@ -134,6 +138,9 @@ void BidirectionalPathTraceIntegrator::startRender(std::function<void()> complet
         std::bind(&BidirectionalPathTraceIntegrator::renderTile, this, _3, _1),
         _tiles.size(),
         [&, completionCallback]() {
+            _scene->cam().flushSplatBuffer();
+            if (_imagePyramid)
+                _imagePyramid->flush();
             _currentSpp = _nextSpp;
             advanceSpp();
             completionCallback();
@@ -2,19 +2,42 @@
 
 #include "cameras/Camera.hpp"
 
+#include "renderer/RendererSettings.hpp"
+
 #include "io/ImageIO.hpp"
 
 namespace Tungsten {
 
-ImagePyramid::ImagePyramid(int maxPathLength, const Camera &camera)
+ImagePyramid::ImagePyramid(int maxPathLength, const Camera &camera, const RendererSettings &settings)
 : _camera(camera),
   _maxPathLength(min(maxPathLength, MaxLength)),
   _w(camera.resolution().x()),
   _h(camera.resolution().y()),
   _outBuffer(new Vec3c[_w*_h])
 {
-    for (int i = 0; i < pyramidCount(_maxPathLength); ++i)
+    for (int i = 0; i < pyramidCount(_maxPathLength); ++i) {
         _frames.emplace_back(_w, _h, camera.reconstructionFilter());
+        if (settings.localSplatAccumulation())
+            _frames.back().enableLocalAccumulation(settings.splatCacheTiles());
+    }
+}
+
+void ImagePyramid::flush()
+{
+    for (AtomicFramebuffer &frame : _frames)
+        frame.flush();
+}
+
+void ImagePyramid::serialize(OutputStreamHandle &out)
+{
+    for (AtomicFramebuffer &frame : _frames)
+        frame.serialize(out);
+}
+
+void ImagePyramid::deserialize(InputStreamHandle &in)
+{
+    for (AtomicFramebuffer &frame : _frames)
+        frame.deserialize(in);
 }
 
 void ImagePyramid::saveBuffers(const Path &prefix, int spp, bool uniformWeights)
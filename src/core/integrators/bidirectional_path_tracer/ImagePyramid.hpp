@@ -3,12 +3,15 @@
 
 #include "cameras/AtomicFramebuffer.hpp"
 
+#include "io/FileUtils.hpp"
+
 #include <memory>
 #include <vector>
 
 namespace Tungsten {
 
 class Camera;
+class RendererSettings;
 class Path;
 
 class ImagePyramid
@@ -32,7 +35,7 @@ class ImagePyramid
     }
 
 public:
-    ImagePyramid(int maxPathLength, const Camera &camera);
+    ImagePyramid(int maxPathLength, const Camera &camera, const RendererSettings &settings);
 
     inline void splatFiltered(int s, int t, Vec2f pixel, Vec3f w)
     {
@@ -50,6 +53,12 @@ public:
         _frames[idx].splat(pixel, w);
     }
 
+    // Merges thread-local splats of all frames, see AtomicFramebuffer::flush
+    void flush();
+
+    void serialize(OutputStreamHandle &out);
+    void deserialize(InputStreamHandle &in);
+
     void saveBuffers(const Path &prefix, int spp, bool uniformWeights);
 };
 
@@ -94,6 +94,9 @@ bool PathVertex::sampleNextVertex(const TraceableScene &scene, TraceBase &tracer
         weight = record.direction.weight;
         pdf = record.direction.pdf;
 
+        // No ray cone footprint here: Light subpaths can't carry one, and a
+        // vertex has to see the same filtered textures no matter which
+        // subpath generated it, or the MIS weights of the strategies disagree
         state.ray = Ray(record.point.p, record.direction.d);
         state.ray.setPrimaryRay(true);
         break;
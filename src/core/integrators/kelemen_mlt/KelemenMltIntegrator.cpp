@@ -20,12 +20,32 @@ KelemenMltIntegrator::KelemenMltIntegrator()
 {
 }
 
-void KelemenMltIntegrator::saveState(OutputStreamHandle &/*out*/)
+void KelemenMltIntegrator::saveState(OutputStreamHandle &out)
 {
+    FileUtils::streamWrite(out, _chainsLaunched);
+    FileUtils::streamWrite(out, _luminanceScale);
+    _sampler.saveState(out);
+
+    saveThreadCount(out, uint32(_tracers.size()));
+    for (auto &tracer : _tracers)
+        tracer->saveState(out);
+
+    if (_imagePyramid)
+        _imagePyramid->serialize(out);
 }
 
-void KelemenMltIntegrator::loadState(InputStreamHandle &/*in*/)
+void KelemenMltIntegrator::loadState(InputStreamHandle &in)
 {
+    FileUtils::streamRead(in, _chainsLaunched);
+    FileUtils::streamRead(in, _luminanceScale);
+    _sampler.loadState(in);
+
+    loadThreadCount(in, uint32(_tracers.size()));
+    for (auto &tracer : _tracers)
+        tracer->loadState(in);
+
+    if (_imagePyramid)
+        _imagePyramid->deserialize(in);
 }
 
 void KelemenMltIntegrator::fromJson(JsonPtr value, const Scene &/*scene*/)
@@ -41,6 +61,7 @@ rapidjson::Value KelemenMltIntegrator::toJson(Allocator &allocator) const
 void KelemenMltIntegrator::prepareForRender(TraceableScene &scene, uint32 seed)
 {
     _chainsLaunched = false;
+    _luminanceScale = 1.0;
     _currentSpp = 0;
     _sampler = UniformSampler(MathUtil::hash32(seed), ThreadUtils::pool->threadCount());
     _scene = &scene;
@@ -49,10 +70,10 @@ void KelemenMltIntegrator::prepareForRender(TraceableScene &scene, uint32 seed)
     _w = scene.cam().resolution().x();
     _h = scene.cam().resolution().y();
     scene.cam().requestColorBuffer();
-    scene.cam().requestSplatBuffer();
+    scene.cam().requestSplatBuffer(scene.rendererSettings());
 
     if (_settings.imagePyramid)
-        _imagePyramid.reset(new ImagePyramid(_settings.maxBounces, _scene->cam()));
+        _imagePyramid.reset(new ImagePyramid(_settings.maxBounces, _scene->cam(), scene.rendererSettings()));
 
     for (uint32 i = 0; i < ThreadUtils::pool->threadCount(); ++i)
         _tracers.emplace_back(new KelemenMltTracer(&scene, _settings, _sampler.state(), i, _imagePyramid.get()));
@@ -123,6 +144,11 @@ void KelemenMltIntegrator::selectSeedPaths()
     _pathCandidates.reset();
 }
 
+bool KelemenMltIntegrator::supportsResumeRender() const
+{
+    return true;
+}
+
 void KelemenMltIntegrator::startRender(std::function<void()> completionCallback)
 {
     if (done()) {
@@ -142,6 +168,9 @@ void KelemenMltIntegrator::startRender(std::function<void()> completionCallback)
             std::bind(&KelemenMltIntegrator::traceSamplePool, this, _1, _2, _3),
             _tracers.size(),
             [&, completionCallback]() {
+                _scene->cam().flushSplatBuffer();
+                if (_imagePyramid)
+                    _imagePyramid->flush();
                 selectSeedPaths();
                 _chainsLaunched = true;
                 completionCallback();
@@ -152,6 +181,9 @@ void KelemenMltIntegrator::startRender(std::function<void()> completionCallback)
             std::bind(&KelemenMltIntegrator::runSampleChain, this, _1, _2, _3),
             _tracers.size(),
             [&, completionCallback]() {
+                _scene->cam().flushSplatBuffer();
+                if (_imagePyramid)
+                    _imagePyramid->flush();
                 _currentSpp = _nextSpp;
                 advanceSpp();
                 completionCallback();
@@ -70,6 +70,8 @@ public:
     virtual void abortRender() override;
 
     virtual void saveOutputs() override;
+
+    virtual bool supportsResumeRender() const override;
 };
 
 }
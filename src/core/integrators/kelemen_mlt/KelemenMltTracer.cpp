@@ -145,4 +145,30 @@ void KelemenMltTracer::runSampleChain(int chainLength, float luminanceScale)
         _currentSplats->apply(*_scene->cam().splatBuffer(), accumulatedWeight/_currentSplats->totalLuminance());
 }
 
+void KelemenMltTracer::saveState(OutputStreamHandle &out)
+{
+    _sampler.saveState(out);
+
+    bool chainStarted = bool(_cameraSampler);
+    FileUtils::streamWrite(out, chainStarted);
+    if (chainStarted) {
+        _cameraSampler->saveState(out);
+        _emitterSampler->saveState(out);
+        _currentSplats->saveState(out);
+    }
+}
+
+void KelemenMltTracer::loadState(InputStreamHandle &in)
+{
+    _sampler.loadState(in);
+
+    if (FileUtils::streamRead<bool>(in)) {
+        _cameraSampler .reset(new MetropolisSampler(&_sampler, _settings.maxBounces*16));
+        _emitterSampler.reset(new MetropolisSampler(&_sampler, _settings.maxBounces*16));
+        _cameraSampler->loadState(in);
+        _emitterSampler->loadState(in);
+        _currentSplats->loadState(in);
+    }
+}
+
 }
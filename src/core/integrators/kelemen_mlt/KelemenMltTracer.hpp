@@ -39,6 +39,9 @@ public:
     void startSampleChain(UniformSampler &replaySampler, float luminance);
     void runSampleChain(int chainLength, float luminanceScale);
 
+    void saveState(OutputStreamHandle &out);
+    void loadState(InputStreamHandle &in);
+
     UniformSampler &sampler()
     {
         return _sampler;
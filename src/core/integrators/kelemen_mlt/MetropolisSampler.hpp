@@ -87,11 +87,27 @@ public:
     {
     }
 
-    virtual void saveState(OutputStreamHandle &/*out*/) override
-    {
-    }
-    virtual void loadState(InputStreamHandle &/*in*/) override
-    {
+    // The helper generator is not part of the state and has to be restored
+    // separately
+    virtual void saveState(OutputStreamHandle &out) override
+    {
+        FileUtils::streamWrite(out, _sampleVector.get(), _maxSize);
+        FileUtils::streamWrite(out, _stackIdx);
+        FileUtils::streamWrite(out, _sampleStack.get(), _stackIdx);
+        FileUtils::streamWrite(out, _vectorIdx);
+        FileUtils::streamWrite(out, _currentTime);
+        FileUtils::streamWrite(out, _largeStepTime);
+        FileUtils::streamWrite(out, _largeStep);
+    }
+    virtual void loadState(InputStreamHandle &in) override
+    {
+        FileUtils::streamRead(in, _sampleVector.get(), _maxSize);
+        FileUtils::streamRead(in, _stackIdx);
+        FileUtils::streamRead(in, _sampleStack.get(), _stackIdx);
+        FileUtils::streamRead(in, _vectorIdx);
+        FileUtils::streamRead(in, _currentTime);
+        FileUtils::streamRead(in, _largeStepTime);
+        FileUtils::streamRead(in, _largeStep);
     }
 
     void setHelperGenerator(UniformSampler *generator)
@@ -7,6 +7,8 @@
 
 #include "math/Vec.hpp"
 
+#include "io/FileUtils.hpp"
+
 #include <memory>
 
 namespace Tungsten {
@@ -67,6 +69,24 @@ public:
         _totalLuminance += value.luminance();
     }
 
+    void saveState(OutputStreamHandle &out) const
+    {
+        FileUtils::streamWrite(out, _filteredSplatCount);
+        FileUtils::streamWrite(out, _splatCount);
+        FileUtils::streamWrite(out, _totalLuminance);
+        FileUtils::streamWrite(out, _filteredSplats.get(), _filteredSplatCount);
+        FileUtils::streamWrite(out, _splats.get(), _splatCount);
+    }
+
+    void loadState(InputStreamHandle &in)
+    {
+        FileUtils::streamRead(in, _filteredSplatCount);
+        FileUtils::streamRead(in, _splatCount);
+        FileUtils::streamRead(in, _totalLuminance);
+        FileUtils::streamRead(in, _filteredSplats.get(), _filteredSplatCount);
+        FileUtils::streamRead(in, _splats.get(), _splatCount);
+    }
+
     float totalLuminance() const
     {
         return _totalLuminance;
@@ -59,7 +59,7 @@ void LightTraceIntegrator::prepareForRender(TraceableScene &scene, uint32 seed)
 
     _w = scene.cam().resolution().x();
     _h = scene.cam().resolution().y();
-    scene.cam().requestSplatBuffer();
+    scene.cam().requestSplatBuffer(scene.rendererSettings());
 
     for (uint32 i = 0; i < ThreadUtils::pool->threadCount(); ++i) {
         _taskData.emplace_back(_scene->rendererSettings().useSobol() ?
@@ -93,6 +93,7 @@ void LightTraceIntegrator::startRender(std::function<void()> completionCallback)
         std::bind(&LightTraceIntegrator::traceRays, this, _1, _2, _3),
         _tracers.size(),
         [&, completionCallback]() {
+            _scene->cam().flushSplatBuffer();
             _currentSpp = _nextSpp;
             advanceSpp();
             completionCallback();
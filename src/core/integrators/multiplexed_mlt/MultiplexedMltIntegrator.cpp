@@ -17,14 +17,40 @@ MultiplexedMltIntegrator::MultiplexedMltIntegrator()
 {
 }
 
-void MultiplexedMltIntegrator::saveState(OutputStreamHandle &/*out*/)
+void MultiplexedMltIntegrator::saveState(OutputStreamHandle &out)
 {
-    FAIL("MultiplexedMltIntegrator::saveState not supported!");
+    FileUtils::streamWrite(out, _chainsLaunched);
+    FileUtils::streamWrite(out, _luminanceScale);
+    FileUtils::streamWrite(out, uint64(_numSeedPathsTraced));
+    FileUtils::streamWrite(out, uint32(_luminancePerLength.size()));
+    FileUtils::streamWrite(out, _luminancePerLength.data(), _luminancePerLength.size());
+    _sampler.saveState(out);
+
+    saveThreadCount(out, uint32(_tracers.size()));
+    for (auto &tracer : _tracers)
+        tracer->saveState(out);
+
+    if (_imagePyramid)
+        _imagePyramid->serialize(out);
 }
 
-void MultiplexedMltIntegrator::loadState(InputStreamHandle &/*in*/)
+void MultiplexedMltIntegrator::loadState(InputStreamHandle &in)
 {
-    FAIL("MultiplexedMltIntegrator::loadState not supported!");
+    FileUtils::streamRead(in, _chainsLaunched);
+    FileUtils::streamRead(in, _luminanceScale);
+    _numSeedPathsTraced = FileUtils::streamRead<uint64>(in);
+    _luminancePerLength.resize(FileUtils::streamRead<uint32>(in));
+    FileUtils::streamRead(in, _luminancePerLength.data(), _luminancePerLength.size());
+    _sampler.loadState(in);
+
+    loadThreadCount(in, uint32(_tracers.size()));
+    for (auto &tracer : _tracers)
+        tracer->loadState(in);
+
+    if (_imagePyramid)
+        _imagePyramid->deserialize(in);
+
+    setBufferWeights();
 }
 
 void MultiplexedMltIntegrator::traceSamplePool(uint32 taskId, uint32 numSubTasks, uint32 /*threadId*/)
@@ -185,6 +211,7 @@ void MultiplexedMltIntegrator::saveOutputs()
 void MultiplexedMltIntegrator::prepareForRender(TraceableScene &scene, uint32 seed)
 {
     _chainsLaunched = false;
+    _luminanceScale = 1.0;
     _currentSpp = 0;
     _numSeedPathsTraced = 0;
     _sampler = UniformSampler(MathUtil::hash32(seed), ThreadUtils::pool->threadCount()*3);
@@ -194,14 +221,14 @@ void MultiplexedMltIntegrator::prepareForRender(TraceableScene &scene, uint32 se
     _w = scene.cam().resolution().x();
     _h = scene.cam().resolution().y();
     scene.cam().requestColorBuffer();
-    scene.cam().requestSplatBuffer();
+    scene.cam().requestSplatBuffer(scene.rendererSettings());
 
     _stats.reset(new AtomicMultiplexedStats(_settings.maxBounces));
 
     _pathCandidates.reset(new PathCandidate[_settings.initialSamplePool]);
 
     if (_settings.imagePyramid)
-        _imagePyramid.reset(new ImagePyramid(_settings.maxBounces, _scene->cam()));
+        _imagePyramid.reset(new ImagePyramid(_settings.maxBounces, _scene->cam(), scene.rendererSettings()));
 
     for (uint32 i = 0; i < ThreadUtils::pool->threadCount(); ++i) {
         _tracers.emplace_back(new MultiplexedMltTracer(&scene, _settings, i, _sampler, _imagePyramid.get()));
@@ -241,6 +268,11 @@ void MultiplexedMltIntegrator::teardownAfterRender()
     _imagePyramid.reset();
 }
 
+bool MultiplexedMltIntegrator::supportsResumeRender() const
+{
+    return true;
+}
+
 void MultiplexedMltIntegrator::startRender(std::function<void()> completionCallback)
 {
     if (_chainsLaunched && done()) {
@@ -256,6 +288,9 @@ void MultiplexedMltIntegrator::startRender(std::function<void()> completionCallb
             std::bind(&MultiplexedMltIntegrator::traceSamplePool, this, _1, _2, _3),
             _tracers.size(),
             [&, completionCallback]() {
+                _scene->cam().flushSplatBuffer();
+                if (_imagePyramid)
+                    _imagePyramid->flush();
                 selectSeedPaths();
                 computeNormalizationFactor();
                 advanceSpp();
@@ -269,6 +304,9 @@ void MultiplexedMltIntegrator::startRender(std::function<void()> completionCallb
             std::bind(&MultiplexedMltIntegrator::runSampleChain, this, _1, _2, _3),
             _tracers.size(),
             [&, completionCallback]() {
+                _scene->cam().flushSplatBuffer();
+                if (_imagePyramid)
+                    _imagePyramid->flush();
                 _currentSpp = _nextSpp;
                 computeNormalizationFactor();
                 advanceSpp();
@@ -17,6 +17,17 @@ MultiplexedMltTracer::MultiplexedMltTracer(TraceableScene *scene, const Multiple
 {
 }
 
+void MultiplexedMltTracer::allocateChain(int length, UniformSampler &cameraHelper, UniformSampler &emitterHelper)
+{
+    MarkovChain &chain = _chains[length];
+    chain.currentSplats.reset(new SplatQueue(1));
+    chain.proposedSplats.reset(new SplatQueue(1));
+    chain.cameraPath.reset(new LightPath(length + 1));
+    chain.emitterPath.reset(new LightPath(length));
+    chain.cameraSampler .reset(new MetropolisSampler( &cameraHelper, (length + 1)*16));
+    chain.emitterSampler.reset(new MetropolisSampler(&emitterHelper, (length + 1)*16));
+}
+
 void MultiplexedMltTracer::tracePaths(LightPath & cameraPath, PathSampleGenerator & cameraSampler,
                                       LightPath &emitterPath, PathSampleGenerator &emitterSampler,
                                       int s, int t)
@@ -119,13 +130,9 @@ void MultiplexedMltTracer::startSampleChain(int s, int t, float luminance, Unifo
 {
     int length = s + t - 1;
 
+    allocateChain(length, cameraReplaySampler, emitterReplaySampler);
+
     MarkovChain &chain = _chains[length];
-    chain.currentSplats.reset(new SplatQueue(1));
-    chain.proposedSplats.reset(new SplatQueue(1));
-    chain.cameraPath.reset(new LightPath(length + 1));
-    chain.emitterPath.reset(new LightPath(length));
-    chain.cameraSampler .reset(new MetropolisSampler( &cameraReplaySampler, (length + 1)*16));
-    chain.emitterSampler.reset(new MetropolisSampler(&emitterReplaySampler, (length + 1)*16));
     chain.currentS = s;
 
     chain.emitterSampler->setRandomElement(0, (s + 0.5f)/(length + 1.0f));
@@ -221,4 +228,42 @@ LargeStepTracker MultiplexedMltTracer::runSampleChain(int pathLength, int chainL
     return largeSteps;
 }
 
+void MultiplexedMltTracer::saveState(OutputStreamHandle &out)
+{
+    _sampler.saveState(out);
+    _cameraSampler.saveState(out);
+    _emitterSampler.saveState(out);
+
+    for (int length = 0; length <= _settings.maxBounces; ++length) {
+        const MarkovChain &chain = _chains[length];
+        bool chainStarted = bool(chain.cameraSampler);
+        FileUtils::streamWrite(out, chainStarted);
+        if (chainStarted) {
+            chain.cameraSampler->saveState(out);
+            chain.emitterSampler->saveState(out);
+            chain.currentSplats->saveState(out);
+            FileUtils::streamWrite(out, chain.currentS);
+        }
+    }
+}
+
+void MultiplexedMltTracer::loadState(InputStreamHandle &in)
+{
+    _sampler.loadState(in);
+    _cameraSampler.loadState(in);
+    _emitterSampler.loadState(in);
+
+    for (int length = 0; length <= _settings.maxBounces; ++length) {
+        if (!FileUtils::streamRead<bool>(in))
+            continue;
+
+        allocateChain(length, _sampler, _sampler);
+        MarkovChain &chain = _chains[length];
+        chain.cameraSampler->loadState(in);
+        chain.emitterSampler->loadState(in);
+        chain.currentSplats->loadState(in);
+        FileUtils::streamRead(in, chain.currentS);
+    }
+}
+
 }
@@ -42,6 +42,8 @@ private:
 
     ImagePyramid *_pyramid;
 
+    void allocateChain(int length, UniformSampler &cameraHelper, UniformSampler &emitterHelper);
+
     void tracePaths(LightPath & cameraPath, PathSampleGenerator & cameraSampler,
                     LightPath &emitterPath, PathSampleGenerator &emitterSampler,
                     int s = -1, int t = -1);
@@ -60,6 +62,9 @@ public:
             UniformSampler &emitterReplaySampler);
     LargeStepTracker runSampleChain(int pathLength, int chainLength, MultiplexedStats &stats, float luminanceScale);
 
+    void saveState(OutputStreamHandle &out);
+    void loadState(InputStreamHandle &in);
+
     UniformPathSampler &cameraSampler()
     {
         return _cameraSampler;
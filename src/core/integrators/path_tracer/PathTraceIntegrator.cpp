@@ -8,6 +8,12 @@
 #include "thread/ThreadUtils.hpp"
 #include "thread/ThreadPool.hpp"
 
+#include "Timer.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
 namespace Tungsten {
 
 CONSTEXPR uint32 PathTraceIntegrator::TileSize;
@@ -37,6 +43,65 @@ void PathTraceIntegrator::diceTiles() {
             );
         }
     }
+
+    uint32 tilesX = (_w + TileSize - 1) / TileSize;
+    uint32 tilesY = (_h + TileSize - 1) / TileSize;
+    uint32 curveSize = 1;
+    while (curveSize < max(tilesX, tilesY)) {
+        curveSize *= 2;
+    }
+    
+    std::vector<uint32> hilbertIndex(_tiles.size());
+    for (size_t i = 0; i < _tiles.size(); ++i) {
+        hilbertIndex[i] = MathUtil::hilbertIndex(curveSize, _tiles[i].x / TileSize, _tiles[i].y / TileSize);
+        _hilbertOrder.push_back(i);
+    }
+    std::sort(_hilbertOrder.begin(), _hilbertOrder.end(), [&](uint32 a, uint32 b) {
+        return hilbertIndex[a] < hilbertIndex[b];
+    });
+    
+    _tileOrder = _hilbertOrder;
+    _tileCost.resize(_tiles.size(), 0.0f);
+}
+
+// Tiles of the first pass are rendered in Hilbert order. Afterwards, tiles are
+// sorted by the render time they took in the previous pass, bucketed by powers
+// of two and in Hilbert order within a bucket. The sorted tiles are then dealt
+// out to the contiguous per-worker ranges of the thread pool, so that every
+// worker starts with its most expensive tiles and the pass ends on cheap ones
+void PathTraceIntegrator::scheduleTiles() {
+    bool haveCosts = false;
+    for (float cost : _tileCost) {
+        haveCosts = haveCosts || cost > 0.0f;
+    }
+    if (!haveCosts) {
+        _tileOrder = _hilbertOrder;
+        return;
+    }
+    
+    auto costBucket = [&](uint32 tile) {
+        return _tileCost[tile] > 0.0f ? std::ilogb(_tileCost[tile]) : std::numeric_limits<int>::min();
+    };
+    std::vector<uint32> sorted(_hilbertOrder);
+    std::stable_sort(sorted.begin(), sorted.end(), [&](uint32 a, uint32 b) {
+        return costBucket(a) > costBucket(b);
+    });
+    
+    uint32 numTiles = sorted.size();
+    uint32 numRanges = min(numTiles, ThreadUtils::pool->threadCount());
+    auto rangeStart = [&](uint32 range) {
+        return uint32(intLerp(0, numTiles, range, numRanges));
+    };
+    
+    std::vector<uint32> rangeFill(numRanges, 0);
+    uint32 range = 0;
+    for (uint32 tile : sorted) {
+        while (rangeFill[range] == rangeStart(range + 1) - rangeStart(range)) {
+            range = (range + 1) % numRanges;
+        }
+        _tileOrder[rangeStart(range) + rangeFill[range]++] = tile;
+        range = (range + 1) % numRanges;
+    }
 }
 
 float PathTraceIntegrator::errorPercentile95() {
@@ -138,8 +203,17 @@ bool PathTraceIntegrator::generateWork() {
     return true;
 }
 
-void PathTraceIntegrator::renderTile(uint32 id, uint32 tileId) {
+void PathTraceIntegrator::renderTile(uint32 id, uint32 taskId) {
+    Timer timer;
+    uint32 tileId = _tileOrder[taskId];
     ImageTile &tile = _tiles[tileId];
+    if (_settings.enableRayStreams) {
+        renderTileStreamed(id, tile);
+        timer.stop();
+        _tileCost[tileId] = timer.elapsed();
+        return;
+    }
+    
     for (uint32 y = 0; y < tile.h; ++y) {
         for (uint32 x = 0; x < tile.w; ++x) {
             Vec2u pixel(tile.x + x, tile.y + y);
@@ -157,6 +231,54 @@ void PathTraceIntegrator::renderTile(uint32 id, uint32 tileId) {
             }
         }
     }
+    timer.stop();
+    _tileCost[tileId] = timer.elapsed();
+}
+
+// Renders the tile one sample round at a time, tracing one sample for all
+// pixels of the tile that still need samples at once. This allows the
+// primary rays of the whole tile to be intersected as a single ray stream.
+// Shadow rays and later bounces are still traced one ray at a time, so this
+// only pays off when primary visibility against meshes dominates the render.
+// Batching shadow rays means deferring their contributions until the whole
+// bounce has been shaded, which the wavefront_path_tracer integrator does
+void PathTraceIntegrator::renderTileStreamed(uint32 id, ImageTile &tile) {
+    uint32 maxSpp = 0;
+    for (uint32 y = 0; y < tile.h; ++y) {
+        for (uint32 x = 0; x < tile.w; ++x) {
+            uint32 variancePixelIndex = (tile.x + x) / VarianceTileSize + (tile.y + y) / VarianceTileSize * _varianceW;
+            maxSpp = max(maxSpp, _samples[variancePixelIndex].nextSampleCount);
+        }
+    }
+    
+    std::vector<Vec2u> pixels;
+    std::vector<uint32> sampleIndices;
+    std::vector<Vec3f> results;
+    pixels.reserve(tile.w * tile.h);
+    sampleIndices.reserve(tile.w * tile.h);
+    results.resize(tile.w * tile.h);
+    
+    for (uint32 i = 0; i < maxSpp; ++i) {
+        pixels.clear();
+        sampleIndices.clear();
+        for (uint32 y = 0; y < tile.h; ++y) {
+            for (uint32 x = 0; x < tile.w; ++x) {
+                Vec2u pixel(tile.x + x, tile.y + y);
+                const SampleRecord &record = _samples[pixel.x() / VarianceTileSize + pixel.y() / VarianceTileSize * _varianceW];
+                if (i < record.nextSampleCount) {
+                    pixels.push_back(pixel);
+                    sampleIndices.push_back(record.sampleIndex + i);
+                }
+            }
+        }
+        
+        _tracers[id]->traceSamples(pixels.size(), pixels.data(), sampleIndices.data(), *tile.sampler, results.data());
+        
+        for (size_t j = 0; j < pixels.size(); ++j) {
+            _samples[pixels[j].x() / VarianceTileSize + pixels[j].y() / VarianceTileSize * _varianceW].addSample(results[j]);
+            _scene->cam().colorBuffer()->addSample(pixels[j], results[j]);
+        }
+    }
 }
 
 void PathTraceIntegrator::saveState(OutputStreamHandle &out) {
@@ -192,9 +314,10 @@ void PathTraceIntegrator::prepareForRender(TraceableScene &scene, uint32 seed) {
     advanceSpp();
     scene.cam().requestColorBuffer();
     
-    for (uint32 i = 0; i < ThreadUtils::pool->threadCount(); ++i) {
-        _tracers.emplace_back(new PathTracer(&scene, _settings, i));
-    }
+    _tracers.resize(ThreadUtils::pool->threadCount());
+    ThreadUtils::forEachThread([&](uint32 i) {
+        _tracers[i].reset(new PathTracer(&scene, _settings, i));
+    });
     
     _w = scene.cam().resolution().x();
     _h = scene.cam().resolution().y();
@@ -210,9 +333,15 @@ void PathTraceIntegrator::teardownAfterRender() {
     _tracers.clear();
     _samples.clear();
     _tiles.clear();
+    _hilbertOrder.clear();
+    _tileOrder.clear();
+    _tileCost.clear();
     _tracers.shrink_to_fit();
     _samples.shrink_to_fit();
     _tiles.shrink_to_fit();
+    _hilbertOrder.shrink_to_fit();
+    _tileOrder.shrink_to_fit();
+    _tileCost.shrink_to_fit();
 }
 
 bool PathTraceIntegrator::supportsResumeRender() const {
@@ -227,6 +356,8 @@ void PathTraceIntegrator::startRender(std::function<void()> completionCallback)
         return;
     }
     
+    scheduleTiles();
+    
     using namespace std::placeholders;
     _group = ThreadUtils::pool->enqueue(
         std::bind(&PathTraceIntegrator::renderTile, this, _3, _1),
@@ -42,15 +42,20 @@ class PathTraceIntegrator : public Integrator
 
     std::vector<SampleRecord> _samples;
     std::vector<ImageTile> _tiles;
+    std::vector<uint32> _hilbertOrder;
+    std::vector<uint32> _tileOrder;
+    std::vector<float> _tileCost;
 
     void diceTiles();
+    void scheduleTiles();
 
     float errorPercentile95();
     void dilateAdaptiveWeights();
     void distributeAdaptiveSamples(int spp);
     bool generateWork();
 
-    void renderTile(uint32 id, uint32 tileId);
+    void renderTile(uint32 id, uint32 taskId);
+    void renderTileStreamed(uint32 id, ImageTile &tile);
 
     virtual void saveState(OutputStreamHandle &out) override;
     virtual void loadState(InputStreamHandle &in) override;
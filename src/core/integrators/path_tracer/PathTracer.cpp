@@ -10,201 +10,265 @@ PathTracer::PathTracer(TraceableScene *scene, const PathTracerSettings &settings
       _trackOutputValues(!scene->rendererSettings().renderOutputs().empty()) {
 }
 
-Vec3f PathTracer::traceSample(Vec2u pixel, PathSampleGenerator &sampler) {
+bool PathTracer::generatePrimaryRay(Vec2u pixel, PathSampleGenerator &sampler, Ray &ray, Vec3f &throughput) {
+    PositionSample point{};
+    if (!_scene->cam().samplePosition(sampler, point)) {
+        return false;
+    }
+    DirectionSample direction{};
+    if (!_scene->cam().sampleDirection(sampler, point, pixel, direction)) {
+        return false;
+    }
     
-    // TODO: Put diagnostic colors in JSON?
-    const Vec3f nanDirColor = Vec3f(0.0f);
-    const Vec3f nanEnvDirColor = Vec3f(0.0f);
-    const Vec3f nanBsdfColor = Vec3f(0.0f);
+    throughput = point.weight * direction.weight;
+    ray = Ray(point.p, direction.d);
+    ray.setPrimaryRay(true);
+    ray.setFootprint(0.0f, _scene->cam().approximatePixelSpread());
+    return true;
+}
+
+Vec3f PathTracer::internalError(Vec2u pixel, const std::runtime_error &e) {
+    std::cout << tfm::format("Caught an internal error at pixel %s: %s", pixel, e.what()) << std::endl;
     
+    return Vec3f(0.0f);
+}
+
+Vec3f PathTracer::traceSample(Vec2u pixel, PathSampleGenerator &sampler) {
     try {
-        
-        PositionSample point{};
-        if (!_scene->cam().samplePosition(sampler, point)) {
+        Ray ray;
+        Vec3f throughput;
+        if (!generatePrimaryRay(pixel, sampler, ray, throughput)) {
             return Vec3f(0.0f);
         }
-        DirectionSample direction{};
-        if (!_scene->cam().sampleDirection(sampler, point, pixel, direction)) {
-            return Vec3f(0.0f);
-        }
-        
-        Vec3f throughput = point.weight * direction.weight;
-        Ray ray(point.p, direction.d);
-        ray.setPrimaryRay(true);
         
-        MediumSample mediumSample{};
-        SurfaceScatterEvent surfaceEvent{};
         IntersectionTemporary data{};
-        Medium::MediumState state{};
-        state.reset();
         IntersectionInfo info{};
-        Vec3f emission(0.0f);
-        const Medium *medium = _scene->cam().medium().get();
-        
-        bool recordedOutputValues = false;
-        
-        bool writtenDiffuseSpecular = false;
-        bool recordedDiffuseSpecular = false;
-        float diffuseRatio = 1.0f;
-        
-        float hitDistance = 0.0f;
-        
-        int mediumBounces = 0;
-        int bounce = 0;
         bool didHit = _scene->intersect(ray, data, info);
-        bool wasSpecular = true;
         
-        auto write_diffuse_specular = [&diffuseRatio, &emission, &writtenDiffuseSpecular, pixel, this] {
-            if (!writtenDiffuseSpecular) {
-                writtenDiffuseSpecular = true;
-                if (auto d = _scene->cam().diffuseBuffer()) { d->addSample(pixel, emission * diffuseRatio); }
-                if (auto s = _scene->cam().specularBuffer()) { s->addSample(pixel, emission * (1.0f - diffuseRatio)); }
+        return tracePath(pixel, sampler, ray, throughput, didHit, data, info);
+    } catch (std::runtime_error &e) {
+        return internalError(pixel, e);
+    }
+}
+
+void PathTracer::traceSamples(uint32 count, const Vec2u *pixels, const uint32 *sampleIndices,
+        PathSampleGenerator &sampler, Vec3f *results) {
+    const uint32 NoRay = 0xFFFFFFFFu;
+    
+    _primaryRays.resize(count);
+    _primaryThroughput.resize(count);
+    _primaryData.resize(count);
+    _primaryInfo.resize(count);
+    _primarySlot.resize(count);
+    _primaryDimension.resize(count);
+    
+    uint32 w = _scene->cam().resolution().x();
+    uint32 numRays = 0;
+    for (uint32 i = 0; i < count; ++i) {
+        sampler.startPath(pixels[i].x() + pixels[i].y() * w, sampleIndices[i]);
+        _primarySlot[i] = NoRay;
+        results[i] = Vec3f(0.0f);
+        try {
+            if (generatePrimaryRay(pixels[i], sampler, _primaryRays[numRays], _primaryThroughput[numRays])) {
+                _primaryDimension[numRays] = sampler.pathDimension();
+                _primarySlot[i] = numRays++;
             }
-        };
+        } catch (std::runtime_error &e) {
+            results[i] = internalError(pixels[i], e);
+        }
+    }
+    
+    _scene->intersect(numRays, _primaryRays.data(), _primaryData.data(), _primaryInfo.data());
+    
+    for (uint32 i = 0; i < count; ++i) {
+        uint32 slot = _primarySlot[i];
+        if (slot == NoRay)
+            continue;
         
-        while ((didHit || medium) && bounce < _settings.maxBounces) {
-            bool hitSurface = true;
-            if (medium) {
-                mediumSample.continuedWeight = throughput;
-                if (!medium->sampleDistance(sampler, ray, state, mediumSample)) {
-                    write_diffuse_specular();
-                    return emission;
-                }
-                emission += throughput * mediumSample.emission;
-                throughput *= mediumSample.weight;
-                hitSurface = mediumSample.exited;
-                if (hitSurface && !didHit) {
-                    break;
-                }
+        try {
+            // Continue the path where the camera sample left off, so that the
+            // rest of the path draws the same sample dimensions as in traceSample
+            sampler.resumePath(pixels[i].x() + pixels[i].y() * w, sampleIndices[i], _primaryDimension[slot]);
+            results[i] = tracePath(pixels[i], sampler, _primaryRays[slot], _primaryThroughput[slot],
+                                   _primaryData[slot].primitive != nullptr, _primaryData[slot], _primaryInfo[slot]);
+        } catch (std::runtime_error &e) {
+            results[i] = internalError(pixels[i], e);
+        }
+    }
+}
+
+Vec3f PathTracer::tracePath(Vec2u pixel, PathSampleGenerator &sampler, Ray ray, Vec3f throughput,
+                            bool didHit, IntersectionTemporary &data, IntersectionInfo &info) {
+    
+    // TODO: Put diagnostic colors in JSON?
+    const Vec3f nanDirColor = Vec3f(0.0f);
+    const Vec3f nanEnvDirColor = Vec3f(0.0f);
+    const Vec3f nanBsdfColor = Vec3f(0.0f);
+    
+    MediumSample mediumSample{};
+    SurfaceScatterEvent surfaceEvent{};
+    Medium::MediumState state{};
+    state.reset();
+    Vec3f emission(0.0f);
+    const Medium *medium = _scene->cam().medium().get();
+    
+    bool recordedOutputValues = false;
+    
+    bool writtenDiffuseSpecular = false;
+    bool recordedDiffuseSpecular = false;
+    float diffuseRatio = 1.0f;
+    
+    float hitDistance = 0.0f;
+    
+    int mediumBounces = 0;
+    int bounce = 0;
+    bool wasSpecular = true;
+    
+    auto write_diffuse_specular = [&diffuseRatio, &emission, &writtenDiffuseSpecular, pixel, this] {
+        if (!writtenDiffuseSpecular) {
+            writtenDiffuseSpecular = true;
+            if (auto d = _scene->cam().diffuseBuffer()) { d->addSample(pixel, emission * diffuseRatio); }
+            if (auto s = _scene->cam().specularBuffer()) { s->addSample(pixel, emission * (1.0f - diffuseRatio)); }
+        }
+    };
+    
+    while ((didHit || medium) && bounce < _settings.maxBounces) {
+        bool hitSurface = true;
+        if (medium) {
+            mediumSample.continuedWeight = throughput;
+            if (!medium->sampleDistance(sampler, ray, state, mediumSample)) {
+                write_diffuse_specular();
+                return emission;
             }
+            emission += throughput * mediumSample.emission;
+            throughput *= mediumSample.weight;
+            hitSurface = mediumSample.exited;
+            if (hitSurface && !didHit) {
+                break;
+            }
+        }
+        
+        if (hitSurface) {
+            hitDistance += ray.farT();
+            
+            if (mediumBounces == 1 && !_settings.lowOrderScattering) {
+                write_diffuse_specular();
+                return emission;
+            }
+            
+            surfaceEvent = makeLocalScatterEvent(data, info, ray, &sampler);
+            Vec3f transmittance(-1.0f);
+            bool terminate = !handleSurface(surfaceEvent, data, info, medium, bounce,
+                                            false, _settings.enableLightSampling && (mediumBounces > 0 || _settings.includeSurfaces),
+                                            ray, throughput, emission, wasSpecular, state, &transmittance);
             
-            if (hitSurface) {
-                hitDistance += ray.farT();
-                
-                if (mediumBounces == 1 && !_settings.lowOrderScattering) {
+            if (!recordedDiffuseSpecular) {
+                recordedDiffuseSpecular = true;
+                diffuseRatio = wasSpecular ? 0.0f : 1.0f;
+            }
+            
+            if (!info.bsdf->lobes().isPureDirac()) {
+                if (mediumBounces == 0 && !_settings.includeSurfaces) {
                     write_diffuse_specular();
                     return emission;
                 }
-                
-                surfaceEvent = makeLocalScatterEvent(data, info, ray, &sampler);
-                Vec3f transmittance(-1.0f);
-                bool terminate = !handleSurface(surfaceEvent, data, info, medium, bounce,
-                                                false, _settings.enableLightSampling && (mediumBounces > 0 || _settings.includeSurfaces),
-                                                ray, throughput, emission, wasSpecular, state, &transmittance);
-                
-                if (!recordedDiffuseSpecular) {
-                    recordedDiffuseSpecular = true;
-                    diffuseRatio = wasSpecular ? 0.0f : 1.0f;
+            }
+            
+            if (_trackOutputValues && !recordedOutputValues && (!wasSpecular || terminate)) {
+                if (_scene->cam().depthBuffer()) {
+                    _scene->cam().depthBuffer()->addSample(pixel, hitDistance);
                 }
-                
-                if (!info.bsdf->lobes().isPureDirac()) {
-                    if (mediumBounces == 0 && !_settings.includeSurfaces) {
-                        write_diffuse_specular();
-                        return emission;
-                    }
+                if (_scene->cam().normalBuffer()) {
+                    _scene->cam().normalBuffer()->addSample(pixel, info.Ns);
                 }
-                
-                if (_trackOutputValues && !recordedOutputValues && (!wasSpecular || terminate)) {
-                    if (_scene->cam().depthBuffer()) {
-                        _scene->cam().depthBuffer()->addSample(pixel, hitDistance);
-                    }
-                    if (_scene->cam().normalBuffer()) {
-                        _scene->cam().normalBuffer()->addSample(pixel, info.Ns);
+                if (_scene->cam().albedoBuffer()) {
+                    Vec3f albedo;
+                    if (auto bsdf = dynamic_cast<const TransparencyBsdf *>(info.bsdf)) {
+                        albedo = (*bsdf->base()->albedo())[info];
+                    } else {
+                        albedo = (*info.bsdf->albedo())[info];
                     }
-                    if (_scene->cam().albedoBuffer()) {
-                        Vec3f albedo;
-                        if (auto bsdf = dynamic_cast<const TransparencyBsdf *>(info.bsdf)) {
-                            albedo = (*bsdf->base()->albedo())[info];
-                        } else {
-                            albedo = (*info.bsdf->albedo())[info];
-                        }
-                        if (info.primitive->isEmissive()) {
-                            albedo += info.primitive->evalDirect(data, info);
-                        }
-                        _scene->cam().albedoBuffer()->addSample(pixel, albedo);
+                    if (info.primitive->isEmissive()) {
+                        albedo += info.primitive->evalDirect(data, info);
                     }
-                    if (_scene->cam().visibilityBuffer() && transmittance != -1.0f) {
-                        _scene->cam().visibilityBuffer()->addSample(pixel, transmittance.avg());
-                    }
-                    recordedOutputValues = true;
-                }
-                
-                if (terminate) {
-                    write_diffuse_specular();
-                    return emission;
+                    _scene->cam().albedoBuffer()->addSample(pixel, albedo);
                 }
-                
-            } else {
-                mediumBounces++;
-                
-                if (!handleVolume(sampler, mediumSample, medium, bounce, false,
-                                  _settings.enableVolumeLightSampling && (mediumBounces > 1 || _settings.lowOrderScattering), ray, throughput, emission, wasSpecular)) {
-                    write_diffuse_specular();
-                    return emission;
+                if (_scene->cam().visibilityBuffer() && transmittance != -1.0f) {
+                    _scene->cam().visibilityBuffer()->addSample(pixel, transmittance.avg());
                 }
+                recordedOutputValues = true;
             }
             
-            if (throughput.max() == 0.0f) {
-                break;
+            if (terminate) {
+                write_diffuse_specular();
+                return emission;
             }
             
-            float roulettePdf = std::abs(throughput).max();
-            if (bounce > 2 && roulettePdf < 0.1f) {
-                if (sampler.nextBoolean(roulettePdf)) {
-                    throughput /= roulettePdf;
-                } else {
-                    write_diffuse_specular();
-                    return emission;
-                }
-            }
+        } else {
+            mediumBounces++;
             
-            if (std::isnan(ray.dir().sum() + ray.pos().sum())) {
-                emission = nanDirColor;
+            if (!handleVolume(sampler, mediumSample, medium, bounce, false,
+                              _settings.enableVolumeLightSampling && (mediumBounces > 1 || _settings.lowOrderScattering), ray, throughput, emission, wasSpecular)) {
                 write_diffuse_specular();
-                return nanDirColor;
+                return emission;
             }
-            if (std::isnan(throughput.sum() + emission.sum())) {
-                emission = nanBsdfColor;
+        }
+        
+        if (throughput.max() == 0.0f) {
+            break;
+        }
+        
+        float roulettePdf = std::abs(throughput).max();
+        if (bounce > 2 && roulettePdf < 0.1f) {
+            if (sampler.nextBoolean(roulettePdf)) {
+                throughput /= roulettePdf;
+            } else {
                 write_diffuse_specular();
-                return nanBsdfColor;
-            }
-            
-            bounce++;
-            if (bounce < _settings.maxBounces) {
-                didHit = _scene->intersect(ray, data, info);
+                return emission;
             }
         }
         
-        if (bounce >= _settings.minBounces && bounce < _settings.maxBounces) {
-            handleInfiniteLights(data, info, _settings.enableLightSampling, ray, throughput, wasSpecular, emission);
+        if (std::isnan(ray.dir().sum() + ray.pos().sum())) {
+            emission = nanDirColor;
+            write_diffuse_specular();
+            return nanDirColor;
         }
-        
         if (std::isnan(throughput.sum() + emission.sum())) {
-            emission = nanEnvDirColor;
+            emission = nanBsdfColor;
             write_diffuse_specular();
-            return nanEnvDirColor;
+            return nanBsdfColor;
         }
         
-        if (_trackOutputValues && !recordedOutputValues) {
-            if (_scene->cam().depthBuffer() && bounce == 0) {
-                _scene->cam().depthBuffer()->addSample(pixel, 0.0f);
-            }
-            if (_scene->cam().normalBuffer()) {
-                _scene->cam().normalBuffer()->addSample(pixel, -ray.dir());
-            }
-            if (_scene->cam().albedoBuffer() && info.primitive && info.primitive->isInfinite()) {
-                _scene->cam().albedoBuffer()->addSample(pixel, info.primitive->evalDirect(data, info));
-            }
+        bounce++;
+        if (bounce < _settings.maxBounces) {
+            didHit = _scene->intersect(ray, data, info);
         }
-        
+    }
+    
+    if (bounce >= _settings.minBounces && bounce < _settings.maxBounces) {
+        handleInfiniteLights(data, info, _settings.enableLightSampling, ray, throughput, wasSpecular, emission);
+    }
+    
+    if (std::isnan(throughput.sum() + emission.sum())) {
+        emission = nanEnvDirColor;
         write_diffuse_specular();
-        return emission;
-        
-    } catch (std::runtime_error &e) {
-        std::cout << tfm::format("Caught an internal error at pixel %s: %s", pixel, e.what()) << std::endl;
-        
-        return Vec3f(0.0f);
+        return nanEnvDirColor;
     }
+    
+    if (_trackOutputValues && !recordedOutputValues) {
+        if (_scene->cam().depthBuffer() && bounce == 0) {
+            _scene->cam().depthBuffer()->addSample(pixel, 0.0f);
+        }
+        if (_scene->cam().normalBuffer()) {
+            _scene->cam().normalBuffer()->addSample(pixel, -ray.dir());
+        }
+        if (_scene->cam().albedoBuffer() && info.primitive && info.primitive->isInfinite()) {
+            _scene->cam().albedoBuffer()->addSample(pixel, info.primitive->evalDirect(data, info));
+        }
+    }
+    
+    write_diffuse_specular();
+    return emission;
 }
 
 }
@@ -12,10 +12,27 @@ class PathTracer : public TraceBase
     PathTracerSettings _settings;
     bool _trackOutputValues;
 
+    std::vector<Ray> _primaryRays;
+    std::vector<Vec3f> _primaryThroughput;
+    std::vector<IntersectionTemporary> _primaryData;
+    std::vector<IntersectionInfo> _primaryInfo;
+    std::vector<uint32> _primarySlot;
+    std::vector<uint32> _primaryDimension;
+
+    bool generatePrimaryRay(Vec2u pixel, PathSampleGenerator &sampler, Ray &ray, Vec3f &throughput);
+    Vec3f tracePath(Vec2u pixel, PathSampleGenerator &sampler, Ray ray, Vec3f throughput,
+            bool didHit, IntersectionTemporary &data, IntersectionInfo &info);
+    Vec3f internalError(Vec2u pixel, const std::runtime_error &e);
+
 public:
     PathTracer(TraceableScene *scene, const PathTracerSettings &settings, uint32 threadId);
 
     Vec3f traceSample(Vec2u pixel, PathSampleGenerator &sampler);
+    // Traces one sample for each of the given pixels, starting the paths
+    // with the sampler itself. The primary rays of all samples are
+    // intersected together through the ray stream interface of the scene
+    void traceSamples(uint32 count, const Vec2u *pixels, const uint32 *sampleIndices,
+            PathSampleGenerator &sampler, Vec3f *results);
 };
 
 }
@@ -13,12 +13,14 @@ struct PathTracerSettings : public TraceSettings
     bool enableVolumeLightSampling;
     bool lowOrderScattering;
     bool includeSurfaces;
+    bool enableRayStreams;
 
     PathTracerSettings()
     : enableLightSampling(true),
       enableVolumeLightSampling(true),
       lowOrderScattering(true),
-      includeSurfaces(true)
+      includeSurfaces(true),
+      enableRayStreams(false)
     {
     }
 
@@ -29,6 +31,7 @@ struct PathTracerSettings : public TraceSettings
         value.getField("enable_volume_light_sampling", enableVolumeLightSampling);
         value.getField("low_order_scattering", lowOrderScattering);
         value.getField("include_surfaces", includeSurfaces);
+        value.getField("enable_ray_streams", enableRayStreams);
     }
 
     rapidjson::Value toJson(rapidjson::Document::AllocatorType &allocator) const
@@ -38,7 +41,8 @@ struct PathTracerSettings : public TraceSettings
             "enable_light_sampling", enableLightSampling,
             "enable_volume_light_sampling", enableVolumeLightSampling,
             "low_order_scattering", lowOrderScattering,
-            "include_surfaces", includeSurfaces
+            "include_surfaces", includeSurfaces,
+            "enable_ray_streams", enableRayStreams
         };
     }
 };
@@ -0,0 +1,258 @@
+#ifndef HASHGRID_HPP_
+#define HASHGRID_HPP_
+
+#include "NearestNeighbourHeap.hpp"
+
+#include "grids/GridDda.hpp"
+
+#include "math/MathUtil.hpp"
+#include "math/Box.hpp"
+#include "math/Vec.hpp"
+
+#include "thread/ThreadUtils.hpp"
+#include "thread/ThreadPool.hpp"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace Tungsten {
+
+// Uniform grid over a set of photons for queries up to a fixed radius. Cells
+// are twice as wide as the radius, so that all photons within the radius of
+// a point lie in the (at most 8) cells around it. Cells are hashed into a
+// table with roughly one bucket per photon, and the photons are reordered in
+// place so that each bucket is a contiguous range
+template<typename PhotonType>
+class HashGrid
+{
+    // Ranges with fewer photons than this are always processed serially
+    static CONSTEXPR uint32 ParallelBuildThreshold = 50000;
+
+    PhotonType *_photons;
+    uint32 _photonCount;
+    float _radius;
+    float _cellSize;
+    float _invCellSize;
+    uint32 _hashMask;
+
+    // Cells that may hold a photon or one of its neighbours, [min, max)
+    Vec3i _minCell, _maxCell;
+
+    std::vector<uint32> _bucketStart;
+
+    Vec3i cellIndex(Vec3f p) const
+    {
+        return Vec3i(std::floor(p*_invCellSize));
+    }
+
+    uint32 bucketIndex(Vec3i cell) const
+    {
+        return (uint32(cell.x())*73856093u ^ uint32(cell.y())*19349663u ^ uint32(cell.z())*83492791u) & _hashMask;
+    }
+
+    template<typename Visitor>
+    void visitBucket(uint32 bucket, Visitor visitor) const
+    {
+        for (uint32 i = _bucketStart[bucket]; i < _bucketStart[bucket + 1]; ++i)
+            visitor(_photons[i]);
+    }
+
+    // Calls visitor(photon) for all photons hashed to the cells in
+    // [minCell, maxCell], which may span at most two cells per axis.
+    // Buckets shared by several of the cells are only visited once
+    template<typename Visitor>
+    void visitCells(Vec3i minCell, Vec3i maxCell, Visitor visitor) const
+    {
+        uint32 visited[8];
+        int visitedCount = 0;
+        for (int z = minCell.z(); z <= maxCell.z(); ++z) {
+            for (int y = minCell.y(); y <= maxCell.y(); ++y) {
+                for (int x = minCell.x(); x <= maxCell.x(); ++x) {
+                    uint32 bucket = bucketIndex(Vec3i(x, y, z));
+                    bool seen = false;
+                    for (int i = 0; i < visitedCount && !seen; ++i)
+                        seen = visited[i] == bucket;
+                    if (!seen) {
+                        visited[visitedCount++] = bucket;
+                        visitBucket(bucket, visitor);
+                    }
+                }
+            }
+        }
+    }
+
+    // Calls visitor(photon) for the photons inside the cells of a slab
+    // through center, which is perpendicular to the given axis and three
+    // cells wide in the other two. Photons that are only in the same
+    // bucket because of a hash collision are skipped
+    template<typename Visitor>
+    void visitSlab(Vec3i center, int axis, Visitor visitor) const
+    {
+        int u = (axis + 1) % 3;
+        int v = (axis + 2) % 3;
+        Vec3i cell = center;
+        for (cell[v] = center[v] - 1; cell[v] <= center[v] + 1; ++cell[v]) {
+            for (cell[u] = center[u] - 1; cell[u] <= center[u] + 1; ++cell[u]) {
+                visitBucket(bucketIndex(cell), [&](const PhotonType &p) {
+                    if (cellIndex(p.pos) == cell)
+                        visitor(p);
+                });
+            }
+        }
+    }
+
+    template<typename Function>
+    void parallelRange(uint32 count, Function func) const
+    {
+        uint32 threadCount = ThreadUtils::pool ? ThreadUtils::pool->threadCount() : 1;
+        uint32 partitions = max(min(threadCount, count/ParallelBuildThreshold), 1u);
+        uint32 span = (count + partitions - 1)/partitions;
+        ThreadUtils::parallelFor(0, partitions, partitions, [&](uint32 idx) {
+            uint32 start = span*idx;
+            uint32 end = min(start + span, count);
+            func(idx, start, end);
+        });
+    }
+
+    // Parallel counting sort of the photons by bucket
+    void buildGrid()
+    {
+        uint32 tableSize = _hashMask + 1;
+
+        std::unique_ptr<uint32[]> buckets(new uint32[_photonCount]);
+        std::unique_ptr<std::atomic<uint32>[]> counts(new std::atomic<uint32>[tableSize]);
+        std::vector<Box3f> bounds(ThreadUtils::pool ? ThreadUtils::pool->threadCount() : 1);
+
+        parallelRange(tableSize, [&](uint32 /*idx*/, uint32 start, uint32 end) {
+            for (uint32 i = start; i < end; ++i)
+                counts[i].store(0, std::memory_order_relaxed);
+        });
+        parallelRange(_photonCount, [&](uint32 idx, uint32 start, uint32 end) {
+            for (uint32 i = start; i < end; ++i) {
+                bounds[idx].grow(_photons[i].pos);
+                buckets[i] = bucketIndex(cellIndex(_photons[i].pos));
+                counts[buckets[i]].fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+
+        Box3f photonBounds;
+        for (const Box3f &b : bounds)
+            photonBounds.grow(b);
+        _minCell = cellIndex(photonBounds.min()) - 1;
+        _maxCell = cellIndex(photonBounds.max()) + 2;
+
+        _bucketStart.resize(tableSize + 1);
+        uint32 offset = 0;
+        for (uint32 i = 0; i < tableSize; ++i) {
+            _bucketStart[i] = offset;
+            offset += counts[i].load(std::memory_order_relaxed);
+            counts[i].store(_bucketStart[i], std::memory_order_relaxed);
+        }
+        _bucketStart[tableSize] = offset;
+
+        std::unique_ptr<PhotonType[]> source(new PhotonType[_photonCount]);
+        parallelRange(_photonCount, [&](uint32 /*idx*/, uint32 start, uint32 end) {
+            std::copy(_photons + start, _photons + end, source.get() + start);
+        });
+        parallelRange(_photonCount, [&](uint32 /*idx*/, uint32 start, uint32 end) {
+            for (uint32 i = start; i < end; ++i)
+                _photons[counts[buckets[i]].fetch_add(1, std::memory_order_relaxed)] = source[i];
+        });
+    }
+
+public:
+    HashGrid(PhotonType *photons, uint32 photonCount, float radius)
+    : _photons(photons),
+      _photonCount(photonCount),
+      _radius(radius),
+      _cellSize(2.0f*radius),
+      _invCellSize(1.0f/_cellSize),
+      _minCell(0),
+      _maxCell(0)
+    {
+        uint32 tableSize = 1;
+        while (tableSize < photonCount && tableSize < (1u << 31u))
+            tableSize *= 2;
+        _hashMask = tableSize - 1;
+
+        if (photonCount > 0)
+            buildGrid();
+    }
+
+    int nearestNeighbours(Vec3f pos, const PhotonType **result, float *distSq, const int k, float maxDist = 1e30f) const
+    {
+        if (_photonCount == 0)
+            return 0;
+
+        maxDist = min(maxDist, _radius);
+        int photonCount = 0;
+        float maxDistSq = maxDist*maxDist;
+
+        Vec3i minCell = cellIndex(pos - maxDist);
+        Vec3i maxCell = min(cellIndex(pos + maxDist), minCell + 1);
+        visitCells(minCell, maxCell, [&](const PhotonType &p) {
+            float dSq = (p.pos - pos).lengthSq();
+            if (dSq < maxDistSq)
+                maxDistSq = insertNearestNeighbour(&p, dSq, result, distSq, k, photonCount, maxDistSq);
+        });
+
+        return photonCount;
+    }
+
+    // Requires the radius of every photon to be at most the grid radius
+    template<typename Traverser>
+    inline void beamQuery(Vec3f pos, Vec3f dir, float farT, Traverser traverser) const
+    {
+        if (_photonCount == 0)
+            return;
+
+        Vec3f invDir = 1.0f/dir;
+        Vec3f mins = (Vec3f(_minCell)*_cellSize - pos)*invDir;
+        Vec3f maxs = (Vec3f(_maxCell)*_cellSize - pos)*invDir;
+        float minT = max(min(mins, maxs).max(), 0.0f);
+        float maxT = min(max(mins, maxs).min(), farT);
+
+        auto visitor = [&](const PhotonType &p) {
+            Vec3f d = p.pos - pos;
+            float proj = d.dot(dir);
+            if (proj >= 0.0f && proj <= farT) {
+                float distSq = d.lengthSq() - proj*proj;
+                if (distSq <= p.radiusSq)
+                    traverser(p, proj, distSq);
+            }
+        };
+
+        // Photons that can contribute lie within one cell of a cell visited
+        // by the ray. The first cell scans its full 3x3x3 neighbourhood, and
+        // every step after that only adds the slab of cells that just came
+        // into reach. Since the traversal is monotonic along each axis, no
+        // cell is scanned more than once
+        Vec3i prevCell;
+        bool first = true;
+        GridDda::march(pos*_invCellSize, dir*_invCellSize, minT, maxT, _minCell, _maxCell,
+                [&](Vec3i cell, float /*ta*/, float /*tb*/) {
+            if (first) {
+                for (int i = -1; i <= 1; ++i)
+                    visitSlab(cell + Vec3i(i, 0, 0), 0, visitor);
+                first = false;
+            } else {
+                int axis = cell.x() != prevCell.x() ? 0 : (cell.y() != prevCell.y() ? 1 : 2);
+                Vec3i slab = cell;
+                slab[axis] += cell[axis] - prevCell[axis];
+                visitSlab(slab, axis, visitor);
+            }
+            prevCell = cell;
+            return false;
+        });
+    }
+
+    float radius() const
+    {
+        return _radius;
+    }
+};
+
+}
+
+#endif /* HASHGRID_HPP_ */
@@ -1,12 +1,13 @@
 #ifndef KDTREE_HPP_
 #define KDTREE_HPP_
 
+#include "NearestNeighbourHeap.hpp"
+
 #include "math/Box.hpp"
 #include "math/Vec.hpp"
 
 #include "thread/ThreadUtils.hpp"
 #include "thread/ThreadPool.hpp"
-#include "thread/TaskGroup.hpp"
 
 #include <algorithm>
 #include <vector>
@@ -16,34 +17,38 @@ namespace Tungsten {
 template<typename PhotonType>
 class KdTree
 {
+    // Subtrees with fewer photons than this are always built serially
+    static CONSTEXPR uint32 ParallelBuildThreshold = 50000;
+
+    struct BuildRange
+    {
+        uint32 dst, start, end;
+    };
+
     PhotonType *_nodes;
     uint32 _treeEnd;
 
-    void recursiveTreeBuild(uint32 dst, uint32 start, uint32 end)
+    // Picks the photon at dst as the splitting plane of the photons in
+    // [start, end) and partitions them into the two subtrees. Requires at
+    // least two photons in the range
+    void splitNode(uint32 dst, uint32 start, uint32 end, BuildRange &left, BuildRange &right)
     {
-        if (end == start) {
-            // Leaf node
-            _nodes[dst].setSplitInfo(0, 0, 0);
-            return;
-        } else if (end - start == 1) {
-            // Single child only. Special case
-            if (_nodes[dst].pos.x() < _nodes[start].pos.x())
-                std::swap(_nodes[dst], _nodes[start]);
-            _nodes[dst].setSplitInfo(start, 0, 1);
-            _nodes[start].setSplitInfo(0, 0, 0);
-            return;
-        }
-
         Box3f bounds(_nodes[dst].pos);
         for (uint32 i = start; i < end; ++i)
             bounds.grow(_nodes[i].pos);
         uint32 splitDim = bounds.diagonal().maxDim();
 
-        std::sort(_nodes + start, _nodes + end, [&](const PhotonType &a, const PhotonType &b) {
+        auto compare = [&](const PhotonType &a, const PhotonType &b) {
             return a.pos[splitDim] < b.pos[splitDim];
-        });
+        };
 
+        // Median selection in linear time. Afterwards, splitIdx holds the
+        // smallest photon of the right half, and we move the largest photon
+        // of the left half next to it
         uint32 splitIdx = start + (end - start + 1)/2;
+        std::nth_element(_nodes + start, _nodes + splitIdx, _nodes + end, compare);
+        std::swap(_nodes[splitIdx - 1], *std::max_element(_nodes + start, _nodes + splitIdx, compare));
+
         float rightPlane = _nodes[splitIdx].pos[splitDim];
         float  headPlane = _nodes[dst].pos[splitDim];
         float  leftPlane = _nodes[splitIdx - 1].pos[splitDim];
@@ -57,20 +62,52 @@ class KdTree
         if (splitIdx > childIdx + 1)
             std::swap(_nodes[childIdx + 1], _nodes[splitIdx]);
 
-        std::shared_ptr<TaskGroup> group;
-        if (splitIdx - start > 100000) {
-            group = ThreadUtils::pool->enqueue([&](uint32, uint32, uint32) {
-                recursiveTreeBuild(childIdx + 0, start + 2, splitIdx + 1);
-            }, 1, [](){});
-        } else {
-            recursiveTreeBuild(childIdx + 0, start + 2, splitIdx + 1);
+        _nodes[dst].setSplitInfo(childIdx, splitDim, 2);
+
+        left  = BuildRange{childIdx + 0, start + 2, splitIdx + 1};
+        right = BuildRange{childIdx + 1, splitIdx + 1, end};
+    }
+
+    void recursiveTreeBuild(uint32 dst, uint32 start, uint32 end)
+    {
+        if (end == start) {
+            // Leaf node
+            _nodes[dst].setSplitInfo(0, 0, 0);
+            return;
+        } else if (end - start == 1) {
+            // Single child only. Special case
+            if (_nodes[dst].pos.x() < _nodes[start].pos.x())
+                std::swap(_nodes[dst], _nodes[start]);
+            _nodes[dst].setSplitInfo(start, 0, 1);
+            _nodes[start].setSplitInfo(0, 0, 0);
+            return;
         }
-        recursiveTreeBuild(childIdx + 1, splitIdx + 1, end);
 
-        if (group && !group->isDone())
-            ThreadUtils::pool->yield(*group);
+        BuildRange left, right;
+        splitNode(dst, start, end, left, right);
+        recursiveTreeBuild(left.dst, left.start, left.end);
+        recursiveTreeBuild(right.dst, right.start, right.end);
+    }
 
-        _nodes[dst].setSplitInfo(childIdx, splitDim, 2);
+    // The upper levels of the tree are split breadth first, with all nodes
+    // of a level processed in parallel, until there are enough independent
+    // subtrees to keep every thread busy. These are then built in parallel
+    void buildTree(uint32 rangeEnd)
+    {
+        uint32 threadCount = ThreadUtils::pool ? ThreadUtils::pool->threadCount() : 1;
+
+        std::vector<BuildRange> level(1, BuildRange{0, 1, rangeEnd});
+        while (threadCount > 1 && level.size() < 2*threadCount && rangeEnd/level.size() > ParallelBuildThreshold) {
+            std::vector<BuildRange> nextLevel(level.size()*2);
+            ThreadUtils::parallelFor(0, level.size(), level.size(), [&](uint32 i) {
+                splitNode(level[i].dst, level[i].start, level[i].end, nextLevel[2*i], nextLevel[2*i + 1]);
+            });
+            level = std::move(nextLevel);
+        }
+
+        ThreadUtils::parallelFor(0, level.size(), min(uint32(level.size()), threadCount), [&](uint32 i) {
+            recursiveTreeBuild(level[i].dst, level[i].start, level[i].end);
+        });
     }
 
     void buildVolumeHierarchy(uint32 root)
@@ -96,11 +133,11 @@ class KdTree
 
 public:
     KdTree(PhotonType *elements, uint32 rangeEnd)
-    : _nodes(elements)
+    : _nodes(elements),
+      _treeEnd(rangeEnd)
     {
         if (rangeEnd > 0)
-            recursiveTreeBuild(0, 1, rangeEnd);
-        _treeEnd = rangeEnd;
+            buildTree(rangeEnd);
     }
 
     void buildVolumeHierarchy(bool fixedRadius, float radiusScale)
@@ -189,52 +226,8 @@ public:
         const PhotonType *current = &_nodes[0];
         while (true) {
             float dSq = (current->pos - pos).lengthSq();
-            if (dSq < maxDistSq) {
-                if (photonCount < k) {
-                    result[photonCount] = current;
-                    distSq[photonCount] = dSq;
-                    photonCount++;
-
-                    if (photonCount == k) {
-                        // Build max heap
-                        const int halfK = k/2;
-                        for (int i = halfK - 1; i >= 0; --i) {
-                            int parent = i;
-                            const PhotonType *reloc = result[i];
-                            float relocDist = distSq[i];
-                            while (parent < halfK) {
-                                int child = parent*2 + 1;
-                                if (child < k - 1 && distSq[child] < distSq[child + 1])
-                                    child++;
-                                if (relocDist >= distSq[child])
-                                    break;
-                                result[parent] = result[child];
-                                distSq[parent] = distSq[child];
-                                parent = child;
-                            }
-                            result[parent] = reloc;
-                            distSq[parent] = relocDist;
-                        }
-                        maxDistSq = distSq[0];
-                    }
-                } else {
-                    const int halfK = k/2;
-                    int parent = 0;
-                    while (parent < halfK) {
-                        int child = parent*2 + 1;
-                        if (child < k - 1 && distSq[child] < distSq[child + 1])
-                            child++;
-                        if (dSq >= distSq[child])
-                            break;
-                        result[parent] = result[child];
-                        distSq[parent] = distSq[child];
-                        parent = child;
-                    }
-                    result[parent] = current;
-                    distSq[parent] = dSq;
-                    maxDistSq = distSq[0];
-                }
-            }
+            if (dSq < maxDistSq)
+                maxDistSq = insertNearestNeighbour(current, dSq, result, distSq, k, photonCount, maxDistSq);
 
             uint32 splitDim = current->splitDim();
             float planeDist = pos[splitDim] - current->pos[splitDim];
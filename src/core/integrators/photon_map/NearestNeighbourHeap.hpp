@@ -0,0 +1,63 @@
+#ifndef NEARESTNEIGHBOURHEAP_HPP_
+#define NEARESTNEIGHBOURHEAP_HPP_
+
+namespace Tungsten {
+
+// Adds a photon to the k nearest neighbours collected in result and distSq.
+// Photons are appended until k of them have been found, after which both
+// arrays are kept as a max heap on distance. Returns the new squared search
+// radius, which is the distance to the k-th nearest photon once k are known
+template<typename PhotonType>
+inline float insertNearestNeighbour(const PhotonType *photon, float dSq, const PhotonType **result,
+        float *distSq, const int k, int &photonCount, float maxDistSq)
+{
+    if (photonCount < k) {
+        result[photonCount] = photon;
+        distSq[photonCount] = dSq;
+        photonCount++;
+
+        if (photonCount == k) {
+            // Build max heap
+            const int halfK = k/2;
+            for (int i = halfK - 1; i >= 0; --i) {
+                int parent = i;
+                const PhotonType *reloc = result[i];
+                float relocDist = distSq[i];
+                while (parent < halfK) {
+                    int child = parent*2 + 1;
+                    if (child < k - 1 && distSq[child] < distSq[child + 1])
+                        child++;
+                    if (relocDist >= distSq[child])
+                        break;
+                    result[parent] = result[child];
+                    distSq[parent] = distSq[child];
+                    parent = child;
+                }
+                result[parent] = reloc;
+                distSq[parent] = relocDist;
+            }
+            return distSq[0];
+        }
+        return maxDistSq;
+    } else {
+        const int halfK = k/2;
+        int parent = 0;
+        while (parent < halfK) {
+            int child = parent*2 + 1;
+            if (child < k - 1 && distSq[child] < distSq[child + 1])
+                child++;
+            if (dSq >= distSq[child])
+                break;
+            result[parent] = result[child];
+            distSq[parent] = distSq[child];
+            parent = child;
+        }
+        result[parent] = photon;
+        distSq[parent] = dSq;
+        return distSq[0];
+    }
+}
+
+}
+
+#endif /* NEARESTNEIGHBOURHEAP_HPP_ */
@@ -1,15 +1,18 @@
 #ifndef PHOTON_HPP_
 #define PHOTON_HPP_
 
+#include "math/Box.hpp"
 #include "math/Vec.hpp"
 
 namespace Tungsten {
 
+// Position and split data come first and share 16 bytes, so that KdTree
+// queries only touch one aligned block of every photon they visit
 struct Photon
 {
+    Vec3f pos;
     uint32 splitData;
     uint32 bounce;
-    Vec3f pos;
     Vec3f dir;
     Vec3f power;
 
@@ -11,6 +11,8 @@
 
 #include "bvh/BinaryBvh.hpp"
 
+#include "Timer.hpp"
+
 namespace Tungsten {
 
 CONSTEXPR uint32 PhotonMapIntegrator::TileSize;
@@ -43,12 +45,30 @@ void PhotonMapIntegrator::diceTiles()
     }
 }
 
-void PhotonMapIntegrator::saveState(OutputStreamHandle &/*out*/)
+void PhotonMapIntegrator::saveState(OutputStreamHandle &out)
+{
+    saveThreadCount(out, uint32(_samplers.size()));
+    for (auto &sampler : _samplers)
+        sampler->saveState(out);
+    for (ImageTile &tile : _tiles)
+        tile.sampler->saveState(out);
+}
+
+void PhotonMapIntegrator::loadState(InputStreamHandle &in)
 {
+    loadThreadCount(in, uint32(_samplers.size()));
+    for (auto &sampler : _samplers)
+        sampler->loadState(in);
+    for (ImageTile &tile : _tiles)
+        tile.sampler->loadState(in);
 }
 
-void PhotonMapIntegrator::loadState(InputStreamHandle &/*in*/)
+void PhotonMapIntegrator::resetPhotonBudgets()
 {
+    _surfaceBudget.reset(uint32(_surfacePhotons.size()));
+    _volumeBudget.reset(uint32(_volumePhotons.size()));
+    _pathBudget.reset(uint32(_pathPhotons.size()));
+    _photonPathBudget.reset(_settings.photonCount);
 }
 
 void PhotonMapIntegrator::tracePhotons(uint32 taskId, uint32 numSubTasks, uint32 threadId, uint32 sampleBase)
@@ -56,31 +76,41 @@ void PhotonMapIntegrator::tracePhotons(uint32 taskId, uint32 numSubTasks, uint32
     SubTaskData &data = _taskData[taskId];
     PathSampleGenerator &sampler = *_samplers[taskId];
 
-    uint32 photonBase    = intLerp(0, _settings.photonCount, taskId + 0, numSubTasks);
-    uint32 photonsToCast = intLerp(0, _settings.photonCount, taskId + 1, numSubTasks) - photonBase;
-
+    // Reserve a little more than an even share up front, from the thread
+    // that fills the buffers
+    auto share = [&](size_t count) { return uint32(count/numSubTasks + count/(4*numSubTasks)); };
+    data.surfaceRange.reserve(share(_surfacePhotons.size()));
+    data.volumeRange.reserve(share(_volumePhotons.size()));
+    data.pathRange.reserve(share(_pathPhotons.size()));
+
+    // Tasks keep taking batches of paths until either all photon buffers
+    // are full or the path budget is used up. No task stops early while
+    // others still have room, so the requested photon count is met exactly
+    // unless the scene deposits fewer photons than paths
     uint32 totalSurfaceCast = 0;
     uint32 totalVolumeCast = 0;
     uint32 totalPathsCast = 0;
-    for (uint32 i = 0; i < photonsToCast; ++i) {
-        sampler.startPath(0, sampleBase + photonBase + i);
-        _tracers[threadId]->tracePhotonPath(
-            data.surfaceRange,
-            data.volumeRange,
-            data.pathRange,
-            sampler
-        );
-        if (!data.surfaceRange.full())
-            totalSurfaceCast++;
-        if (!data.volumeRange.full())
-            totalVolumeCast++;
-        if (!data.pathRange.full())
-            totalPathsCast++;
-        if (data.surfaceRange.full() && data.volumeRange.full() && data.pathRange.full())
-            break;
-
-        if (_group->isAborting())
-                break;
+    uint32 pathBase, pathCount;
+    bool done = false;
+    while (!done && (pathCount = _photonPathBudget.take(PhotonPathBatchSize, pathBase)) > 0) {
+        for (uint32 i = 0; i < pathCount && !done; ++i) {
+            sampler.startPath(0, sampleBase + pathBase + i);
+            _tracers[threadId]->tracePhotonPath(
+                data.surfaceRange,
+                data.volumeRange,
+                data.pathRange,
+                sampler
+            );
+            if (!data.surfaceRange.full())
+                totalSurfaceCast++;
+            if (!data.volumeRange.full())
+                totalVolumeCast++;
+            if (!data.pathRange.full())
+                totalPathsCast++;
+
+            done = (data.surfaceRange.full() && data.volumeRange.full() && data.pathRange.full())
+                || (_group && _group->isAborting());
+        }
     }
 
     _totalTracedSurfacePaths += totalSurfaceCast;
@@ -103,8 +133,10 @@ void PhotonMapIntegrator::tracePixels(uint32 tileId, uint32 threadId, float surf
             for (int i = 0; i < spp; ++i) {
                 tile.sampler->startPath(pixelIndex, _currentSpp + i);
                 Vec3f c = _tracers[threadId]->traceSensorPath(pixel,
-                    *_surfaceTree,
+                    _surfaceTree.get(),
+                    _surfaceHashGrid.get(),
                     _volumeTree.get(),
+                    _volumeHashGrid.get(),
                     _volumeBvh.get(),
                     _volumeGrid.get(),
                     _beams.get(),
@@ -119,25 +151,41 @@ void PhotonMapIntegrator::tracePixels(uint32 tileId, uint32 threadId, float surf
                 );
                 _scene->cam().colorBuffer()->addSample(pixel, c);
             }
-            if (_group->isAborting())
+            if (_group && _group->isAborting())
                 break;
         }
     }
 }
 
 template<typename PhotonType>
-std::unique_ptr<KdTree<PhotonType>> streamCompactAndBuild(std::vector<PhotonRange<PhotonType>> ranges,
-        std::vector<PhotonType> &photons, uint32 totalTraced)
+uint32 streamCompactAndScale(const std::vector<PhotonRange<PhotonType> *> &ranges,
+        ThreadUtils::DistributedVector<PhotonType> &photons, uint32 totalTraced)
 {
-    uint32 tail = streamCompact(ranges);
+    uint32 tail = streamCompact(ranges, photons.data(), true);
 
     float scale = 1.0f/totalTraced;
     for (uint32 i = 0; i < tail; ++i)
         photons[i].power *= scale;
 
+    return tail;
+}
+
+template<typename PhotonType>
+std::unique_ptr<KdTree<PhotonType>> streamCompactAndBuild(const std::vector<PhotonRange<PhotonType> *> &ranges,
+        ThreadUtils::DistributedVector<PhotonType> &photons, uint32 totalTraced)
+{
+    uint32 tail = streamCompactAndScale(ranges, photons, totalTraced);
     return std::unique_ptr<KdTree<PhotonType>>(new KdTree<PhotonType>(&photons[0], tail));
 }
 
+template<typename PhotonType>
+std::unique_ptr<HashGrid<PhotonType>> streamCompactAndBuildGrid(const std::vector<PhotonRange<PhotonType> *> &ranges,
+        ThreadUtils::DistributedVector<PhotonType> &photons, uint32 totalTraced, float radius)
+{
+    uint32 tail = streamCompactAndScale(ranges, photons, totalTraced);
+    return std::unique_ptr<HashGrid<PhotonType>>(new HashGrid<PhotonType>(&photons[0], tail, radius));
+}
+
 static void precomputeBeam(PhotonBeam &beam, const PathPhoton &p0, const PathPhoton &p1)
 {
     beam.p0 = p0.pos;
@@ -331,25 +379,37 @@ void PhotonMapIntegrator::buildPlaneGrid(uint32 tail, float volumeRadiusScale)
     _volumeGrid.reset(new GridAccel(_scene->bounds(), _settings.gridMemBudgetKb, std::move(prims)));
 }
 
-void PhotonMapIntegrator::buildPhotonDataStructures(float volumeRadiusScale)
+void PhotonMapIntegrator::buildPhotonDataStructures(float surfaceRadiusScale, float volumeRadiusScale)
 {
-    std::vector<SurfacePhotonRange> surfaceRanges;
-    std::vector<VolumePhotonRange> volumeRanges;
-    std::vector<PathPhotonRange> pathRanges;
-    for (const SubTaskData &data : _taskData) {
-        surfaceRanges.emplace_back(data.surfaceRange);
-        volumeRanges.emplace_back(data.volumeRange);
-        pathRanges.emplace_back(data.pathRange);
+    std::vector<SurfacePhotonRange *> surfaceRanges;
+    std::vector<VolumePhotonRange *> volumeRanges;
+    std::vector<PathPhotonRange *> pathRanges;
+    for (SubTaskData &data : _taskData) {
+        surfaceRanges.emplace_back(&data.surfaceRange);
+        volumeRanges.emplace_back(&data.volumeRange);
+        pathRanges.emplace_back(&data.pathRange);
     }
 
-    _surfaceTree = streamCompactAndBuild(surfaceRanges, _surfacePhotons, _totalTracedSurfacePaths);
-
-    if (!_volumePhotons.empty()) {
+    bool useHashGrid = _settings.surfaceAccel == PhotonMapSettings::ACCEL_HASH_GRID;
+    if (useHashGrid)
+        _surfaceHashGrid = streamCompactAndBuildGrid(surfaceRanges, _surfacePhotons, _totalTracedSurfacePaths,
+                _settings.gatherRadius*surfaceRadiusScale);
+    else
+        _surfaceTree = streamCompactAndBuild(surfaceRanges, _surfacePhotons, _totalTracedSurfacePaths);
+
+    if (!_volumePhotons.empty() && useHashGrid && _settings.fixedVolumeRadius) {
+        // The grid needs an upper bound on the photon radius, so it is only
+        // used for volume photons with a fixed radius
+        float volumeRadius = _settings.volumeGatherRadius*volumeRadiusScale;
+        _volumeHashGrid = streamCompactAndBuildGrid(volumeRanges, _volumePhotons, _totalTracedVolumePaths, volumeRadius);
+        for (VolumePhoton &p : _volumePhotons)
+            p.radiusSq = volumeRadius*volumeRadius;
+    } else if (!_volumePhotons.empty()) {
         _volumeTree = streamCompactAndBuild(volumeRanges, _volumePhotons, _totalTracedVolumePaths);
         float volumeRadius = _settings.fixedVolumeRadius ? _settings.volumeGatherRadius : 1.0f;
         _volumeTree->buildVolumeHierarchy(_settings.fixedVolumeRadius, volumeRadius*volumeRadiusScale);
     } else if (!_pathPhotons.empty()) {
-        uint32 tail = streamCompact(pathRanges);
+        uint32 tail = streamCompact(pathRanges, _pathPhotons.data(), false);
         for (uint32 i = 0; i < tail; ++i)
             _pathPhotons[i].power *= (1.0/_totalTracedPaths);
 
@@ -406,6 +466,7 @@ void PhotonMapIntegrator::prepareForRender(TraceableScene &scene, uint32 seed)
 {
     _sampler = UniformSampler(MathUtil::hash32(seed));
     _currentSpp = 0;
+    _tracingTime = _buildTime = _gatherTime = 0.0;
     _totalTracedSurfacePaths = 0;
     _totalTracedVolumePaths  = 0;
     _totalTracedPaths        = 0;
@@ -413,7 +474,7 @@ void PhotonMapIntegrator::prepareForRender(TraceableScene &scene, uint32 seed)
     _scene = &scene;
     advanceSpp();
     scene.cam().requestColorBuffer();
-    scene.cam().requestSplatBuffer();
+    scene.cam().requestSplatBuffer(scene.rendererSettings());
 
     _useFrustumGrid = _settings.useFrustumGrid;
     if (_useFrustumGrid && !dynamic_cast<const PinholeCamera *>(&scene.cam())) {
@@ -422,34 +483,36 @@ void PhotonMapIntegrator::prepareForRender(TraceableScene &scene, uint32 seed)
         _useFrustumGrid = false;
     }
 
+    // Photons are deposited by whichever thread takes the next batch of
+    // paths, so their pages are spread across NUMA nodes rather than
+    // placed on the node of any one thread
     if (_settings.includeSurfaces)
-        _surfacePhotons.resize(_settings.photonCount);
+        ThreadUtils::distributedResize(_surfacePhotons, _settings.photonCount);
     if (!_scene->media().empty()) {
         if (_settings.volumePhotonType == PhotonMapSettings::VOLUME_POINTS)
-            _volumePhotons.resize(_settings.volumePhotonCount);
+            ThreadUtils::distributedResize(_volumePhotons, _settings.volumePhotonCount);
         else
-            _pathPhotons.resize(_settings.volumePhotonCount);
+            ThreadUtils::distributedResize(_pathPhotons, _settings.volumePhotonCount);
     }
 
     int numThreads = ThreadUtils::pool->threadCount();
     for (int i = 0; i < numThreads; ++i) {
-        uint32 surfaceRangeStart = intLerp(0, uint32(     _surfacePhotons.size()), i + 0, numThreads);
-        uint32 surfaceRangeEnd   = intLerp(0, uint32(     _surfacePhotons.size()), i + 1, numThreads);
-        uint32  volumeRangeStart = intLerp(0, uint32(_settings.volumePhotonCount), i + 0, numThreads);
-        uint32  volumeRangeEnd   = intLerp(0, uint32(_settings.volumePhotonCount), i + 1, numThreads);
         _taskData.emplace_back(SubTaskData{
-            SurfacePhotonRange(_surfacePhotons.empty() ? nullptr : &_surfacePhotons[0], surfaceRangeStart, surfaceRangeEnd),
-            VolumePhotonRange(  _volumePhotons.empty() ? nullptr : & _volumePhotons[0],  volumeRangeStart,  volumeRangeEnd),
-              PathPhotonRange(    _pathPhotons.empty() ? nullptr : &   _pathPhotons[0],  volumeRangeStart,  volumeRangeEnd)
+            SurfacePhotonRange(&_surfaceBudget),
+            VolumePhotonRange(&_volumeBudget),
+            PathPhotonRange(&_pathBudget)
         });
         _samplers.emplace_back(_scene->rendererSettings().useSobol() ?
             std::unique_ptr<PathSampleGenerator>(new SobolPathSampler(MathUtil::hash32(_sampler.nextI()))) :
             std::unique_ptr<PathSampleGenerator>(new UniformPathSampler(MathUtil::hash32(_sampler.nextI())))
         );
-
-        _tracers.emplace_back(new PhotonTracer(&scene, _settings, i));
     }
 
+    _tracers.resize(numThreads);
+    ThreadUtils::forEachThread([&](uint32 i) {
+        _tracers[i].reset(new PhotonTracer(&scene, _settings, i));
+    });
+
     Vec2u res = _scene->cam().resolution();
     _w = res.x();
     _h = res.y();
@@ -485,6 +548,8 @@ void PhotonMapIntegrator::teardownAfterRender()
 
     _surfaceTree.reset();
     _volumeTree.reset();
+    _surfaceHashGrid.reset();
+    _volumeHashGrid.reset();
     _volumeGrid.reset();
     _volumeBvh.reset();
 }
@@ -495,15 +560,23 @@ void PhotonMapIntegrator::renderSegment(std::function<void()> completionCallback
 
     _scene->cam().setSplatWeight(1.0/_nextSpp);
 
-    if (!_surfaceTree) {
+    Timer timer;
+    if (!_surfaceTree && !_surfaceHashGrid) {
+        resetPhotonBudgets();
         ThreadUtils::pool->yield(*ThreadUtils::pool->enqueue(
             std::bind(&PhotonMapIntegrator::tracePhotons, this, _1, _2, _3, 0),
             _tracers.size(), [](){}
         ));
+        timer.stop();
+        _tracingTime += timer.elapsed();
 
-        buildPhotonDataStructures(1.0f);
+        timer.start();
+        buildPhotonDataStructures(1.0f, 1.0f);
+        timer.stop();
+        _buildTime += timer.elapsed();
     }
 
+    timer.start();
     ThreadUtils::pool->yield(*ThreadUtils::pool->enqueue(
         std::bind(&PhotonMapIntegrator::tracePixels, this, _1, _3, _settings.gatherRadius, _settings.volumeGatherRadius),
         _tiles.size(), [](){}
@@ -520,6 +593,10 @@ void PhotonMapIntegrator::renderSegment(std::function<void()> completionCallback
             }, _tracers.size(), [](){}
         ));
     }
+    timer.stop();
+    _gatherTime += timer.elapsed();
+
+    _scene->cam().flushSplatBuffer();
 
     _currentSpp = _nextSpp;
     advanceSpp();
@@ -527,6 +604,15 @@ void PhotonMapIntegrator::renderSegment(std::function<void()> completionCallback
     completionCallback();
 }
 
+std::vector<Integrator::StageTime> PhotonMapIntegrator::stageTimes() const
+{
+    return std::vector<StageTime>{
+        StageTime("Photon tracing", _tracingTime),
+        StageTime("Photon data structure build", _buildTime),
+        StageTime("Photon gather", _gatherTime)
+    };
+}
+
 void PhotonMapIntegrator::startRender(std::function<void()> completionCallback)
 {
     if (done()) {
@@ -3,7 +3,9 @@
 
 #include "PhotonMapSettings.hpp"
 #include "PhotonTracer.hpp"
+#include "PhotonRange.hpp"
 #include "GridAccel.hpp"
+#include "HashGrid.hpp"
 #include "KdTree.hpp"
 #include "Photon.hpp"
 
@@ -12,6 +14,7 @@
 
 #include "sampling/PathSampleGenerator.hpp"
 
+#include "thread/ThreadUtils.hpp"
 #include "thread/TaskGroup.hpp"
 
 #include "math/MathUtil.hpp"
@@ -32,8 +35,11 @@ class PhotonMapIntegrator : public Integrator
 {
 protected:
     static CONSTEXPR uint32 TileSize = 16;
+    static CONSTEXPR uint32 PhotonPathBatchSize = 256;
 
-    struct SubTaskData
+    // Every thread appends to its own ranges on every deposit, so each
+    // thread's ranges get cache lines of their own
+    struct alignas(64) SubTaskData
     {
         SurfacePhotonRange surfaceRange;
         VolumePhotonRange volumeRange;
@@ -54,9 +60,14 @@ protected:
     std::atomic<uint32> _totalTracedVolumePaths;
     std::atomic<uint32> _totalTracedPaths;
 
-    std::vector<Photon> _surfacePhotons;
-    std::vector<VolumePhoton> _volumePhotons;
-    std::vector<PathPhoton> _pathPhotons;
+    PhotonBudget _surfaceBudget;
+    PhotonBudget _volumeBudget;
+    PhotonBudget _pathBudget;
+    PhotonBudget _photonPathBudget;
+
+    ThreadUtils::DistributedVector<Photon> _surfacePhotons;
+    ThreadUtils::DistributedVector<VolumePhoton> _volumePhotons;
+    ThreadUtils::DistributedVector<PathPhoton> _pathPhotons;
     std::unique_ptr<PhotonBeam[]> _beams;
     std::unique_ptr<PhotonPlane0D[]> _planes0D;
     std::unique_ptr<PhotonPlane1D[]> _planes1D;
@@ -64,6 +75,8 @@ protected:
 
     std::unique_ptr<KdTree<Photon>> _surfaceTree;
     std::unique_ptr<KdTree<VolumePhoton>> _volumeTree;
+    std::unique_ptr<HashGrid<Photon>> _surfaceHashGrid;
+    std::unique_ptr<HashGrid<VolumePhoton>> _volumeHashGrid;
     std::unique_ptr<Bvh::BinaryBvh> _volumeBvh;
     std::unique_ptr<GridAccel> _volumeGrid;
 
@@ -73,11 +86,16 @@ protected:
 
     bool _useFrustumGrid;
 
+    double _tracingTime;
+    double _buildTime;
+    double _gatherTime;
+
     void diceTiles();
 
     virtual void saveState(OutputStreamHandle &out) override;
     virtual void loadState(InputStreamHandle &in) override;
 
+    void resetPhotonBudgets();
     void tracePhotons(uint32 taskId, uint32 numSubTasks, uint32 threadId, uint32 sampleBase);
     void tracePixels(uint32 tileId, uint32 threadId, float surfaceRadius, float volumeRadius);
 
@@ -86,7 +104,7 @@ protected:
     void buildBeamGrid(uint32 tail, float volumeRadiusScale);
     void buildPlaneBvh(uint32 tail, float volumeRadiusScale);
     void buildPlaneGrid(uint32 tail, float volumeRadiusScale);
-    void buildPhotonDataStructures(float volumeRadiusScale);
+    void buildPhotonDataStructures(float surfaceRadiusScale, float volumeRadiusScale);
 
     void renderSegment(std::function<void()> completionCallback);
 
@@ -103,6 +121,8 @@ public:
     virtual void startRender(std::function<void()> completionCallback) override;
     virtual void waitForCompletion() override;
     virtual void abortRender() override;
+
+    virtual std::vector<StageTime> stageTimes() const override;
 };
 
 }
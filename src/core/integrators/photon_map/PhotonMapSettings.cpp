@@ -9,4 +9,9 @@ DEFINE_STRINGABLE_ENUM(PhotonMapSettings::VolumePhotonType, "volume_photon_type"
     {"planes_1d", PhotonMapSettings::VOLUME_PLANES_1D},
 }))
 
+DEFINE_STRINGABLE_ENUM(PhotonMapSettings::SurfaceAccel, "surface_accel", ({
+    {"kd_tree", PhotonMapSettings::ACCEL_KD_TREE},
+    {"hash_grid", PhotonMapSettings::ACCEL_HASH_GRID},
+}))
+
 }
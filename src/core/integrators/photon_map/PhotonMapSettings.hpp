@@ -21,8 +21,16 @@ struct PhotonMapSettings : public TraceSettings
         VOLUME_PLANES_1D,
     };
 
+    enum SurfaceAccelEnum
+    {
+        ACCEL_KD_TREE,
+        ACCEL_HASH_GRID,
+    };
+
     typedef StringableEnum<VolumePhotonEnum> VolumePhotonType;
     friend VolumePhotonType;
+    typedef StringableEnum<SurfaceAccelEnum> SurfaceAccel;
+    friend SurfaceAccel;
 
     uint32 photonCount;
     uint32 volumePhotonCount;
@@ -30,6 +38,7 @@ struct PhotonMapSettings : public TraceSettings
     float gatherRadius;
     float volumeGatherRadius;
     VolumePhotonType volumePhotonType;
+    SurfaceAccel surfaceAccel;
     bool includeSurfaces;
     bool lowOrderScattering;
     bool fixedVolumeRadius;
@@ -44,6 +53,7 @@ struct PhotonMapSettings : public TraceSettings
       gatherRadius(1e30f),
       volumeGatherRadius(gatherRadius),
       volumePhotonType("points"),
+      surfaceAccel("kd_tree"),
       includeSurfaces(true),
       lowOrderScattering(true),
       fixedVolumeRadius(false),
@@ -61,6 +71,8 @@ struct PhotonMapSettings : public TraceSettings
         value.getField("gather_photon_count", gatherCount);
         if (auto type = value["volume_photon_type"])
             volumePhotonType = type;
+        if (auto accel = value["surface_accel"])
+            surfaceAccel = accel;
         bool gatherRadiusSet = value.getField("gather_radius", gatherRadius);
         if (!value.getField("volume_gather_radius", volumeGatherRadius) && gatherRadiusSet)
             volumeGatherRadius = gatherRadius;
@@ -73,6 +85,8 @@ struct PhotonMapSettings : public TraceSettings
 
         if (useFrustumGrid && volumePhotonType == VOLUME_POINTS)
             value.parseError("Photon points cannot be used with a frustum aligned grid");
+        if (surfaceAccel == ACCEL_HASH_GRID && gatherRadius >= 1e30f)
+            value.parseError("The hash grid surface accelerator requires a finite gather_radius");
     }
 
     rapidjson::Value toJson(rapidjson::Document::AllocatorType &allocator) const
@@ -85,6 +99,7 @@ struct PhotonMapSettings : public TraceSettings
             "gather_radius", gatherRadius,
             "volume_gather_radius", volumeGatherRadius,
             "volume_photon_type", volumePhotonType.toString(),
+            "surface_accel", surfaceAccel.toString(),
             "low_order_scattering", lowOrderScattering,
             "include_surfaces", includeSurfaces,
             "fixed_volume_radius", fixedVolumeRadius,
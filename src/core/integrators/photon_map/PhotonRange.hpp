@@ -3,102 +3,244 @@
 
 #include "Photon.hpp"
 
+#include "thread/ThreadUtils.hpp"
+#include "thread/ThreadPool.hpp"
+
 #include "math/MathUtil.hpp"
+#include "math/Box.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <vector>
 
 namespace Tungsten {
 
+// Number of photons (or photon paths) that may still be traced, shared by
+// all tracing threads. Threads take from it in batches, so that the counter
+// is only touched once per batch. Each budget lives on its own cache line
+class alignas(64) PhotonBudget
+{
+    std::atomic<uint32> _remaining;
+    uint32 _total;
+
+public:
+    PhotonBudget()
+    : _remaining(0),
+      _total(0)
+    {
+    }
+
+    void reset(uint32 total)
+    {
+        _total = total;
+        _remaining.store(total, std::memory_order_relaxed);
+    }
+
+    // Takes up to count items out of the budget and returns how many were
+    // taken. first receives the index of the first item taken
+    uint32 take(uint32 count, uint32 &first)
+    {
+        uint32 remaining = _remaining.load(std::memory_order_relaxed);
+        while (remaining > 0) {
+            uint32 taken = min(count, remaining);
+            if (_remaining.compare_exchange_weak(remaining, remaining - taken, std::memory_order_relaxed)) {
+                first = _total - remaining;
+                return taken;
+            }
+        }
+        return 0;
+    }
+};
+
+// Photons of one type deposited by a single tracing thread. Photons are
+// appended without synchronization, and the permission to store them is
+// taken from a shared PhotonBudget in batches
 template<typename PhotonType>
 class PhotonRange
 {
-    PhotonType *_dst;
-    uint32 _start;
-    uint32 _next;
-    uint32 _end;
+    static CONSTEXPR uint32 BatchSize = 1024;
+
+    std::vector<PhotonType> _photons;
+    PhotonBudget *_budget;
+    uint32 _credit;
 
 public:
     PhotonRange()
-    : _dst(nullptr), _start(0), _next(0), _end(0)
+    : _budget(nullptr), _credit(0)
     {
     }
 
-    PhotonRange(PhotonType *dst, uint32 start, uint32 end)
-    : _dst(dst),
-      _start(start),
-      _next(start),
-      _end(end)
+    PhotonRange(PhotonBudget *budget)
+    : _budget(budget),
+      _credit(0)
     {
     }
 
     PhotonType &addPhoton()
     {
-        return _dst[_next++];
+        _credit--;
+        _photons.emplace_back();
+        return _photons.back();
     }
 
-    bool full() const
+    // Takes a new batch from the budget once the current one is used up.
+    // A range that is full stays full until the budget is reset
+    bool full()
     {
-        return _dst == nullptr || _next == _end;
+        if (_credit == 0 && _budget) {
+            uint32 first;
+            _credit = _budget->take(BatchSize, first);
+        }
+        return _credit == 0;
     }
 
-    uint32 start() const
+    PhotonType &lastPhoton()
     {
-        return _start;
+        return _photons.back();
     }
 
-    uint32 end() const
+    const PhotonType *data() const
     {
-        return _end;
+        return _photons.data();
     }
 
-    uint32 next() const
+    uint32 size() const
     {
-        return _next;
+        return uint32(_photons.size());
     }
 
-    void reset()
+    void reserve(uint32 count)
     {
-        _next = _start;
+        _photons.reserve(count);
     }
 
-    void bumpNext(int offset)
+    void reset()
     {
-        _next += offset;
+        _photons.clear();
+        _credit = 0;
     }
 
-    PhotonType *nextPtr()
+    void release()
     {
-        return _dst + _next;
+        std::vector<PhotonType>().swap(_photons);
+        _credit = 0;
     }
 };
 
-template<typename PhotonType>
-uint32 streamCompact(std::vector<PhotonRange<PhotonType>> &ranges)
+namespace PhotonRangeDetail {
+
+static CONSTEXPR uint32 ParallelThreshold = 50000;
+
+template<typename Function>
+void parallelRange(uint32 count, Function func)
+{
+    uint32 threadCount = ThreadUtils::pool ? ThreadUtils::pool->threadCount() : 1;
+    uint32 partitions = max(min(threadCount, count/ParallelThreshold), 1u);
+    uint32 span = (count + partitions - 1)/partitions;
+    ThreadUtils::parallelFor(0, partitions, partitions, [&](uint32 idx) {
+        uint32 start = span*idx;
+        uint32 end = min(start + span, count);
+        func(idx, partitions, start, end);
+    });
+}
+
+// Stable parallel LSD radix sort of the keys by the Morton code in their
+// upper 32 bits
+inline void sortMortonKeys(std::vector<uint64> &keys)
 {
-    uint32 tail = 0;
-    for (size_t i = 0; i < ranges.size(); ++i) {
-        uint32 gap = ranges[i].end() - ranges[i].next();
-
-        for (size_t t = i + 1; t < ranges.size() && gap > 0; ++t) {
-            uint32 copyCount = min(gap, ranges[t].next() - ranges[t].start());
-            if (copyCount > 0) {
-                std::memcpy(
-                    ranges[i].nextPtr(),
-                    ranges[t].nextPtr() - copyCount,
-                    copyCount*sizeof(PhotonType)
-                );
+    const uint32 RadixBits = 10;
+    const uint32 BucketCount = 1u << RadixBits;
+
+    uint32 count = uint32(keys.size());
+    uint32 threadCount = ThreadUtils::pool ? ThreadUtils::pool->threadCount() : 1;
+    std::vector<uint64> sorted(count);
+    std::vector<uint32> offsets(threadCount*BucketCount);
+    for (uint32 shift = 32; shift < 62; shift += RadixBits) {
+        uint32 partitionCount = 0;
+        parallelRange(count, [&](uint32 idx, uint32 partitions, uint32 start, uint32 end) {
+            uint32 *histogram = &offsets[idx*BucketCount];
+            std::fill(histogram, histogram + BucketCount, 0u);
+            for (uint32 i = start; i < end; ++i)
+                histogram[(keys[i] >> shift) & (BucketCount - 1)]++;
+            if (idx == 0)
+                partitionCount = partitions;
+        });
+
+        uint32 offset = 0;
+        for (uint32 bucket = 0; bucket < BucketCount; ++bucket) {
+            for (uint32 p = 0; p < partitionCount; ++p) {
+                uint32 bucketCount = offsets[p*BucketCount + bucket];
+                offsets[p*BucketCount + bucket] = offset;
+                offset += bucketCount;
             }
-            ranges[i].bumpNext( int(copyCount));
-            ranges[t].bumpNext(-int(copyCount));
-            gap -= copyCount;
         }
 
-        tail = ranges[i].next();
-        if (gap > 0)
-            break;
+        parallelRange(count, [&](uint32 idx, uint32 /*partitions*/, uint32 start, uint32 end) {
+            uint32 *offset = &offsets[idx*BucketCount];
+            for (uint32 i = start; i < end; ++i)
+                sorted[offset[(keys[i] >> shift) & (BucketCount - 1)]++] = keys[i];
+        });
+        keys.swap(sorted);
     }
+}
+
+}
+
+// Moves the photons of all ranges into dst and returns their number. The
+// ranges are emptied and their memory is released. Without spatialSort,
+// the ranges are concatenated in order, which keeps the photons of a path
+// next to each other. Otherwise, the photons are stored in Morton order of
+// their positions, so that photons that are close in space are also close
+// in memory during the acceleration structure build and the gather
+template<typename PhotonType>
+uint32 streamCompact(const std::vector<PhotonRange<PhotonType> *> &ranges, PhotonType *dst, bool spatialSort)
+{
+    std::vector<uint32> offsets(ranges.size() + 1, 0);
+    for (size_t i = 0; i < ranges.size(); ++i)
+        offsets[i + 1] = offsets[i] + ranges[i]->size();
+    uint32 count = offsets.back();
+
+    if (!spatialSort || count == 0) {
+        ThreadUtils::parallelFor(0, uint32(ranges.size()), uint32(ranges.size()), [&](uint32 i) {
+            std::copy(ranges[i]->data(), ranges[i]->data() + ranges[i]->size(), dst + offsets[i]);
+        });
+    } else {
+        std::vector<Box3f> bounds(ranges.size());
+        ThreadUtils::parallelFor(0, uint32(ranges.size()), uint32(ranges.size()), [&](uint32 i) {
+            for (uint32 j = 0; j < ranges[i]->size(); ++j)
+                bounds[i].grow(ranges[i]->data()[j].pos);
+        });
+        Box3f photonBounds;
+        for (const Box3f &b : bounds)
+            photonBounds.grow(b);
+
+        Vec3f origin = photonBounds.min();
+        Vec3f scale = 1023.0f/max(photonBounds.diagonal(), Vec3f(1e-30f));
+
+        std::vector<uint64> keys(count);
+        ThreadUtils::parallelFor(0, uint32(ranges.size()), uint32(ranges.size()), [&](uint32 i) {
+            for (uint32 j = 0; j < ranges[i]->size(); ++j) {
+                Vec3u cell = Vec3u(clamp((ranges[i]->data()[j].pos - origin)*scale, Vec3f(0.0f), Vec3f(1023.0f)));
+                uint64 code = MathUtil::mortonCode3(cell.x(), cell.y(), cell.z());
+                keys[offsets[i] + j] = (code << 32u) | (offsets[i] + j);
+            }
+        });
+
+        PhotonRangeDetail::sortMortonKeys(keys);
+
+        PhotonRangeDetail::parallelRange(count, [&](uint32 /*idx*/, uint32 /*partitions*/, uint32 start, uint32 end) {
+            for (uint32 i = start; i < end; ++i) {
+                uint32 src = uint32(keys[i]);
+                size_t range = std::upper_bound(offsets.begin(), offsets.end(), src) - offsets.begin() - 1;
+                dst[i] = ranges[range]->data()[src - offsets[range]];
+            }
+        });
+    }
+
+    for (PhotonRange<PhotonType> *range : ranges)
+        range->release();
 
-    return tail;
+    return count;
 }
 
 typedef PhotonRange<Photon> SurfacePhotonRange;
@@ -243,8 +243,8 @@ void PhotonTracer::evalPrimaryRays(const PhotonBeam *beams, const PhotonPlane0D
     }
 }
 
-Vec3f PhotonTracer::traceSensorPath(Vec2u pixel, const KdTree<Photon> &surfaceTree,
-        const KdTree<VolumePhoton> *mediumTree, const Bvh::BinaryBvh *mediumBvh, const GridAccel *mediumGrid,
+Vec3f PhotonTracer::traceSensorPath(Vec2u pixel, const KdTree<Photon> *surfaceTree, const HashGrid<Photon> *surfaceGrid,
+        const KdTree<VolumePhoton> *mediumTree, const HashGrid<VolumePhoton> *mediumHashGrid, const Bvh::BinaryBvh *mediumBvh, const GridAccel *mediumGrid,
         const PhotonBeam *beams, const PhotonPlane0D *planes0D, const PhotonPlane1D *planes1D, PathSampleGenerator &sampler,
         float gatherRadius, float volumeGatherRadius,
         PhotonMapSettings::VolumePhotonType photonType, Ray &depthRay, bool useFrustumGrid)
@@ -259,6 +259,8 @@ Vec3f PhotonTracer::traceSensorPath(Vec2u pixel, const KdTree<Photon> &surfaceTr
         return Vec3f(0.0f);
 
     Vec3f throughput = point.weight*direction.weight;
+    // Photons are deposited with unfiltered texture lookups, so sensor paths
+    // don't carry a ray cone footprint either
     Ray ray(point.p, direction.d);
     ray.setPrimaryRay(true);
 
@@ -315,7 +317,10 @@ Vec3f PhotonTracer::traceSensorPath(Vec2u pixel, const KdTree<Photon> &surfaceTr
 
 
                 if (photonType == PhotonMapSettings::VOLUME_POINTS) {
-                    mediumTree->beamQuery(ray.pos(), ray.dir(), ray.farT(), pointContribution);
+                    if (mediumHashGrid)
+                        mediumHashGrid->beamQuery(ray.pos(), ray.dir(), ray.farT(), pointContribution);
+                    else
+                        mediumTree->beamQuery(ray.pos(), ray.dir(), ray.farT(), pointContribution);
                 } else if (photonType == PhotonMapSettings::VOLUME_BEAMS) {
                     if (mediumBvh) {
                         mediumBvh->trace(ray, [&](Ray &ray, uint32 photonIndex, float /*tMin*/, const Vec3pf &bounds) {
@@ -394,8 +399,11 @@ Vec3f PhotonTracer::traceSensorPath(Vec2u pixel, const KdTree<Photon> &surfaceTr
     if (info.primitive->isEmissive() && bounce > _settings.minBounces)
         result += throughput*info.primitive->evalDirect(data, info);
 
-    int count = surfaceTree.nearestNeighbours(ray.hitpoint(), _photonQuery.get(), _distanceQuery.get(),
-            _settings.gatherCount, gatherRadius);
+    int count = surfaceGrid
+        ? surfaceGrid->nearestNeighbours(ray.hitpoint(), _photonQuery.get(), _distanceQuery.get(),
+                _settings.gatherCount, gatherRadius)
+        : surfaceTree->nearestNeighbours(ray.hitpoint(), _photonQuery.get(), _distanceQuery.get(),
+                _settings.gatherCount, gatherRadius);
     if (count == 0)
         return result;
 
@@ -480,7 +488,7 @@ void PhotonTracer::tracePhotonPath(SurfacePhotonRange &surfaceRange, VolumePhoto
             }
 
             if ((!hitSurface || tracePlanes) && !pathRange.full()) {
-                pathRange.nextPtr()[-1].sampledLength = mediumSample.continuedT;
+                pathRange.lastPhoton().sampledLength = mediumSample.continuedT;
                 PathPhoton &p = pathRange.addPhoton();
                 p.pos = mediumSample.p;
                 p.power = continuedThroughput;
@@ -504,7 +512,7 @@ void PhotonTracer::tracePhotonPath(SurfacePhotonRange &surfaceRange, VolumePhoto
                 if (!medium->sampleDistance(sampler, continuedRay, continuedState, mediumSample))
                     break;
                 if (!pathRange.full()) {
-                    pathRange.nextPtr()[-1].sampledLength = mediumSample.continuedT;
+                    pathRange.lastPhoton().sampledLength = mediumSample.continuedT;
                     PathPhoton &p = pathRange.addPhoton();
                     p.pos = mediumSample.p;
                     p.power = throughput*mediumSample.weight*phaseSample.weight;
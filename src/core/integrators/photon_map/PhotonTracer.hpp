@@ -4,6 +4,7 @@
 #include "PhotonMapSettings.hpp"
 #include "FrustumBinner.hpp"
 #include "PhotonRange.hpp"
+#include "HashGrid.hpp"
 #include "KdTree.hpp"
 #include "Photon.hpp"
 
@@ -103,8 +104,8 @@ public:
     void evalPrimaryRays(const PhotonBeam *beams, const PhotonPlane0D *planes0D, const PhotonPlane1D *planes1D,
             uint32 start, uint32 end, float radius, const Ray *depthBuffer, PathSampleGenerator &sampler, float scale);
 
-    Vec3f traceSensorPath(Vec2u pixel, const KdTree<Photon> &surfaceTree,
-            const KdTree<VolumePhoton> *mediumTree, const Bvh::BinaryBvh *mediumBvh, const GridAccel *mediumGrid,
+    Vec3f traceSensorPath(Vec2u pixel, const KdTree<Photon> *surfaceTree, const HashGrid<Photon> *surfaceGrid,
+            const KdTree<VolumePhoton> *mediumTree, const HashGrid<VolumePhoton> *mediumHashGrid, const Bvh::BinaryBvh *mediumBvh, const GridAccel *mediumGrid,
             const PhotonBeam *beams, const PhotonPlane0D *planes0D, const PhotonPlane1D *planes1D, PathSampleGenerator &sampler,
             float gatherRadius, float volumeGatherRadius,
             PhotonMapSettings::VolumePhotonType photonType, Ray &depthRay, bool useFrustumGrid);
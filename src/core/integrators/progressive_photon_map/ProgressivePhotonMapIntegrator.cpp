@@ -12,6 +12,8 @@
 
 #include "bvh/BinaryBvh.hpp"
 
+#include "Timer.hpp"
+
 namespace Tungsten {
 
 ProgressivePhotonMapIntegrator::ProgressivePhotonMapIntegrator()
@@ -19,6 +21,20 @@ ProgressivePhotonMapIntegrator::ProgressivePhotonMapIntegrator()
 {
 }
 
+// The radius schedule only depends on the iteration count, so the
+// iteration is all that needs to be saved in addition to the samplers
+void ProgressivePhotonMapIntegrator::saveState(OutputStreamHandle &out)
+{
+    PhotonMapIntegrator::saveState(out);
+    FileUtils::streamWrite(out, _iteration);
+}
+
+void ProgressivePhotonMapIntegrator::loadState(InputStreamHandle &in)
+{
+    PhotonMapIntegrator::loadState(in);
+    FileUtils::streamRead(in, _iteration);
+}
+
 void ProgressivePhotonMapIntegrator::fromJson(JsonPtr value, const Scene &scene)
 {
     PhotonMapIntegrator::fromJson(value, scene);
@@ -39,6 +55,11 @@ void ProgressivePhotonMapIntegrator::prepareForRender(TraceableScene &scene, uin
         _shadowSamplers.emplace_back(_sampler.nextI());
 }
 
+bool ProgressivePhotonMapIntegrator::supportsResumeRender() const
+{
+    return true;
+}
+
 void ProgressivePhotonMapIntegrator::renderSegment(std::function<void()> completionCallback)
 {
     _totalTracedSurfacePaths = 0;
@@ -49,11 +70,15 @@ void ProgressivePhotonMapIntegrator::renderSegment(std::function<void()> complet
 
     using namespace std::placeholders;
 
+    Timer timer;
+    resetPhotonBudgets();
     ThreadUtils::pool->yield(*ThreadUtils::pool->enqueue(
         std::bind(&ProgressivePhotonMapIntegrator::tracePhotons, this, _1, _2, _3, _iteration*_settings.photonCount),
         _tracers.size(),
         [](){}
     ));
+    timer.stop();
+    _tracingTime += timer.elapsed();
 
     float gamma = 1.0f;
     for (uint32 i = 1; i <= _iteration; ++i)
@@ -72,8 +97,12 @@ void ProgressivePhotonMapIntegrator::renderSegment(std::function<void()> complet
     float surfaceRadius = _settings.gatherRadius*gamma2D;
     float volumeRadius = _settings.volumeGatherRadius*volumeScale;
 
-    buildPhotonDataStructures(volumeScale);
+    timer.start();
+    buildPhotonDataStructures(gamma2D, volumeScale);
+    timer.stop();
+    _buildTime += timer.elapsed();
 
+    timer.start();
     ThreadUtils::pool->yield(*ThreadUtils::pool->enqueue(
         std::bind(&ProgressivePhotonMapIntegrator::tracePixels, this, _1, _3, surfaceRadius, volumeRadius),
         _tiles.size(),
@@ -89,6 +118,8 @@ void ProgressivePhotonMapIntegrator::renderSegment(std::function<void()> complet
             }, _tracers.size(), [](){}
         ));
     }
+    timer.stop();
+    _gatherTime += timer.elapsed();
 
     _currentSpp = _nextSpp;
     advanceSpp();
@@ -99,6 +130,8 @@ void ProgressivePhotonMapIntegrator::renderSegment(std::function<void()> complet
     _planes1D.reset();
     _surfaceTree.reset();
     _volumeTree.reset();
+    _surfaceHashGrid.reset();
+    _volumeHashGrid.reset();
     _volumeGrid.reset();
     _volumeBvh.reset();
     for (SubTaskData &data : _taskData) {
@@ -32,6 +32,9 @@ class ProgressivePhotonMapIntegrator : public PhotonMapIntegrator
 
     uint32 _iteration;
 
+    virtual void saveState(OutputStreamHandle &out) override;
+    virtual void loadState(InputStreamHandle &in) override;
+
     void renderSegment(std::function<void()> completionCallback);
 
 public:
@@ -42,6 +45,8 @@ public:
 
     virtual void prepareForRender(TraceableScene &scene, uint32 seed) override;
 
+    virtual bool supportsResumeRender() const override;
+
     virtual void startRender(std::function<void()> completionCallback) override;
 };
 
@@ -17,14 +17,40 @@ ReversibleJumpMltIntegrator::ReversibleJumpMltIntegrator()
 {
 }
 
-void ReversibleJumpMltIntegrator::saveState(OutputStreamHandle &/*out*/)
+void ReversibleJumpMltIntegrator::saveState(OutputStreamHandle &out)
 {
-    FAIL("ReversibleJumpMltIntegrator::saveState not supported!");
+    FileUtils::streamWrite(out, _chainsLaunched);
+    FileUtils::streamWrite(out, _luminanceScale);
+    FileUtils::streamWrite(out, uint64(_numSeedPathsTraced));
+    FileUtils::streamWrite(out, uint32(_luminancePerLength.size()));
+    FileUtils::streamWrite(out, _luminancePerLength.data(), _luminancePerLength.size());
+    _sampler.saveState(out);
+
+    saveThreadCount(out, uint32(_tracers.size()));
+    for (auto &tracer : _tracers)
+        tracer->saveState(out);
+
+    if (_imagePyramid)
+        _imagePyramid->serialize(out);
 }
 
-void ReversibleJumpMltIntegrator::loadState(InputStreamHandle &/*in*/)
+void ReversibleJumpMltIntegrator::loadState(InputStreamHandle &in)
 {
-    FAIL("ReversibleJumpMltIntegrator::loadState not supported!");
+    FileUtils::streamRead(in, _chainsLaunched);
+    FileUtils::streamRead(in, _luminanceScale);
+    _numSeedPathsTraced = FileUtils::streamRead<uint64>(in);
+    _luminancePerLength.resize(FileUtils::streamRead<uint32>(in));
+    FileUtils::streamRead(in, _luminancePerLength.data(), _luminancePerLength.size());
+    _sampler.loadState(in);
+
+    loadThreadCount(in, uint32(_tracers.size()));
+    for (auto &tracer : _tracers)
+        tracer->loadState(in);
+
+    if (_imagePyramid)
+        _imagePyramid->deserialize(in);
+
+    setBufferWeights();
 }
 
 void ReversibleJumpMltIntegrator::traceSamplePool(uint32 taskId, uint32 numSubTasks, uint32 /*threadId*/)
@@ -185,6 +211,7 @@ void ReversibleJumpMltIntegrator::saveOutputs()
 void ReversibleJumpMltIntegrator::prepareForRender(TraceableScene &scene, uint32 seed)
 {
     _chainsLaunched = false;
+    _luminanceScale = 1.0;
     _currentSpp = 0;
     _numSeedPathsTraced = 0;
     _sampler = UniformSampler(MathUtil::hash32(seed), ThreadUtils::pool->threadCount()*3);
@@ -194,14 +221,14 @@ void ReversibleJumpMltIntegrator::prepareForRender(TraceableScene &scene, uint32
     _w = scene.cam().resolution().x();
     _h = scene.cam().resolution().y();
     scene.cam().requestColorBuffer();
-    scene.cam().requestSplatBuffer();
+    scene.cam().requestSplatBuffer(scene.rendererSettings());
 
     _stats.reset(new AtomicMultiplexedStats(_settings.maxBounces));
 
     _pathCandidates.reset(new PathCandidate[_settings.initialSamplePool]);
 
     if (_settings.imagePyramid)
-        _imagePyramid.reset(new ImagePyramid(_settings.maxBounces, _scene->cam()));
+        _imagePyramid.reset(new ImagePyramid(_settings.maxBounces, _scene->cam(), scene.rendererSettings()));
 
     for (uint32 i = 0; i < ThreadUtils::pool->threadCount(); ++i) {
         _tracers.emplace_back(new ReversibleJumpMltTracer(&scene, _settings, i, _sampler, _imagePyramid.get()));
@@ -245,6 +272,11 @@ void ReversibleJumpMltIntegrator::teardownAfterRender()
     _imagePyramid.reset();
 }
 
+bool ReversibleJumpMltIntegrator::supportsResumeRender() const
+{
+    return true;
+}
+
 void ReversibleJumpMltIntegrator::startRender(std::function<void()> completionCallback)
 {
     if (_chainsLaunched && done()) {
@@ -260,6 +292,9 @@ void ReversibleJumpMltIntegrator::startRender(std::function<void()> completionCa
             std::bind(&ReversibleJumpMltIntegrator::traceSamplePool, this, _1, _2, _3),
             _tracers.size(),
             [&, completionCallback]() {
+                _scene->cam().flushSplatBuffer();
+                if (_imagePyramid)
+                    _imagePyramid->flush();
                 selectSeedPaths();
                 computeNormalizationFactor();
                 advanceSpp();
@@ -273,6 +308,9 @@ void ReversibleJumpMltIntegrator::startRender(std::function<void()> completionCa
             std::bind(&ReversibleJumpMltIntegrator::runSampleChain, this, _1, _2, _3),
             _tracers.size(),
             [&, completionCallback]() {
+                _scene->cam().flushSplatBuffer();
+                if (_imagePyramid)
+                    _imagePyramid->flush();
                 _currentSpp = _nextSpp;
                 computeNormalizationFactor();
                 advanceSpp();
@@ -17,6 +17,15 @@ ReversibleJumpMltTracer::ReversibleJumpMltTracer(TraceableScene *scene, const Re
 {
 }
 
+void ReversibleJumpMltTracer::allocateChain(int length, UniformSampler &cameraHelper, UniformSampler &emitterHelper)
+{
+    MarkovChain &chain = _chains[length];
+    chain. cameraSampler.reset(new WritableMetropolisSampler(_settings.gaussianMutation, & cameraHelper, length + 4));
+    chain.emitterSampler.reset(new WritableMetropolisSampler(_settings.gaussianMutation, &emitterHelper, length + 4));
+    chain. currentState.reset(new ChainState(length));
+    chain.proposedState.reset(new ChainState(length));
+}
+
 void ReversibleJumpMltTracer::tracePaths(
         LightPath & cameraPath, PathSampleGenerator & cameraSampler,
         LightPath &emitterPath, PathSampleGenerator &emitterSampler,
@@ -124,11 +133,9 @@ void ReversibleJumpMltTracer::startSampleChain(int s, int t, float luminance, Un
 {
     int length = s + t - 1;
 
+    allocateChain(length, cameraReplaySampler, emitterReplaySampler);
+
     MarkovChain &chain = _chains[length];
-    chain. cameraSampler.reset(new WritableMetropolisSampler(_settings.gaussianMutation, & cameraReplaySampler, length + 4));
-    chain.emitterSampler.reset(new WritableMetropolisSampler(_settings.gaussianMutation, &emitterReplaySampler, length + 4));
-    chain. currentState.reset(new ChainState(length));
-    chain.proposedState.reset(new ChainState(length));
     chain.currentS = s;
 
     evalSample(*chain.cameraSampler, *chain.emitterSampler, length, s, *chain.currentState);
@@ -265,4 +272,58 @@ LargeStepTracker ReversibleJumpMltTracer::runSampleChain(int pathLength, int cha
     return largeSteps;
 }
 
+void ReversibleJumpMltTracer::saveState(OutputStreamHandle &out)
+{
+    _sampler.saveState(out);
+    _cameraSampler.saveState(out);
+    _emitterSampler.saveState(out);
+
+    for (int length = 0; length <= _settings.maxBounces; ++length) {
+        const MarkovChain &chain = _chains[length];
+        bool chainStarted = bool(chain.cameraSampler);
+        FileUtils::streamWrite(out, chainStarted);
+        if (chainStarted) {
+            chain.cameraSampler->saveState(out);
+            chain.emitterSampler->saveState(out);
+            FileUtils::streamWrite(out, chain.currentS);
+            chain.currentState->splats.saveState(out);
+        }
+    }
+}
+
+void ReversibleJumpMltTracer::loadState(InputStreamHandle &in)
+{
+    _sampler.loadState(in);
+    _cameraSampler.loadState(in);
+    _emitterSampler.loadState(in);
+
+    for (int length = 0; length <= _settings.maxBounces; ++length) {
+        if (!FileUtils::streamRead<bool>(in))
+            continue;
+
+        allocateChain(length, _sampler, _sampler);
+        MarkovChain &chain = _chains[length];
+        chain.cameraSampler->loadState(in);
+        chain.emitterSampler->loadState(in);
+        FileUtils::streamRead(in, chain.currentS);
+
+        // The light paths of the current state are needed for strategy
+        // changes, but cannot be saved. They are rebuilt by tracing the
+        // accepted sample again with rewound copies of the chain samplers,
+        // without touching any of the random number streams of the chain
+        UniformSampler scratchHelper;
+        UniformPathSampler savedCameraSampler(_cameraSampler);
+        WritableMetropolisSampler  cameraReplay(*chain. cameraSampler);
+        WritableMetropolisSampler emitterReplay(*chain.emitterSampler);
+         cameraReplay.rewindToAccepted();
+        emitterReplay.rewindToAccepted();
+         cameraReplay.setHelperGenerator(&scratchHelper);
+        emitterReplay.setHelperGenerator(&scratchHelper);
+        evalSample(cameraReplay, emitterReplay, length, chain.currentS, *chain.currentState);
+        _cameraSampler = savedCameraSampler;
+
+        chain.currentState->splats.loadState(in);
+    }
+}
+
 }
@@ -54,6 +54,8 @@ class ReversibleJumpMltTracer : public TraceBase
 
     ImagePyramid *_pyramid;
 
+    void allocateChain(int length, UniformSampler &cameraHelper, UniformSampler &emitterHelper);
+
     void tracePaths(LightPath & cameraPath, PathSampleGenerator & cameraSampler,
                     LightPath &emitterPath, PathSampleGenerator &emitterSampler,
                     int s = -1, int t = -1, bool prune = true);
@@ -71,6 +73,9 @@ public:
             UniformSampler &emitterReplaySampler);
     LargeStepTracker runSampleChain(int pathLength, int chainLength, MultiplexedStats &stats, float luminanceScale);
 
+    void saveState(OutputStreamHandle &out);
+    void loadState(InputStreamHandle &in);
+
     UniformPathSampler &cameraSampler()
     {
         return _cameraSampler;
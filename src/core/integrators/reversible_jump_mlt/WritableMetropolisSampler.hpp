@@ -185,11 +185,41 @@ public:
         _blockOffset = 0;
     }
 
-    virtual void saveState(OutputStreamHandle &/*out*/) override final
-    {
+    // The helper generator is not part of the state and has to be restored
+    // separately
+    virtual void saveState(OutputStreamHandle &out) override final
+    {
+        FileUtils::streamWrite(out, _sampleVector.get(), _maxSize);
+        FileUtils::streamWrite(out, _stackIdx);
+        FileUtils::streamWrite(out, _sampleStack.get(), _stackIdx);
+        FileUtils::streamWrite(out, _currentTime);
+        FileUtils::streamWrite(out, _largeStepTime);
+        FileUtils::streamWrite(out, _largeStep);
+        FileUtils::streamWrite(out, _frozen);
+    }
+    virtual void loadState(InputStreamHandle &in) override final
+    {
+        FileUtils::streamRead(in, _sampleVector.get(), _maxSize);
+        FileUtils::streamRead(in, _stackIdx);
+        FileUtils::streamRead(in, _sampleStack.get(), _stackIdx);
+        FileUtils::streamRead(in, _currentTime);
+        FileUtils::streamRead(in, _largeStepTime);
+        FileUtils::streamRead(in, _largeStep);
+        FileUtils::streamRead(in, _frozen);
+        startPath(0, 0);
     }
-    virtual void loadState(InputStreamHandle &/*in*/) override final
+
+    // Steps back to the time of the last accepted sample. Tracing a path
+    // afterwards reproduces the accepted path without mutating it. Only
+    // meant to be used on a copy of a sampler, since the sample vector is
+    // not restored once the next sample is accepted
+    void rewindToAccepted()
     {
+        _currentTime--;
+        _largeStep = false;
+        _frozen = true;
+        _stackIdx = 0;
+        startPath(0, 0);
     }
 
     void setHelperGenerator(UniformSampler *generator)
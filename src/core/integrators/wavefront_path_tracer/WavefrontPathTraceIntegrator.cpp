@@ -0,0 +1,169 @@
+#include "WavefrontPathTraceIntegrator.hpp"
+
+#include "cameras/Camera.hpp"
+
+#include "thread/ThreadUtils.hpp"
+#include "thread/ThreadPool.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+namespace Tungsten {
+
+CONSTEXPR uint32 WavefrontPathTraceIntegrator::TileSize;
+
+WavefrontPathTraceIntegrator::WavefrontPathTraceIntegrator()
+: Integrator(),
+  _w(0),
+  _h(0),
+  _seed(0)
+{
+}
+
+void WavefrontPathTraceIntegrator::diceTiles()
+{
+    for (uint32 y = 0; y < _h; y += TileSize)
+        for (uint32 x = 0; x < _w; x += TileSize)
+            _tiles.emplace_back(x, y, min(TileSize, _w - x), min(TileSize, _h - y), nullptr);
+}
+
+void WavefrontPathTraceIntegrator::renderTile(uint32 id, uint32 tileId)
+{
+    if (_fallbackTracers.empty())
+        _tracers[id]->renderTile(_tiles[tileId], _currentSpp, _nextSpp);
+    else
+        renderTileFallback(id, _tiles[tileId]);
+}
+
+void WavefrontPathTraceIntegrator::renderTileFallback(uint32 id, const ImageTile &tile)
+{
+    for (uint32 y = 0; y < tile.h; ++y) {
+        for (uint32 x = 0; x < tile.w; ++x) {
+            Vec2u pixel(tile.x + x, tile.y + y);
+            uint32 pixelIndex = pixel.x() + pixel.y()*_w;
+            for (uint32 i = _currentSpp; i < _nextSpp; ++i) {
+                PathSampleGenerator &sampler = *_fallbackSamplers[id];
+                WavefrontPathTracer::startSample(sampler, _seed, pixelIndex, i);
+                Vec3f c = _fallbackTracers[id]->traceSample(pixel, sampler);
+                _scene->cam().colorBuffer()->addSample(pixel, c);
+            }
+        }
+    }
+}
+
+void WavefrontPathTraceIntegrator::saveState(OutputStreamHandle &/*out*/)
+{
+}
+
+void WavefrontPathTraceIntegrator::loadState(InputStreamHandle &/*in*/)
+{
+}
+
+void WavefrontPathTraceIntegrator::fromJson(JsonPtr value, const Scene &/*scene*/)
+{
+    _settings.fromJson(value);
+}
+
+rapidjson::Value WavefrontPathTraceIntegrator::toJson(Allocator &allocator) const
+{
+    return _settings.toJson(allocator);
+}
+
+void WavefrontPathTraceIntegrator::prepareForRender(TraceableScene &scene, uint32 seed)
+{
+    _currentSpp = 0;
+    _seed = MathUtil::hash32(seed);
+    _scene = &scene;
+    advanceSpp();
+    scene.cam().requestColorBuffer();
+
+    _w = scene.cam().resolution().x();
+    _h = scene.cam().resolution().y();
+    diceTiles();
+
+    // The wavefront tracer only handles surface transport into the color
+    // buffer. Anything else is rendered with the regular path tracer, which
+    // supports all of it
+    std::vector<OutputBufferSettings> outputs = scene.rendererSettings().renderOutputs();
+    bool hasAovs = std::any_of(outputs.begin(), outputs.end(), [](const OutputBufferSettings &output) {
+        return output.type() != OutputColor;
+    });
+    const char *unsupported = nullptr;
+    if (!scene.media().empty())
+        unsupported = "participating media";
+    else if (hasAovs)
+        unsupported = "render outputs other than color";
+
+    if (!unsupported) {
+        _tracers.resize(ThreadUtils::pool->threadCount());
+        ThreadUtils::forEachThread([&](uint32 i) {
+            _tracers[i].reset(new WavefrontPathTracer(&scene, _settings, i, _seed));
+        });
+    } else {
+        std::cout << "Warning: The wavefront path tracer does not support " << unsupported
+                << ". Falling back to regular path tracing for this render." << std::endl;
+
+        PathTracerSettings settings;
+        static_cast<TraceSettings &>(settings) = _settings;
+        settings.enableLightSampling = _settings.enableLightSampling;
+
+        _fallbackTracers.resize(ThreadUtils::pool->threadCount());
+        _fallbackSamplers.resize(ThreadUtils::pool->threadCount());
+        ThreadUtils::forEachThread([&](uint32 i) {
+            _fallbackTracers[i].reset(new PathTracer(&scene, settings, i));
+            _fallbackSamplers[i] = WavefrontPathTracer::makeSampler(scene, _seed);
+        });
+    }
+}
+
+void WavefrontPathTraceIntegrator::teardownAfterRender()
+{
+    _group.reset();
+
+    _tracers.clear();
+    _fallbackTracers.clear();
+    _fallbackSamplers.clear();
+    _tiles.clear();
+    _tracers.shrink_to_fit();
+    _fallbackTracers.shrink_to_fit();
+    _fallbackSamplers.shrink_to_fit();
+    _tiles.shrink_to_fit();
+}
+
+void WavefrontPathTraceIntegrator::startRender(std::function<void()> completionCallback)
+{
+    if (done()) {
+        completionCallback();
+        return;
+    }
+
+    using namespace std::placeholders;
+    _group = ThreadUtils::pool->enqueue(
+        std::bind(&WavefrontPathTraceIntegrator::renderTile, this, _3, _1),
+        _tiles.size(),
+        [&, completionCallback]() {
+            _currentSpp = _nextSpp;
+            advanceSpp();
+            completionCallback();
+        }
+    );
+}
+
+void WavefrontPathTraceIntegrator::waitForCompletion()
+{
+    if (_group) {
+        _group->wait();
+        _group.reset();
+    }
+}
+
+void WavefrontPathTraceIntegrator::abortRender()
+{
+    if (_group) {
+        _group->abort();
+        _group->wait();
+        _group.reset();
+    }
+}
+
+}
@@ -0,0 +1,65 @@
+#ifndef WAVEFRONTPATHTRACEINTEGRATOR_HPP_
+#define WAVEFRONTPATHTRACEINTEGRATOR_HPP_
+
+#include "WavefrontPathTracerSettings.hpp"
+#include "WavefrontPathTracer.hpp"
+
+#include "integrators/path_tracer/PathTracer.hpp"
+#include "integrators/Integrator.hpp"
+#include "integrators/ImageTile.hpp"
+
+#include "thread/TaskGroup.hpp"
+
+#include "math/MathUtil.hpp"
+
+#include <memory>
+#include <vector>
+
+namespace Tungsten {
+
+class WavefrontPathTraceIntegrator : public Integrator
+{
+    // Tiles are large enough to keep the default wavefront size busy at one
+    // sample per pixel
+    static CONSTEXPR uint32 TileSize = 64;
+
+    WavefrontPathTracerSettings _settings;
+
+    std::shared_ptr<TaskGroup> _group;
+
+    uint32 _w;
+    uint32 _h;
+    uint32 _seed;
+
+    std::vector<std::unique_ptr<WavefrontPathTracer>> _tracers;
+    // Used instead of the wavefront tracers in scenes with participating
+    // media or render outputs other than color
+    std::vector<std::unique_ptr<PathTracer>> _fallbackTracers;
+    std::vector<std::unique_ptr<PathSampleGenerator>> _fallbackSamplers;
+    std::vector<ImageTile> _tiles;
+
+    void diceTiles();
+
+    void renderTile(uint32 id, uint32 tileId);
+    void renderTileFallback(uint32 id, const ImageTile &tile);
+
+    virtual void saveState(OutputStreamHandle &out) override;
+    virtual void loadState(InputStreamHandle &in) override;
+
+public:
+    WavefrontPathTraceIntegrator();
+
+    virtual void fromJson(JsonPtr value, const Scene &scene) override;
+    virtual rapidjson::Value toJson(Allocator &allocator) const override;
+
+    virtual void prepareForRender(TraceableScene &scene, uint32 seed) override;
+    virtual void teardownAfterRender() override;
+
+    virtual void startRender(std::function<void()> completionCallback) override;
+    virtual void waitForCompletion() override;
+    virtual void abortRender() override;
+};
+
+}
+
+#endif /* WAVEFRONTPATHTRACEINTEGRATOR_HPP_ */
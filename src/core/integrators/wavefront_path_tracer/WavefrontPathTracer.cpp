@@ -0,0 +1,389 @@
+#include "WavefrontPathTracer.hpp"
+
+#include "sampling/UniformPathSampler.hpp"
+#include "sampling/SobolPathSampler.hpp"
+
+#include <typeinfo>
+#include <algorithm>
+#include <iostream>
+
+namespace Tungsten {
+
+WavefrontPathTracer::WavefrontPathTracer(TraceableScene *scene, const WavefrontPathTracerSettings &settings,
+        uint32 threadId, uint32 seed)
+: TraceBase(scene, settings, threadId),
+  _settings(settings),
+  _seed(seed)
+{
+    uint32 poolSize = max(_settings.wavefrontSize, 1);
+    _paths.resize(poolSize);
+    for (uint32 i = 0; i < poolSize; ++i)
+        _samplers.emplace_back(makeSampler(*scene, seed));
+    _rays.resize(poolSize);
+    _data.resize(poolSize);
+    _info.resize(poolSize);
+    _hits.reserve(poolSize);
+
+    // At most two shadow rays (light and BSDF sample) are queued per path and bounce
+    _shadowRays.reserve(2*poolSize);
+    _shadowRecords.reserve(2*poolSize);
+    _shadowOccluded.reset(new bool[2*poolSize]);
+}
+
+std::unique_ptr<PathSampleGenerator> WavefrontPathTracer::makeSampler(const TraceableScene &scene, uint32 seed)
+{
+    if (scene.rendererSettings().useSobol())
+        return std::unique_ptr<PathSampleGenerator>(new SobolPathSampler(seed));
+    else
+        return std::unique_ptr<PathSampleGenerator>(new UniformPathSampler(seed));
+}
+
+void WavefrontPathTracer::startSample(PathSampleGenerator &sampler, uint32 seed, uint32 pixelIndex, uint32 sample)
+{
+    uint64 state = (uint64(MathUtil::hash32(seed + pixelIndex)) << 32) | MathUtil::hash32(sample ^ MathUtil::hash32(seed));
+    uint64 sequence = ((uint64(pixelIndex) << 32) | sample) << 1;
+    sampler.startPath(pixelIndex, sample);
+    sampler.uniformGenerator() = UniformSampler(state, sequence);
+}
+
+bool WavefrontPathTracer::startPath(uint32 pathId, Vec2u pixel, uint32 sample)
+{
+    PathState &path = _paths[pathId];
+    PathSampleGenerator &sampler = *_samplers[pathId];
+    startSample(sampler, _seed, pixel.x() + pixel.y()*_scene->cam().resolution().x(), sample);
+
+    PositionSample point;
+    if (!_scene->cam().samplePosition(sampler, point))
+        return false;
+    DirectionSample direction;
+    if (!_scene->cam().sampleDirection(sampler, point, pixel, direction))
+        return false;
+
+    path.pixel = pixel;
+    path.throughput = point.weight*direction.weight;
+    path.emission = Vec3f(0.0f);
+    path.bounce = 0;
+    path.wasSpecular = true;
+    path.active = true;
+    path.failed = false;
+
+    _rays[pathId] = Ray(point.p, direction.d);
+    _rays[pathId].setPrimaryRay(true);
+    _rays[pathId].setFootprint(0.0f, _scene->cam().approximatePixelSpread());
+
+    return true;
+}
+
+void WavefrontPathTracer::finishPath(uint32 pathId)
+{
+    const PathState &path = _paths[pathId];
+    Vec3f result = path.emission;
+    if (path.failed || std::isnan(result.sum()))
+        result = Vec3f(0.0f);
+    _scene->cam().colorBuffer()->addSample(path.pixel, result);
+}
+
+void WavefrontPathTracer::handleMiss(uint32 pathId)
+{
+    PathState &path = _paths[pathId];
+    if (path.bounce >= _settings.minBounces)
+        handleInfiniteLights(_data[pathId], _info[pathId], _settings.enableLightSampling,
+                _rays[pathId], path.throughput, path.wasSpecular, path.emission);
+    path.active = false;
+}
+
+void WavefrontPathTracer::shadeHit(uint32 pathId)
+{
+    PathState &path = _paths[pathId];
+    PathSampleGenerator &sampler = *_samplers[pathId];
+    Ray &ray = _rays[pathId];
+    IntersectionTemporary &data = _data[pathId];
+    IntersectionInfo &info = _info[pathId];
+    const Bsdf &bsdf = *info.bsdf;
+
+    SurfaceScatterEvent event = makeLocalScatterEvent(data, info, ray, &sampler);
+
+    // For forward events, the transport direction does not matter (since wi = -wo)
+    Vec3f transparency = bsdf.eval(event.makeForwardEvent(), false);
+    float transparencyScalar = transparency.avg();
+
+    Vec3f wo;
+    if (sampler.nextBoolean(transparencyScalar)) {
+        wo = ray.dir();
+        path.throughput *= transparency/transparencyScalar;
+    } else {
+        if (_settings.enableLightSampling && path.bounce < _settings.maxBounces - 1)
+            queueDirect(pathId, event);
+
+        if (info.primitive->isEmissive() && path.bounce >= _settings.minBounces) {
+            if (!_settings.enableLightSampling || path.wasSpecular || !info.primitive->isSamplable())
+                path.emission += info.primitive->evalDirect(data, info)*path.throughput;
+        }
+
+        event.requestedLobe = BsdfLobes::AllLobes;
+        if (!bsdf.sample(event, false)) {
+            path.active = false;
+            return;
+        }
+
+        wo = event.frame.toGlobal(event.wo);
+        if (!isConsistent(event, wo)) {
+            path.active = false;
+            return;
+        }
+
+        path.throughput *= event.weight;
+        path.wasSpecular = event.sampledLobe.hasSpecular();
+        if (!path.wasSpecular)
+            ray.setPrimaryRay(false);
+    }
+
+    ray = ray.scatter(ray.hitpoint(), wo, info.epsilon);
+
+    if (path.throughput.max() == 0.0f) {
+        path.active = false;
+        return;
+    }
+
+    float roulettePdf = std::abs(path.throughput).max();
+    if (path.bounce > 2 && roulettePdf < 0.1f) {
+        if (sampler.nextBoolean(roulettePdf)) {
+            path.throughput /= roulettePdf;
+        } else {
+            path.active = false;
+            return;
+        }
+    }
+
+    if (std::isnan(ray.dir().sum() + ray.pos().sum()) || std::isnan(path.throughput.sum() + path.emission.sum())) {
+        path.failed = true;
+        path.active = false;
+        return;
+    }
+
+    path.bounce++;
+    if (path.bounce >= _settings.maxBounces)
+        path.active = false;
+}
+
+// Same as TraceBase::attenuatedEmission, minus the shadow ray
+bool WavefrontPathTracer::unshadowedEmission(const Primitive &light, float expectedDist,
+        IntersectionTemporary &data, IntersectionInfo &info, Ray &ray, Vec3f &emission) const
+{
+    CONSTEXPR float fudgeFactor = 1.0f + 1e-3f;
+
+    if (light.isDirac()) {
+        ray.setFarT(expectedDist);
+    } else {
+        if (!light.intersect(ray, data) || ray.farT()*fudgeFactor < expectedDist)
+            return false;
+    }
+    info.p = ray.pos() + ray.dir()*ray.farT();
+    info.w = ray.dir();
+    info.footprint = info.uvScale = 0.0f;
+    light.intersectionInfo(data, info);
+
+    emission = light.evalDirect(data, info);
+    return emission != 0.0f;
+}
+
+void WavefrontPathTracer::queueShadowRay(uint32 pathId, int bounce, const Primitive &light,
+        const Ray &ray, const Vec3f &contribution)
+{
+    // The light itself must not occlude the shadow ray, so the occlusion
+    // query stops just short of the point sampled on the light
+    CONSTEXPR float shortenFactor = 1.0f - 1e-4f;
+
+    _shadowRecords.emplace_back(ShadowRecord{pathId, bounce, ray.farT(), &light, contribution});
+    _shadowRays.push_back(ray);
+    _shadowRays.back().setFarT(ray.farT()*shortenFactor);
+}
+
+void WavefrontPathTracer::queueLightSample(uint32 pathId, const Primitive &light,
+        SurfaceScatterEvent &event, const Vec3f &weight)
+{
+    LightSample sample;
+    if (!light.sampleDirect(_threadId, event.info->p, *event.sampler, sample))
+        return;
+
+    event.wo = event.frame.toLocal(sample.d);
+    if (!isConsistent(event, sample.d))
+        return;
+
+    event.requestedLobe = BsdfLobes::AllButSpecular;
+
+    Vec3f f = event.info->bsdf->eval(event, false);
+    if (f == 0.0f)
+        return;
+
+    Ray ray = _rays[pathId].scatter(event.info->p, sample.d, event.info->epsilon);
+    ray.setPrimaryRay(false);
+
+    IntersectionTemporary data;
+    IntersectionInfo info;
+    Vec3f e;
+    if (!unshadowedEmission(light, sample.dist, data, info, ray, e))
+        return;
+
+    Vec3f lightF = f*e/sample.pdf;
+
+    if (!light.isDirac())
+        lightF *= SampleWarp::powerHeuristic(sample.pdf, event.info->bsdf->pdf(event));
+
+    queueShadowRay(pathId, _paths[pathId].bounce + 1, light, ray, lightF*weight);
+}
+
+void WavefrontPathTracer::queueBsdfSample(uint32 pathId, const Primitive &light,
+        SurfaceScatterEvent &event, const Vec3f &weight)
+{
+    event.requestedLobe = BsdfLobes::AllButSpecular;
+    if (!event.info->bsdf->sample(event, false))
+        return;
+    if (event.weight == 0.0f)
+        return;
+
+    Vec3f wo = event.frame.toGlobal(event.wo);
+    if (!isConsistent(event, wo))
+        return;
+
+    Ray ray = _rays[pathId].scatter(event.info->p, wo, event.info->epsilon);
+    ray.setPrimaryRay(false);
+
+    IntersectionTemporary data;
+    IntersectionInfo info;
+    Vec3f e;
+    if (!unshadowedEmission(light, -1.0f, data, info, ray, e))
+        return;
+
+    Vec3f bsdfF = e*event.weight;
+
+    bsdfF *= SampleWarp::powerHeuristic(event.pdf, light.directPdf(_threadId, data, info, event.info->p));
+
+    queueShadowRay(pathId, _paths[pathId].bounce + 1, light, ray, bsdfF*weight);
+}
+
+void WavefrontPathTracer::queueDirect(uint32 pathId, SurfaceScatterEvent &event)
+{
+    float weight;
+    const Primitive *light = chooseLight(*event.sampler, event.info->p, weight);
+    if (light == nullptr)
+        return;
+
+    if (event.info->bsdf->lobes().isPureSpecular() || event.info->bsdf->lobes().isForward())
+        return;
+
+    Vec3f throughput = _paths[pathId].throughput*weight;
+    queueLightSample(pathId, *light, event, throughput);
+    if (!light->isDirac())
+        queueBsdfSample(pathId, *light, event, throughput);
+}
+
+void WavefrontPathTracer::traceShadowRays()
+{
+    uint32 count = _shadowRays.size();
+    _scene->occluded(count, _shadowRays.data(), _shadowOccluded.get());
+
+    for (uint32 i = 0; i < count; ++i) {
+        const ShadowRecord &record = _shadowRecords[i];
+        if (record.bounce < _settings.minBounces)
+            continue;
+
+        // Transparent surfaces let shadow rays pass, which a plain occlusion
+        // query can't account for. If there are any, occluded shadow rays
+        // are traced again with the full shadow ray logic
+        Vec3f transmittance(1.0f);
+        if (_shadowOccluded[i]) {
+            if (!_scene->hasTransparency())
+                continue;
+            Ray ray = _shadowRays[i];
+            ray.setFarT(record.farT);
+            transmittance = generalizedShadowRay(*_samplers[record.path], ray, nullptr, record.light,
+                    true, true, record.bounce);
+        }
+
+        _paths[record.path].emission += record.contribution*transmittance;
+    }
+
+    _shadowRays.clear();
+    _shadowRecords.clear();
+}
+
+void WavefrontPathTracer::renderTile(const ImageTile &tile, uint32 sampleBegin, uint32 sampleEnd)
+{
+    uint32 poolSize = _paths.size();
+    uint32 numPixels = tile.w*tile.h;
+    uint64 numSamples = uint64(numPixels)*(sampleEnd - sampleBegin);
+    uint64 nextSample = 0;
+
+    uint32 numActive = 0;
+    while (true) {
+        // Refill the pool with new camera paths. Consecutive paths belong to
+        // neighbouring pixels, which keeps the primary rays coherent
+        while (numActive < poolSize && nextSample < numSamples) {
+            uint32 pixelIndex = nextSample % numPixels;
+            uint32 sample = sampleBegin + nextSample/numPixels;
+            nextSample++;
+
+            Vec2u pixel(tile.x + pixelIndex % tile.w, tile.y + pixelIndex/tile.w);
+            if (startPath(numActive, pixel, sample))
+                numActive++;
+            else
+                _scene->cam().colorBuffer()->addSample(pixel, Vec3f(0.0f));
+        }
+        if (numActive == 0)
+            break;
+
+        _scene->intersect(numActive, _rays.data(), _data.data(), _info.data());
+
+        _hits.clear();
+        for (uint32 i = 0; i < numActive; ++i) {
+            if (_data[i].primitive)
+                _hits.emplace_back(HitKey{typeid(*_info[i].bsdf).hash_code(), _info[i].bsdf, i});
+            else
+                handleMiss(i);
+        }
+
+        // Shading all hits with the same material back to back keeps the
+        // code and data of one BSDF in cache, rather than jumping between
+        // BSDF implementations with every path
+        if (_settings.sortHits) {
+            std::sort(_hits.begin(), _hits.end(), [](const HitKey &a, const HitKey &b) {
+                if (a.bsdfType != b.bsdfType)
+                    return a.bsdfType < b.bsdfType;
+                if (a.bsdf != b.bsdf)
+                    return a.bsdf < b.bsdf;
+                return a.path < b.path;
+            });
+        }
+
+        for (const HitKey &hit : _hits) {
+            try {
+                shadeHit(hit.path);
+            } catch (std::runtime_error &e) {
+                std::cout << tfm::format("Caught an internal error at pixel %s: %s", _paths[hit.path].pixel, e.what()) << std::endl;
+                _paths[hit.path].failed = true;
+                _paths[hit.path].active = false;
+            }
+        }
+
+        traceShadowRays();
+
+        // Retire finished paths, moving active paths from the end of the
+        // pool into the free slots
+        for (uint32 i = 0; i < numActive; ) {
+            if (_paths[i].active) {
+                i++;
+                continue;
+            }
+            finishPath(i);
+            numActive--;
+            if (i != numActive) {
+                _paths[i] = _paths[numActive];
+                std::swap(_samplers[i], _samplers[numActive]);
+                _rays[i] = _rays[numActive];
+            }
+        }
+    }
+}
+
+}
@@ -0,0 +1,105 @@
+#ifndef WAVEFRONTPATHTRACER_HPP_
+#define WAVEFRONTPATHTRACER_HPP_
+
+#include "WavefrontPathTracerSettings.hpp"
+
+#include "integrators/TraceBase.hpp"
+#include "integrators/ImageTile.hpp"
+
+#include "sampling/PathSampleGenerator.hpp"
+
+#include <memory>
+#include <vector>
+
+namespace Tungsten {
+
+// Breadth-first path tracer. Instead of following one path at a time, it
+// keeps a pool of in-flight paths that are advanced one bounce at a time:
+// All paths are intersected as one ray stream, the resulting hits are sorted
+// by material and shaded, and the shadow rays generated during shading are
+// traced together as a second ray stream. Paths that terminate are replaced
+// by new camera paths until all samples of the tile are done.
+//
+// Only surface transport into the color buffer is handled; scenes with
+// participating media or other render outputs are rendered with the
+// regular PathTracer by the integrator instead.
+class WavefrontPathTracer : public TraceBase
+{
+    struct PathState
+    {
+        Vec2u pixel;
+        Vec3f throughput;
+        Vec3f emission;
+        int bounce;
+        bool wasSpecular;
+        bool active;
+        bool failed;
+    };
+
+    struct ShadowRecord
+    {
+        uint32 path;
+        int bounce;
+        float farT;
+        const Primitive *light;
+        Vec3f contribution;
+    };
+
+    struct HitKey
+    {
+        size_t bsdfType;
+        const Bsdf *bsdf;
+        uint32 path;
+    };
+
+    WavefrontPathTracerSettings _settings;
+    uint32 _seed;
+
+    std::vector<PathState> _paths;
+    std::vector<std::unique_ptr<PathSampleGenerator>> _samplers;
+    std::vector<Ray> _rays;
+    std::vector<IntersectionTemporary> _data;
+    std::vector<IntersectionInfo> _info;
+    std::vector<HitKey> _hits;
+
+    std::vector<Ray> _shadowRays;
+    std::vector<ShadowRecord> _shadowRecords;
+    std::unique_ptr<bool[]> _shadowOccluded;
+
+    bool startPath(uint32 pathId, Vec2u pixel, uint32 sample);
+    void finishPath(uint32 pathId);
+
+    void handleMiss(uint32 pathId);
+    void shadeHit(uint32 pathId);
+
+    bool unshadowedEmission(const Primitive &light, float expectedDist, IntersectionTemporary &data,
+            IntersectionInfo &info, Ray &ray, Vec3f &emission) const;
+    void queueShadowRay(uint32 pathId, int bounce, const Primitive &light, const Ray &ray,
+            const Vec3f &contribution);
+    void queueLightSample(uint32 pathId, const Primitive &light, SurfaceScatterEvent &event,
+            const Vec3f &weight);
+    void queueBsdfSample(uint32 pathId, const Primitive &light, SurfaceScatterEvent &event,
+            const Vec3f &weight);
+    void queueDirect(uint32 pathId, SurfaceScatterEvent &event);
+    void traceShadowRays();
+
+public:
+    WavefrontPathTracer(TraceableScene *scene, const WavefrontPathTracerSettings &settings,
+            uint32 threadId, uint32 seed);
+
+    // Traces samples [sampleBegin, sampleEnd) of every pixel in the tile and
+    // adds them to the color buffer of the camera
+    void renderTile(const ImageTile &tile, uint32 sampleBegin, uint32 sampleEnd);
+
+    // Creates the sample generator selected in the renderer settings of the
+    // scene, i.e. a Sobol or a uniform sampler
+    static std::unique_ptr<PathSampleGenerator> makeSampler(const TraceableScene &scene, uint32 seed);
+    // Prepares a sampler for the given sample of a pixel. Since the paths of
+    // a wavefront are advanced interleaved, every path gets its own uniform
+    // sequence for the decisions the generator doesn't stratify
+    static void startSample(PathSampleGenerator &sampler, uint32 seed, uint32 pixelIndex, uint32 sample);
+};
+
+}
+
+#endif /* WAVEFRONTPATHTRACER_HPP_ */
@@ -0,0 +1,44 @@
+#ifndef WAVEFRONTPATHTRACERSETTINGS_HPP_
+#define WAVEFRONTPATHTRACERSETTINGS_HPP_
+
+#include "integrators/TraceSettings.hpp"
+
+#include "io/JsonObject.hpp"
+
+namespace Tungsten {
+
+struct WavefrontPathTracerSettings : public TraceSettings
+{
+    bool enableLightSampling;
+    bool sortHits;
+    int wavefrontSize;
+
+    WavefrontPathTracerSettings()
+    : enableLightSampling(true),
+      sortHits(true),
+      wavefrontSize(4096)
+    {
+    }
+
+    void fromJson(JsonPtr value)
+    {
+        TraceSettings::fromJson(value);
+        value.getField("enable_light_sampling", enableLightSampling);
+        value.getField("sort_hits", sortHits);
+        value.getField("wavefront_size", wavefrontSize);
+    }
+
+    rapidjson::Value toJson(rapidjson::Document::AllocatorType &allocator) const
+    {
+        return JsonObject{TraceSettings::toJson(allocator), allocator,
+            "type", "wavefront_path_tracer",
+            "enable_light_sampling", enableLightSampling,
+            "sort_hits", sortHits,
+            "wavefront_size", wavefrontSize
+        };
+    }
+};
+
+}
+
+#endif /* WAVEFRONTPATHTRACERSETTINGS_HPP_ */
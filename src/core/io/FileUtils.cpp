@@ -1,6 +1,7 @@
 #include "FileUtils.hpp"
 #include "FileStreambuf.hpp"
 #include "UnicodeUtils.hpp"
+#include "FileIterables.hpp"
 #include "ZipStreambuf.hpp"
 #include "ZipReader.hpp"
 #include "Path.hpp"
@@ -20,11 +21,15 @@
 #include <limits.h>
 #include <stdlib.h>
 #include <libgen.h>
+#include <signal.h>
+#include <fcntl.h>
 #endif
 
 #include <fstream>
 #include <cstring>
+#include <cstdlib>
 #include <cstdio>
+#include <cerrno>
 #include <memory>
 #include <locale>
 
@@ -34,6 +39,10 @@ static Path getNativeCurrentDir();
 
 std::unordered_map<Path, std::shared_ptr<ZipReader>> FileUtils::_archives;
 std::unordered_map<const std::ios *, FileUtils::StreamMetadata> FileUtils::_metaData;
+std::unordered_set<Path> FileUtils::_pendingTempFiles;
+uint64 FileUtils::_tempFileCounter = 0;
+std::unordered_set<Path> FileUtils::_cleanedTempDirectories;
+std::mutex FileUtils::_streamMutex;
 Path FileUtils::_currentDir = getNativeCurrentDir();
 
 typedef std::string::size_type SizeType;
@@ -245,18 +254,156 @@ static Path getNativeCurrentDir()
     return Path();
 }
 
+// Flushes the contents of a file to disk, so that they survive a power loss
+bool FileUtils::syncFile(const Path &p)
+{
+#if _WIN32
+    HANDLE file = CreateFileW(makeWideLongPath(p).c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    bool result = FlushFileBuffers(file) != 0;
+    CloseHandle(file);
+    return result;
+#else
+    int fd = open(p.absolute().asString().c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    bool result = fsync(fd) == 0;
+    close(fd);
+    return result;
+#endif
+}
+
+// Flushes the directory entries of a directory to disk, e.g. to make a
+// rename durable. Windows doesn't need (or allow) this
+void FileUtils::syncDirectory(const Path &p)
+{
+#if !_WIN32
+    int fd = open(p.absolute().asString().c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+#endif
+}
+
+static uint32 currentProcessId()
+{
+#if _WIN32
+    return uint32(GetCurrentProcessId());
+#else
+    return uint32(getpid());
+#endif
+}
+
+// Only returns false if the process is known to have exited
+static bool processAlive(uint32 pid)
+{
+#if _WIN32
+    HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, DWORD(pid));
+    if (!process)
+        return GetLastError() != ERROR_INVALID_PARAMETER;
+    DWORD exitCode;
+    bool alive = !GetExitCodeProcess(process, &exitCode) || exitCode == STILL_ACTIVE;
+    CloseHandle(process);
+    return alive;
+#else
+    return kill(pid_t(pid), 0) == 0 || errno != ESRCH;
+#endif
+}
+
+// Temporary files are named <target>.<pid>.<counter>.tmp. Returns false for
+// any other file name
+static bool parseTempFileName(const std::string &name, uint32 &pid)
+{
+    const char *suffix = ".tmp";
+    size_t suffixLength = std::strlen(suffix);
+    if (name.size() <= suffixLength || name.compare(name.size() - suffixLength, suffixLength, suffix) != 0)
+        return false;
+
+    size_t counterEnd = name.size() - suffixLength;
+    size_t counterStart = name.find_last_of('.', counterEnd - 1);
+    if (counterStart == std::string::npos || counterStart == 0)
+        return false;
+    size_t pidStart = name.find_last_of('.', counterStart - 1);
+    if (pidStart == std::string::npos || pidStart == 0)
+        return false;
+
+    auto isNumber = [&](size_t start, size_t end) {
+        if (start == end)
+            return false;
+        for (size_t i = start; i < end; ++i)
+            if (name[i] < '0' || name[i] > '9')
+                return false;
+        return true;
+    };
+    if (!isNumber(pidStart + 1, counterStart) || !isNumber(counterStart + 1, counterEnd))
+        return false;
+
+    pid = uint32(std::strtoul(name.c_str() + pidStart + 1, nullptr, 10));
+    return true;
+}
+
+// Deletes temporary files in a directory that were left behind by crashed
+// processes: Files of processes that have exited, and files of a previous
+// process that had the same id as this one and that no stream of ours owns
+void FileUtils::deleteStaleTempFiles(const Path &dir)
+{
+    uint32 ownPid = currentProcessId();
+    for (const Path &p : dir.files("tmp")) {
+        uint32 pid;
+        if (!parseTempFileName(p.fileName().asString(), pid))
+            continue;
+
+        if (pid == ownPid) {
+            std::unique_lock<std::mutex> lock(_streamMutex);
+            if (!_pendingTempFiles.count(p))
+                deleteFile(p);
+        } else if (!processAlive(pid)) {
+            deleteFile(p);
+        }
+    }
+}
+
 void FileUtils::finalizeStream(std::ios *stream)
 {
-    auto iter = _metaData.find(stream);
+    std::unique_ptr<StreamMetadata> metaData;
+    {
+        std::unique_lock<std::mutex> lock(_streamMutex);
+        auto iter = _metaData.find(stream);
+        if (iter != _metaData.end()) {
+            metaData.reset(new StreamMetadata(std::move(iter->second)));
+            _metaData.erase(iter);
+        }
+    }
 
-    delete stream;
+    // Streams writing to a temporary file only replace their target if
+    // everything was written successfully
+    bool complete = true;
+    if (metaData && !metaData->targetPath.empty())
+        if (std::ostream *out = dynamic_cast<std::ostream *>(stream))
+            complete = out->flush().good();
 
-    if (iter != _metaData.end()) {
-        iter->second.streambuf.reset();
+    delete stream;
 
-        if (!iter->second.targetPath.empty())
-            moveFile(iter->second.srcPath, iter->second.targetPath, true);
-        _metaData.erase(iter);
+    if (metaData) {
+        metaData->streambuf.reset();
+
+        // The temporary file is synced before the rename and the directory
+        // after it, so that the target is never empty or truncated after a
+        // power loss either
+        if (!metaData->targetPath.empty()) {
+            if (complete)
+                complete = syncFile(metaData->srcPath);
+            if (complete && moveFile(metaData->srcPath, metaData->targetPath, true))
+                syncDirectory(metaData->targetPath.absolute().parent());
+            else
+                deleteFile(metaData->srcPath);
+
+            std::unique_lock<std::mutex> lock(_streamMutex);
+            _pendingTempFiles.erase(metaData->srcPath);
+        }
     }
 }
 
@@ -270,6 +417,7 @@ OutputStreamHandle FileUtils::openFileOutputStream(const Path &p)
     std::unique_ptr<FileOutputStreambuf> streambuf(new FileOutputStreambuf(std::move(file)));
     std::shared_ptr<std::ostream> out(new std::ostream(streambuf.get()),
             [](std::ostream *stream){ finalizeStream(stream); });
+    std::unique_lock<std::mutex> lock(_streamMutex);
     _metaData.insert(std::make_pair(out.get(), std::move(StreamMetadata(std::move(streambuf)))));
 #else
     std::shared_ptr<std::ostream> out(new std::ofstream(p.absolute().asString(),
@@ -279,6 +427,7 @@ OutputStreamHandle FileUtils::openFileOutputStream(const Path &p)
     if (!out->good())
         return nullptr;
 
+    std::unique_lock<std::mutex> lock(_streamMutex);
     _metaData.insert(std::make_pair(out.get(), StreamMetadata()));
 #endif
 
@@ -288,9 +437,12 @@ OutputStreamHandle FileUtils::openFileOutputStream(const Path &p)
 std::shared_ptr<ZipReader> FileUtils::openArchive(const Path &p)
 {
     Path key = p.normalize();
-    auto iter = _archives.find(key);
-    if (iter != _archives.end())
-        return iter->second;
+    {
+        std::unique_lock<std::mutex> lock(_streamMutex);
+        auto iter = _archives.find(key);
+        if (iter != _archives.end())
+            return iter->second;
+    }
 
     std::shared_ptr<ZipReader> archive;
     try {
@@ -299,8 +451,8 @@ std::shared_ptr<ZipReader> FileUtils::openArchive(const Path &p)
         return nullptr;
     }
 
-    _archives.insert(std::make_pair(key, archive));
-    return std::move(archive);
+    std::unique_lock<std::mutex> lock(_streamMutex);
+    return _archives.insert(std::make_pair(key, archive)).first->second;
 }
 
 bool FileUtils::recursiveArchiveFind(const Path &p, std::shared_ptr<ZipReader> &archive,
@@ -358,6 +510,13 @@ bool FileUtils::execStat(const Path &p, StatStruct &dst)
     NativeStatStruct stat;
     if (execNativeStat(p, stat)) {
         dst.size        = stat.st_size;
+#if _WIN32
+        dst.modified    = uint64(stat.st_mtime)*1000000000ull;
+#elif __APPLE__
+        dst.modified    = uint64(stat.st_mtimespec.tv_sec)*1000000000ull + uint64(stat.st_mtimespec.tv_nsec);
+#else
+        dst.modified    = uint64(stat.st_mtim.tv_sec)*1000000000ull + uint64(stat.st_mtim.tv_nsec);
+#endif
         dst.isDirectory = S_ISDIR(stat.st_mode);
         dst.isFile      = S_ISREG(stat.st_mode);
         return true;
@@ -367,6 +526,7 @@ bool FileUtils::execStat(const Path &p, StatStruct &dst)
     const ZipEntry *entry = nullptr;
     if (recursiveArchiveFind(p, archive, entry)) {
         dst.size        = entry->size;
+        dst.modified    = 0;
         dst.isDirectory = entry->isDirectory;
         dst.isFile      = !entry->isDirectory;
         return true;
@@ -431,6 +591,14 @@ uint64 FileUtils::fileSize(const Path &path)
     return info.size;
 }
 
+uint64 FileUtils::lastModified(const Path &path)
+{
+    StatStruct info;
+    if (!execStat(path, info))
+        return 0;
+    return info.modified;
+}
+
 
 bool FileUtils::createDirectory(const Path &path, bool recursive)
 {
@@ -562,6 +730,7 @@ InputStreamHandle FileUtils::openInputStream(const Path &p)
         std::unique_ptr<FileInputStreambuf> streambuf(new FileInputStreambuf(std::move(file)));
         std::shared_ptr<std::istream> in(new std::istream(streambuf.get()),
                 [](std::istream *stream){ finalizeStream(stream); });
+        std::unique_lock<std::mutex> lock(_streamMutex);
         _metaData.insert(std::make_pair(in.get(), StreamMetadata(std::move(streambuf))));
 #else
         std::shared_ptr<std::istream> in(new std::ifstream(p.absolute().asString(),
@@ -583,6 +752,7 @@ InputStreamHandle FileUtils::openInputStream(const Path &p)
 
         std::shared_ptr<std::istream> in(new std::istream(streambuf.get()),
                 [](std::istream *stream){ finalizeStream(stream); });
+        std::unique_lock<std::mutex> lock(_streamMutex);
         _metaData.insert(std::make_pair(in.get(), StreamMetadata(std::move(streambuf), std::move(archive))));
 
         return std::move(in);
@@ -591,21 +761,35 @@ InputStreamHandle FileUtils::openInputStream(const Path &p)
     return nullptr;
 }
 
+// Files are written to a temporary file first and moved over the target when
+// the stream is closed, so that an interrupted write never leaves a truncated
+// file behind. Temporary file names contain the process id and a counter, so
+// that concurrent writers of the same target (in this or other processes)
+// never share one. Temporary files of crashed processes are removed the first
+// time a stream is opened in their directory
 OutputStreamHandle FileUtils::openOutputStream(const Path &p)
 {
-    if (!p.exists())
-        return openFileOutputStream(p);
-
-    Path tmpPath(p + ".tmp");
-    int index = 0;
-    while (tmpPath.exists())
-        tmpPath = p + tfm::format(".tmp%03d", ++index);
+    Path target = p.absolute();
+    Path dir = target.parent().stripSeparator();
+    Path tmpPath;
+    bool cleanDirectory;
+    {
+        std::unique_lock<std::mutex> lock(_streamMutex);
+        tmpPath = target + tfm::format(".%d.%d.tmp", currentProcessId(), ++_tempFileCounter);
+        _pendingTempFiles.insert(tmpPath);
+        cleanDirectory = _cleanedTempDirectories.insert(dir).second;
+    }
+    if (cleanDirectory)
+        deleteStaleTempFiles(dir);
 
     OutputStreamHandle out = openFileOutputStream(tmpPath);
+    std::unique_lock<std::mutex> lock(_streamMutex);
     if (out) {
         auto iter = _metaData.find(out.get());
         iter->second.srcPath = tmpPath;
-        iter->second.targetPath = p;
+        iter->second.targetPath = target;
+    } else {
+        _pendingTempFiles.erase(tmpPath);
     }
 
     return std::move(out);
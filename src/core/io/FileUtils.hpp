@@ -8,10 +8,12 @@
 
 #include <rapidjson/document.h>
 #include <unordered_map>
+#include <unordered_set>
 #include <functional>
 #include <streambuf>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -34,6 +36,8 @@ public:
 
 // WARNING: Do not assume any functions operating on the file system to be thread-safe or re-entrant.
 // The underlying operating system API as well as the implementation here do not make this safe.
+// The only exception are streams, which may be opened and closed from multiple threads at once
+// (e.g. to load resources in parallel). Changing the current directory is never thread-safe.
 class FileUtils
 {
     FileUtils() {}
@@ -41,6 +45,7 @@ class FileUtils
     struct StatStruct
     {
         uint64 size;
+        uint64 modified;
         bool isDirectory;
         bool isFile;
     };
@@ -70,9 +75,23 @@ class FileUtils
 
     static std::unordered_map<Path, std::shared_ptr<ZipReader>> _archives;
     static std::unordered_map<const std::ios *, StreamMetadata> _metaData;
+    // Temporary files of output streams of this process that are open or
+    // being moved over their target
+    static std::unordered_set<Path> _pendingTempFiles;
+    // Makes temporary file names unique within the process; the process id
+    // makes them unique between processes
+    static uint64 _tempFileCounter;
+    // Directories that were already searched for stale temporary files. A
+    // directory is only searched once per process
+    static std::unordered_set<Path> _cleanedTempDirectories;
+    // Protects _archives, _metaData and the temporary file state
+    static std::mutex _streamMutex;
     static Path _currentDir;
 
     static void finalizeStream(std::ios *stream);
+    static bool syncFile(const Path &p);
+    static void syncDirectory(const Path &p);
+    static void deleteStaleTempFiles(const Path &dir);
     static OutputStreamHandle openFileOutputStream(const Path &p);
 
     static std::shared_ptr<ZipReader> openArchive(const Path &p);
@@ -90,6 +109,10 @@ public:
     static Path getDataPath();
 
     static uint64 fileSize(const Path &path);
+    // Modification time in nanoseconds since the epoch (or the best
+    // resolution the platform offers), or 0 if unknown (e.g. for files
+    // inside archives)
+    static uint64 lastModified(const Path &path);
 
     static bool createDirectory(const Path &path, bool recursive = true);
 
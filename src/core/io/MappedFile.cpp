@@ -0,0 +1,89 @@
+#include "MappedFile.hpp"
+#include "UnicodeUtils.hpp"
+
+#if _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace Tungsten {
+
+MappedFile::MappedFile()
+: _data(nullptr),
+  _size(0)
+#if _WIN32
+  , _file(INVALID_HANDLE_VALUE),
+  _mapping(nullptr)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+#if _WIN32
+    if (_data)
+        UnmapViewOfFile(_data);
+    if (_mapping)
+        CloseHandle(_mapping);
+    if (_file != INVALID_HANDLE_VALUE)
+        CloseHandle(_file);
+#else
+    if (_data)
+        munmap(const_cast<uint8 *>(_data), size_t(_size));
+#endif
+}
+
+std::shared_ptr<MappedFile> MappedFile::open(const Path &path)
+{
+    std::shared_ptr<MappedFile> result(new MappedFile());
+
+#if _WIN32
+    std::string nativePath = path.absolute().normalize().nativeSeparators().asString();
+    std::wstring widePath = UnicodeUtils::utf8ToWchar("\\\\?\\" + nativePath);
+
+    result->_file = CreateFileW(widePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (result->_file == INVALID_HANDLE_VALUE)
+        return nullptr;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(result->_file, &size) || size.QuadPart == 0)
+        return nullptr;
+
+    result->_mapping = CreateFileMappingW(result->_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!result->_mapping)
+        return nullptr;
+
+    result->_data = static_cast<const uint8 *>(MapViewOfFile(result->_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!result->_data)
+        return nullptr;
+    result->_size = uint64(size.QuadPart);
+#else
+    int fd = ::open(path.absolute().asString().c_str(), O_RDONLY);
+    if (fd == -1)
+        return nullptr;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return nullptr;
+    }
+
+    void *data = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps its own reference to the file
+    close(fd);
+    if (data == MAP_FAILED)
+        return nullptr;
+
+    result->_data = static_cast<const uint8 *>(data);
+    result->_size = uint64(info.st_size);
+#endif
+
+    return result;
+}
+
+}
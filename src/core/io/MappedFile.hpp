@@ -0,0 +1,49 @@
+#ifndef MAPPEDFILE_HPP_
+#define MAPPEDFILE_HPP_
+
+#include "Path.hpp"
+
+#include "IntTypes.hpp"
+
+#include <memory>
+
+namespace Tungsten {
+
+// Read-only view of a file mapped into the address space. Pages are only
+// read from disk when they are first touched, and the view stays valid for
+// as long as the MappedFile object is alive
+class MappedFile
+{
+    const uint8 *_data;
+    uint64 _size;
+#if _WIN32
+    void *_file;
+    void *_mapping;
+#endif
+
+    MappedFile();
+
+public:
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // Returns nullptr if the file cannot be mapped, e.g. because it lives
+    // inside a zip archive. Callers should fall back to stream reads then
+    static std::shared_ptr<MappedFile> open(const Path &path);
+
+    const uint8 *data() const
+    {
+        return _data;
+    }
+
+    uint64 size() const
+    {
+        return _size;
+    }
+};
+
+}
+
+#endif /* MAPPEDFILE_HPP_ */
@@ -1,9 +1,14 @@
 #include "MeshIO.hpp"
+#include "MappedFile.hpp"
 #include "FileUtils.hpp"
 #include "ObjLoader.hpp"
 #include "IntTypes.hpp"
 
+#include "Debug.hpp"
+
 #include <tinyformat/tinyformat.hpp>
+#include <type_traits>
+#include <cstring>
 
 namespace Tungsten {
 
@@ -27,26 +32,230 @@ bool loadWo3(const Path &path, std::vector<Vertex> &verts, std::vector<TriangleI
     return true;
 }
 
-bool saveWo3(const Path &path, const std::vector<Vertex> &verts, const std::vector<TriangleI> &tris)
+bool saveWo3(const Path &path, const MeshBuffer<Vertex> &verts, const MeshBuffer<TriangleI> &tris)
 {
     OutputStreamHandle stream = FileUtils::openOutputStream(path);
     if (!stream)
         return false;
 
     FileUtils::streamWrite(stream, uint64(verts.size()));
-    FileUtils::streamWrite(stream, verts);
+    FileUtils::streamWrite(stream, verts.data(), verts.size());
     FileUtils::streamWrite(stream, uint64(tris.size()));
-    FileUtils::streamWrite(stream, tris);
+    FileUtils::streamWrite(stream, tris.data(), tris.size());
+
+    return true;
+}
+
+// .wo4 is laid out so that it can be mapped into memory and used in place:
+// a fixed size header followed by the vertex, triangle and (optional) area
+// CDF arrays, each starting at a cache line aligned offset. The arrays use
+// the in-memory layout of Vertex and TriangleI, so files are only portable
+// between machines of the same endianness
+static const char Wo4Magic[4] = {'W', 'O', '4', '\0'};
+static const uint32 Wo4Version = 1;
+static const uint64 Wo4Alignment = 64;
+
+enum Wo4Flags
+{
+    Wo4HasBounds  = (1 << 0),
+    Wo4HasAreaCdf = (1 << 1),
+};
+
+struct Wo4Header
+{
+    char magic[4];
+    uint32 version;
+    uint32 flags;
+    float totalArea;
+    uint64 numVerts;
+    uint64 numTris;
+    uint64 vertOffset;
+    uint64 triOffset;
+    uint64 cdfOffset;
+    float boundsMin[3];
+    float boundsMax[3];
+    uint8 padding[48];
+};
 
+static_assert(sizeof(Wo4Header) == 128, "Unexpected .wo4 header size");
+static_assert(sizeof(Vertex) == 32 && std::is_trivially_copyable<Vertex>::value,
+        "Vertex layout does not match .wo4 files");
+static_assert(sizeof(TriangleI) == 16 && std::is_trivially_copyable<TriangleI>::value,
+        "TriangleI layout does not match .wo4 files");
+
+static uint64 alignWo4Offset(uint64 offset)
+{
+    return (offset + Wo4Alignment - 1) & ~(Wo4Alignment - 1);
+}
+
+static bool checkWo4Header(const Wo4Header &header, uint64 fileSize)
+{
+    if (std::memcmp(header.magic, Wo4Magic, sizeof(Wo4Magic)) != 0 || header.version != Wo4Version)
+        return false;
+
+    uint64 vertEnd = header.vertOffset + header.numVerts*sizeof(Vertex);
+    uint64 triEnd  = header.triOffset  + header.numTris*sizeof(TriangleI);
+    if (header.vertOffset < sizeof(Wo4Header) || header.triOffset < vertEnd || triEnd > fileSize)
+        return false;
+    if (header.vertOffset % Wo4Alignment != 0 || header.triOffset % Wo4Alignment != 0)
+        return false;
+    if (header.flags & Wo4HasAreaCdf) {
+        uint64 cdfEnd = header.cdfOffset + (header.numTris + 1)*sizeof(float);
+        if (header.cdfOffset < triEnd || header.cdfOffset % Wo4Alignment != 0 || cdfEnd > fileSize)
+            return false;
+    }
     return true;
 }
 
+static void readWo4Metadata(const Wo4Header &header, MeshMetadata &metadata)
+{
+    metadata.hasBounds = (header.flags & Wo4HasBounds) != 0;
+    if (metadata.hasBounds)
+        metadata.bounds = Box3f(
+            Vec3f(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]),
+            Vec3f(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2])
+        );
+    metadata.hasAreaCdf = (header.flags & Wo4HasAreaCdf) != 0;
+    metadata.totalArea = header.totalArea;
+}
+
+// Fallback for files that cannot be mapped, e.g. because they are stored
+// inside an archive. Sections are read in file order, so the stream does
+// not need to be seekable
+static bool streamWo4(const Path &path, MeshBuffer<Vertex> &verts, MeshBuffer<TriangleI> &tris,
+        MeshMetadata &metadata)
+{
+    InputStreamHandle stream = FileUtils::openInputStream(path);
+    if (!stream)
+        return false;
+
+    Wo4Header header;
+    FileUtils::streamRead(stream, header);
+    if (!*stream || !checkWo4Header(header, FileUtils::fileSize(path)))
+        return false;
+
+    std::vector<Vertex> vertData(size_t(header.numVerts));
+    std::vector<TriangleI> triData(size_t(header.numTris));
+    stream->ignore(header.vertOffset - sizeof(Wo4Header));
+    FileUtils::streamRead(stream, vertData);
+    stream->ignore(header.triOffset - (header.vertOffset + header.numVerts*sizeof(Vertex)));
+    FileUtils::streamRead(stream, triData);
+
+    readWo4Metadata(header, metadata);
+    if (metadata.hasAreaCdf) {
+        std::vector<float> cdf(size_t(header.numTris + 1));
+        stream->ignore(header.cdfOffset - (header.triOffset + header.numTris*sizeof(TriangleI)));
+        FileUtils::streamRead(stream, cdf);
+        metadata.areaCdf = MeshBuffer<float>(std::move(cdf));
+    }
+    if (!*stream)
+        return false;
+
+    verts = MeshBuffer<Vertex>(std::move(vertData));
+    tris = MeshBuffer<TriangleI>(std::move(triData));
+
+    return true;
+}
+
+bool loadWo4(const Path &path, MeshBuffer<Vertex> &verts, MeshBuffer<TriangleI> &tris, MeshMetadata &metadata)
+{
+    std::shared_ptr<MappedFile> file = MappedFile::open(path);
+    if (!file)
+        return streamWo4(path, verts, tris, metadata);
+
+    Wo4Header header;
+    if (file->size() < sizeof(Wo4Header))
+        return false;
+    std::memcpy(&header, file->data(), sizeof(Wo4Header));
+    if (!checkWo4Header(header, file->size())) {
+        DBG("Invalid or unsupported .wo4 file '%s'", path);
+        return false;
+    }
+
+    const uint8 *base = file->data();
+    verts = MeshBuffer<Vertex>(file, reinterpret_cast<const Vertex *>(base + header.vertOffset),
+            size_t(header.numVerts));
+    tris = MeshBuffer<TriangleI>(file, reinterpret_cast<const TriangleI *>(base + header.triOffset),
+            size_t(header.numTris));
+
+    readWo4Metadata(header, metadata);
+    if (metadata.hasAreaCdf)
+        metadata.areaCdf = MeshBuffer<float>(file, reinterpret_cast<const float *>(base + header.cdfOffset),
+                size_t(header.numTris + 1));
+
+    return true;
+}
+
+bool saveWo4(const Path &path, const MeshBuffer<Vertex> &verts, const MeshBuffer<TriangleI> &tris)
+{
+    Box3f bounds;
+    for (const Vertex &v : verts)
+        bounds.grow(v.pos());
+
+    // Running sum is kept in double precision so that the normalized
+    // CDF of very large meshes stays monotonic and ends at exactly 1
+    std::vector<float> cdf(tris.size() + 1);
+    std::vector<double> runningSum(tris.size() + 1, 0.0);
+    for (size_t i = 0; i < tris.size(); ++i) {
+        const TriangleI &t = tris[i];
+        bool valid = t.v0 < verts.size() && t.v1 < verts.size() && t.v2 < verts.size();
+        float area = valid ? MathUtil::triangleArea(verts[t.v0].pos(), verts[t.v1].pos(), verts[t.v2].pos()) : 0.0f;
+        runningSum[i + 1] = runningSum[i] + area;
+    }
+    double totalArea = runningSum.back();
+    for (size_t i = 0; i <= tris.size(); ++i)
+        cdf[i] = totalArea > 0.0 ? float(runningSum[i]/totalArea) : float(i)/max(tris.size(), size_t(1));
+    cdf.back() = 1.0f;
+
+    Wo4Header header;
+    std::memset(&header, 0, sizeof(Wo4Header));
+    std::memcpy(header.magic, Wo4Magic, sizeof(Wo4Magic));
+    header.version = Wo4Version;
+    header.flags = Wo4HasAreaCdf;
+    header.totalArea = float(totalArea);
+    header.numVerts = verts.size();
+    header.numTris = tris.size();
+    header.vertOffset = alignWo4Offset(sizeof(Wo4Header));
+    header.triOffset = alignWo4Offset(header.vertOffset + verts.size()*sizeof(Vertex));
+    header.cdfOffset = alignWo4Offset(header.triOffset + tris.size()*sizeof(TriangleI));
+    if (!verts.empty()) {
+        header.flags |= Wo4HasBounds;
+        for (int i = 0; i < 3; ++i) {
+            header.boundsMin[i] = bounds.min()[i];
+            header.boundsMax[i] = bounds.max()[i];
+        }
+    }
+
+    OutputStreamHandle stream = FileUtils::openOutputStream(path);
+    if (!stream)
+        return false;
+
+    uint64 offset = 0;
+    auto padTo = [&](uint64 target) {
+        for (; offset < target; ++offset)
+            stream->put(0);
+    };
+
+    FileUtils::streamWrite(stream, header);
+    offset += sizeof(Wo4Header);
+    padTo(header.vertOffset);
+    FileUtils::streamWrite(stream, verts.data(), verts.size());
+    offset += verts.size()*sizeof(Vertex);
+    padTo(header.triOffset);
+    FileUtils::streamWrite(stream, tris.data(), tris.size());
+    offset += tris.size()*sizeof(TriangleI);
+    padTo(header.cdfOffset);
+    FileUtils::streamWrite(stream, cdf);
+
+    return bool(*stream);
+}
+
 bool loadObj(const Path &path, std::vector<Vertex> &verts, std::vector<TriangleI> &tris)
 {
     return ObjLoader::loadGeometryOnly(path, verts, tris);
 }
 
-bool saveObj(const Path &path, const std::vector<Vertex> &verts, const std::vector<TriangleI> &tris)
+bool saveObj(const Path &path, const MeshBuffer<Vertex> &verts, const MeshBuffer<TriangleI> &tris)
 {
     OutputStreamHandle stream = FileUtils::openOutputStream(path);
     if (!stream)
@@ -73,13 +282,48 @@ bool load(const Path &path, std::vector<Vertex> &verts, std::vector<TriangleI> &
         return loadWo3(path, verts, tris);
     else if (path.testExtension("obj"))
         return loadObj(path, verts, tris);
+    else if (path.testExtension("wo4")) {
+        MeshBuffer<Vertex> vertBuffer;
+        MeshBuffer<TriangleI> triBuffer;
+        MeshMetadata metadata;
+        if (!loadWo4(path, vertBuffer, triBuffer, metadata))
+            return false;
+        verts = std::move(vertBuffer.vector());
+        tris = std::move(triBuffer.vector());
+        return true;
+    }
     return false;
 }
 
 bool save(const Path &path, const std::vector<Vertex> &verts, const std::vector<TriangleI> &tris)
+{
+    return save(path,
+        MeshBuffer<Vertex>(nullptr, verts.data(), verts.size()),
+        MeshBuffer<TriangleI>(nullptr, tris.data(), tris.size())
+    );
+}
+
+bool load(const Path &path, MeshBuffer<Vertex> &verts, MeshBuffer<TriangleI> &tris, MeshMetadata &metadata)
+{
+    metadata = MeshMetadata();
+    if (path.testExtension("wo4"))
+        return loadWo4(path, verts, tris, metadata);
+
+    std::vector<Vertex> vertData;
+    std::vector<TriangleI> triData;
+    if (!load(path, vertData, triData))
+        return false;
+    verts = MeshBuffer<Vertex>(std::move(vertData));
+    tris = MeshBuffer<TriangleI>(std::move(triData));
+    return true;
+}
+
+bool save(const Path &path, const MeshBuffer<Vertex> &verts, const MeshBuffer<TriangleI> &tris)
 {
     if (path.testExtension("wo3"))
         return saveWo3(path, verts, tris);
+    else if (path.testExtension("wo4"))
+        return saveWo4(path, verts, tris);
     else if (path.testExtension("obj"))
         return saveObj(path, verts, tris);
     return false;
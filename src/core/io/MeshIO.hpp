@@ -3,9 +3,12 @@
 
 #include "Path.hpp"
 
+#include "primitives/MeshBuffer.hpp"
 #include "primitives/Triangle.hpp"
 #include "primitives/Vertex.hpp"
 
+#include "math/Box.hpp"
+
 #include <string>
 #include <vector>
 
@@ -13,9 +16,34 @@ namespace Tungsten {
 
 namespace MeshIO {
 
+// Optional data precomputed at save time. Only .wo4 files carry it
+struct MeshMetadata
+{
+    bool hasBounds;
+    Box3f bounds;
+
+    // Normalized CDF over the object space triangle areas, with
+    // numTris + 1 entries starting at 0 and ending at 1
+    bool hasAreaCdf;
+    MeshBuffer<float> areaCdf;
+    float totalArea;
+
+    MeshMetadata()
+    : hasBounds(false),
+      hasAreaCdf(false),
+      totalArea(0.0f)
+    {
+    }
+};
+
 bool load(const Path &path, std::vector<Vertex> &verts, std::vector<TriangleI> &tris);
 bool save(const Path &path, const std::vector<Vertex> &verts, const std::vector<TriangleI> &tris);
 
+// .wo4 files are memory mapped where possible, in which case the returned
+// buffers are views into the mapping and no mesh data is copied
+bool load(const Path &path, MeshBuffer<Vertex> &verts, MeshBuffer<TriangleI> &tris, MeshMetadata &metadata);
+bool save(const Path &path, const MeshBuffer<Vertex> &verts, const MeshBuffer<TriangleI> &tris);
+
 }
 
 }
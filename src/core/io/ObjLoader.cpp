@@ -1,5 +1,6 @@
 #include "ObjLoader.hpp"
 #include "DirectoryChange.hpp"
+#include "MappedFile.hpp"
 #include "FileUtils.hpp"
 #include "Scene.hpp"
 
@@ -15,6 +16,9 @@
 
 #include "cameras/PinholeCamera.hpp"
 
+#include "thread/ThreadUtils.hpp"
+#include "thread/ThreadPool.hpp"
+
 #include "bsdfs/RoughConductorBsdf.hpp"
 #include "bsdfs/RoughPlasticBsdf.hpp"
 #include "bsdfs/TransparencyBsdf.hpp"
@@ -27,10 +31,123 @@
 
 #include <tinyformat/tinyformat.hpp>
 #include <algorithm>
+#include <iterator>
+#include <charconv>
+#include <cstring>
+#include <cstdlib>
 #include <cctype>
 
 namespace Tungsten {
 
+// Chunks smaller than this are not worth handing to another thread
+static CONSTEXPR size_t MinChunkSize = 1024*1024;
+
+// The parsing functions below work on lines inside the (not null
+// terminated) file buffer and never allocate
+
+static inline bool isLineSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static inline void skipLineSpace(const char *&s, const char *end)
+{
+    while (s < end && isLineSpace(*s))
+        s++;
+}
+
+// Same matching rules as ObjLoader::hasPrefix, with the end of the line
+// taking the place of the null terminator
+static bool linePrefix(const char *s, const char *end, const char *pre)
+{
+    for (; *pre; ++s, ++pre)
+        if (s == end || std::tolower(*s) != std::tolower(*pre))
+            return false;
+    return s != end && std::isspace(*s);
+}
+
+static bool parseFloat(const char *&s, const char *end, float &dst)
+{
+    skipLineSpace(s, end);
+    // from_chars does not accept an explicit plus sign
+    if (s < end && *s == '+')
+        s++;
+#ifdef __cpp_lib_to_chars
+    std::from_chars_result result = std::from_chars(s, end, dst);
+    if (result.ec != std::errc())
+        return false;
+    s = result.ptr;
+#else
+    char token[64];
+    size_t length = 0;
+    while (s + length < end && length < sizeof(token) - 1 && !isLineSpace(s[length]))
+        length++;
+    std::memcpy(token, s, length);
+    token[length] = '\0';
+    char *tokenEnd;
+    dst = std::strtof(token, &tokenEnd);
+    if (tokenEnd == token)
+        return false;
+    s += tokenEnd - token;
+#endif
+    return true;
+}
+
+static bool parseInt(const char *&s, const char *end, int32 &dst)
+{
+    skipLineSpace(s, end);
+    if (s < end && *s == '+')
+        s++;
+    std::from_chars_result result = std::from_chars(s, end, dst);
+    if (result.ec != std::errc())
+        return false;
+    s = result.ptr;
+    return true;
+}
+
+template<unsigned Size>
+static Vec<float, Size> parseVector(const char *s, const char *end)
+{
+    Vec<float, Size> result(0.0f);
+    for (unsigned i = 0; i < Size; ++i)
+        if (!parseFloat(s, end, result[i]))
+            break;
+    return result;
+}
+
+static void parseFace(const char *s, const char *end, std::vector<Vec3i> &dst)
+{
+    while (true) {
+        int32 indices[] = {0, 0, 0};
+        for (int i = 0; i < 3; ++i) {
+            if ((s == end || *s != '/') && !parseInt(s, end, indices[i]))
+                break;
+            if (s < end && *s == '/')
+                s++;
+            else
+                break;
+        }
+        if (indices[0] == 0)
+            break;
+
+        dst.emplace_back(indices[0], indices[1], indices[2]);
+    }
+}
+
+static void parseCurve(const char *s, const char *end, std::vector<Vec3i> &dst)
+{
+    int32 index;
+    while (parseInt(s, end, index)) {
+        if (s < end && *s == '/') {
+            s++;
+            int32 tmp;
+            parseInt(s, end, tmp);
+        }
+
+        dst.emplace_back(index, 0, 0);
+    }
+}
+
 template<unsigned Size>
 Vec<float, Size> ObjLoader::loadVector(const char *s)
 {
@@ -89,58 +206,6 @@ uint32 ObjLoader::fetchVertex(int32 pos, int32 normal, int32 uv)
     }
 }
 
-void ObjLoader::loadCurve(const char *line)
-{
-    uint32 prev = 0;
-    int vertexCount = 0;
-
-    std::istringstream ss(line);
-    while (!ss.fail() && !ss.eof()) {
-        int32 index;
-        ss >> index;
-        if (ss.peek() == '/') {
-            ss.get();
-            uint32 tmp;
-            ss >> tmp;
-        }
-
-        uint32 current = fetchVertex(index, 0, 0);
-
-        if (++vertexCount >= 2)
-            _segments.emplace_back(SegmentI{prev, current});
-        prev = current;
-    }
-}
-
-void ObjLoader::loadFace(const char *line)
-{
-    uint32 first = 0, current = 0;
-    int vertexCount = 0;
-
-    std::istringstream ss(line);
-    while (!ss.fail() && !ss.eof()) {
-        int32 indices[] = {0, 0, 0};
-        for (int i = 0; i < 3; ++i) {
-            if (ss.peek() != '/')
-                ss >> indices[i];
-            if (ss.peek() == '/')
-                ss.get();
-            else
-                break;
-        }
-        if (indices[0] == 0)
-            break;
-
-        uint32 vert = fetchVertex(indices[0], indices[2], indices[1]);
-
-        if (++vertexCount >= 3)
-            _tris.emplace_back(first, current, vert, _currentMaterial);
-        else
-            first = current;
-        current = vert;
-    }
-}
-
 std::string ObjLoader::extractString(const char *line)
 {
     std::string str(line);
@@ -222,18 +287,9 @@ void ObjLoader::loadLine(const char *line)
         clearPerMeshData();
     }
 
+    // Vertex attributes, faces and curves are handled by parseChunk
     skipWhitespace(line);
-    if (hasPrefix(line, "v"))
-        _pos.push_back(loadVector<3>(line + 2));
-    else if (hasPrefix(line, "vn"))
-        _normal.push_back(loadVector<3>(line + 3));
-    else if (hasPrefix(line, "vt"))
-        _uv.push_back(loadVector<2>(line + 3));
-    else if (hasPrefix(line, "f"))
-        loadFace(line + 2);
-    else if (hasPrefix(line, "l"))
-        loadCurve(line + 2);
-    else if (_geometryOnly)
+    if (_geometryOnly)
         return;
     else if (hasPrefix(line, "mtllib"))
         loadMaterialLibrary(line + 7);
@@ -517,17 +573,163 @@ std::shared_ptr<Primitive> ObjLoader::finalizeMesh()
     return std::move(prim);
 }
 
-void ObjLoader::loadFile(std::istream &in)
+void ObjLoader::parseChunk(const char *fileBegin, const char *begin, const char *end, ParsedChunk &chunk)
+{
+    for (const char *line = begin; line < end;) {
+        const char *lineEnd = static_cast<const char *>(std::memchr(line, '\n', end - line));
+        if (!lineEnd)
+            lineEnd = end;
+
+        const char *s = line;
+        skipLineSpace(s, lineEnd);
+
+        ParsedLine parsed;
+        parsed.numPos    = uint32(chunk.pos.size());
+        parsed.numNormal = uint32(chunk.normal.size());
+        parsed.numUv     = uint32(chunk.uv.size());
+        parsed.begin = chunk.indices.size();
+
+        if (linePrefix(s, lineEnd, "v")) {
+            chunk.pos.push_back(parseVector<3>(s + 1, lineEnd));
+        } else if (linePrefix(s, lineEnd, "vn")) {
+            chunk.normal.push_back(parseVector<3>(s + 2, lineEnd));
+        } else if (linePrefix(s, lineEnd, "vt")) {
+            chunk.uv.push_back(parseVector<2>(s + 2, lineEnd));
+        } else if (linePrefix(s, lineEnd, "f") || linePrefix(s, lineEnd, "l")) {
+            bool isFace = linePrefix(s, lineEnd, "f");
+            if (isFace)
+                parseFace(s + 1, lineEnd, chunk.indices);
+            else
+                parseCurve(s + 1, lineEnd, chunk.indices);
+            parsed.type = isFace ? LINE_FACE : LINE_CURVE;
+            parsed.end = chunk.indices.size();
+            if (parsed.end > parsed.begin)
+                chunk.lines.push_back(parsed);
+        } else if (s < lineEnd && *s != '#') {
+            parsed.type = LINE_OTHER;
+            parsed.begin = uint64(line - fileBegin);
+            parsed.end = uint64(lineEnd - fileBegin);
+            chunk.lines.push_back(parsed);
+        }
+
+        line = lineEnd + 1;
+    }
+}
+
+Vec3i ObjLoader::resolveIndex(Vec3i index, const ParsedLine &line, const Vec3i &chunkBase) const
 {
-    std::string line;
-    while (!in.fail() && !in.eof()) {
-        std::getline(in, line);
+    // Relative indices refer to the attributes that were read before
+    // this line, which may include attributes from earlier chunks
+    if (index.x() < 0)
+        index.x() += chunkBase.x() + int32(line.numPos) + 1;
+    if (index.y() < 0)
+        index.y() += chunkBase.y() + int32(line.numUv) + 1;
+    if (index.z() < 0)
+        index.z() += chunkBase.z() + int32(line.numNormal) + 1;
+    return index;
+}
 
-        loadLine(line.c_str());
+void ObjLoader::replayChunk(const ParsedChunk &chunk, const char *fileBegin, Vec3i chunkBase)
+{
+    for (const ParsedLine &line : chunk.lines) {
+        if (line.type == LINE_FACE) {
+            uint32 first = 0, current = 0;
+            int vertexCount = 0;
+            for (uint64 i = line.begin; i < line.end; ++i) {
+                Vec3i index = resolveIndex(chunk.indices[i], line, chunkBase);
+                uint32 vert = fetchVertex(index.x(), index.z(), index.y());
+
+                if (++vertexCount >= 3)
+                    _tris.emplace_back(first, current, vert, _currentMaterial);
+                else
+                    first = current;
+                current = vert;
+            }
+        } else if (line.type == LINE_CURVE) {
+            uint32 prev = 0;
+            int vertexCount = 0;
+            for (uint64 i = line.begin; i < line.end; ++i) {
+                uint32 current = fetchVertex(resolveIndex(chunk.indices[i], line, chunkBase).x(), 0, 0);
+
+                if (++vertexCount >= 2)
+                    _segments.emplace_back(SegmentI{prev, current});
+                prev = current;
+            }
+        } else {
+            std::string text(fileBegin + line.begin, fileBegin + line.end);
+            loadLine(text.c_str());
+        }
     }
 }
 
-ObjLoader::ObjLoader(std::istream &in, const Path &path, std::shared_ptr<TextureCache> cache)
+void ObjLoader::loadFile(const char *begin, const char *end)
+{
+    size_t size = end - begin;
+    uint32 numChunks = 1;
+    if (ThreadUtils::pool && size >= 2*MinChunkSize)
+        numChunks = uint32(min(size/MinChunkSize, size_t(ThreadUtils::pool->threadCount())));
+
+    std::vector<const char *> chunkStarts(numChunks + 1, end);
+    chunkStarts[0] = begin;
+    for (uint32 i = 1; i < numChunks; ++i) {
+        const char *split = max(begin + (size*i)/numChunks, chunkStarts[i - 1]);
+        const char *newline = static_cast<const char *>(std::memchr(split, '\n', end - split));
+        chunkStarts[i] = newline ? newline + 1 : end;
+    }
+
+    std::vector<ParsedChunk> chunks(numChunks);
+    if (numChunks == 1) {
+        parseChunk(begin, begin, end, chunks[0]);
+    } else {
+        std::shared_ptr<TaskGroup> group = ThreadUtils::pool->enqueue([&](uint32 i, uint32, uint32) {
+            parseChunk(begin, chunkStarts[i], chunkStarts[i + 1], chunks[i]);
+        }, numChunks);
+        ThreadUtils::pool->yield(*group);
+    }
+
+    size_t numPos = 0, numNormal = 0, numUv = 0;
+    for (const ParsedChunk &chunk : chunks) {
+        numPos    += chunk.pos.size();
+        numNormal += chunk.normal.size();
+        numUv     += chunk.uv.size();
+    }
+    _pos.reserve(_pos.size() + numPos);
+    _normal.reserve(_normal.size() + numNormal);
+    _uv.reserve(_uv.size() + numUv);
+    for (const ParsedChunk &chunk : chunks) {
+        _pos.insert(_pos.end(), chunk.pos.begin(), chunk.pos.end());
+        _normal.insert(_normal.end(), chunk.normal.begin(), chunk.normal.end());
+        _uv.insert(_uv.end(), chunk.uv.begin(), chunk.uv.end());
+    }
+
+    Vec3i chunkBase(0);
+    for (ParsedChunk &chunk : chunks) {
+        replayChunk(chunk, begin, chunkBase);
+        chunkBase += Vec3i(int32(chunk.pos.size()), int32(chunk.uv.size()), int32(chunk.normal.size()));
+        chunk = ParsedChunk();
+    }
+}
+
+bool ObjLoader::FileContents::open(const Path &path)
+{
+    mapping = MappedFile::open(path);
+    if (mapping) {
+        begin = reinterpret_cast<const char *>(mapping->data());
+        end = begin + mapping->size();
+        return true;
+    }
+
+    // Files inside archives (and empty files) cannot be mapped
+    InputStreamHandle in = FileUtils::openInputStream(path);
+    if (!in)
+        return false;
+    buffer.assign(std::istreambuf_iterator<char>(*in), std::istreambuf_iterator<char>());
+    begin = buffer.data();
+    end = begin + buffer.size();
+    return true;
+}
+
+ObjLoader::ObjLoader(const FileContents &file, const Path &path, std::shared_ptr<TextureCache> cache)
 : _geometryOnly(false),
   _errorMaterial(std::make_shared<ErrorBsdf>()),
   _textureCache(std::move(cache)),
@@ -536,7 +738,7 @@ ObjLoader::ObjLoader(std::istream &in, const Path &path, std::shared_ptr<Texture
 {
     DirectoryChange context(path.parent());
 
-    loadFile(in);
+    loadFile(file.begin, file.end);
 
     if (!_tris.empty() || !_segments.empty()) {
         _meshes.emplace_back(finalizeMesh());
@@ -544,22 +746,21 @@ ObjLoader::ObjLoader(std::istream &in, const Path &path, std::shared_ptr<Texture
     }
 }
 
-ObjLoader::ObjLoader(std::istream &in)
-: _geometryOnly(true)
+ObjLoader::ObjLoader(const FileContents &file)
+: _geometryOnly(true),
+  _currentMaterial(-1)
 {
-    loadFile(in);
+    loadFile(file.begin, file.end);
 }
 
 Scene *ObjLoader::load(const Path &path, std::shared_ptr<TextureCache> cache)
 {
-
-    InputStreamHandle file = FileUtils::openInputStream(path);
-
-    if (file) {
+    FileContents file;
+    if (file.open(path)) {
         if (!cache)
             cache = std::make_shared<TextureCache>();
 
-        ObjLoader loader(*file, path, cache);
+        ObjLoader loader(file, path, cache);
 
         std::shared_ptr<Camera> cam(std::make_shared<PinholeCamera>());
         cam->setLookAt(loader._bounds.center());
@@ -581,11 +782,11 @@ Scene *ObjLoader::load(const Path &path, std::shared_ptr<TextureCache> cache)
 
 bool ObjLoader::loadGeometryOnly(const Path &path, std::vector<Vertex> &verts, std::vector<TriangleI> &tris)
 {
-    InputStreamHandle file = FileUtils::openInputStream(path);
-    if (!file)
+    FileContents file;
+    if (!file.open(path))
         return false;
 
-    ObjLoader loader(*file);
+    ObjLoader loader(file);
 
     verts = std::move(loader._verts);
     tris  = std::move(loader._tris);
@@ -595,11 +796,11 @@ bool ObjLoader::loadGeometryOnly(const Path &path, std::vector<Vertex> &verts, s
 
 bool ObjLoader::loadCurvesOnly(const Path &path, std::vector<uint32> &curveEnds, std::vector<Vec4f> &nodeData)
 {
-    InputStreamHandle file = FileUtils::openInputStream(path);
-    if (!file)
+    FileContents file;
+    if (!file.open(path))
         return false;
 
-    ObjLoader loader(*file);
+    ObjLoader loader(file);
 
     loader.finalizeCurveData(curveEnds, nodeData);
 
@@ -20,6 +20,7 @@
 
 namespace Tungsten {
 
+class MappedFile;
 class Primitive;
 
 class ObjLoader
@@ -30,6 +31,46 @@ class ObjLoader
         uint32 v1;
     };
 
+    // The file is split into chunks at line boundaries, which are parsed in
+    // parallel. Vertex attributes are parsed directly into the chunk, while
+    // faces, curves and all other statements are recorded in file order and
+    // replayed serially afterwards, so that the result does not depend on
+    // how the file was split
+    enum LineType : uint32
+    {
+        LINE_FACE,
+        LINE_CURVE,
+        LINE_OTHER,
+    };
+    struct ParsedLine
+    {
+        LineType type;
+        // Number of positions, normals and uvs in the chunk preceding this
+        // line. Needed to resolve relative (negative) indices
+        uint32 numPos, numNormal, numUv;
+        // Range in the chunk's index array for faces and curves, and
+        // offsets into the file for everything else
+        uint64 begin, end;
+    };
+    struct ParsedChunk
+    {
+        std::vector<Vec3f> pos;
+        std::vector<Vec3f> normal;
+        std::vector<Vec2f> uv;
+        // (pos, uv, normal) triplets as they appear in the file
+        std::vector<Vec3i> indices;
+        std::vector<ParsedLine> lines;
+    };
+    struct FileContents
+    {
+        std::shared_ptr<MappedFile> mapping;
+        std::string buffer;
+        const char *begin;
+        const char *end;
+
+        bool open(const Path &path);
+    };
+
     bool _geometryOnly;
 
     std::shared_ptr<Bsdf> _errorMaterial;
@@ -54,8 +95,8 @@ class ObjLoader
 
     std::vector<std::shared_ptr<Primitive>> _meshes;
 
-    void skipWhitespace(const char *&s);
-    bool hasPrefix(const char *s, const char *pre);
+    static void skipWhitespace(const char *&s);
+    static bool hasPrefix(const char *s, const char *pre);
     uint32 fetchVertex(int32 pos, int32 normal, int32 uv);
 
     std::string extractString(const char *line);
@@ -63,11 +104,12 @@ class ObjLoader
 
     template<unsigned Size>
     Vec<float, Size> loadVector(const char *s);
-    void loadCurve(const char *line);
-    void loadFace(const char *line);
+    static void parseChunk(const char *fileBegin, const char *begin, const char *end, ParsedChunk &chunk);
+    Vec3i resolveIndex(Vec3i index, const ParsedLine &line, const Vec3i &chunkBase) const;
+    void replayChunk(const ParsedChunk &chunk, const char *fileBegin, Vec3i chunkBase);
     void loadMaterialLibrary(const char *path);
     void loadLine(const char *line);
-    void loadFile(std::istream &in);
+    void loadFile(const char *begin, const char *end);
 
     std::shared_ptr<Bsdf> convertObjMaterial(const ObjMaterial &mat);
 
@@ -82,8 +124,8 @@ class ObjLoader
     std::shared_ptr<Primitive> tryInstantiateDisk(const std::string &name, std::shared_ptr<Bsdf> &bsdf);
     std::shared_ptr<Primitive> finalizeMesh();
 
-    ObjLoader(std::istream &in, const Path &path, std::shared_ptr<TextureCache> cache);
-    ObjLoader(std::istream &in);
+    ObjLoader(const FileContents &file, const Path &path, std::shared_ptr<TextureCache> cache);
+    ObjLoader(const FileContents &file);
 
 public:
     static Scene *load(const Path &path, std::shared_ptr<TextureCache> cache = nullptr);
@@ -0,0 +1,72 @@
+#include "ResourceLoader.hpp"
+
+#include "thread/ThreadUtils.hpp"
+#include "thread/ThreadPool.hpp"
+
+#include "Timer.hpp"
+
+#include "Debug.hpp"
+
+namespace Tungsten {
+
+ResourceLoader::JobId ResourceLoader::addJob(std::string name, std::function<void()> load,
+        const std::vector<JobId> &dependencies)
+{
+    JobId id = _jobs.size();
+    _jobs.emplace_back(Job{std::move(name), std::move(load), std::vector<JobId>(),
+            uint32(dependencies.size()), 0.0});
+    for (JobId d : dependencies)
+        _jobs[d].dependents.push_back(id);
+    return id;
+}
+
+void ResourceLoader::run()
+{
+    auto runJob = [&](JobId id) {
+        Timer timer;
+        _jobs[id].load();
+        timer.stop();
+        _jobs[id].seconds = timer.elapsed();
+    };
+
+    std::vector<JobId> wave;
+    for (JobId i = 0; i < _jobs.size(); ++i)
+        if (_jobs[i].unfinishedDependencies == 0)
+            wave.push_back(i);
+
+    size_t finishedJobs = 0;
+    while (!wave.empty()) {
+        if (!ThreadUtils::pool || wave.size() == 1) {
+            for (JobId id : wave)
+                runJob(id);
+        } else {
+            auto group = ThreadUtils::pool->enqueue([&](uint32 idx, uint32 /*num*/, uint32 /*threadId*/) {
+                runJob(wave[idx]);
+            }, wave.size());
+            ThreadUtils::pool->yield(*group);
+            group->wait();
+        }
+        finishedJobs += wave.size();
+
+        std::vector<JobId> nextWave;
+        for (JobId id : wave)
+            for (JobId dependent : _jobs[id].dependents)
+                if (--_jobs[dependent].unfinishedDependencies == 0)
+                    nextWave.push_back(dependent);
+        wave = std::move(nextWave);
+    }
+
+    if (finishedJobs != _jobs.size())
+        FAIL("Resource load jobs contain a dependency cycle");
+}
+
+std::vector<ResourceLoader::Timing> ResourceLoader::timings() const
+{
+    std::vector<Timing> result;
+    result.reserve(_jobs.size());
+    for (const Job &job : _jobs)
+        result.emplace_back(job.name, job.seconds);
+    return result;
+}
+
+}
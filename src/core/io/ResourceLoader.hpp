@@ -0,0 +1,48 @@
+#ifndef RESOURCELOADER_HPP_
+#define RESOURCELOADER_HPP_
+
+#include "IntTypes.hpp"
+
+#include <functional>
+#include <utility>
+#include <string>
+#include <vector>
+
+namespace Tungsten {
+
+// Loads scene resources in parallel on the thread pool. Every load job may
+// depend on other jobs and only starts once all of them have finished.
+// Jobs run in waves: All jobs whose dependencies are satisfied are fanned
+// out over the pool at once, and the next wave starts once they are done
+class ResourceLoader
+{
+public:
+    typedef uint32 JobId;
+    typedef std::pair<std::string, double> Timing;
+
+private:
+    struct Job
+    {
+        std::string name;
+        std::function<void()> load;
+        std::vector<JobId> dependents;
+        uint32 unfinishedDependencies;
+        double seconds;
+    };
+
+    std::vector<Job> _jobs;
+
+public:
+    JobId addJob(std::string name, std::function<void()> load,
+            const std::vector<JobId> &dependencies = std::vector<JobId>());
+
+    // Runs all jobs, rethrowing the first exception thrown by any of them
+    void run();
+
+    // Name and load time in seconds of every job, in the order they were added
+    std::vector<Timing> timings() const;
+};
+
+}
+
+#endif /* RESOURCELOADER_HPP_ */
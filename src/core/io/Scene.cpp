@@ -278,21 +278,67 @@ rapidjson::Value Scene::toJson(Allocator &allocator) const
     };
 }
 
+template<typename T>
+static std::string describeResource(const char *kind, const T &object, size_t index)
+{
+    if (object.unnamed())
+        return tfm::format("%s %d", kind, index);
+    else
+        return tfm::format("%s '%s'", kind, object.name());
+}
+
+// All resources are loaded in parallel. Child primitives (e.g. instance
+// masters) get load jobs of their own, which run exactly once even if the
+// child is shared, and before any primitive built from them. Helper
+// primitives are created from the loaded primitives and can only be
+// created once everything else has finished loading
 void Scene::loadResources()
 {
-    for (const std::shared_ptr<Medium> &b : _media)
-        b->loadResources();
-    for (const std::shared_ptr<Bsdf> &b : _bsdfs)
-        b->loadResources();
-    for (const std::shared_ptr<Primitive> &t : _primitives)
-        t->loadResources();
+    ResourceLoader loader;
+    std::vector<ResourceLoader::JobId> jobs;
+
+    std::unordered_map<Primitive *, ResourceLoader::JobId> primitiveJobs;
+    std::function<ResourceLoader::JobId(const std::shared_ptr<Primitive> &, std::string)> addPrimitiveJob =
+            [&](const std::shared_ptr<Primitive> &primitive, std::string name) {
+        auto iter = primitiveJobs.find(primitive.get());
+        if (iter != primitiveJobs.end())
+            return iter->second;
+
+        std::vector<ResourceLoader::JobId> children;
+        std::vector<std::shared_ptr<Primitive>> childPrimitives = primitive->childPrimitives();
+        for (size_t i = 0; i < childPrimitives.size(); ++i)
+            children.push_back(addPrimitiveJob(childPrimitives[i],
+                    name + " " + describeResource("child", *childPrimitives[i], i)));
+
+        ResourceLoader::JobId job = loader.addJob(std::move(name), [primitive]() { primitive->loadResources(); }, children);
+        primitiveJobs.insert(std::make_pair(primitive.get(), job));
+        jobs.push_back(job);
+        return job;
+    };
+
+    for (size_t i = 0; i < _media.size(); ++i)
+        jobs.push_back(loader.addJob(describeResource("medium", *_media[i], i),
+                [this, i]() { _media[i]->loadResources(); }));
+    for (size_t i = 0; i < _bsdfs.size(); ++i)
+        jobs.push_back(loader.addJob(describeResource("bsdf", *_bsdfs[i], i),
+                [this, i]() { _bsdfs[i]->loadResources(); }));
+    for (size_t i = 0; i < _primitives.size(); ++i)
+        addPrimitiveJob(_primitives[i], describeResource("primitive", *_primitives[i], i));
+
+    jobs.push_back(loader.addJob("camera", [this]() { _camera->loadResources(); }));
+    jobs.push_back(loader.addJob("integrator", [this]() { _integrator->loadResources(); }));
+    jobs.push_back(loader.addJob("renderer settings", [this]() { _rendererSettings.loadResources(); }));
 
-    _camera->loadResources();
-    _integrator->loadResources();
-    _rendererSettings.loadResources();
+    _textureCache->addLoadJobs(loader, jobs);
 
-    _textureCache->loadResources();
+    loader.addJob("helper primitives", [this]() { createHelperPrimitives(); }, jobs);
 
+    loader.run();
+    _resourceLoadTimes = loader.timings();
+}
+
+void Scene::createHelperPrimitives()
+{
     for (size_t i = 0; i < _primitives.size(); ++i) {
         auto helperPrimitives = _primitives[i]->createHelperPrimitives();
         if (!helperPrimitives.empty()) {
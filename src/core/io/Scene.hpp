@@ -9,6 +9,7 @@
 #include <map>
 
 #include "JsonSerializable.hpp"
+#include "ResourceLoader.hpp"
 #include "TextureCache.hpp"
 #include "ImageIO.hpp"
 #include "Path.hpp"
@@ -51,6 +52,10 @@ class Scene : public JsonSerializable
 
     RendererSettings _rendererSettings;
 
+    std::vector<ResourceLoader::Timing> _resourceLoadTimes;
+
+    void createHelperPrimitives();
+
 public:
     Scene();
 
@@ -164,6 +169,12 @@ public:
         return _resources;
     }
 
+    // Load time of every resource loaded by the last call to loadResources
+    const std::vector<ResourceLoader::Timing> &resourceLoadTimes() const
+    {
+        return _resourceLoadTimes;
+    }
+
     static Scene *load(const Path &path, std::shared_ptr<TextureCache> cache = nullptr, const Path *inputDirectory = nullptr);
     static void save(const Path &path, const Scene &scene);
 };
@@ -1,6 +1,8 @@
 #include "TextureCache.hpp"
 #include "FileUtils.hpp"
 
+#include <tinyformat/tinyformat.hpp>
+
 #include "textures/BitmapTexture.hpp"
 #include "textures/IesTexture.hpp"
 
@@ -69,6 +71,16 @@ void TextureCache::loadResources()
         i->loadResources();
 }
 
+void TextureCache::addLoadJobs(ResourceLoader &loader, std::vector<ResourceLoader::JobId> &jobs)
+{
+    for (const BitmapKeyType &t : _textures)
+        jobs.push_back(loader.addJob(t->path() ? tfm::format("texture '%s'", *t->path()) : "texture",
+                [t]() { t->loadResources(); }));
+    for (const IesKeyType &t : _iesTextures)
+        jobs.push_back(loader.addJob(t->path() ? tfm::format("ies texture '%s'", *t->path()) : "ies texture",
+                [t]() { t->loadResources(); }));
+}
+
 template<typename T, typename Comparator>
 void pruneSet(std::set<std::shared_ptr<T>, Comparator> &set)
 {
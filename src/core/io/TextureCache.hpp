@@ -1,6 +1,7 @@
 #ifndef TEXTURECACHE_HPP_
 #define TEXTURECACHE_HPP_
 
+#include "ResourceLoader.hpp"
 #include "ImageIO.hpp"
 
 #include <rapidjson/document.h>
@@ -8,6 +9,7 @@
 #include <utility>
 #include <memory>
 #include <string>
+#include <vector>
 #include <set>
 
 namespace Tungsten {
@@ -36,6 +38,8 @@ public:
     std::shared_ptr<IesTexture> fetchIesTexture(PathPtr path, int resolution);
 
     void loadResources();
+    // Adds one load job per texture, appending their ids to jobs
+    void addLoadJobs(ResourceLoader &loader, std::vector<ResourceLoader::JobId> &jobs);
     void prune();
 };
 
@@ -127,6 +127,40 @@ public:
         return x;
     }
 
+    // Position of (x, y) along a Hilbert curve filling a n x n grid,
+    // where n is a power of two
+    static inline uint32 hilbertIndex(uint32 n, uint32 x, uint32 y)
+    {
+        uint32 d = 0;
+        for (uint32 s = n/2; s > 0; s /= 2) {
+            uint32 rx = (x & s) > 0;
+            uint32 ry = (y & s) > 0;
+            d += s*s*((3*rx) ^ ry);
+            if (ry == 0) {
+                if (rx == 1) {
+                    x = n - 1 - x;
+                    y = n - 1 - y;
+                }
+                std::swap(x, y);
+            }
+        }
+        return d;
+    }
+
+    // Interleaves the lower 10 bits of x, y and z into a 30 bit Morton code
+    static inline uint32 mortonCode3(uint32 x, uint32 y, uint32 z)
+    {
+        auto spread = [](uint32 v) {
+            v &= 0x3FFu;
+            v = (v | (v << 16u)) & 0x030000FFu;
+            v = (v | (v <<  8u)) & 0x0300F00Fu;
+            v = (v | (v <<  4u)) & 0x030C30C3u;
+            v = (v | (v <<  2u)) & 0x09249249u;
+            return v;
+        };
+        return spread(x) | (spread(y) << 1u) | (spread(z) << 2u);
+    }
+
     static float sphericalDistance(float lat0, float long0, float lat1, float long1, float r)
     {
         float  latSin = std::sin(( lat1 -  lat0)*0.5f);
@@ -16,13 +16,16 @@ class Ray
     float _nearT;
     float _farT;
     float _time;
+    float _footprint;
+    float _spread;
     bool _primaryRay;
 
 public:
     Ray() = default;
 
     Ray(const Vec3f &pos, const Vec3f &dir, float nearT = 1e-4f, float farT = infinity(), float time = 0.0f)
-    : _pos(pos), _dir(dir), _nearT(nearT), _farT(farT), _time(time), _primaryRay(false)
+    : _pos(pos), _dir(dir), _nearT(nearT), _farT(farT), _time(time),
+      _footprint(0.0f), _spread(0.0f), _primaryRay(false)
     {
     }
 
@@ -33,6 +36,8 @@ public:
         ray._dir = newDir;
         ray._nearT = newNearT;
         ray._farT = newFarT;
+        if (_spread > 0.0f && _farT < infinity())
+            ray._footprint = footprintAt(_farT);
         return ray;
     }
 
@@ -91,6 +96,25 @@ public:
         _time = time;
     }
 
+    // Width of the ray cone at distance t along the ray. Camera rays of the
+    // unidirectional path tracers start out with a spread of roughly one
+    // pixel; all other rays have a zero footprint and are not filtered
+    float footprintAt(float t) const
+    {
+        return _footprint + _spread*t;
+    }
+
+    float spread() const
+    {
+        return _spread;
+    }
+
+    void setFootprint(float footprint, float spread)
+    {
+        _footprint = footprint;
+        _spread = spread;
+    }
+
     bool isPrimaryRay() const
     {
         return _primaryRay;
@@ -1,5 +1,7 @@
 #include "VoxelMedium.hpp"
 
+#include "transmittances/ExponentialTransmittance.hpp"
+
 #include "sampling/PathSampleGenerator.hpp"
 
 #include "math/TangentFrame.hpp"
@@ -12,8 +14,22 @@ namespace Tungsten {
 
 VoxelMedium::VoxelMedium()
 : _sigmaA(0.0f),
-  _sigmaS(0.0f)
+  _sigmaS(0.0f),
+  _trackingString("exact"),
+  _majorantCellSize(8.0f)
+{
+    _trackingMethod = stringToTrackingMethod(_trackingString);
+}
+
+VoxelMedium::TrackingMethod VoxelMedium::stringToTrackingMethod(const std::string &name)
 {
+    if (name == "exact")
+        return TrackingMethod::Exact;
+    else if (name == "ratio")
+        return TrackingMethod::Ratio;
+    else if (name == "residual_ratio")
+        return TrackingMethod::ResidualRatio;
+    FAIL("Invalid tracking method: '%s'", name);
 }
 
 void VoxelMedium::fromJson(JsonPtr value, const Scene &scene)
@@ -21,7 +37,15 @@ void VoxelMedium::fromJson(JsonPtr value, const Scene &scene)
     Medium::fromJson(value, scene);
     value.getField("sigma_a", _sigmaA);
     value.getField("sigma_s", _sigmaS);
+    value.getField("tracking", _trackingString);
+    value.getField("majorant_cell_size", _majorantCellSize);
     _grid = scene.fetchGrid(value.getRequiredMember("grid"));
+
+    _trackingMethod = stringToTrackingMethod(_trackingString);
+    if (_trackingMethod != TrackingMethod::Exact && !dynamic_cast<const ExponentialTransmittance *>(_transmittance.get()))
+        value.parseError("Tracking requires exponential transmittance");
+    if (_majorantCellSize <= 0.0f)
+        value.parseError("Majorant cell size must be positive");
 }
 
 rapidjson::Value VoxelMedium::toJson(Allocator &allocator) const
@@ -30,6 +54,8 @@ rapidjson::Value VoxelMedium::toJson(Allocator &allocator) const
         "type", "voxel",
         "sigma_a", _sigmaA,
         "sigma_s", _sigmaS,
+        "tracking", _trackingString,
+        "majorant_cell_size", _majorantCellSize,
         "grid", *_grid
     };
 }
@@ -47,10 +73,14 @@ bool VoxelMedium::isHomogeneous() const
 void VoxelMedium::prepareForRender()
 {
     _sigmaT = _sigmaA + _sigmaS;
+    _sigmaTMax = _sigmaT.max();
     _absorptionOnly = _sigmaS == 0.0f;
 
     _worldToGrid = _grid->invNaturalTransform();
     _gridBounds = _grid->bounds();
+
+    if (_trackingMethod != TrackingMethod::Exact)
+        _majorants.build(*_grid, _gridBounds, _majorantCellSize);
 }
 
 static inline bool bboxIntersection(const Box3f &box, const Vec3f &o, const Vec3f &d,
@@ -79,6 +109,97 @@ static inline bool bboxIntersection(const Box3f &box, const Vec3f &o, const Vec3
     return false;
 }
 
+Vec3f VoxelMedium::trackTransmittance(PathSampleGenerator &sampler, Vec3f p, Vec3f w, float t0, float t1,
+        float sigmaScale) const
+{
+    bool residual = _trackingMethod == TrackingMethod::ResidualRatio;
+
+    Vec3f result(1.0f);
+    _majorants.march(p, w, t0, t1, [&](Vec2f range, float ta, float tb) {
+        // Residual ratio tracking integrates the cell minimum analytically
+        // and only tracks the residual above it
+        float control = residual ? range.x() : 0.0f;
+        if (control > 0.0f)
+            result *= std::exp(-(tb - ta)*control*sigmaScale*_sigmaT);
+
+        float majorant = (range.y() - control)*_sigmaTMax*sigmaScale;
+        if (majorant <= 0.0f)
+            return false;
+
+        float t = ta;
+        while (true) {
+            t -= std::log(1.0f - sampler.next1D())/majorant;
+            if (t >= tb)
+                break;
+            float rho = _grid->density(p + w*t) - control;
+            result *= 1.0f - rho*sigmaScale*_sigmaT/majorant;
+        }
+        return result.max() <= 0.0f;
+    });
+    return result;
+}
+
+void VoxelMedium::trackDistance(PathSampleGenerator &sampler, Vec3f p, Vec3f w, float t0, float t1, float wPrime,
+        MediumState &state, MediumSample &sample) const
+{
+    float sigmaScale = 1.0f/wPrime;
+
+    // Delta tracking against the cell majorant. For chromatic media, real
+    // and null collisions are chosen proportional to the largest throughput
+    // weighted coefficient over the color channels, and the weights make up
+    // for the difference to the per channel coefficients
+    Vec3f weight(1.0f);
+    float tCollision = t1, rho = 0.0f, collisionPdf = 1.0f;
+    float tau = -std::log(1.0f - sampler.next1D());
+    bool collided = _majorants.march(p, w, t0, t1, [&](Vec2f range, float ta, float tb) {
+        float majorant = range.y()*_sigmaTMax*sigmaScale;
+        if (majorant <= 0.0f)
+            return false;
+
+        float t = ta;
+        while (true) {
+            float dt = tau/majorant;
+            if (t + dt >= tb) {
+                tau -= (tb - t)*majorant;
+                return false;
+            }
+            t += dt;
+
+            float density = _grid->density(p + w*t);
+            Vec3f sigmaT = density*sigmaScale*_sigmaT;
+            Vec3f sigmaN = majorant - sigmaT;
+            float real = (weight*sigmaT).max();
+            float null = (weight*sigmaN).max();
+            float pReal = real/(real + null);
+            if (sampler.next1D() < pReal) {
+                tCollision = t;
+                rho = density;
+                collisionPdf = majorant*pReal;
+                return true;
+            }
+            weight *= sigmaN/(majorant*(1.0f - pReal));
+            tau = -std::log(1.0f - sampler.next1D());
+        }
+    });
+
+    if (collided) {
+        // Transmittance over collision pdf, in world space units
+        collisionPdf *= wPrime;
+        weight /= collisionPdf;
+        sample.t = tCollision/wPrime;
+        sample.exited = false;
+        sample.pdf = collisionPdf;
+        sample.emission = _grid->emission(p + w*tCollision)*weight;
+        sample.weight = weight*rho*_sigmaS;
+    } else {
+        sample.t = t1/wPrime;
+        sample.exited = true;
+        sample.pdf = 1.0f;
+        sample.weight = weight;
+    }
+    state.advance();
+}
+
 Vec3f VoxelMedium::sigmaA(Vec3f p) const
 {
     return _grid->density(p)*_sigmaA;
@@ -118,10 +239,16 @@ bool VoxelMedium::sampleDistance(PathSampleGenerator &sampler, const Ray &ray,
 
     if (_absorptionOnly) {
         sample.t = maxT;
-        Vec3f tau = _grid->opticalDepth(sampler, p, w, t0, t1)*(_sigmaT/wPrime);
-        sample.weight = _transmittance->eval(tau, state.firstScatter, true);
+        if (_trackingMethod != TrackingMethod::Exact) {
+            sample.weight = trackTransmittance(sampler, p, w, t0, t1, 1.0f/wPrime);
+        } else {
+            Vec3f tau = _grid->opticalDepth(sampler, p, w, t0, t1)*(_sigmaT/wPrime);
+            sample.weight = _transmittance->eval(tau, state.firstScatter, true);
+        }
         sample.pdf = 1.0f;
         sample.exited = true;
+    } else if (_trackingMethod != TrackingMethod::Exact) {
+        trackDistance(sampler, p, w, t0, t1, wPrime, state, sample);
     } else {
         int component = sampler.nextDiscrete(3);
         float sigmaTc = _sigmaT[component];
@@ -164,6 +291,9 @@ Vec3f VoxelMedium::transmittance(PathSampleGenerator &sampler, const Ray &ray, b
     if (!bboxIntersection(_gridBounds, p, w, t0, t1))
         return Vec3f(1.0f);
 
+    if (_trackingMethod != TrackingMethod::Exact)
+        return trackTransmittance(sampler, p, w, t0, t1, 1.0f/wPrime);
+
     Vec3f tau = _grid->opticalDepth(sampler, p, w, t0, t1)*(_sigmaT/wPrime);
     return _transmittance->eval(tau, startOnSurface, endOnSurface);
 }
@@ -3,21 +3,48 @@
 
 #include "Medium.hpp"
 
+#include "grids/MajorantGrid.hpp"
 #include "grids/Grid.hpp"
 
 namespace Tungsten {
 
 class VoxelMedium : public Medium
 {
+    // Exact defers to the integration and sampling methods of the grid.
+    // The other methods use delta tracking against a majorant grid for
+    // distance sampling, and ratio or residual ratio tracking for
+    // transmittance. Tracking requires exponential transmittance, and the
+    // pdfs it reports are not exact, so it is meant for unidirectional
+    // integrators
+    enum class TrackingMethod
+    {
+        Exact,
+        Ratio,
+        ResidualRatio,
+    };
+
     Vec3f _sigmaA, _sigmaS;
     Vec3f _sigmaT;
+    float _sigmaTMax;
     bool _absorptionOnly;
 
+    std::string _trackingString;
+    TrackingMethod _trackingMethod;
+    float _majorantCellSize;
+
     std::shared_ptr<Grid> _grid;
+    MajorantGrid _majorants;
 
     Mat4f _worldToGrid;
     Box3f _gridBounds;
 
+    static TrackingMethod stringToTrackingMethod(const std::string &name);
+
+    Vec3f trackTransmittance(PathSampleGenerator &sampler, Vec3f p, Vec3f w, float t0, float t1,
+            float sigmaScale) const;
+    void trackDistance(PathSampleGenerator &sampler, Vec3f p, Vec3f w, float t0, float t1, float wPrime,
+            MediumState &state, MediumSample &sample) const;
+
 public:
     VoxelMedium();
 
@@ -1,5 +1,6 @@
 #include "Curves.hpp"
 #include "TriangleMesh.hpp"
+#include "EmbreeUtil.hpp"
 
 #include "sampling/UniformSampler.hpp"
 
@@ -15,6 +16,9 @@
 #include "io/CurveIO.hpp"
 #include "io/Scene.hpp"
 
+#include <embree2/rtcore_geometry.h>
+#include <embree2/rtcore_ray.h>
+
 namespace Tungsten {
 
 DEFINE_STRINGABLE_ENUM(Curves::CurveMode, "curve mode", ({
@@ -223,6 +227,15 @@ static Vec3f project(const Vec3f &lx, const Vec3f &ly, const Vec3f &lz, const Ve
     return Vec3f(lx.dot(q), ly.dot(q), lz.dot(q));
 }
 
+// Embree's curve surfaces are closed tubes. Only the side facing the ray
+// is kept, which matches the half cylinder intersector below and avoids
+// self intersections of rays leaving the fiber
+static void frontFacingFilter(void * /*userPtr*/, RTCRay &ray)
+{
+    if (ray.Ng[0]*ray.dir[0] + ray.Ng[1]*ray.dir[1] + ray.Ng[2]*ray.dir[2] >= 0.0f)
+        ray.geomID = RTC_INVALID_GEOMETRY_ID;
+}
+
 static Box3f curveBox(const Vec4f &q0, const Vec4f &q1, const Vec4f &q2)
 {
     Vec2f xMinMax(BSpline::quadraticMinMax(q0.x(), q1.x(), q2.x()));
@@ -241,17 +254,21 @@ Curves::Curves()
   _subsample(0.0f),
   _overrideThickness(false),
   _taperThickness(false),
-  _bsdf(std::make_shared<HairBcsdf>())
+  _useEmbree(true),
+  _bsdf(std::make_shared<HairBcsdf>()),
+  _scene(nullptr)
 {
 }
 
 Curves::Curves(const Curves &o)
-: Primitive(o)
+: Primitive(o),
+  _scene(nullptr)
 {
     _mode              = o._mode;
     _curveThickness    = o._curveThickness;
     _taperThickness    = o._taperThickness;
     _overrideThickness = o._overrideThickness;
+    _useEmbree         = o._useEmbree;
     _path              = o._path;
     _curveCount        = o._curveCount;
     _nodeCount         = o._nodeCount;
@@ -271,12 +288,19 @@ Curves::Curves(std::vector<uint32> curveEnds, std::vector<Vec4f> nodeData, std::
   _curveThickness(0.01f),
   _overrideThickness(false),
   _taperThickness(false),
+  _useEmbree(true),
   _curveCount(curveEnds.size()),
   _nodeCount(nodeData.size()),
   _curveEnds(std::move(curveEnds)),
   _nodeData(std::move(nodeData)),
-  _bsdf(std::move(bsdf))
+  _bsdf(std::move(bsdf)),
+  _scene(nullptr)
+{
+}
+
+Curves::~Curves()
 {
+    deleteScene();
 }
 
 void Curves::loadCurves()
@@ -370,6 +394,77 @@ void Curves::buildProxy()
     _proxy = std::make_shared<TriangleMesh>(verts, tris, _bsdf, "Curves", false, false);
 }
 
+bool Curves::supportsEmbree() const
+{
+    // Embree only offers ray facing hair and round tubes. Ribbons with
+    // user supplied orientation have to go through our own intersector
+    return _useEmbree && _mode != MODE_RIBBON;
+}
+
+void Curves::buildEmbreeScene(const std::vector<uint32> &segments)
+{
+    // A quadratic B-spline segment is converted to a quadratic Bezier curve
+    // and then degree elevated to a cubic. Both steps are exact and keep the
+    // parametrization intact, so Embree's u is our spline parameter. The end
+    // point of a segment is shared with the start of the next one
+    _bezierNodes.clear();
+    _bezierStarts.clear();
+    _embreeSegments.clear();
+    _bezierNodes.reserve(segments.size()*3 + _curveCount);
+    _bezierStarts.reserve(segments.size());
+    _embreeSegments.reserve(segments.size());
+
+    uint32 prevSegment = 0;
+    for (uint32 t : segments) {
+        const Vec4f &p0 = _nodeData[t - 2];
+        const Vec4f &p1 = _nodeData[t - 1];
+        const Vec4f &p2 = _nodeData[t - 0];
+        Vec4f b0 = (p0 + p1)*0.5f;
+        Vec4f b2 = (p1 + p2)*0.5f;
+
+        if (_bezierNodes.empty() || prevSegment + 1 != t)
+            _bezierNodes.push_back(b0);
+        _bezierStarts.push_back(_bezierNodes.size() - 1);
+        _bezierNodes.push_back((b0 + p1*2.0f)*(1.0f/3.0f));
+        _bezierNodes.push_back((p1*2.0f + b2)*(1.0f/3.0f));
+        _bezierNodes.push_back(b2);
+
+        _embreeSegments.push_back(t - 2);
+        prevSegment = t;
+    }
+
+    _scene = rtcDeviceNewScene(EmbreeUtil::getDevice(), RTC_SCENE_STATIC | RTC_SCENE_INCOHERENT, RTC_INTERSECT1);
+    if (!_bezierStarts.empty()) {
+        unsigned geomId;
+        if (_mode == MODE_BCSDF_CYLINDER) {
+            // The BCSDF only needs the ray facing fiber cross section,
+            // which is exactly what Embree's hair primitive provides
+            geomId = rtcNewHairGeometry(_scene, RTC_GEOMETRY_STATIC, _bezierStarts.size(), _bezierNodes.size(), 1);
+            rtcSetUserData(_scene, geomId, this);
+            rtcSetIntersectionFilterFunction(_scene, geomId, &Curves::hairFilter);
+            rtcSetOcclusionFilterFunction(_scene, geomId, &Curves::hairFilter);
+        } else {
+            geomId = rtcNewCurveGeometry(_scene, RTC_GEOMETRY_STATIC, _bezierStarts.size(), _bezierNodes.size(), 1);
+            rtcSetIntersectionFilterFunction(_scene, geomId, &frontFacingFilter);
+            rtcSetOcclusionFilterFunction(_scene, geomId, &frontFacingFilter);
+        }
+        rtcSetBuffer(_scene, geomId, RTC_VERTEX_BUFFER, _bezierNodes.data(), 0, sizeof(Vec4f));
+        rtcSetBuffer(_scene, geomId, RTC_INDEX_BUFFER, _bezierStarts.data(), 0, sizeof(uint32));
+    }
+    rtcCommit(_scene);
+}
+
+void Curves::deleteScene()
+{
+    if (_scene) {
+        rtcDeleteScene(_scene);
+        _scene = nullptr;
+    }
+    _bezierNodes.clear();
+    _bezierStarts.clear();
+    _embreeSegments.clear();
+}
+
 void Curves::fromJson(JsonPtr value, const Scene &scene)
 {
     Primitive::fromJson(value, scene);
@@ -378,6 +473,7 @@ void Curves::fromJson(JsonPtr value, const Scene &scene)
     _mode = value["mode"];
     value.getField("curve_taper", _taperThickness);
     value.getField("subsample", _subsample);
+    value.getField("use_embree", _useEmbree);
     _overrideThickness = value.getField("curve_thickness", _curveThickness);
 }
 
@@ -387,6 +483,7 @@ rapidjson::Value Curves::toJson(Allocator &allocator) const
         "type", "curves",
         "curve_taper", _taperThickness,
         "subsample", _subsample,
+        "use_embree", _useEmbree,
         "mode", _mode.toString(),
         "bsdf", *_bsdf
     };
@@ -421,7 +518,9 @@ void Curves::saveAs(const Path &path)
 
 bool Curves::intersect(Ray &ray, IntersectionTemporary &data) const
 {
-    if (_mode == MODE_RIBBON)
+    if (_scene)
+        return embreeIntersect(ray, data);
+    else if (_mode == MODE_RIBBON)
         return intersectTemplate<true>(ray, data);
     else
         return intersectTemplate<false>(ray, data);
@@ -469,8 +568,72 @@ bool Curves::intersectTemplate(Ray &ray, IntersectionTemporary &data) const
     return didIntersect;
 }
 
+// Distance along the ray to the front of the fiber around the spline point
+// at parameter t, treating the fiber locally as a straight cylinder. Also
+// returns the distance between ray and fiber axis and the fiber radius
+float Curves::tubeEntry(uint32 p0, float t, const Vec3f &o, const Vec3f &d, float &distance, float &width) const
+{
+    Vec4f q = BSpline::quadratic(_nodeData[p0], _nodeData[p0 + 1], _nodeData[p0 + 2], t);
+    Vec3f tangent = BSpline::quadraticDeriv(_nodeData[p0].xyz(), _nodeData[p0 + 1].xyz(), _nodeData[p0 + 2].xyz(), t);
+
+    Vec3f toAxis = q.xyz() - o;
+    float depth = d.dot(toAxis);
+    distance = (toAxis - d*depth).length();
+    width = q.w();
+
+    float cosTheta = tangent.normalized().dot(d);
+    float sinThetaSq = max(1.0f - cosTheta*cosTheta, 1e-4f);
+    return depth - std::sqrt(max(sqr(width) - sqr(distance), 0.0f)/sinThetaSq);
+}
+
+// Embree's hair is a ray facing ribbon through the fiber axis, which is also
+// hit by rays leaving the fiber surface. Like the half cylinder intersector,
+// we only accept hits on the front of the fiber that lie in front of the ray
+void Curves::hairFilter(void *userPtr, RTCRay &ray)
+{
+    const Curves *curves = static_cast<const Curves *>(userPtr);
+    Vec3f o(ray.org[0], ray.org[1], ray.org[2]);
+    Vec3f d(ray.dir[0], ray.dir[1], ray.dir[2]);
+
+    float distance, width;
+    float tEntry = curves->tubeEntry(curves->_embreeSegments[ray.primID], clamp(ray.u, 0.0f, 1.0f), o, d, distance, width);
+    if (!(tEntry > ray.tnear))
+        ray.geomID = RTC_INVALID_GEOMETRY_ID;
+}
+
+bool Curves::embreeIntersect(Ray &ray, IntersectionTemporary &data) const
+{
+    RTCRay eRay(EmbreeUtil::convert(ray));
+    rtcIntersect(_scene, eRay);
+    if (eRay.geomID == RTC_INVALID_GEOMETRY_ID)
+        return false;
+
+    uint32 p0 = _embreeSegments[eRay.primID];
+    float t = clamp(eRay.u, 0.0f, 1.0f);
+    float distance, width;
+    float tEntry = tubeEntry(p0, t, ray.pos(), ray.dir(), distance, width);
+    float tHit = _mode == MODE_BCSDF_CYLINDER ? min(tEntry, eRay.tfar) : eRay.tfar;
+
+    CurveIntersection &isect = *data.as<CurveIntersection>();
+    isect.curveP0 = p0;
+    isect.t = tHit;
+    isect.uv = Vec2f(t, 0.5f + 0.5f*(width > 0.0f ? min(distance/width, 1.0f) : 0.0f));
+    isect.w = width;
+
+    ray.setFarT(tHit);
+    data.primitive = this;
+
+    return true;
+}
+
 bool Curves::occluded(const Ray &ray) const
 {
+    if (_scene) {
+        RTCRay eRay(EmbreeUtil::convert(ray));
+        rtcOccluded(_scene, eRay);
+        return eRay.geomID != RTC_INVALID_GEOMETRY_ID;
+    }
+
     IntersectionTemporary tmp;
     Ray r(ray);
     return intersect(r, tmp);
@@ -571,8 +734,14 @@ const TriangleMesh &Curves::asTriangleMesh()
 
 void Curves::prepareForRender()
 {
+    bool embree = supportsEmbree();
+
     Bvh::PrimVector prims;
-    prims.reserve(_nodeCount - 2*_curveCount);
+    std::vector<uint32> segments;
+    if (embree)
+        segments.reserve(_nodeCount - 2*_curveCount);
+    else
+        prims.reserve(_nodeCount - 2*_curveCount);
 
     float widthScale = _transform.extractScaleVec().avg();
 
@@ -594,6 +763,11 @@ void Curves::prepareForRender()
             continue;
 
         for (uint32 t = start + 2; t < _curveEnds[i]; ++t) {
+            if (embree) {
+                segments.push_back(t);
+                continue;
+            }
+
             const Vec4f &p0 = _nodeData[t - 2];
             const Vec4f &p1 = _nodeData[t - 1];
             const Vec4f &p2 = _nodeData[t - 0];
@@ -606,7 +780,10 @@ void Curves::prepareForRender()
         }
     }
 
-    _bvh.reset(new Bvh::BinaryBvh(std::move(prims), 2));
+    if (embree)
+        buildEmbreeScene(segments);
+    else
+        _bvh.reset(new Bvh::BinaryBvh(std::move(prims), 2));
 
     //_needsRayTransform = true;
 
@@ -618,6 +795,7 @@ void Curves::prepareForRender()
 void Curves::teardownAfterRender()
 {
     _bvh.reset();
+    deleteScene();
     // TODO
     loadCurves();
 
@@ -9,6 +9,10 @@
 
 #include "StringableEnum.hpp"
 
+#include <embree2/rtcore.h>
+#include <embree2/rtcore_scene.h>
+#include <embree2/rtcore_ray.h>
+
 #include <memory>
 #include <vector>
 
@@ -35,6 +39,7 @@ class Curves : public Primitive
     float _subsample;
     bool _overrideThickness;
     bool _taperThickness;
+    bool _useEmbree;
 
     uint32 _curveCount;
     uint32 _nodeCount;
@@ -51,15 +56,31 @@ class Curves : public Primitive
 
     std::unique_ptr<Bvh::BinaryBvh> _bvh;
 
+    // Native Embree curves, used instead of _bvh for the cylinder modes.
+    // Every B-spline segment is converted to a cubic Bezier curve, and
+    // _embreeSegments maps Embree's primID back to the segment's first node
+    RTCScene _scene;
+    std::vector<Vec4f> _bezierNodes;
+    std::vector<uint32> _bezierStarts;
+    std::vector<uint32> _embreeSegments;
+
     void loadCurves();
     void computeBounds();
     void buildProxy();
 
+    bool supportsEmbree() const;
+    void buildEmbreeScene(const std::vector<uint32> &segments);
+    void deleteScene();
+    float tubeEntry(uint32 p0, float t, const Vec3f &o, const Vec3f &d, float &distance, float &width) const;
+    bool embreeIntersect(Ray &ray, IntersectionTemporary &data) const;
+
+    static void hairFilter(void *userPtr, RTCRay &ray);
+
     template<bool isRibbon>
     bool intersectTemplate(Ray &ray, IntersectionTemporary &data) const;
 
 public:
-    virtual ~Curves() {}
+    virtual ~Curves();
 
     Curves();
     Curves(const Curves &o);
@@ -295,6 +295,12 @@ float Disk::approximateRadiance(uint32 /*threadIndex*/, const Vec3f &p) const
     return (TWO_PI - std::abs(Q))*_emission->average().max();
 }
 
+void Disk::emissionNormalBounds(Vec3f &axis, float &theta) const
+{
+    axis = _n;
+    theta = 0.0f;
+}
+
 Box3f Disk::bounds() const
 {
     Box3f result;
@@ -52,6 +52,33 @@ inline RTCRay convert(const Ray &r)
     return ray;
 }
 
+inline Ray convert(const RTCRay4 &r, int lane)
+{
+    return Ray(
+        Vec3f(r.orgx[lane], r.orgy[lane], r.orgz[lane]),
+        Vec3f(r.dirx[lane], r.diry[lane], r.dirz[lane]),
+        r.tnear[lane],
+        r.tfar[lane]
+    );
+}
+
+inline void convert(const Ray &r, RTCRay4 &dst, int lane)
+{
+    dst.orgx[lane] = r.pos().x();
+    dst.orgy[lane] = r.pos().y();
+    dst.orgz[lane] = r.pos().z();
+    dst.dirx[lane] = r.dir().x();
+    dst.diry[lane] = r.dir().y();
+    dst.dirz[lane] = r.dir().z();
+    dst.tnear[lane] = r.nearT();
+    dst.tfar[lane]  = r.farT();
+    dst.time[lane] = 0.0f;
+    dst.mask[lane] = 0xFFFFFFFFu;
+    dst.geomID[lane] = RTC_INVALID_GEOMETRY_ID;
+    dst.primID[lane] = RTC_INVALID_GEOMETRY_ID;
+    dst.instID[lane] = RTC_INVALID_GEOMETRY_ID;
+}
+
 }
 
 }
@@ -52,6 +52,55 @@ const Primitive &Instance::getMaster(const IntersectionTemporary &data) const
     return *_master[_instanceId[data.flags]];
 }
 
+void Instance::buildMasterScenes()
+{
+    _masterMesh.clear();
+    _masterScene.clear();
+    for (const auto &m : _master) {
+        const TriangleMesh *mesh = dynamic_cast<const TriangleMesh *>(m.get());
+        _masterMesh.push_back(mesh);
+        if (mesh) {
+            _masterScene.push_back(mesh->embreeScene());
+            continue;
+        }
+
+        RTCScene scene = rtcDeviceNewScene(EmbreeUtil::getDevice(), RTC_SCENE_STATIC | RTC_SCENE_INCOHERENT, RTC_INTERSECT1);
+        unsigned geomId = rtcNewUserGeometry(scene, 1);
+        rtcSetUserData(scene, geomId, m.get());
+        rtcSetBoundsFunction(scene, geomId, [](void *ptr, size_t /*i*/, RTCBounds &bounds) {
+            bounds = EmbreeUtil::convert(static_cast<const Primitive *>(ptr)->bounds());
+        });
+        rtcSetIntersectFunction(scene, geomId, [](void *ptr, RTCRay &embreeRay, size_t /*i*/) {
+            // The instance has already moved the ray into master space
+            Ray ray(EmbreeUtil::convert(embreeRay));
+            if (static_cast<const Primitive *>(ptr)->intersect(ray, static_cast<InstanceRay &>(embreeRay).data)) {
+                embreeRay.tfar = ray.farT();
+                embreeRay.geomID = 0;
+                embreeRay.primID = 0;
+            }
+        });
+        rtcSetOccludedFunction(scene, geomId, [](void *ptr, RTCRay &embreeRay, size_t /*i*/) {
+            if (static_cast<const Primitive *>(ptr)->occluded(EmbreeUtil::convert(embreeRay)))
+                embreeRay.geomID = 0;
+        });
+        rtcCommit(scene);
+        _masterScene.push_back(scene);
+    }
+}
+
+void Instance::deleteScenes()
+{
+    if (_scene) {
+        rtcDeleteScene(_scene);
+        _scene = nullptr;
+    }
+    for (size_t i = 0; i < _masterScene.size(); ++i)
+        if (!_masterMesh[i])
+            rtcDeleteScene(_masterScene[i]);
+    _masterScene.clear();
+    _masterMesh.clear();
+}
+
 float Instance::powerToRadianceFactor() const
 {
     return 0.0f;
@@ -258,11 +307,17 @@ bool saveInstances(const Path &path, uint32 instanceCount, const Vec3f *instance
 
 Instance::Instance()
 : _ratio(0),
-  _instanceCount(0)
+  _instanceCount(0),
+  _scene(nullptr)
 {
 }
 
-void Instance::loadResources()
+Instance::~Instance()
+{
+    deleteScenes();
+}
+
+void Instance::loadInstanceFiles()
 {
     Box3f bounds;
     if (_instanceFileA)
@@ -281,6 +336,16 @@ void Instance::loadResources()
     }
 }
 
+void Instance::loadResources()
+{
+    loadInstanceFiles();
+}
+
+std::vector<std::shared_ptr<Primitive>> Instance::childPrimitives() const
+{
+    return _master;
+}
+
 void Instance::saveResources()
 {
     if (_instanceFileA && !_instanceFileB)
@@ -289,42 +354,27 @@ void Instance::saveResources()
 
 bool Instance::intersect(Ray &ray, IntersectionTemporary &data) const
 {
-    bool hit = false;
-    uint32 prim;
-    _bvh->trace(ray, [&](Ray &ray, uint32 id, float tMin, const Vec3pf &/*bounds*/) {
-        QuaternionF invRot = _instanceRot[id].conjugate();
-        Ray localRay = ray.scatter(invRot*(ray.pos() - _instancePos[id]), invRot*ray.dir(), tMin);
-        bool hitI = _master[_instanceId[id]]->intersect(localRay, data);
-        if (hitI) {
-            hit = true;
-            prim = id;
-            ray.setFarT(localRay.farT());
-        }
-    });
+    InstanceRay eRay(EmbreeUtil::convert(ray), data);
+    rtcIntersect(_scene, eRay);
+    if (eRay.geomID == RTC_INVALID_GEOMETRY_ID)
+        return false;
 
-    if (hit) {
-        data.primitive = this;
-        data.flags = prim;
-    }
+    uint32 id = eRay.instID;
+    if (const TriangleMesh *mesh = _masterMesh[_instanceId[id]])
+        mesh->embreeIntersection(eRay, _instanceRot[id].conjugate()*ray.dir(), data);
 
-    return hit;
+    ray.setFarT(eRay.tfar);
+    data.primitive = this;
+    data.flags = id;
+
+    return true;
 }
 
 bool Instance::occluded(const Ray &ray) const
 {
-    Ray tmpRay = ray;
-    bool occluded = false;
-    _bvh->trace(tmpRay, [&](Ray &ray, uint32 id, float tMin, const Vec3pf &/*bounds*/) {
-        QuaternionF invRot = _instanceRot[id].conjugate();
-        Ray localRay = ray.scatter(invRot*(ray.pos() - _instancePos[id]), invRot*ray.dir(), tMin);
-        bool occludedI = _master[_instanceId[id]]->occluded(localRay);
-        if (occludedI) {
-            occluded = true;
-            ray.setFarT(ray.farT() - 1);
-        }
-    });
-
-    return occluded;
+    RTCRay eRay(EmbreeUtil::convert(ray));
+    rtcOccluded(_scene, eRay);
+    return eRay.geomID != RTC_INVALID_GEOMETRY_ID;
 }
 
 bool Instance::hitBackside(const IntersectionTemporary &data) const
@@ -334,12 +384,19 @@ bool Instance::hitBackside(const IntersectionTemporary &data) const
 
 void Instance::intersectionInfo(const IntersectionTemporary &data, IntersectionInfo &info) const
 {
+    // The hit point and direction come in world space, but the master
+    // expects them in its own space
+    QuaternionF rot = _instanceRot[data.flags];
+    QuaternionF invRot = rot.conjugate();
+    info.p = invRot*(info.p - _instancePos[data.flags]);
+    info.w = invRot*info.w;
+
     getMaster(data).intersectionInfo(data, info);
 
-    QuaternionF rot = _instanceRot[data.flags];
     info.Ng = rot*info.Ng;
     info.Ns = rot*info.Ns;
     info.p = _instancePos[data.flags] + rot*info.p;
+    info.w = rot*info.w;
     info.primitive = this;
 }
 
@@ -394,9 +451,6 @@ void Instance::prepareForRender()
     for (auto &m : _master)
         m->prepareForRender();
 
-    Bvh::PrimVector prims;
-    prims.reserve(_instanceCount);
-
     auto rot = QuaternionF::fromMatrix(_transform.extractRotation());
     for (uint32 i = 0; i < _instanceCount; ++i) {
         _instancePos[i] = _transform*_instancePos[i];
@@ -407,30 +461,33 @@ void Instance::prepareForRender()
     for (const auto &m : _master)
         masterBounds.emplace_back(m->bounds());
 
+    deleteScenes();
+    buildMasterScenes();
+    _scene = rtcDeviceNewScene(EmbreeUtil::getDevice(), RTC_SCENE_STATIC | RTC_SCENE_INCOHERENT, RTC_INTERSECT1);
+
     _bounds = Box3f();
     for (uint32 i = 0; i < _instanceCount; ++i) {
         Box3f bLocal = masterBounds[_instanceId[i]];
+        Mat4f transform = Mat4f::translate(_instancePos[i])*_instanceRot[i].toMatrix();
 
-        Box3f bGlobal;
         for (float x : {0, 1})
             for (float y : {0, 1})
                 for (float z : {0, 1})
-                    bGlobal.grow(_instancePos[i] + _instanceRot[i]*lerp(bLocal.min(), bLocal.max(), Vec3f(x, y, z)));
+                    _bounds.grow(transform*lerp(bLocal.min(), bLocal.max(), Vec3f(x, y, z)));
 
-        _bounds.grow(bGlobal);
-
-        prims.emplace_back(Bvh::Primitive(bGlobal, bGlobal.center(), i));
+        // Instance IDs are handed out in order, so they match our indices
+        unsigned geomId = rtcNewInstance2(_scene, _masterScene[_instanceId[i]]);
+        rtcSetTransform2(_scene, geomId, RTC_MATRIX_ROW_MAJOR, transform.data());
     }
-
-    _bvh.reset(new Bvh::BinaryBvh(std::move(prims), 2));
+    rtcCommit(_scene);
 
     Primitive::prepareForRender();
 }
 
 void Instance::teardownAfterRender()
 {
-    _bvh.reset();
-    loadResources();
+    deleteScenes();
+    loadInstanceFiles();
 
     Primitive::teardownAfterRender();
 }
@@ -1,17 +1,30 @@
 #ifndef INSTANCE_HPP_
 #define INSTANCE_HPP_
 
+#include "EmbreeUtil.hpp"
 #include "Primitive.hpp"
 
 #include "math/Quaternion.hpp"
 
-#include "bvh/BinaryBvh.hpp"
-
 namespace Tungsten {
 
+// Instances are traced as a two level Embree BVH: every master is an
+// Embree scene, and every instance is a native Embree instance of it.
+// Triangle mesh masters share the scene of the mesh; other primitives are
+// wrapped in a user geometry
 class Instance : public Primitive
 {
+    struct InstanceRay : RTCRay
+    {
+        IntersectionTemporary &data;
+
+        InstanceRay(RTCRay eRay, IntersectionTemporary &data_)
+        : RTCRay(eRay), data(data_) {}
+    };
+
     std::vector<std::shared_ptr<Primitive>> _master;
+    std::vector<const TriangleMesh *> _masterMesh;
+    std::vector<RTCScene> _masterScene;
 
     PathPtr _instanceFileA;
     PathPtr _instanceFileB;
@@ -26,9 +39,12 @@ class Instance : public Primitive
 
     std::shared_ptr<TriangleMesh> _proxy;
 
-    std::unique_ptr<Bvh::BinaryBvh> _bvh;
+    RTCScene _scene;
 
+    void loadInstanceFiles();
     void buildProxy();
+    void buildMasterScenes();
+    void deleteScenes();
 
     const Primitive &getMaster(const IntersectionTemporary &data) const;
 
@@ -37,11 +53,13 @@ protected:
 
 public:
     Instance();
+    ~Instance();
 
     virtual void fromJson(JsonPtr value, const Scene &scene) override;
     virtual rapidjson::Value toJson(Allocator &allocator) const override;
 
     virtual void loadResources() override;
+    virtual std::vector<std::shared_ptr<Primitive>> childPrimitives() const override;
     virtual void saveResources() override;
 
     virtual bool intersect(Ray &ray, IntersectionTemporary &data) const override;
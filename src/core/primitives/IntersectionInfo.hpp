@@ -16,6 +16,10 @@ struct IntersectionInfo
     Vec3f w;
     Vec2f uv;
     float epsilon;
+    // World space width of the ray cone at the hit point, and the ratio of
+    // uv space to world space lengths around it. Both are zero if unknown
+    float footprint;
+    float uvScale;
 
     const Primitive *primitive;
     const Bsdf *bsdf;
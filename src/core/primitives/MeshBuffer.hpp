@@ -0,0 +1,105 @@
+#ifndef MESHBUFFER_HPP_
+#define MESHBUFFER_HPP_
+
+#include <memory>
+#include <vector>
+
+namespace Tungsten {
+
+// Contiguous array of mesh data that either owns its elements or is a
+// read-only view into memory owned by someone else (usually a memory mapped
+// mesh file, which is kept alive through the source handle). Views are
+// copied into an owned vector the first time mutable access is requested
+template<typename T>
+class MeshBuffer
+{
+    std::vector<T> _owned;
+    std::shared_ptr<const void> _source;
+    const T *_view;
+    size_t _viewSize;
+    bool _isView;
+
+public:
+    typedef const T *const_iterator;
+
+    MeshBuffer()
+    : _view(nullptr),
+      _viewSize(0),
+      _isView(false)
+    {
+    }
+
+    MeshBuffer(std::vector<T> elements)
+    : _owned(std::move(elements)),
+      _view(nullptr),
+      _viewSize(0),
+      _isView(false)
+    {
+    }
+
+    // The source handle may be null if the viewed memory is guaranteed to
+    // outlive the buffer by other means
+    MeshBuffer(std::shared_ptr<const void> source, const T *data, size_t size)
+    : _source(std::move(source)),
+      _view(data),
+      _viewSize(size),
+      _isView(true)
+    {
+    }
+
+    std::vector<T> &vector()
+    {
+        if (_isView) {
+            _owned.assign(_view, _view + _viewSize);
+            _source.reset();
+            _view = nullptr;
+            _viewSize = 0;
+            _isView = false;
+        }
+        return _owned;
+    }
+
+    void clear()
+    {
+        *this = MeshBuffer();
+    }
+
+    bool isView() const
+    {
+        return _isView;
+    }
+
+    const T *data() const
+    {
+        return _isView ? _view : _owned.data();
+    }
+
+    size_t size() const
+    {
+        return _isView ? _viewSize : _owned.size();
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    const T &operator[](size_t i) const
+    {
+        return data()[i];
+    }
+
+    const_iterator begin() const
+    {
+        return data();
+    }
+
+    const_iterator end() const
+    {
+        return data() + size();
+    }
+};
+
+}
+
+#endif /* MESHBUFFER_HPP_ */
@@ -6,6 +6,8 @@
 #include "io/JsonObject.hpp"
 #include "io/Scene.hpp"
 
+#include "math/Angle.hpp"
+
 namespace Tungsten {
 
 std::shared_ptr<Bsdf> Primitive::_defaultBsdf = std::make_shared<LambertBsdf>();
@@ -108,6 +110,20 @@ Vec3f Primitive::evalDirect(const IntersectionTemporary &data, const Intersectio
     return (*_emission)[info];
 }
 
+float Primitive::approximatePower() const
+{
+    float factor = powerToRadianceFactor();
+    if (!_emission || factor <= 0.0f)
+        return -1.0f;
+    return _emission->average().max()/factor;
+}
+
+void Primitive::emissionNormalBounds(Vec3f &axis, float &theta) const
+{
+    axis = Vec3f(0.0f, 0.0f, 1.0f);
+    theta = PI;
+}
+
 void Primitive::prepareForRender()
 {
     if (_power) {
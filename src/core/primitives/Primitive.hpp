@@ -86,6 +86,12 @@ public:
     virtual bool isInfinite() const = 0;
 
     virtual float approximateRadiance(uint32 threadIndex, const Vec3f &p) const = 0;
+    // Total emitted power, or a negative value if it can't be estimated.
+    // Only valid after prepareForRender
+    virtual float approximatePower() const;
+    // Cone (axis and half angle) bounding the normals of the emitting
+    // surface. Defaults to all directions
+    virtual void emissionNormalBounds(Vec3f &axis, float &theta) const;
 
     virtual Box3f bounds() const = 0;
 
@@ -108,6 +114,13 @@ public:
         return std::vector<std::shared_ptr<Primitive>>();
     }
 
+    // Primitives this one is built from (e.g. the masters of an instance).
+    // The scene loads their resources before the resources of this one
+    virtual std::vector<std::shared_ptr<Primitive>> childPrimitives() const
+    {
+        return std::vector<std::shared_ptr<Primitive>>();
+    }
+
     virtual bool isEmissive() const
     {
         return (_emission.operator bool() && _emission->maximum().max() > 0.0f) ||
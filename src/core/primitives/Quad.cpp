@@ -126,6 +126,8 @@ void Quad::intersectionInfo(const IntersectionTemporary &data, IntersectionInfo
     info.Ng = info.Ns = _frame.normal;
     info.p = isect->p;
     info.uv = Vec2f(isect->u, isect->v);
+    if (info.footprint > 0.0f)
+        info.uvScale = 1.0f/std::sqrt(_edge0.length()*_edge1.length());
     info.primitive = this;
     info.bsdf = _bsdf.get();
 }
@@ -278,6 +280,12 @@ float Quad::approximateRadiance(uint32 /*threadIndex*/, const Vec3f &p) const
     return (TWO_PI - std::abs(Q))*_emission->average().max();
 }
 
+void Quad::emissionNormalBounds(Vec3f &axis, float &theta) const
+{
+    axis = _frame.normal;
+    theta = 0.0f;
+}
+
 Box3f Quad::bounds() const
 {
     Box3f result;
@@ -124,6 +124,7 @@ void Sphere::intersectionInfo(const IntersectionTemporary &/*data*/, Intersectio
     info.uv = Vec2f(std::atan2(localN.y(), localN.x())*INV_TWO_PI + 0.5f, std::acos(clamp(localN.z(), -1.0f, 1.0f))*INV_PI);
     if (std::isnan(info.uv.x()))
         info.uv.x() = 0.0f;
+    info.uvScale = INV_PI/_radius;
     info.primitive = this;
     info.bsdf = _bsdf.get();
 }
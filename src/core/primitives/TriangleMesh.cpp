@@ -32,6 +32,8 @@ TriangleMesh::TriangleMesh()
 : _smoothed(false),
   _backfaceCulling(false),
   _recomputeNormals(false),
+  _hasObjectBounds(false),
+  _objectArea(0.0f),
   _bsdfs(1, _defaultBsdf),
   _scene(nullptr)
 {
@@ -45,6 +47,10 @@ TriangleMesh::TriangleMesh(const TriangleMesh &o)
   _recomputeNormals(o._recomputeNormals),
   _verts(o._verts),
   _tris(o._tris),
+  _hasObjectBounds(o._hasObjectBounds),
+  _objectBounds(o._objectBounds),
+  _objectAreaCdf(o._objectAreaCdf),
+  _objectArea(o._objectArea),
   _bsdfs(o._bsdfs),
   _bounds(o._bounds)
 {
@@ -74,6 +80,8 @@ TriangleMesh::TriangleMesh(std::vector<Vertex> verts, std::vector<TriangleI> tri
   _recomputeNormals(false),
   _verts(std::move(verts)),
   _tris(std::move(tris)),
+  _hasObjectBounds(false),
+  _objectArea(0.0f),
   _bsdfs(std::move(bsdfs))
 {
 }
@@ -105,6 +113,36 @@ Vec2f TriangleMesh::uvAt(int triangle, float u, float v) const
     return (1.0f - u - v)*uv0 + u*uv1 + v*uv2;
 }
 
+static bool isIdentity(const Mat4f &m)
+{
+    Mat4f identity;
+    for (int i = 0; i < 16; ++i)
+        if (m[i] != identity[i])
+            return false;
+    return true;
+}
+
+// Returns true if the transform is a rotation/translation with uniform
+// scaling, in which case object space areas only change by a constant factor
+bool TriangleMesh::uniformScale(float &scale) const
+{
+    Vec3f x = _transform.right(), y = _transform.up(), z = _transform.fwd();
+    float lx = x.length(), ly = y.length(), lz = z.length();
+    float tolerance = 1e-4f*lx;
+    if (std::abs(lx - ly) > tolerance || std::abs(lx - lz) > tolerance)
+        return false;
+    if (std::abs(x.dot(y)) > tolerance*lx || std::abs(x.dot(z)) > tolerance*lx || std::abs(y.dot(z)) > tolerance*lx)
+        return false;
+    scale = lx;
+    return true;
+}
+
+void TriangleMesh::invalidateMetadata()
+{
+    _hasObjectBounds = false;
+    _objectAreaCdf.clear();
+}
+
 float TriangleMesh::powerToRadianceFactor() const
 {
     return INV_PI*_invArea;
@@ -154,8 +192,15 @@ rapidjson::Value TriangleMesh::toJson(Allocator &allocator) const
 
 void TriangleMesh::loadResources()
 {
-    if (_path && !MeshIO::load(*_path, _verts, _tris))
+    MeshIO::MeshMetadata metadata;
+    if (_path && !MeshIO::load(*_path, _verts, _tris, metadata))
         DBG("Unable to load triangle mesh at %s", *_path);
+
+    _hasObjectBounds = metadata.hasBounds;
+    _objectBounds = metadata.bounds;
+    _objectAreaCdf = metadata.hasAreaCdf ? std::move(metadata.areaCdf) : MeshBuffer<float>();
+    _objectArea = metadata.totalArea;
+
     if (_recomputeNormals && _smoothed)
         calcSmoothVertexNormals();
 }
@@ -176,18 +221,21 @@ void TriangleMesh::calcSmoothVertexNormals()
     static const float SplitLimit = std::cos(PI*0.15f);
     //static CONSTEXPR float SplitLimit = -1.0f;
 
-    std::vector<Vec3f> geometricN(_verts.size(), Vec3f(0.0f));
+    std::vector<Vertex> &verts = this->verts();
+    std::vector<TriangleI> &tris = this->tris();
+
+    std::vector<Vec3f> geometricN(verts.size(), Vec3f(0.0f));
     std::unordered_multimap<Vec3f, uint32> posToVert;
 
-    for (uint32 i = 0; i < _verts.size(); ++i) {
-        _verts[i].normal() = Vec3f(0.0f);
-        posToVert.insert(std::make_pair(_verts[i].pos(), i));
+    for (uint32 i = 0; i < verts.size(); ++i) {
+        verts[i].normal() = Vec3f(0.0f);
+        posToVert.insert(std::make_pair(verts[i].pos(), i));
     }
 
-    for (TriangleI &t : _tris) {
-        const Vec3f &p0 = _verts[t.v0].pos();
-        const Vec3f &p1 = _verts[t.v1].pos();
-        const Vec3f &p2 = _verts[t.v2].pos();
+    for (TriangleI &t : tris) {
+        const Vec3f &p0 = verts[t.v0].pos();
+        const Vec3f &p1 = verts[t.v1].pos();
+        const Vec3f &p2 = verts[t.v2].pos();
         Vec3f normal = (p1 - p0).cross(p2 - p0);
         if (normal == 0.0f)
             normal = Vec3f(0.0f, 1.0f, 0.0f);
@@ -199,48 +247,62 @@ void TriangleMesh::calcSmoothVertexNormals()
             if (n == 0.0f) {
                 n = normal;
             } else if (n.dot(normal) < SplitLimit) {
-                _verts.push_back(_verts[t.vs[i]]);
+                verts.push_back(verts[t.vs[i]]);
                 geometricN.push_back(normal);
-                t.vs[i] = _verts.size() - 1;
+                t.vs[i] = verts.size() - 1;
             }
         }
     }
 
-    for (TriangleI &t : _tris) {
-        const Vec3f &p0 = _verts[t.v0].pos();
-        const Vec3f &p1 = _verts[t.v1].pos();
-        const Vec3f &p2 = _verts[t.v2].pos();
+    for (TriangleI &t : tris) {
+        const Vec3f &p0 = verts[t.v0].pos();
+        const Vec3f &p1 = verts[t.v1].pos();
+        const Vec3f &p2 = verts[t.v2].pos();
         Vec3f normal = (p1 - p0).cross(p2 - p0);
         Vec3f nN = normal.normalized();
 
         for (int i = 0; i < 3; ++i) {
-            auto iters = posToVert.equal_range(_verts[t.vs[i]].pos());
+            auto iters = posToVert.equal_range(verts[t.vs[i]].pos());
 
             for (auto t = iters.first; t != iters.second; ++t)
                 if (geometricN[t->second].dot(nN) >= SplitLimit)
-                    _verts[t->second].normal() += normal;
+                    verts[t->second].normal() += normal;
         }
     }
 
-    for (uint32 i = 0; i < _verts.size(); ++i) {
-        if (_verts[i].normal() == 0.0f)
-            _verts[i].normal() = geometricN[i];
+    for (uint32 i = 0; i < verts.size(); ++i) {
+        if (verts[i].normal() == 0.0f)
+            verts[i].normal() = geometricN[i];
         else
-            _verts[i].normal().normalize();
+            verts[i].normal().normalize();
     }
 }
 
 void TriangleMesh::computeBounds()
 {
     Box3f box;
-    for (Vertex &v : _verts)
-        box.grow(_transform*v.pos());
+    if (_hasObjectBounds) {
+        // Transformed corners of the stored box, so that mapped vertex
+        // data does not need to be touched just to compute bounds
+        for (int i = 0; i < 8; ++i)
+            box.grow(_transform*Vec3f(
+                (i & 1) ? _objectBounds.max().x() : _objectBounds.min().x(),
+                (i & 2) ? _objectBounds.max().y() : _objectBounds.min().y(),
+                (i & 4) ? _objectBounds.max().z() : _objectBounds.min().z()
+            ));
+    } else {
+        for (const Vertex &v : _verts)
+            box.grow(_transform*v.pos());
+    }
     _bounds = box;
 }
 
 void TriangleMesh::makeCube()
 {
-    const Vec3f verts[6][4] = {
+    std::vector<Vertex> &verts = this->verts();
+    std::vector<TriangleI> &tris = this->tris();
+
+    const Vec3f positions[6][4] = {
         {{-0.5f, -0.5f, -0.5f}, {-0.5f, -0.5f,  0.5f}, { 0.5f, -0.5f,  0.5f}, { 0.5f, -0.5f, -0.5f}},
         {{-0.5f,  0.5f,  0.5f}, {-0.5f,  0.5f, -0.5f}, { 0.5f,  0.5f, -0.5f}, { 0.5f,  0.5f,  0.5f}},
         {{-0.5f,  0.5f, -0.5f}, {-0.5f, -0.5f, -0.5f}, { 0.5f, -0.5f, -0.5f}, { 0.5f,  0.5f, -0.5f}},
@@ -251,20 +313,23 @@ void TriangleMesh::makeCube()
     const Vec2f uvs[] = {{0.0f, 0.0f}, {1.0f, 0.0f}, {1.0f, 1.0f}, {0.0f, 1.0f}};
 
     for (int i = 0; i < 6; ++i) {
-        int idx = _verts.size();
-        _tris.emplace_back(idx, idx + 2, idx + 1);
-        _tris.emplace_back(idx, idx + 3, idx + 2);
+        int idx = verts.size();
+        tris.emplace_back(idx, idx + 2, idx + 1);
+        tris.emplace_back(idx, idx + 3, idx + 2);
 
         for (int j = 0; j < 4; ++j)
-            _verts.emplace_back(verts[i][j], uvs[j]);
+            verts.emplace_back(positions[i][j], uvs[j]);
     }
 }
 
 void TriangleMesh::makeSphere(float radius)
 {
+    std::vector<Vertex> &verts = this->verts();
+    std::vector<TriangleI> &tris = this->tris();
+
     CONSTEXPR int SubDiv = 10;
     CONSTEXPR int Skip = SubDiv*2 + 1;
-    for (int f = 0, idx = _verts.size(); f < 3; ++f) {
+    for (int f = 0, idx = verts.size(); f < 3; ++f) {
         for (int s = -1; s <= 1; s += 2) {
             for (int u = -SubDiv; u <= SubDiv; ++u) {
                 for (int v = -SubDiv; v <= SubDiv; ++v, ++idx) {
@@ -272,11 +337,11 @@ void TriangleMesh::makeSphere(float radius)
                     p[f] = s;
                     p[(f + 1) % 3] = u*(1.0f/SubDiv)*s;
                     p[(f + 2) % 3] = v*(1.0f/SubDiv);
-                    _verts.emplace_back(p.normalized()*radius);
+                    verts.emplace_back(p.normalized()*radius);
 
                     if (v > -SubDiv && u > -SubDiv) {
-                        _tris.emplace_back(idx - Skip - 1, idx, idx - Skip);
-                        _tris.emplace_back(idx - Skip - 1, idx - 1, idx);
+                        tris.emplace_back(idx - Skip - 1, idx, idx - Skip);
+                        tris.emplace_back(idx - Skip - 1, idx - 1, idx);
                     }
                 }
             }
@@ -286,31 +351,37 @@ void TriangleMesh::makeSphere(float radius)
 
 void TriangleMesh::makeCone(float radius, float height)
 {
+    std::vector<Vertex> &verts = this->verts();
+    std::vector<TriangleI> &tris = this->tris();
+
     CONSTEXPR int SubDiv = 36;
-    int base = _verts.size();
-    _verts.emplace_back(Vec3f(0.0f));
+    int base = verts.size();
+    verts.emplace_back(Vec3f(0.0f));
     for (int i = 0; i < SubDiv; ++i) {
         float a = i*TWO_PI/SubDiv;
-        _verts.emplace_back(Vec3f(std::cos(a)*radius, height, std::sin(a)*radius));
-        _tris.emplace_back(base, base + i + 1, base + ((i + 1) % SubDiv) + 1);
+        verts.emplace_back(Vec3f(std::cos(a)*radius, height, std::sin(a)*radius));
+        tris.emplace_back(base, base + i + 1, base + ((i + 1) % SubDiv) + 1);
     }
 }
 
 void TriangleMesh::makeCylinder(float radius, float height)
 {
+    std::vector<Vertex> &verts = this->verts();
+    std::vector<TriangleI> &tris = this->tris();
+
     CONSTEXPR int SubDiv = 36;
-    int base = _verts.size();
-    _verts.emplace_back(Vec3f(0.0f, -height, 0.0f));
-    _verts.emplace_back(Vec3f(0.0f,  height, 0.0f));
+    int base = verts.size();
+    verts.emplace_back(Vec3f(0.0f, -height, 0.0f));
+    verts.emplace_back(Vec3f(0.0f,  height, 0.0f));
     for (int i = 0; i < SubDiv; ++i) {
         float a = i*TWO_PI/SubDiv;
-        _verts.emplace_back(Vec3f(std::cos(a)*radius, -height, std::sin(a)*radius));
-        _verts.emplace_back(Vec3f(std::cos(a)*radius,  height, std::sin(a)*radius));
+        verts.emplace_back(Vec3f(std::cos(a)*radius, -height, std::sin(a)*radius));
+        verts.emplace_back(Vec3f(std::cos(a)*radius,  height, std::sin(a)*radius));
         int i1 = (i + 1) % SubDiv;
-        _tris.emplace_back(base + 0, base + 2 + i*2, base + 2 + i1*2);
-        _tris.emplace_back(base + 1, base + 3 + i*2, base + 3 + i1*2);
-        _tris.emplace_back(base + 2 + i *2, base + 3 + i*2, base + 2 + i1*2);
-        _tris.emplace_back(base + 2 + i1*2, base + 3 + i*2, base + 3 + i1*2);
+        tris.emplace_back(base + 0, base + 2 + i*2, base + 2 + i1*2);
+        tris.emplace_back(base + 1, base + 3 + i*2, base + 3 + i1*2);
+        tris.emplace_back(base + 2 + i *2, base + 3 + i*2, base + 2 + i1*2);
+        tris.emplace_back(base + 2 + i1*2, base + 3 + i*2, base + 3 + i1*2);
     }
 }
 
@@ -320,20 +391,23 @@ bool TriangleMesh::intersect(Ray &ray, IntersectionTemporary &data) const
     rtcIntersect(_scene, eRay);
     if (eRay.geomID != RTC_INVALID_GEOMETRY_ID) {
         ray.setFarT(eRay.tfar);
-
-        data.primitive = this;
-        MeshIntersection *isect = data.as<MeshIntersection>();
-        isect->Ng = unnormalizedGeometricNormalAt(eRay.primID);
-        isect->u = eRay.u;
-        isect->v = eRay.v;
-        isect->primId = eRay.primID;
-        isect->backSide = isect->Ng.dot(ray.dir()) > 0.0f;
-
+        embreeIntersection(eRay, ray.dir(), data);
         return true;
     }
     return false;
 }
 
+void TriangleMesh::embreeIntersection(const RTCRay &eRay, const Vec3f &dir, IntersectionTemporary &data) const
+{
+    data.primitive = this;
+    MeshIntersection *isect = data.as<MeshIntersection>();
+    isect->Ng = unnormalizedGeometricNormalAt(eRay.primID);
+    isect->u = eRay.u;
+    isect->v = eRay.v;
+    isect->primId = eRay.primID;
+    isect->backSide = isect->Ng.dot(dir) > 0.0f;
+}
+
 bool TriangleMesh::occluded(const Ray &ray) const
 {
     RTCRay eRay(EmbreeUtil::convert(ray));
@@ -351,7 +425,17 @@ void TriangleMesh::intersectionInfo(const IntersectionTemporary &data, Intersect
         info.Ns = info.Ng;
     info.uv = uvAt(isect->primId, isect->u, isect->v);
     info.primitive = this;
-    info.bsdf = _bsdfs[_tris[isect->primId].material].get();
+    info.bsdf = _bsdfs[clamp(_tris[isect->primId].material, 0, int(_bsdfs.size()) - 1)].get();
+
+    if (info.footprint > 0.0f) {
+        const TriangleI &t = _tris[isect->primId];
+        Vec2f duv1 = _tfVerts[t.v1].uv() - _tfVerts[t.v0].uv();
+        Vec2f duv2 = _tfVerts[t.v2].uv() - _tfVerts[t.v0].uv();
+        float uvArea = std::abs(duv1.x()*duv2.y() - duv1.y()*duv2.x());
+        float area = isect->Ng.length();
+        if (area > 0.0f)
+            info.uvScale = std::sqrt(uvArea/area);
+    }
 }
 
 bool TriangleMesh::hitBackside(const IntersectionTemporary &data) const
@@ -399,6 +483,16 @@ void TriangleMesh::makeSamplable(const TraceableScene &/*scene*/, uint32 /*threa
         return;
 
     std::vector<float> areas(_tris.size());
+    float scale;
+    if (!_objectAreaCdf.empty() && uniformScale(scale)) {
+        // Relative areas are invariant under uniform scaling, so the
+        // stored CDF can be used directly
+        for (size_t i = 0; i < _tris.size(); ++i)
+            areas[i] = _objectAreaCdf[i + 1] - _objectAreaCdf[i];
+        _triSampler.reset(new Distribution1D(std::move(areas)));
+        return;
+    }
+
     _totalArea = 0.0f;
     for (size_t i = 0; i < _tris.size(); ++i) {
         Vec3f p0 = _tfVerts[_tris[i].v0].pos();
@@ -528,40 +622,45 @@ void TriangleMesh::prepareForRender()
     if (_verts.empty() || _tris.empty())
         return;
 
-    _scene = rtcDeviceNewScene(EmbreeUtil::getDevice(), RTC_SCENE_STATIC | RTC_SCENE_INCOHERENT, RTC_INTERSECT1);
-    _geomId = rtcNewTriangleMesh(_scene, RTC_GEOMETRY_STATIC, _tris.size(), _verts.size(), 1);
-    Vec4f *vs = static_cast<Vec4f *>(rtcMapBuffer(_scene, _geomId, RTC_VERTEX_BUFFER));
-    Vec3u *ts = static_cast<Vec3u *>(rtcMapBuffer(_scene, _geomId, RTC_INDEX_BUFFER));
-
-    for (size_t i = 0; i < _tris.size(); ++i) {
-        const TriangleI &t = _tris[i];
-        _tris[i].material = clamp(_tris[i].material, 0, int(_bsdfs.size()) - 1);
-        ts[i] = Vec3u(t.v0, t.v1, t.v2);
-    }
-
-    _tfVerts.resize(_verts.size());
-    Mat4f normalTform(_transform.toNormalMatrix());
-    for (size_t i = 0; i < _verts.size(); ++i) {
-        _tfVerts[i] = Vertex(
-            _transform*_verts[i].pos(),
-            normalTform.transformVector(_verts[i].normal()),
-            _verts[i].uv()
-        );
-        const Vec3f &p = _tfVerts[i].pos();
-        vs[i] = Vec4f(p.x(), p.y(), p.z(), 0.0f);
+    // Vertices in world space are only needed if the transform is not the
+    // identity. Otherwise the (possibly memory mapped) object space
+    // vertices are used as is
+    if (isIdentity(_transform)) {
+        _tfVerts = MeshBuffer<Vertex>(nullptr, _verts.data(), _verts.size());
+    } else {
+        std::vector<Vertex> tfVerts(_verts.size());
+        Mat4f normalTform(_transform.toNormalMatrix());
+        for (size_t i = 0; i < _verts.size(); ++i) {
+            tfVerts[i] = Vertex(
+                _transform*_verts[i].pos(),
+                normalTform.transformVector(_verts[i].normal()),
+                _verts[i].uv()
+            );
+        }
+        _tfVerts = MeshBuffer<Vertex>(std::move(tfVerts));
     }
 
-    _totalArea = 0.0f;
-    for (size_t i = 0; i < _tris.size(); ++i) {
-        Vec3f p0 = _tfVerts[_tris[i].v0].pos();
-        Vec3f p1 = _tfVerts[_tris[i].v1].pos();
-        Vec3f p2 = _tfVerts[_tris[i].v2].pos();
-        _totalArea += MathUtil::triangleArea(p0, p1, p2);
+    float scale;
+    if (!_objectAreaCdf.empty() && uniformScale(scale)) {
+        _totalArea = _objectArea*scale*scale;
+    } else {
+        _totalArea = 0.0f;
+        for (size_t i = 0; i < _tris.size(); ++i) {
+            Vec3f p0 = _tfVerts[_tris[i].v0].pos();
+            Vec3f p1 = _tfVerts[_tris[i].v1].pos();
+            Vec3f p2 = _tfVerts[_tris[i].v2].pos();
+            _totalArea += MathUtil::triangleArea(p0, p1, p2);
+        }
     }
     _invArea = 1.0f/_totalArea;
 
-    rtcUnmapBuffer(_scene, _geomId, RTC_VERTEX_BUFFER);
-    rtcUnmapBuffer(_scene, _geomId, RTC_INDEX_BUFFER);
+    // Embree reads vertices and indices straight from our own arrays. The
+    // position is the first member of Vertex and is followed by the normal,
+    // which satisfies Embree's requirement of 16 readable bytes per vertex
+    _scene = rtcDeviceNewScene(EmbreeUtil::getDevice(), RTC_SCENE_STATIC | RTC_SCENE_INCOHERENT, RTC_INTERSECT1);
+    _geomId = rtcNewTriangleMesh(_scene, RTC_GEOMETRY_STATIC, _tris.size(), _verts.size(), 1);
+    rtcSetBuffer(_scene, _geomId, RTC_VERTEX_BUFFER, _tfVerts.data(), 0, sizeof(Vertex));
+    rtcSetBuffer(_scene, _geomId, RTC_INDEX_BUFFER, _tris.data(), 0, sizeof(TriangleI));
 
     rtcCommit(_scene);
 
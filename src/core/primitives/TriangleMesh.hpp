@@ -1,6 +1,7 @@
 #ifndef TRIANGLEMESH_HPP_
 #define TRIANGLEMESH_HPP_
 
+#include "MeshBuffer.hpp"
 #include "Primitive.hpp"
 #include "Triangle.hpp"
 #include "Vertex.hpp"
@@ -15,6 +16,7 @@
 #include <embree2/rtcore.h>
 #include <embree2/rtcore_scene.h>
 #include <embree2/rtcore_geometry.h>
+#include <embree2/rtcore_ray.h>
 
 namespace Tungsten {
 
@@ -27,9 +29,16 @@ class TriangleMesh : public Primitive
     bool _backfaceCulling;
     bool _recomputeNormals;
 
-    std::vector<Vertex> _verts;
-    std::vector<Vertex> _tfVerts;
-    std::vector<TriangleI> _tris;
+    MeshBuffer<Vertex> _verts;
+    MeshBuffer<Vertex> _tfVerts;
+    MeshBuffer<TriangleI> _tris;
+
+    // Object space data precomputed by the mesh file, if available.
+    // Invalidated whenever the geometry is modified
+    bool _hasObjectBounds;
+    Box3f _objectBounds;
+    MeshBuffer<float> _objectAreaCdf;
+    float _objectArea;
 
     std::vector<std::shared_ptr<Bsdf>> _bsdfs;
 
@@ -46,6 +55,9 @@ class TriangleMesh : public Primitive
     Vec3f normalAt(int triangle, float u, float v) const;
     Vec2f uvAt(int triangle, float u, float v) const;
 
+    bool uniformScale(float &scale) const;
+    void invalidateMetadata();
+
 protected:
     virtual float powerToRadianceFactor() const override;
 
@@ -81,6 +93,17 @@ public:
     virtual bool tangentSpace(const IntersectionTemporary &data, const IntersectionInfo &/*info*/,
             Vec3f &T, Vec3f &B) const override;
 
+    // Fills the intersection temporary from a hit returned by the Embree
+    // scene of this mesh, e.g. when the scene is traced as an instance.
+    // The direction is that of the ray in the space of the mesh
+    void embreeIntersection(const RTCRay &eRay, const Vec3f &dir, IntersectionTemporary &data) const;
+
+    // Only valid between prepareForRender and teardownAfterRender
+    RTCScene embreeScene() const
+    {
+        return _scene;
+    }
+
     virtual const TriangleMesh &asTriangleMesh() override;
 
     virtual bool isSamplable() const override;
@@ -117,24 +140,26 @@ public:
 
     virtual Primitive *clone() override;
 
-    const std::vector<TriangleI>& tris() const
+    const MeshBuffer<TriangleI>& tris() const
     {
         return _tris;
     }
 
-    const std::vector<Vertex>& verts() const
+    const MeshBuffer<Vertex>& verts() const
     {
         return _verts;
     }
 
     std::vector<TriangleI>& tris()
     {
-        return _tris;
+        invalidateMetadata();
+        return _tris.vector();
     }
 
     std::vector<Vertex>& verts()
     {
-        return _verts;
+        invalidateMetadata();
+        return _verts.vector();
     }
 
     bool smoothed() const
@@ -24,6 +24,8 @@ class RendererSettings : public JsonSerializable
     bool _enableResumeRender;
     bool _useSceneBvh;
     bool _useSobol;
+    bool _localSplatAccumulation;
+    uint32 _splatCacheTiles;
     uint32 _spp;
     uint32 _sppStep;
     std::string _checkpointInterval;
@@ -39,6 +41,8 @@ public:
       _enableResumeRender(false),
       _useSceneBvh(true),
       _useSobol(true),
+      _localSplatAccumulation(false),
+      _splatCacheTiles(64),
       _spp(32),
       _sppStep(16),
       _checkpointInterval("0"),
@@ -62,6 +66,8 @@ public:
         value.getField("enable_resume_render", _enableResumeRender);
         value.getField("stratified_sampler", _useSobol);
         value.getField("scene_bvh", _useSceneBvh);
+        value.getField("local_splat_accumulation", _localSplatAccumulation);
+        value.getField("splat_cache_tiles", _splatCacheTiles);
         value.getField("spp", _spp);
         value.getField("spp_step", _sppStep);
         value.getField("checkpoint_interval", _checkpointInterval);
@@ -83,6 +89,8 @@ public:
             "enable_resume_render", _enableResumeRender,
             "stratified_sampler", _useSobol,
             "scene_bvh", _useSceneBvh,
+            "local_splat_accumulation", _localSplatAccumulation,
+            "splat_cache_tiles", _splatCacheTiles,
             "spp", _spp,
             "spp_step", _sppStep,
             "checkpoint_interval", _checkpointInterval,
@@ -174,6 +182,16 @@ public:
         return _useSobol;
     }
 
+    bool localSplatAccumulation() const
+    {
+        return _localSplatAccumulation;
+    }
+
+    uint32 splatCacheTiles() const
+    {
+        return _splatCacheTiles;
+    }
+
     bool useSceneBvh() const
     {
         return _useSceneBvh;
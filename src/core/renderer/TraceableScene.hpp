@@ -13,7 +13,10 @@
 
 #include "media/Medium.hpp"
 
+#include "bvh/LightBvh.hpp"
+
 #include "RendererSettings.hpp"
+#include <unordered_map>
 #include <vector>
 #include <memory>
 
@@ -35,8 +38,22 @@ public:
         : RTCRay(eRay), data(data_), ray(ray_), userGeomId(userGeomId_) {}
     };
 
+    // Rays are handed to Embree in packets of this size by the ray stream
+    // interface. Embree is built for SSE, so wider packets are not available
+    static const int RayPacketSize = 4;
+
+    struct IntersectionRayPacket : RTCRay4
+    {
+        IntersectionTemporary *data[RayPacketSize];
+        Ray *ray[RayPacketSize];
+        unsigned userGeomId;
+    };
+
 private:
     const float DefaultEpsilon = 5e-4f;
+    // Below this many finite lights, the per-light radiance estimates used
+    // for light selection are cheap and more accurate than the light BVH
+    static const uint32 MinLightBvhSize = 8;
 
     Camera &_cam;
     Integrator &_integrator;
@@ -48,10 +65,53 @@ private:
     std::vector<const Primitive *> _finites;
     RendererSettings _settings;
 
+    // Lights in the light BVH are addressed by their emitter index. Lights
+    // that can't go in the BVH (infinite lights or lights of unknown power)
+    // are selected individually alongside it
+    std::unique_ptr<Bvh::LightBvh> _lightBvh;
+    std::vector<uint32> _bvhLights;
+    std::vector<uint32> _unclusteredLights;
+    std::vector<int> _lightToEmitter;
+    std::unordered_map<const Primitive *, uint32> _lightIndex;
+
     RTCScene _scene = nullptr;
     unsigned _userGeomId;
 
     Box3f _sceneBounds;
+    bool _hasTransparency = false;
+
+    void buildLightBvh()
+    {
+        std::vector<Bvh::LightBvh::Emitter> emitters;
+        _lightToEmitter.resize(_lights.size(), -1);
+        for (uint32 i = 0; i < _lights.size(); ++i) {
+            _lightIndex[_lights[i].get()] = i;
+            float power = _lights[i]->approximatePower();
+            if (_lights[i]->isInfinite() || power < 0.0f) {
+                _unclusteredLights.push_back(i);
+                continue;
+            }
+
+            Bvh::LightBvh::Emitter e;
+            e.bounds = _lights[i]->bounds();
+            e.power = power;
+            _lights[i]->emissionNormalBounds(e.axis, e.theta);
+            _lightToEmitter[i] = emitters.size();
+            _bvhLights.push_back(i);
+            emitters.push_back(e);
+        }
+
+        if (emitters.size() < MinLightBvhSize) {
+            _bvhLights.clear();
+            _unclusteredLights.clear();
+            std::fill(_lightToEmitter.begin(), _lightToEmitter.end(), -1);
+            for (uint32 i = 0; i < _lights.size(); ++i)
+                _unclusteredLights.push_back(i);
+            return;
+        }
+
+        _lightBvh.reset(new Bvh::LightBvh(std::move(emitters)));
+    }
 
 public:
     TraceableScene(Camera &cam, Integrator &integrator,
@@ -79,9 +139,12 @@ public:
         int finiteCount = 0, lightCount = 0;
         for (std::shared_ptr<Primitive> &m : _primitives) {
             m->prepareForRender();
-            for (int i = 0; i < m->numBsdfs(); ++i)
+            for (int i = 0; i < m->numBsdfs(); ++i) {
                 if (m->bsdf(i)->unnamed())
                     m->bsdf(i)->prepareForRender();
+                if (m->bsdf(i)->lobes().hasForward())
+                    _hasTransparency = true;
+            }
 
             if (!m->isDirac() && !m->isInfinite())
                 finiteCount++;
@@ -101,6 +164,8 @@ public:
             _infiniteLights.push_back(defaultLight);
         }
 
+        buildLightBvh();
+
         for (std::shared_ptr<Primitive> &m : _primitives) {
             if (m->isInfinite() || m->isDirac())
                 continue;
@@ -110,7 +175,7 @@ public:
         }
 
         if (_settings.useSceneBvh()) {
-            _scene = rtcDeviceNewScene(EmbreeUtil::getDevice(), RTC_SCENE_STATIC | RTC_SCENE_INCOHERENT, RTC_INTERSECT1);
+            _scene = rtcDeviceNewScene(EmbreeUtil::getDevice(), RTC_SCENE_STATIC | RTC_SCENE_INCOHERENT, RTC_INTERSECT1 | RTC_INTERSECT4);
             _userGeomId = rtcNewUserGeometry(_scene, _finites.size());
             rtcSetUserData(_scene, _userGeomId, this);
 
@@ -129,6 +194,25 @@ public:
                 if (static_cast<TraceableScene *>(ptr)->finites()[i]->occluded(Ray(EmbreeUtil::convert(embreeRay))))
                     embreeRay.geomID = 0;
             });
+            rtcSetIntersectFunction4(_scene, _userGeomId, [](const void *valid, void *ptr, RTCRay4 &embreeRay, size_t i) {
+                IntersectionRayPacket &packet = *static_cast<IntersectionRayPacket *>(&embreeRay);
+                const Primitive *prim = static_cast<TraceableScene *>(ptr)->finites()[i];
+                for (int lane = 0; lane < RayPacketSize; ++lane) {
+                    if (static_cast<const int *>(valid)[lane] == 0)
+                        continue;
+                    if (prim->intersect(*packet.ray[lane], *packet.data[lane])) {
+                        embreeRay.tfar[lane] = packet.ray[lane]->farT();
+                        embreeRay.geomID[lane] = packet.userGeomId;
+                        embreeRay.primID[lane] = i;
+                    }
+                }
+            });
+            rtcSetOccludedFunction4(_scene, _userGeomId, [](const void *valid, void *ptr, RTCRay4 &embreeRay, size_t i) {
+                const Primitive *prim = static_cast<TraceableScene *>(ptr)->finites()[i];
+                for (int lane = 0; lane < RayPacketSize; ++lane)
+                    if (static_cast<const int *>(valid)[lane] != 0 && prim->occluded(EmbreeUtil::convert(embreeRay, lane)))
+                        embreeRay.geomID[lane] = 0;
+            });
 
             rtcCommit(_scene);
         }
@@ -180,10 +264,17 @@ public:
                 prim->intersect(ray, data);
         }
 
+        return finishIntersection(ray, data, info);
+    }
+
+    bool finishIntersection(Ray &ray, IntersectionTemporary &data, IntersectionInfo &info) const
+    {
         if (data.primitive) {
             info.p = ray.pos() + ray.dir()*ray.farT();
             info.w = ray.dir();
             info.epsilon = DefaultEpsilon;
+            info.footprint = ray.footprintAt(ray.farT());
+            info.uvScale = 0.0f;
             data.primitive->intersectionInfo(data, info);
             return true;
         } else {
@@ -191,6 +282,42 @@ public:
         }
     }
 
+    // Intersects a stream of rays. Ray i hit the scene if data[i].primitive
+    // is not null afterwards, and info[i] is filled in exactly as it would
+    // be by the single ray intersect. If the scene BVH is enabled, rays are
+    // traced as Embree ray packets, otherwise they are traced one at a time
+    void intersect(uint32 count, Ray *rays, IntersectionTemporary *data, IntersectionInfo *info) const
+    {
+        if (!_settings.useSceneBvh()) {
+            for (uint32 i = 0; i < count; ++i)
+                intersect(rays[i], data[i], info[i]);
+            return;
+        }
+
+        IntersectionRayPacket packet;
+        packet.userGeomId = _userGeomId;
+        for (uint32 start = 0; start < count; start += RayPacketSize) {
+            alignas(16) int valid[RayPacketSize];
+            for (int lane = 0; lane < RayPacketSize; ++lane) {
+                uint32 i = start + lane;
+                valid[lane] = i < count ? -1 : 0;
+                if (i >= count)
+                    continue;
+
+                info[i].primitive = nullptr;
+                data[i].primitive = nullptr;
+                EmbreeUtil::convert(rays[i], packet, lane);
+                packet.data[lane] = &data[i];
+                packet.ray[lane] = &rays[i];
+            }
+
+            rtcIntersect4(valid, _scene, packet);
+
+            for (uint32 i = start; i < min(start + RayPacketSize, count); ++i)
+                finishIntersection(rays[i], data[i], info[i]);
+        }
+    }
+
     bool intersectInfinites(Ray &ray, IntersectionTemporary &data, IntersectionInfo &info) const
     {
         info.primitive = nullptr;
@@ -201,6 +328,7 @@ public:
 
         if (data.primitive) {
             info.w = ray.dir();
+            info.footprint = info.uvScale = 0.0f;
             data.primitive->intersectionInfo(data, info);
             return true;
         } else {
@@ -222,6 +350,31 @@ public:
         }
     }
 
+    // Stream version of occluded. See intersect above
+    void occluded(uint32 count, const Ray *rays, bool *occluded) const
+    {
+        if (!_settings.useSceneBvh()) {
+            for (uint32 i = 0; i < count; ++i)
+                occluded[i] = this->occluded(rays[i]);
+            return;
+        }
+
+        RTCRay4 packet;
+        for (uint32 start = 0; start < count; start += RayPacketSize) {
+            alignas(16) int valid[RayPacketSize];
+            for (int lane = 0; lane < RayPacketSize; ++lane) {
+                valid[lane] = start + lane < count ? -1 : 0;
+                if (start + lane < count)
+                    EmbreeUtil::convert(rays[start + lane], packet, lane);
+            }
+
+            rtcOccluded4(valid, _scene, packet);
+
+            for (uint32 i = start; i < min(start + RayPacketSize, count); ++i)
+                occluded[i] = packet.geomID[i - start] != RTC_INVALID_GEOMETRY_ID;
+        }
+    }
+
     const Box3f &bounds() const
     {
         return _sceneBounds;
@@ -252,11 +405,59 @@ public:
         return _lights;
     }
 
+    const std::vector<std::shared_ptr<Primitive>> &infiniteLights() const
+    {
+        return _infiniteLights;
+    }
+
+    // Null if the scene has too few lights to benefit from a light BVH
+    const Bvh::LightBvh *lightBvh() const
+    {
+        return _lightBvh.get();
+    }
+
+    // Indices of the lights in the light BVH, by emitter index
+    const std::vector<uint32> &bvhLights() const
+    {
+        return _bvhLights;
+    }
+
+    // Indices of the lights that are not part of the light BVH
+    const std::vector<uint32> &unclusteredLights() const
+    {
+        return _unclusteredLights;
+    }
+
+    // Emitter index in the light BVH of a light, or -1
+    int lightEmitter(uint32 lightIndex) const
+    {
+        return _lightToEmitter[lightIndex];
+    }
+
+    // Index of a light in lights(), or -1 if the primitive is not a light
+    int lightIndex(const Primitive *light) const
+    {
+        auto iter = _lightIndex.find(light);
+        return iter == _lightIndex.end() ? -1 : int(iter->second);
+    }
+
     const std::vector<const Primitive *> &finites() const
     {
         return _finites;
     }
 
+    const std::vector<std::shared_ptr<Bsdf>> &bsdfs() const
+    {
+        return _bsdfs;
+    }
+
+    // True if the BSDF of any primitive, named or not, has a forward lobe
+    // that lets shadow rays pass through
+    bool hasTransparency() const
+    {
+        return _hasTransparency;
+    }
+
     const std::vector<std::shared_ptr<Medium>> &media() const
     {
         return _media;
@@ -0,0 +1,47 @@
+#ifndef CDFGUIDETABLE_HPP_
+#define CDFGUIDETABLE_HPP_
+
+#include "math/MathUtil.hpp"
+
+#include "IntTypes.hpp"
+
+#include <vector>
+
+namespace Tungsten {
+
+// Cutpoint table over a normalized CDF of n + 1 entries (cdf[0] = 0, cdf[n] = 1).
+// Bucket k stores the last entry whose CDF value is <= k/n, so a lookup
+// starts right next to the answer and only walks a few entries on average.
+// It returns exactly the same index as a binary search over the CDF, which
+// keeps warps built on top of it invertible.
+class CdfGuideTable
+{
+    std::vector<uint32> _guide;
+
+public:
+    void build(const float *cdf, int n)
+    {
+        _guide.resize(n);
+        int idx = 0;
+        for (int k = 0; k < n; ++k) {
+            float t = k/float(n);
+            while (idx < n - 1 && cdf[idx + 1] <= t)
+                idx++;
+            _guide[k] = idx;
+        }
+    }
+
+    int find(const float *cdf, int n, float u) const
+    {
+        int idx = _guide[clamp(int(u*n), 0, n - 1)];
+        while (idx > 0 && cdf[idx] > u)
+            idx--;
+        while (idx < n - 1 && cdf[idx + 1] <= u)
+            idx++;
+        return idx;
+    }
+};
+
+}
+
+#endif /* CDFGUIDETABLE_HPP_ */
@@ -1,19 +1,81 @@
 #ifndef DISTRIBUTION1D_HPP_
 #define DISTRIBUTION1D_HPP_
 
+#include "CdfGuideTable.hpp"
+
 #include "math/MathUtil.hpp"
 
-#include <algorithm>
+#include "IntTypes.hpp"
+
 #include <vector>
 
 namespace Tungsten {
 
 class Distribution1D
 {
+    // The alias method splits u into a slot index and a fraction, so the
+    // fraction only keeps 23 - log2(n) bits of precision. Beyond this size
+    // the quantization becomes visible in the sampled probabilities and we
+    // fall back to the (guided) CDF instead.
+    static const size_t MaxAliasSize = 4096;
+
     std::vector<float> _pdf;
     std::vector<float> _cdf;
+    std::vector<float> _aliasProb;
+    std::vector<uint32> _alias;
+    CdfGuideTable _guide;
+
+    // Vose's alias table construction
+    void buildAliasTable()
+    {
+        int n = int(_pdf.size());
+        _aliasProb.resize(n);
+        _alias.resize(n);
+
+        std::vector<double> scaled(n);
+        std::vector<int> small, large;
+        int maxIdx = 0;
+        for (int i = 0; i < n; ++i) {
+            if (_pdf[i] > _pdf[maxIdx])
+                maxIdx = i;
+            scaled[i] = double(_pdf[i])*n;
+            if (scaled[i] < 1.0)
+                small.push_back(i);
+            else
+                large.push_back(i);
+        }
+
+        while (!small.empty() && !large.empty()) {
+            int s = small.back();
+            int l = large.back();
+            small.pop_back();
+
+            _aliasProb[s] = float(scaled[s]);
+            _alias[s] = l;
+
+            scaled[l] -= 1.0 - scaled[s];
+            if (scaled[l] < 1.0) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        // Leftovers are only off from 1 by round-off. Small leftovers keep
+        // their own probability and hand the rest of their slot to the
+        // largest entry, so that zero weight entries are never sampled
+        for (int i : large) {
+            _aliasProb[i] = 1.0f;
+            _alias[i] = i;
+        }
+        for (int i : small) {
+            _aliasProb[i] = float(scaled[i]);
+            _alias[i] = maxIdx;
+        }
+    }
+
 public:
-    Distribution1D(std::vector<float> weights)
+    // Alias tables are only built up to maxAliasSize entries. Larger limits
+    // trade sampling precision for speed
+    Distribution1D(std::vector<float> weights, size_t maxAliasSize = MaxAliasSize)
     : _pdf(std::move(weights))
     {
         _cdf.resize(_pdf.size() + 1);
@@ -26,14 +88,46 @@ public:
         for (float &c : _cdf)
             c /= totalWeight;
         _cdf.back() = 1.0f;
+
+        _guide.build(_cdf.data(), int(_pdf.size()));
+        if (_pdf.size() <= maxAliasSize)
+            buildAliasTable();
     }
 
+    // Constant time sampling. The remapped u is uniform, but not monotonic
+    // in the input; use warpInvertible if the mapping needs to be undone
     void warp(float &u, int &idx) const
     {
-        idx = int(std::distance(_cdf.begin(), std::upper_bound(_cdf.begin(), _cdf.end(), u)) - 1);
+        if (_alias.empty()) {
+            warpInvertible(u, idx);
+            return;
+        }
+
+        int n = int(_alias.size());
+        float scaled = u*n;
+        int slot = clamp(int(scaled), 0, n - 1);
+        float frac = scaled - slot;
+        float p = _aliasProb[slot];
+        if (frac < p) {
+            idx = slot;
+            u = clamp(frac/p, 0.0f, 1.0f);
+        } else {
+            idx = int(_alias[slot]);
+            u = clamp((frac - p)/(1.0f - p), 0.0f, 1.0f);
+        }
+    }
+
+    void warpInvertible(float &u, int &idx) const
+    {
+        idx = _guide.find(_cdf.data(), int(_pdf.size()), u);
         u = clamp((u - _cdf[idx])/_pdf[idx], 0.0f, 1.0f);
     }
 
+    float unwarp(float u, int idx) const
+    {
+        return u*_pdf[idx] + _cdf[idx];
+    }
+
     float pdf(int idx) const
     {
         return _pdf[idx];
@@ -1,19 +1,25 @@
 #ifndef DISTRIBUTION2D_HPP_
 #define DISTRIBUTION2D_HPP_
 
+#include "CdfGuideTable.hpp"
+
 #include "math/MathUtil.hpp"
 
-#include <algorithm>
 #include <vector>
 
 namespace Tungsten {
 
+// Warps have to remain exact inverses of unwarp (BitmapTexture::invert relies
+// on this for MLT), so unlike Distribution1D this keeps the CDF mapping and
+// only replaces the binary searches with guide table lookups
 class Distribution2D
 {
     int _w, _h;
     std::vector<float> _marginalPdf, _marginalCdf;
     std::vector<float> _pdf;
     std::vector<float> _cdf;
+    CdfGuideTable _marginalGuide;
+    std::vector<CdfGuideTable> _rowGuides;
 public:
     Distribution2D(std::vector<float> weights, int w, int h)
     : _w(w), _h(h), _pdf(std::move(weights))
@@ -61,15 +67,18 @@ public:
         for (float &c : _marginalCdf)
             c /= totalWeight;
         _marginalCdf.back() = 1.0f;
+
+        _marginalGuide.build(_marginalCdf.data(), h);
+        _rowGuides.resize(h);
+        for (int y = 0; y < h; ++y)
+            _rowGuides[y].build(&_cdf[y*(w + 1)], w);
     }
 
     void warp(Vec2f &uv, int &row, int &column) const
     {
-        row = int(std::distance(_marginalCdf.begin(), std::upper_bound(_marginalCdf.begin(), _marginalCdf.end(), uv.y())) - 1);
+        row = _marginalGuide.find(_marginalCdf.data(), _h, uv.y());
         uv.y() = clamp((uv.y() - _marginalCdf[row])/_marginalPdf[row], 0.0f, 1.0f);
-        auto rowStart = _cdf.begin() + row*(_w + 1);
-        auto rowEnd = rowStart + (_w + 1);
-        column = int(std::distance(rowStart, std::upper_bound(rowStart, rowEnd, uv.x())) - 1);
+        column = _rowGuides[row].find(&_cdf[row*(_w + 1)], _w, uv.x());
         int idxC = row*(_w + 1) + column;
         int idxP = row*_w + column;
         uv.x() = clamp((uv.x() - _cdf[idxC])/_pdf[idxP], 0.0f, 1.0f);
@@ -17,6 +17,18 @@ public:
     virtual void startPath(uint32 pixelId, uint32 sample) = 0;
     virtual void advancePath() = 0;
 
+    // Number of sample dimensions the current path has drawn so far, and
+    // a way to continue a path from there after other paths were started in
+    // between. Generators without per-path state just keep drawing from
+    // their sequence
+    virtual uint32 pathDimension() const
+    {
+        return 0;
+    }
+    virtual void resumePath(uint32 /*pixelId*/, uint32 /*sample*/, uint32 /*dimension*/)
+    {
+    }
+
     virtual void saveState(OutputStreamHandle &out) = 0;
     virtual void loadState(InputStreamHandle &in) = 0;
 
@@ -54,6 +54,16 @@ public:
     {
     }
 
+    virtual uint32 pathDimension() const override final
+    {
+        return _dimension;
+    }
+    virtual void resumePath(uint32 pixelId, uint32 sample, uint32 dimension) override final
+    {
+        startPath(pixelId, sample);
+        _dimension = dimension;
+    }
+
     virtual bool nextBoolean(float pTrue) override final
     {
         return _supplementalSampler.next1D() < pTrue;
@@ -1,4 +1,5 @@
 #include "BitmapTexture.hpp"
+#include "TexturePager.hpp"
 
 #include "primitives/IntersectionInfo.hpp"
 
@@ -12,6 +13,9 @@
 
 namespace Tungsten {
 
+static CONSTEXPR uint32 CacheMagic = 0x43585454; // 'TTXC'
+static CONSTEXPR uint32 CacheVersion = 2;
+
 struct Rgba
 {
     uint8 c[4];
@@ -22,6 +26,40 @@ struct Rgba
     }
 };
 
+static inline uint8 averageTexels(uint8 a, uint8 b, uint8 c, uint8 d)
+{
+    return uint8((uint32(a) + uint32(b) + uint32(c) + uint32(d) + 2u) >> 2u);
+}
+
+static inline float averageTexels(float a, float b, float c, float d)
+{
+    return (a + b + c + d)*0.25f;
+}
+
+static inline Vec3f averageTexels(const Vec3f &a, const Vec3f &b, const Vec3f &c, const Vec3f &d)
+{
+    return (a + b + c + d)*0.25f;
+}
+
+static inline Rgba averageTexels(const Rgba &a, const Rgba &b, const Rgba &c, const Rgba &d)
+{
+    Rgba result;
+    for (int i = 0; i < 4; ++i)
+        result.c[i] = averageTexels(a.c[i], b.c[i], c.c[i], d.c[i]);
+    return result;
+}
+
+static size_t texelSize(BitmapTexture::TexelType type)
+{
+    switch (type) {
+    case BitmapTexture::TexelType::SCALAR_LDR: return sizeof(uint8);
+    case BitmapTexture::TexelType::SCALAR_HDR: return sizeof(float);
+    case BitmapTexture::TexelType::RGB_LDR:    return sizeof(Rgba);
+    case BitmapTexture::TexelType::RGB_HDR:    return sizeof(Vec3f);
+    }
+    return 0;
+}
+
 BitmapTexture::BitmapTexture()
 : BitmapTexture("", TexelConversion::REQUEST_RGB, true, true, false)
 {
@@ -43,6 +81,7 @@ BitmapTexture::BitmapTexture(PathPtr path, TexelConversion conversion,
   _valid(false),
   _min(0.0f), _max(0.0f), _avg(0.0f),
   _texels(nullptr),
+  _texelCount(0),
   _w(0), _h(0),
   _texelType(TexelType::SCALAR_LDR),
   _scale(1.0f)
@@ -73,40 +112,21 @@ BitmapTexture::BitmapTexture(const BitmapTexture &o)
     _h               = o._h;
     _texelType       = o._texelType;
     _scale           = o._scale;
+    _texelCount      = o._texelCount;
+    _levels          = o._levels;
 
+    _texels = nullptr;
     if (o._texels) {
-        size_t size = 0;
-        switch (_texelType) {
-        case TexelType::SCALAR_LDR:
-            _texels = new uint8[_w*_h];
-            size = _w*_h*sizeof(uint8);
-            break;
-        case TexelType::SCALAR_HDR:
-            _texels = new float[_w*_h];
-            size = _w*_h*sizeof(float);
-            break;
-        case TexelType::RGB_LDR:
-            _texels = new uint8[_w*_h*4];
-            size = _w*_h*4*sizeof(uint8);
-            break;
-        case TexelType::RGB_HDR:
-            _texels = new Vec3f[_w*_h];
-            size = _w*_h*sizeof(Vec3f);
-            break;
-        }
-
-        std::memcpy(_texels, o._texels, size);
+        _texels = allocateTexels(_texelCount);
+        std::memcpy(_texels, o._texels, _texelCount*texelSize(_texelType));
     }
+    if (o._paged)
+        _paged.reset(new PagedTexels(o._paged->path(), o._paged->dataOffset(), texelSize(_texelType), _texelCount));
 }
 
 BitmapTexture::~BitmapTexture()
 {
-    switch (_texelType) {
-    case TexelType::SCALAR_LDR: delete[] as<uint8>(); break;
-    case TexelType::SCALAR_HDR: delete[] as<float>(); break;
-    case TexelType::RGB_LDR: delete[] as<uint8>(); break;
-    case TexelType::RGB_HDR: delete[] as<Vec3f>(); break;
-    }
+    freeTexels(_texels);
 }
 
 inline bool BitmapTexture::isRgb() const
@@ -137,20 +157,45 @@ inline const T *BitmapTexture::as() const
     return reinterpret_cast<const T *>(_texels);
 }
 
-inline float BitmapTexture::getScalar(int x, int y) const
+template<typename T>
+inline const T &BitmapTexture::texel(size_t idx) const
+{
+    if (_paged)
+        return *reinterpret_cast<const T *>(_paged->texel(idx));
+    else
+        return as<T>()[idx];
+}
+
+inline size_t BitmapTexture::texelIndex(const MipLevel &level, int x, int y) const
+{
+    size_t tile = size_t((y >> TileSizeLog)*level.tilesX + (x >> TileSizeLog));
+    return level.offset + (tile << (2*TileSizeLog)) + ((y & (TileSize - 1)) << TileSizeLog) + (x & (TileSize - 1));
+}
+
+inline float BitmapTexture::getScalar(const MipLevel &level, int x, int y) const
 {
     if (isHdr())
-        return as<float>()[x + y*_w];
+        return texel<float>(texelIndex(level, x, y));
     else
-        return float(as<uint8>()[x + y*_w])*(1.0f/255.0f);
+        return float(texel<uint8>(texelIndex(level, x, y)))*(1.0f/255.0f);
 }
 
-inline Vec3f BitmapTexture::getRgb(int x, int y) const
+inline Vec3f BitmapTexture::getRgb(const MipLevel &level, int x, int y) const
 {
     if (isHdr())
-        return as<Vec3f>()[x + y*_w];
+        return texel<Vec3f>(texelIndex(level, x, y));
     else
-        return as<Rgba>()[x + y*_w].normalize();
+        return texel<Rgba>(texelIndex(level, x, y)).normalize();
+}
+
+inline float BitmapTexture::getScalar(int x, int y) const
+{
+    return getScalar(_levels[0], x, y);
+}
+
+inline Vec3f BitmapTexture::getRgb(int x, int y) const
+{
+    return getRgb(_levels[0], x, y);
 }
 
 inline float BitmapTexture::weight(int x, int y) const
@@ -173,13 +218,87 @@ BitmapTexture::TexelType BitmapTexture::getTexelType(bool isRgb, bool isHdr)
         return TexelType::SCALAR_LDR;
 }
 
+void *BitmapTexture::allocateTexels(size_t count) const
+{
+    switch (_texelType) {
+    case TexelType::SCALAR_LDR: return new uint8[count]();
+    case TexelType::SCALAR_HDR: return new float[count]();
+    case TexelType::RGB_LDR:    return new uint8[count*4]();
+    case TexelType::RGB_HDR:    return new Vec3f[count];
+    }
+    return nullptr;
+}
+
+void BitmapTexture::freeTexels(void *texels) const
+{
+    switch (_texelType) {
+    case TexelType::SCALAR_LDR: delete[] static_cast<uint8 *>(texels); break;
+    case TexelType::SCALAR_HDR: delete[] static_cast<float *>(texels); break;
+    case TexelType::RGB_LDR:    delete[] static_cast<uint8 *>(texels); break;
+    case TexelType::RGB_HDR:    delete[] static_cast<Vec3f *>(texels); break;
+    }
+}
+
+template<typename T>
+void BitmapTexture::buildMipChain(const T *texels)
+{
+    _levels.clear();
+    int w = _w, h = _h;
+    size_t offset = 0;
+    while (true) {
+        int tilesX = (w + TileSize - 1) >> TileSizeLog;
+        int tilesY = (h + TileSize - 1) >> TileSizeLog;
+        _levels.push_back(MipLevel{w, h, tilesX, offset});
+        offset += size_t(tilesX*tilesY) << (2*TileSizeLog);
+
+        if (w == 1 && h == 1)
+            break;
+        w = max(w/2, 1);
+        h = max(h/2, 1);
+    }
+
+    _texelCount = offset;
+    T *dst = static_cast<T *>(allocateTexels(_texelCount));
+
+    const MipLevel &base = _levels[0];
+    for (int y = 0; y < _h; ++y)
+        for (int x = 0; x < _w; ++x)
+            dst[texelIndex(base, x, y)] = texels[x + y*_w];
+
+    for (size_t i = 1; i < _levels.size(); ++i) {
+        const MipLevel &src = _levels[i - 1];
+        const MipLevel &level = _levels[i];
+        for (int y = 0; y < level.h; ++y) {
+            int y0 = min(2*y, src.h - 1), y1 = min(2*y + 1, src.h - 1);
+            for (int x = 0; x < level.w; ++x) {
+                int x0 = min(2*x, src.w - 1), x1 = min(2*x + 1, src.w - 1);
+                dst[texelIndex(level, x, y)] = averageTexels(
+                    dst[texelIndex(src, x0, y0)],
+                    dst[texelIndex(src, x1, y0)],
+                    dst[texelIndex(src, x0, y1)],
+                    dst[texelIndex(src, x1, y1)]
+                );
+            }
+        }
+    }
+
+    _texels = dst;
+}
+
 void BitmapTexture::init(void *texels, int w, int h, TexelType texelType)
 {
-    _texels = texels;
     _w = w;
     _h = h;
     _texelType = texelType;
 
+    switch (_texelType) {
+    case TexelType::SCALAR_LDR: buildMipChain(static_cast<const uint8 *>(texels)); break;
+    case TexelType::SCALAR_HDR: buildMipChain(static_cast<const float *>(texels)); break;
+    case TexelType::RGB_LDR:    buildMipChain(static_cast<const Rgba *>(texels)); break;
+    case TexelType::RGB_HDR:    buildMipChain(static_cast<const Vec3f *>(texels)); break;
+    }
+    freeTexels(texels);
+
     if (isRgb()) {
         _max = _min = getRgb(0, 0);
         _avg = Vec3f(0.0f);
@@ -237,11 +356,8 @@ rapidjson::Value BitmapTexture::toJson(Allocator &allocator) const
     }
 }
 
-void BitmapTexture::loadResources()
+void BitmapTexture::loadTexels()
 {
-    if (_texels)
-        return;
-
     bool isRgb, isHdr;
     int w, h;
     void *pixels = nullptr;
@@ -275,6 +391,145 @@ void BitmapTexture::loadResources()
     init(pixels, w, h, getTexelType(isRgb, isHdr));
 }
 
+bool BitmapTexture::readCacheHeader(const Path &path, uint64 sourceSize, uint64 sourceModified, uint64 &dataOffset)
+{
+    InputStreamHandle in = FileUtils::openInputStream(path);
+    if (!in)
+        return false;
+
+    uint32 magic = 0, version = 0;
+    uint64 cachedSourceSize = 0, cachedSourceModified = 0;
+    FileUtils::streamRead(in, magic);
+    FileUtils::streamRead(in, version);
+    FileUtils::streamRead(in, cachedSourceSize);
+    FileUtils::streamRead(in, cachedSourceModified);
+    if (!*in || magic != CacheMagic || version != CacheVersion)
+        return false;
+    // An edited source file rarely keeps its size, but always gets a new
+    // modification time
+    if (cachedSourceSize != sourceSize || cachedSourceModified != sourceModified)
+        return false;
+
+    uint32 texelType, levelCount;
+    int32 w, h;
+    Vec3f minT, maxT, avgT;
+    uint64 texelCount;
+    FileUtils::streamRead(in, texelType);
+    FileUtils::streamRead(in, w);
+    FileUtils::streamRead(in, h);
+    FileUtils::streamRead(in, minT);
+    FileUtils::streamRead(in, maxT);
+    FileUtils::streamRead(in, avgT);
+    FileUtils::streamRead(in, texelCount);
+    FileUtils::streamRead(in, levelCount);
+
+    std::vector<MipLevel> levels(levelCount);
+    for (MipLevel &level : levels) {
+        int32 tilesX;
+        uint64 offset;
+        FileUtils::streamRead(in, level.w);
+        FileUtils::streamRead(in, level.h);
+        FileUtils::streamRead(in, tilesX);
+        FileUtils::streamRead(in, offset);
+        level.tilesX = tilesX;
+        level.offset = size_t(offset);
+    }
+    if (!*in || texelType > uint32(TexelType::RGB_HDR) || levels.empty())
+        return false;
+
+    _texelType = TexelType(texelType);
+    _w = w;
+    _h = h;
+    _min = minT;
+    _max = maxT;
+    _avg = avgT;
+    _texelCount = size_t(texelCount);
+    _levels = std::move(levels);
+    dataOffset = uint64(in->tellg());
+
+    return true;
+}
+
+bool BitmapTexture::writeCacheFile(const Path &path, uint64 sourceSize, uint64 sourceModified, uint64 &dataOffset) const
+{
+    if (!FileUtils::createDirectory(path.parent()))
+        return false;
+
+    // Output streams write to a temporary file of their own and only
+    // replace the target once complete, so textures sharing a cache file
+    // can't see a partially written one
+    OutputStreamHandle out = FileUtils::openOutputStream(path);
+    if (!out)
+        return false;
+
+    FileUtils::streamWrite(out, CacheMagic);
+    FileUtils::streamWrite(out, CacheVersion);
+    FileUtils::streamWrite(out, sourceSize);
+    FileUtils::streamWrite(out, sourceModified);
+    FileUtils::streamWrite(out, uint32(_texelType));
+    FileUtils::streamWrite(out, int32(_w));
+    FileUtils::streamWrite(out, int32(_h));
+    FileUtils::streamWrite(out, _min);
+    FileUtils::streamWrite(out, _max);
+    FileUtils::streamWrite(out, _avg);
+    FileUtils::streamWrite(out, uint64(_texelCount));
+    FileUtils::streamWrite(out, uint32(_levels.size()));
+    for (const MipLevel &level : _levels) {
+        FileUtils::streamWrite(out, int32(level.w));
+        FileUtils::streamWrite(out, int32(level.h));
+        FileUtils::streamWrite(out, int32(level.tilesX));
+        FileUtils::streamWrite(out, uint64(level.offset));
+    }
+    dataOffset = uint64(out->tellp());
+    out->write(static_cast<const char *>(_texels), _texelCount*texelSize(_texelType));
+
+    // Closing the stream moves the file into place, which has to happen
+    // before the pages are read back
+    bool success = bool(out->flush());
+    out.reset();
+
+    return success && path.exists();
+}
+
+bool BitmapTexture::loadPaged()
+{
+    uint64 sourceSize = FileUtils::fileSize(*_path);
+    uint64 sourceModified = FileUtils::lastModified(*_path);
+    if (sourceSize == 0)
+        return false;
+
+    uint32 key = uint32(_texelConversion)*2 + (_gammaCorrect ? 1 : 0);
+    Path cachePath = TexturePager::cacheFile(*_path, key);
+
+    uint64 dataOffset;
+    if (!readCacheHeader(cachePath, sourceSize, sourceModified, dataOffset)) {
+        // First use of this texture: decode it and convert it to the tiled
+        // cache format. If that fails, the texture simply stays in memory
+        loadTexels();
+        if (!_valid || !writeCacheFile(cachePath, sourceSize, sourceModified, dataOffset))
+            return true;
+
+        freeTexels(_texels);
+        _texels = nullptr;
+    }
+
+    _paged.reset(new PagedTexels(cachePath, dataOffset, texelSize(_texelType), _texelCount));
+    _valid = true;
+
+    return true;
+}
+
+void BitmapTexture::loadResources()
+{
+    if (_texels || _paged)
+        return;
+
+    if (TexturePager::enabled() && _path && !_path->empty() && loadPaged())
+        return;
+
+    loadTexels();
+}
+
 bool BitmapTexture::isConstant() const
 {
     return false;
@@ -295,10 +550,11 @@ Vec3f BitmapTexture::maximum() const
     return _scale*_max;
 }
 
-Vec3f BitmapTexture::operator[](const Vec2f &uv) const
+Vec3f BitmapTexture::lookup(const MipLevel &level, const Vec2f &uv) const
 {
-    float u = uv.x()*_w;
-    float v = (1.0f - uv.y())*_h;
+    int w = level.w, h = level.h;
+    float u = uv.x()*w;
+    float v = (1.0f - uv.y())*h;
     bool linear = _linear && _valid;
     if (linear) {
         u -= 0.5f;
@@ -311,53 +567,78 @@ Vec3f BitmapTexture::operator[](const Vec2f &uv) const
     u -= iu0;
     v -= iv0;
     if (!_clamp) {
-        iu0 = ((iu0 % _w) + _w) % _w;
-        iu1 = ((iu1 % _w) + _w) % _w;
-        iv0 = ((iv0 % _h) + _h) % _h;
-        iv1 = ((iv1 % _h) + _h) % _h;
+        iu0 = ((iu0 % w) + w) % w;
+        iu1 = ((iu1 % w) + w) % w;
+        iv0 = ((iv0 % h) + h) % h;
+        iv1 = ((iv1 % h) + h) % h;
     } else {
-        iu0 = Tungsten::clamp(iu0, 0, _w - 1);
-        iu1 = Tungsten::clamp(iu1, 0, _w - 1);
-        iv0 = Tungsten::clamp(iv0, 0, _h - 1);
-        iv1 = Tungsten::clamp(iv1, 0, _h - 1);
+        iu0 = Tungsten::clamp(iu0, 0, w - 1);
+        iu1 = Tungsten::clamp(iu1, 0, w - 1);
+        iv0 = Tungsten::clamp(iv0, 0, h - 1);
+        iv1 = Tungsten::clamp(iv1, 0, h - 1);
     }
 
     if (!linear) {
         if (isRgb())
-            return getRgb(iu0, iv0);
+            return getRgb(level, iu0, iv0);
         else
-            return Vec3f(getScalar(iu0, iv0));
+            return Vec3f(getScalar(level, iu0, iv0));
     }
 
 
     if (isRgb()) {
         return _scale*lerp(
-            getRgb(iu0, iv0),
-            getRgb(iu1, iv0),
-            getRgb(iu0, iv1),
-            getRgb(iu1, iv1),
+            getRgb(level, iu0, iv0),
+            getRgb(level, iu1, iv0),
+            getRgb(level, iu0, iv1),
+            getRgb(level, iu1, iv1),
             u,
             v
         );
     } else {
         return Vec3f(_scale*lerp(
-            getScalar(iu0, iv0),
-            getScalar(iu1, iv0),
-            getScalar(iu0, iv1),
-            getScalar(iu1, iv1),
+            getScalar(level, iu0, iv0),
+            getScalar(level, iu1, iv0),
+            getScalar(level, iu0, iv1),
+            getScalar(level, iu1, iv1),
             u,
             v
         ));
     }
 }
 
+Vec3f BitmapTexture::operator[](const Vec2f &uv) const
+{
+    TexturePager::ReadGuard guard(_paged != nullptr);
+    return lookup(_levels[0], uv);
+}
+
 Vec3f BitmapTexture::operator[](const IntersectionInfo &info) const
 {
-    return (*this)[info.uv];
+    if (!_linear || !_valid || info.footprint <= 0.0f || info.uvScale <= 0.0f)
+        return (*this)[info.uv];
+
+    TexturePager::ReadGuard guard(_paged != nullptr);
+
+    // Width of the ray cone in texels, stretched by its projection onto the surface
+    float cosTheta = max(std::abs(info.Ng.dot(info.w)), 1e-2f);
+    float width = info.footprint*info.uvScale*max(_w, _h)/cosTheta;
+    if (width <= 1.0f)
+        return lookup(_levels[0], info.uv);
+
+    float lod = min(std::log2(width), float(_levels.size() - 1));
+    int level = int(lod);
+    float t = lod - level;
+    if (level + 1 == int(_levels.size()))
+        return lookup(_levels[level], info.uv);
+
+    return lookup(_levels[level], info.uv)*(1.0f - t) + lookup(_levels[level + 1], info.uv)*t;
 }
 
 void BitmapTexture::derivatives(const Vec2f &uv, Vec2f &derivs) const
 {
+    TexturePager::ReadGuard guard(_paged != nullptr);
+
     derivs = Vec2f(0.0f);
     float u = uv.x()*_w - 0.5f;
     float v = (1.0f - uv.y())*_h - 0.5f;
@@ -404,6 +685,7 @@ void BitmapTexture::makeSamplable(TextureMapJacobian jacobian)
 
     std::vector<float> weights(_w*_h);
     for (int y = 0, idx = 0; y < _h; ++y) {
+        TexturePager::ReadGuard guard(_paged != nullptr);
         float rowWeight = 1.0f;
         if (jacobian == MAP_SPHERICAL)
             rowWeight *= std::sin((y*PI)/_h);
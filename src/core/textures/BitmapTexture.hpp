@@ -6,9 +6,12 @@
 #include "io/ImageIO.hpp"
 #include "io/Path.hpp"
 
+#include <vector>
+
 namespace Tungsten {
 
 class Distribution2D;
+class PagedTexels;
 
 class BitmapTexture : public Texture
 {
@@ -23,6 +26,18 @@ public:
 private:
     typedef JsonSerializable::Allocator Allocator;
 
+    // Texels of all mip levels are stored in a single allocation, with each
+    // level split into square tiles that are contiguous in memory
+    static const int TileSizeLog = 3;
+    static const int TileSize = 1 << TileSizeLog;
+
+    struct MipLevel
+    {
+        int w, h;
+        int tilesX;
+        size_t offset;
+    };
+
     PathPtr _path;
     TexelConversion _texelConversion;
     bool _gammaCorrect;
@@ -31,6 +46,9 @@ private:
 
     Vec3f _min, _max, _avg;
     void *_texels;
+    std::unique_ptr<PagedTexels> _paged;
+    size_t _texelCount;
+    std::vector<MipLevel> _levels;
     int _w;
     int _h;
     TexelType _texelType;
@@ -46,11 +64,28 @@ private:
 
     template<typename T>
     inline const T *as() const;
+    template<typename T>
+    inline const T &texel(size_t idx) const;
 
+    inline size_t texelIndex(const MipLevel &level, int x, int y) const;
+    inline float getScalar(const MipLevel &level, int x, int y) const;
+    inline Vec3f getRgb(const MipLevel &level, int x, int y) const;
     inline float getScalar(int x, int y) const;
     inline Vec3f getRgb(int x, int y) const;
     inline float weight(int x, int y) const;
 
+    void *allocateTexels(size_t count) const;
+    void freeTexels(void *texels) const;
+    template<typename T>
+    void buildMipChain(const T *texels);
+
+    Vec3f lookup(const MipLevel &level, const Vec2f &uv) const;
+
+    void loadTexels();
+    bool loadPaged();
+    bool readCacheHeader(const Path &path, uint64 sourceSize, uint64 sourceModified, uint64 &dataOffset);
+    bool writeCacheFile(const Path &path, uint64 sourceSize, uint64 sourceModified, uint64 &dataOffset) const;
+
 protected:
     TexelType getTexelType(bool isRgb, bool isHdr);
 
@@ -0,0 +1,230 @@
+#include "TexturePager.hpp"
+
+#include "Debug.hpp"
+
+#include <tinyformat/tinyformat.hpp>
+#include <algorithm>
+#include <limits>
+
+namespace Tungsten {
+
+std::mutex TexturePager::_mutex;
+uint64 TexturePager::_budget = 0;
+Path TexturePager::_cacheDirectory("texture_cache");
+
+std::atomic<uint64> TexturePager::_epoch(1);
+std::vector<std::unique_ptr<TexturePager::ThreadSlot>> TexturePager::_slots;
+thread_local TexturePager::ThreadSlot *TexturePager::_threadSlot = nullptr;
+
+std::vector<TexturePager::ResidentPage> TexturePager::_resident;
+std::vector<TexturePager::ResidentPage> TexturePager::_loading;
+std::condition_variable TexturePager::_pageLoaded;
+std::vector<TexturePager::RetiredPage> TexturePager::_retired;
+size_t TexturePager::_clockHand = 0;
+uint64 TexturePager::_residentBytes = 0;
+uint64 TexturePager::_misses = 0;
+uint64 TexturePager::_evictions = 0;
+uint64 TexturePager::_bytesRead = 0;
+
+PagedTexels::PagedTexels(const Path &path, uint64 dataOffset, size_t texelSize, size_t texelCount)
+: _path(path),
+  _dataOffset(dataOffset),
+  _texelSize(texelSize),
+  _texelCount(texelCount),
+  _pageCount(uint32((texelCount + PageSize - 1) >> PageSizeLog)),
+  _pages(new std::atomic<uint8 *>[_pageCount]),
+  _referenced(new std::atomic<bool>[_pageCount])
+{
+    for (uint32 i = 0; i < _pageCount; ++i) {
+        _pages[i].store(nullptr, std::memory_order_relaxed);
+        _referenced[i].store(false, std::memory_order_relaxed);
+    }
+}
+
+PagedTexels::~PagedTexels()
+{
+    TexturePager::release(*this);
+}
+
+bool PagedTexels::readPage(uint32 page, uint8 *dst) const
+{
+    std::unique_lock<std::mutex> lock(_streamMutex);
+    if (!_stream)
+        _stream = FileUtils::openInputStream(_path);
+    if (!_stream)
+        return false;
+
+    _stream->clear();
+    _stream->seekg(_dataOffset + (uint64(page) << PageSizeLog)*_texelSize);
+    _stream->read(reinterpret_cast<char *>(dst), pageBytes(page));
+    return bool(*_stream);
+}
+
+TexturePager::ThreadSlot *TexturePager::registerThread()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _slots.emplace_back(new ThreadSlot());
+    _slots.back()->epoch.store(0);
+    _slots.back()->hits.store(0);
+    return _slots.back().get();
+}
+
+bool TexturePager::enter()
+{
+    ThreadSlot *slot = threadSlot();
+    if (slot->epoch.load(std::memory_order_relaxed) != 0)
+        return false;
+
+    slot->epoch.store(_epoch.load(), std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return true;
+}
+
+void TexturePager::leave()
+{
+    _threadSlot->epoch.store(0, std::memory_order_release);
+}
+
+void TexturePager::evict(size_t bytes)
+{
+    while (_residentBytes + bytes > _budget && !_resident.empty()) {
+        if (_clockHand >= _resident.size())
+            _clockHand = 0;
+
+        ResidentPage &entry = _resident[_clockHand];
+        if (entry.owner->_referenced[entry.page].exchange(false, std::memory_order_relaxed)) {
+            _clockHand++;
+            continue;
+        }
+
+        uint8 *data = entry.owner->_pages[entry.page].exchange(nullptr, std::memory_order_acq_rel);
+        _residentBytes -= entry.owner->pageBytes(entry.page);
+        _evictions++;
+        _retired.push_back(RetiredPage{data, _epoch.fetch_add(1)});
+
+        entry = _resident.back();
+        _resident.pop_back();
+    }
+}
+
+void TexturePager::reclaim()
+{
+    if (_retired.empty())
+        return;
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64 minEpoch = std::numeric_limits<uint64>::max();
+    for (const auto &slot : _slots) {
+        uint64 epoch = slot->epoch.load(std::memory_order_acquire);
+        if (epoch != 0)
+            minEpoch = std::min(minEpoch, epoch);
+    }
+
+    auto end = std::remove_if(_retired.begin(), _retired.end(), [&](const RetiredPage &p) {
+        if (p.epoch >= minEpoch)
+            return false;
+        delete[] p.data;
+        return true;
+    });
+    _retired.erase(end, _retired.end());
+}
+
+void TexturePager::setBudget(uint64 bytes)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _budget = bytes;
+}
+
+void TexturePager::setCacheDirectory(const Path &dir)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cacheDirectory = dir.absolute();
+}
+
+Path TexturePager::cacheFile(const Path &source, uint32 key)
+{
+    std::string id = tfm::format("%s|%d", source.absolute().normalize().asString(), key);
+    uint64 hash = std::hash<std::string>()(id);
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _cacheDirectory/tfm::format("%s-%016x.tiled", source.baseName().asString(), hash);
+}
+
+uint8 *TexturePager::fault(const PagedTexels &owner, uint32 page)
+{
+    auto isLoading = [&]() {
+        return std::any_of(_loading.begin(), _loading.end(), [&](const ResidentPage &p) {
+            return p.owner == &owner && p.page == page;
+        });
+    };
+
+    size_t bytes = owner.pageBytes(page);
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _pageLoaded.wait(lock, [&]() { return !isLoading(); });
+
+        uint8 *data = owner._pages[page].load(std::memory_order_acquire);
+        if (data)
+            return data;
+
+        // Reserve the memory of the page before reading it, so that
+        // concurrent misses don't overshoot the budget
+        evict(bytes);
+        reclaim();
+        _residentBytes += bytes;
+        _loading.push_back(ResidentPage{&owner, page});
+    }
+
+    uint8 *data = new uint8[bytes];
+    if (!owner.readPage(page, data)) {
+        std::fill(data, data + bytes, uint8(0));
+        DBG("Failed to read texture page %d from '%s'", page, owner._path);
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _loading.erase(std::find_if(_loading.begin(), _loading.end(), [&](const ResidentPage &p) {
+        return p.owner == &owner && p.page == page;
+    }));
+    _misses++;
+    _bytesRead += bytes;
+    _resident.push_back(ResidentPage{&owner, page});
+    owner._pages[page].store(data, std::memory_order_release);
+    _pageLoaded.notify_all();
+
+    return data;
+}
+
+void TexturePager::release(const PagedTexels &owner)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    // Nobody can be reading from a texture that is being destroyed, so
+    // its pages can be freed immediately
+    for (size_t i = 0; i < _resident.size();) {
+        if (_resident[i].owner == &owner) {
+            _residentBytes -= owner.pageBytes(_resident[i].page);
+            delete[] owner._pages[_resident[i].page].exchange(nullptr);
+            _resident[i] = _resident.back();
+            _resident.pop_back();
+        } else {
+            i++;
+        }
+    }
+}
+
+TexturePager::Stats TexturePager::stats()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    Stats result;
+    result.hits = 0;
+    for (const auto &slot : _slots)
+        result.hits += slot->hits.load(std::memory_order_relaxed);
+    result.misses = _misses;
+    result.evictions = _evictions;
+    result.bytesRead = _bytesRead;
+    result.residentBytes = _residentBytes;
+    return result;
+}
+
+}
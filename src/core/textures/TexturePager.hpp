@@ -0,0 +1,206 @@
+#ifndef TEXTUREPAGER_HPP_
+#define TEXTUREPAGER_HPP_
+
+#include "io/FileUtils.hpp"
+#include "io/Path.hpp"
+
+#include "IntTypes.hpp"
+
+#include <condition_variable>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <mutex>
+
+namespace Tungsten {
+
+class TexturePager;
+
+// Texels of a single texture that live in a tiled cache file on disk. The
+// texel array is split into fixed size pages, which are read on first
+// access and may be evicted again by the TexturePager at any time
+class PagedTexels
+{
+    friend class TexturePager;
+
+public:
+    static const int PageSizeLog = 12;
+    static const size_t PageSize = size_t(1) << PageSizeLog;
+
+private:
+    Path _path;
+    uint64 _dataOffset;
+    size_t _texelSize;
+    size_t _texelCount;
+    uint32 _pageCount;
+
+    // Pages of the same texture are read through one stream, which
+    // this protects
+    mutable std::mutex _streamMutex;
+    mutable InputStreamHandle _stream;
+    std::unique_ptr<std::atomic<uint8 *>[]> _pages;
+    std::unique_ptr<std::atomic<bool>[]> _referenced;
+
+    size_t pageBytes(uint32 page) const
+    {
+        size_t end = std::min(size_t(page + 1) << PageSizeLog, _texelCount);
+        return (end - (size_t(page) << PageSizeLog))*_texelSize;
+    }
+
+    bool readPage(uint32 page, uint8 *dst) const;
+
+public:
+    PagedTexels(const Path &path, uint64 dataOffset, size_t texelSize, size_t texelCount);
+    ~PagedTexels();
+
+    inline const uint8 *texel(size_t idx) const;
+
+    const Path &path() const
+    {
+        return _path;
+    }
+
+    uint64 dataOffset() const
+    {
+        return _dataOffset;
+    }
+};
+
+// Process-wide page cache for all PagedTexels, holding at most budget()
+// bytes of texel data. Lookups of resident pages are lock-free: readers
+// announce the epoch they started in through a ReadGuard, and evicted
+// pages are only freed once no reader from an earlier epoch is left.
+// Misses and evictions (clock approximation of LRU) take a global lock,
+// which is released while a missing page is read from disk.
+class TexturePager
+{
+public:
+    struct Stats
+    {
+        uint64 hits;
+        uint64 misses;
+        uint64 evictions;
+        uint64 bytesRead;
+        uint64 residentBytes;
+    };
+
+    class ReadGuard
+    {
+        bool _active;
+    public:
+        ReadGuard(bool paged)
+        : _active(false)
+        {
+            if (paged)
+                _active = enter();
+        }
+
+        ~ReadGuard()
+        {
+            if (_active)
+                leave();
+        }
+    };
+
+private:
+    struct ThreadSlot
+    {
+        std::atomic<uint64> epoch;
+        std::atomic<uint64> hits;
+    };
+    struct ResidentPage
+    {
+        const PagedTexels *owner;
+        uint32 page;
+    };
+    struct RetiredPage
+    {
+        uint8 *data;
+        uint64 epoch;
+    };
+
+    static std::mutex _mutex;
+    static uint64 _budget;
+    static Path _cacheDirectory;
+
+    static std::atomic<uint64> _epoch;
+    static std::vector<std::unique_ptr<ThreadSlot>> _slots;
+    static thread_local ThreadSlot *_threadSlot;
+
+    static std::vector<ResidentPage> _resident;
+    // Pages that are being read from disk. Their memory already counts
+    // towards the resident bytes. Threads that fault on one of them wait
+    // for _pageLoaded instead of reading it again
+    static std::vector<ResidentPage> _loading;
+    static std::condition_variable _pageLoaded;
+    static std::vector<RetiredPage> _retired;
+    static size_t _clockHand;
+    static uint64 _residentBytes;
+    static uint64 _misses;
+    static uint64 _evictions;
+    static uint64 _bytesRead;
+
+    static ThreadSlot *threadSlot()
+    {
+        if (!_threadSlot)
+            _threadSlot = registerThread();
+        return _threadSlot;
+    }
+
+    static ThreadSlot *registerThread();
+    static bool enter();
+    static void leave();
+
+    static void evict(size_t bytes);
+    static void reclaim();
+
+public:
+    // A budget of zero disables paging; textures are then fully loaded
+    static void setBudget(uint64 bytes);
+    static void setCacheDirectory(const Path &dir);
+
+    static bool enabled()
+    {
+        return _budget > 0;
+    }
+
+    static uint64 budget()
+    {
+        return _budget;
+    }
+
+    // Location of the tiled cache file for a source texture. The key
+    // distinguishes different decodings of the same source file
+    static Path cacheFile(const Path &source, uint32 key);
+
+    static void countHit()
+    {
+        ThreadSlot *slot = threadSlot();
+        slot->hits.store(slot->hits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    static uint8 *fault(const PagedTexels &owner, uint32 page);
+    static void release(const PagedTexels &owner);
+
+    static Stats stats();
+};
+
+inline const uint8 *PagedTexels::texel(size_t idx) const
+{
+    uint32 page = uint32(idx >> PageSizeLog);
+    uint8 *data = _pages[page].load(std::memory_order_acquire);
+    if (data)
+        TexturePager::countHit();
+    else
+        data = TexturePager::fault(*this, page);
+
+    if (!_referenced[page].load(std::memory_order_relaxed))
+        _referenced[page].store(true, std::memory_order_relaxed);
+
+    return data + (idx & (PageSize - 1))*_texelSize;
+}
+
+}
+
+#endif /* TEXTUREPAGER_HPP_ */
@@ -1,13 +1,32 @@
 #include "ThreadPool.hpp"
+#include "ThreadUtils.hpp"
 
+#include "math/MathUtil.hpp"
+
+#include <tinyformat/tinyformat.hpp>
+#include <iostream>
 #include <chrono>
 
 namespace Tungsten {
 
-ThreadPool::ThreadPool(uint32 threadCount)
+// Set by the worker threads of a pool on startup
+static thread_local const ThreadPool *currentPool = nullptr;
+static thread_local uint32 currentWorkerId = 0;
+
+ThreadPool::ThreadPool(uint32 threadCount, bool pinThreads)
 : _threadCount(threadCount),
-  _terminateFlag(false)
+  _pinThreads(pinThreads),
+  _terminateFlag(false),
+  _queuedChunks(0),
+  _sleepingThreads(0),
+  _nextQueue(0)
 {
+    for (uint32 i = 0; i < _threadCount; ++i) {
+        _queues.emplace_back(new WorkerQueue());
+        _queues.back()->pinnedChunks = 0;
+        _queues.back()->rngState = MathUtil::hash32(i + 1);
+    }
+
     startThreads();
 }
 
@@ -16,33 +35,153 @@ ThreadPool::~ThreadPool()
     stop();
 }
 
-std::shared_ptr<TaskGroup> ThreadPool::acquireTask(uint32 &subTaskId)
+void ThreadPool::pushChunk(uint32 queueId, TaskChunk chunk)
+{
+    std::unique_lock<std::mutex> lock(_queues[queueId]->mutex);
+    if (chunk.pinned)
+        _queues[queueId]->pinnedChunks++;
+    else
+        _queuedChunks++;
+    _queues[queueId]->chunks.emplace_back(std::move(chunk));
+}
+
+// Takes the next subtask from the front of our own queue. Chunks are
+// queued in enqueue order and consumed front to back, so task groups run
+// first in first out and the subtasks of a chunk run in order
+bool ThreadPool::popChunk(uint32 queueId, TaskChunk &chunk)
+{
+    WorkerQueue &queue = *_queues[queueId];
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    while (!queue.chunks.empty()) {
+        TaskChunk &front = queue.chunks.front();
+        bool aborting = front.task->isAborting();
+        if (!aborting) {
+            chunk.task = front.task;
+            chunk.begin = front.begin++;
+            chunk.end = chunk.begin + 1;
+            chunk.pinned = front.pinned;
+        }
+        if (aborting || front.begin == front.end) {
+            if (front.pinned)
+                queue.pinnedChunks--;
+            else
+                _queuedChunks--;
+            queue.chunks.pop_front();
+        }
+        if (!aborting)
+            return true;
+    }
+    return false;
+}
+
+// Steals from the front of a randomly chosen victim. Pool workers steal
+// half of the victim's oldest chunk at once, so that large task groups
+// are spread across all workers after only a logarithmic number of steals.
+// Chunks pinned to the victim are left alone
+bool ThreadPool::stealChunk(uint32 thiefId, uint32 &rngState, TaskChunk &chunk)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+
+    bool isWorker = thiefId < _threadCount;
+    uint32 start = rngState % _threadCount;
+    for (uint32 i = 0; i < _threadCount; ++i) {
+        uint32 victimId = (start + i) % _threadCount;
+        if (victimId == thiefId)
+            continue;
+
+        WorkerQueue &victim = *_queues[victimId];
+        std::unique_lock<std::mutex> lock(victim.mutex);
+        for (auto iter = victim.chunks.begin(); iter != victim.chunks.end(); ) {
+            TaskChunk &oldest = *iter;
+            if (oldest.pinned) {
+                ++iter;
+                continue;
+            }
+            if (oldest.task->isAborting()) {
+                iter = victim.chunks.erase(iter);
+                _queuedChunks--;
+                continue;
+            }
+
+            uint32 size = oldest.end - oldest.begin;
+            chunk.task = oldest.task;
+            chunk.pinned = false;
+            if (size == 1) {
+                chunk.begin = oldest.begin;
+                chunk.end = oldest.end;
+                victim.chunks.erase(iter);
+                _queuedChunks--;
+            } else if (isWorker) {
+                uint32 mid = oldest.begin + size/2;
+                chunk.begin = mid;
+                chunk.end = oldest.end;
+                oldest.end = mid;
+            } else {
+                chunk.begin = oldest.begin++;
+                chunk.end = chunk.begin + 1;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::acquireTask(uint32 threadId, uint32 &rngState, std::shared_ptr<TaskGroup> &task, uint32 &subTaskId)
 {
     if (_terminateFlag)
-        return nullptr;
-    std::shared_ptr<TaskGroup> task = _tasks.front();
-    if (task->isAborting()) {
-        _tasks.pop_front();
-        return nullptr;
+        return false;
+
+    TaskChunk chunk;
+    bool isWorker = threadId < _threadCount;
+    if (!(isWorker && popChunk(threadId, chunk)) && !stealChunk(threadId, rngState, chunk))
+        return false;
+
+    if (chunk.end - chunk.begin > 1) {
+        pushChunk(threadId, TaskChunk{chunk.task, chunk.begin + 1, chunk.end, false});
+        wakeThreads(1);
     }
-    subTaskId = task->startSubTask();
-    if (subTaskId == task->numSubTasks() - 1)
-        _tasks.pop_front();
-    return std::move(task);
+
+    chunk.task->startSubTask();
+    subTaskId = chunk.begin;
+    task = std::move(chunk.task);
+    return true;
+}
+
+void ThreadPool::wakeThreads(uint32 count)
+{
+    if (_sleepingThreads == 0)
+        return;
+
+    std::unique_lock<std::mutex> lock(_sleepMutex);
+    if (count == 1)
+        _sleepCond.notify_one();
+    else
+        _sleepCond.notify_all();
 }
 
 void ThreadPool::runWorker(uint32 threadId)
 {
+    currentPool = this;
+    currentWorkerId = threadId;
+    if (_pinThreads && !ThreadUtils::pinCurrentThread(threadId))
+        std::cout << tfm::format("Warning: Unable to pin worker thread %d to a core. It will run unpinned\n", threadId) << std::flush;
+
+    WorkerQueue &queue = *_queues[threadId];
+    uint32 &rngState = queue.rngState;
     while (!_terminateFlag) {
         uint32 subTaskId;
         std::shared_ptr<TaskGroup> task;
-        {
-            std::unique_lock<std::mutex> lock(_taskMutex);
-            _taskCond.wait(lock, [this]{return _terminateFlag || !_tasks.empty();});
-            task = acquireTask(subTaskId);
-        }
-        if (task)
+        if (acquireTask(threadId, rngState, task, subTaskId)) {
             task->run(threadId, subTaskId);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(_sleepMutex);
+        _sleepingThreads++;
+        _sleepCond.wait(lock, [&]{return _terminateFlag || _queuedChunks > 0 || queue.pinnedChunks > 0;});
+        _sleepingThreads--;
     }
 }
 
@@ -64,24 +203,34 @@ void ThreadPool::yield(TaskGroup &wait)
     if (iter != _idToNumericId.end())
         id = iter->second;
 
+    std::atomic<uint32> noPinnedChunks(0);
+    std::atomic<uint32> &pinnedChunks = id < _threadCount ? _queues[id]->pinnedChunks : noPinnedChunks;
+
+    uint32 rngState = MathUtil::hash32(id + 1);
     while (!wait.isDone() && !_terminateFlag) {
         uint32 subTaskId;
         std::shared_ptr<TaskGroup> task;
-        {
-            std::unique_lock<std::mutex> lock(_taskMutex);
-            if (!_taskCond.wait_for(lock, waitSpan, [this]{return _terminateFlag || !_tasks.empty();}))
-                continue;
-            task = acquireTask(subTaskId);
-        }
-        if (task)
+        if (acquireTask(id, rngState, task, subTaskId)) {
             task->run(id, subTaskId);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(_sleepMutex);
+        _sleepingThreads++;
+        _sleepCond.wait_for(lock, waitSpan, [&]{return _terminateFlag || _queuedChunks > 0 || pinnedChunks > 0;});
+        _sleepingThreads--;
     }
 }
 
 void ThreadPool::reset()
 {
     stop();
-    _tasks.clear();
+    for (auto &queue : _queues) {
+        std::unique_lock<std::mutex> lock(queue->mutex);
+        queue->chunks.clear();
+        queue->pinnedChunks = 0;
+    }
+    _queuedChunks = 0;
     startThreads();
 }
 
@@ -89,8 +238,8 @@ void ThreadPool::stop()
 {
     _terminateFlag = true;
     {
-        std::unique_lock<std::mutex> lock(_taskMutex);
-        _taskCond.notify_all();
+        std::unique_lock<std::mutex> lock(_sleepMutex);
+        _sleepCond.notify_all();
     }
     while (!_workers.empty()) {
         _workers.back()->detach();
@@ -98,21 +247,40 @@ void ThreadPool::stop()
     }
 }
 
+uint32 ThreadPool::currentThreadId() const
+{
+    return currentPool == this ? currentWorkerId : _threadCount;
+}
+
 std::shared_ptr<TaskGroup> ThreadPool::enqueue(TaskFunc func, int numSubtasks, Finisher finisher)
 {
     std::shared_ptr<TaskGroup> task(std::make_shared<TaskGroup>(std::move(func),
             std::move(finisher), numSubtasks));
 
-    {
-        std::unique_lock<std::mutex> lock(_taskMutex);
-        _tasks.emplace_back(task);
-        if (numSubtasks == 1)
-            _taskCond.notify_one();
-        else
-            _taskCond.notify_all();
+    // Hand out one contiguous chunk per worker, starting at a rotating
+    // offset so that single-subtask groups spread evenly across the pool
+    uint32 numChunks = min(uint32(numSubtasks), _threadCount);
+    uint32 firstQueue = _nextQueue.fetch_add(numChunks);
+    for (uint32 i = 0; i < numChunks; ++i) {
+        uint32 begin = uint64(numSubtasks)*i/numChunks;
+        uint32 end   = uint64(numSubtasks)*(i + 1)/numChunks;
+        pushChunk((firstQueue + i) % _threadCount, TaskChunk{task, begin, end, false});
     }
+    wakeThreads(numChunks);
 
     return std::move(task);
 }
 
+std::shared_ptr<TaskGroup> ThreadPool::enqueuePerThread(TaskFunc func, Finisher finisher)
+{
+    std::shared_ptr<TaskGroup> task(std::make_shared<TaskGroup>(std::move(func),
+            std::move(finisher), _threadCount));
+
+    for (uint32 i = 0; i < _threadCount; ++i)
+        pushChunk(i, TaskChunk{task, i, i + 1, true});
+    wakeThreads(_threadCount);
+
+    return task;
+}
+
 }
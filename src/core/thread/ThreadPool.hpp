@@ -17,27 +17,57 @@
 
 namespace Tungsten {
 
+// Work-stealing thread pool. Every worker owns a deque of task chunks,
+// i.e. contiguous ranges of subtasks of a single TaskGroup. Workers take
+// subtasks from the oldest chunk of their own deque, so that task groups
+// are still started in the order they were enqueued, like with a single
+// global queue. Idle workers steal the upper half of a victim's oldest
+// chunk.
 class ThreadPool
 {
     typedef std::function<void(uint32, uint32, uint32)> TaskFunc;
     typedef std::function<void()> Finisher;
 
+    struct TaskChunk
+    {
+        std::shared_ptr<TaskGroup> task;
+        uint32 begin, end;
+        bool pinned;
+    };
+
+    struct alignas(64) WorkerQueue
+    {
+        std::mutex mutex;
+        std::deque<TaskChunk> chunks;
+        std::atomic<uint32> pinnedChunks;
+        uint32 rngState;
+    };
+
     uint32 _threadCount;
+    bool _pinThreads;
     std::vector<std::unique_ptr<std::thread>> _workers;
+    std::vector<std::unique_ptr<WorkerQueue>> _queues;
     std::atomic<bool> _terminateFlag;
 
-    std::deque<std::shared_ptr<TaskGroup>> _tasks;
-    std::mutex _taskMutex;
-    std::condition_variable _taskCond;
+    std::atomic<uint32> _queuedChunks;
+    std::atomic<uint32> _sleepingThreads;
+    std::atomic<uint32> _nextQueue;
+    std::mutex _sleepMutex;
+    std::condition_variable _sleepCond;
 
     std::unordered_map<std::thread::id, uint32> _idToNumericId;
 
-    std::shared_ptr<TaskGroup> acquireTask(uint32 &subTaskId);
+    void pushChunk(uint32 queueId, TaskChunk chunk);
+    bool popChunk(uint32 queueId, TaskChunk &chunk);
+    bool stealChunk(uint32 thiefId, uint32 &rngState, TaskChunk &chunk);
+    bool acquireTask(uint32 threadId, uint32 &rngState, std::shared_ptr<TaskGroup> &task, uint32 &subTaskId);
+    void wakeThreads(uint32 count);
+
     void runWorker(uint32 threadId);
     void startThreads();
 
 public:
-    ThreadPool(uint32 threadCount);
+    ThreadPool(uint32 threadCount, bool pinThreads = false);
     ~ThreadPool();
 
     void yield(TaskGroup &wait);
@@ -45,13 +75,28 @@ public:
     void reset();
     void stop();
 
+    // Subtasks are handed out as min(numSubtasks, threadCount()) contiguous
+    // ranges of near-equal size, one per worker, each executed front to back
     std::shared_ptr<TaskGroup> enqueue(TaskFunc func, int numSubtasks = 1,
             Finisher finisher = Finisher());
+    // Runs one subtask on every worker, with subtask i running on worker i.
+    // Idle workers never steal these, which makes it possible to initialize
+    // per-thread state on the thread (and NUMA node) that will use it
+    std::shared_ptr<TaskGroup> enqueuePerThread(TaskFunc func, Finisher finisher = Finisher());
 
     uint32 threadCount() const
     {
         return _threadCount;
     }
+
+    bool pinThreads() const
+    {
+        return _pinThreads;
+    }
+
+    // Index of the calling worker thread in [0, threadCount()). Threads
+    // that are not part of the pool get threadCount()
+    uint32 currentThreadId() const;
 };
 
 }
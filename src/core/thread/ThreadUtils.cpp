@@ -1,13 +1,24 @@
+#include "ThreadUtils.hpp"
 #include "ThreadPool.hpp"
 
 #include "math/MathUtil.hpp"
 
+#include "Platform.hpp"
+
+#include <fstream>
+#include <cstring>
 #include <thread>
+#include <vector>
+#include <string>
 #if _WIN32
 #include <windows.h>
 #else
 #include <unistd.h>
 #endif
+#if __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 namespace Tungsten {
 
@@ -15,6 +26,82 @@ namespace ThreadUtils {
 
 ThreadPool *pool = nullptr;
 
+// Parses lists of the form "0-3,8,10-11" used by Linux sysfs
+static std::vector<uint32> parseCpuList(const std::string &list)
+{
+    std::vector<uint32> result;
+    const char *s = list.c_str();
+    while (*s) {
+        char *end;
+        uint32 first = std::strtoul(s, &end, 10);
+        if (end == s)
+            break;
+        uint32 last = first;
+        s = end;
+        if (*s == '-') {
+            last = std::strtoul(s + 1, &end, 10);
+            s = end;
+        }
+        for (uint32 i = first; i <= last; ++i)
+            result.push_back(i);
+        if (*s == ',')
+            s++;
+        else
+            break;
+    }
+    return result;
+}
+
+// Returns the CPUs of every NUMA node that the process is allowed to run
+// on (e.g. inside a cpuset or after taskset). Nodes without any allowed CPU
+// are left out. If the topology can't be queried, all allowed CPUs are
+// reported as belonging to a single node
+static const std::vector<std::vector<uint32>> &numaTopology()
+{
+    static std::vector<std::vector<uint32>> topology = []() {
+        std::vector<std::vector<uint32>> nodes;
+#if __linux__
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        bool haveAllowed = sched_getaffinity(0, sizeof(cpu_set_t), &allowed) == 0;
+        auto isAllowed = [&](uint32 cpu) {
+            return !haveAllowed || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed));
+        };
+
+        std::string line;
+        std::ifstream online("/sys/devices/system/node/online");
+        if (online.good() && std::getline(online, line)) {
+            for (uint32 node : parseCpuList(line)) {
+                std::ifstream cpus("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+                if (cpus.good() && std::getline(cpus, line)) {
+                    std::vector<uint32> cpuList;
+                    for (uint32 cpu : parseCpuList(line))
+                        if (isAllowed(cpu))
+                            cpuList.push_back(cpu);
+                    if (!cpuList.empty())
+                        nodes.emplace_back(std::move(cpuList));
+                }
+            }
+        }
+        if (nodes.empty() && haveAllowed) {
+            nodes.emplace_back();
+            for (uint32 cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+                if (CPU_ISSET(cpu, &allowed))
+                    nodes.back().push_back(cpu);
+            if (nodes.back().empty())
+                nodes.clear();
+        }
+#endif
+        if (nodes.empty()) {
+            nodes.emplace_back();
+            for (uint32 i = 0; i < idealThreadCount(); ++i)
+                nodes.back().push_back(i);
+        }
+        return nodes;
+    }();
+    return topology;
+}
+
 uint32 idealThreadCount()
 {
     // std::thread::hardware_concurrency support is not great, so let's try
@@ -37,9 +124,35 @@ uint32 idealThreadCount()
     return 4;
 }
 
-void startThreads(int numThreads)
+uint32 numaNodeCount()
 {
-    pool = new ThreadPool(numThreads);
+    return numaTopology().size();
+}
+
+void startThreads(int numThreads, bool pinThreads)
+{
+    pool = new ThreadPool(numThreads, pinThreads);
+}
+
+bool pinCurrentThread(uint32 threadId)
+{
+    const auto &nodes = numaTopology();
+    const std::vector<uint32> &cpus = nodes[threadId % nodes.size()];
+    uint32 cpu = cpus[(threadId/nodes.size()) % cpus.size()];
+
+#if __linux__
+    if (cpu >= CPU_SETSIZE)
+        return false;
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(cpu, &cpuSet);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuSet) == 0;
+#elif _WIN32
+    return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << (cpu % (sizeof(DWORD_PTR)*8))) != 0;
+#else
+    MARK_UNUSED(cpu);
+    return false;
+#endif
 }
 
 void parallelFor(uint32 start, uint32 end, uint32 partitions, std::function<void(uint32)> func)
@@ -58,6 +171,33 @@ void parallelFor(uint32 start, uint32 end, uint32 partitions, std::function<void
         pool->yield(*pool->enqueue(taskRun, partitions));
 }
 
+void forEachThread(std::function<void(uint32)> func)
+{
+    if (pool->pinThreads()) {
+        pool->yield(*pool->enqueuePerThread([&func](uint32 idx, uint32 /*num*/, uint32 /*threadId*/) {
+            func(idx);
+        }));
+    } else {
+        for (uint32 i = 0; i < pool->threadCount(); ++i)
+            func(i);
+    }
+}
+
+void zeroMemory(void *dst, size_t bytes)
+{
+    if (!pool || !pool->pinThreads()) {
+        std::memset(dst, 0, bytes);
+        return;
+    }
+
+    uint32 numBands = pool->threadCount();
+    forEachThread([&](uint32 i) {
+        size_t start = bytes*i/numBands;
+        size_t end   = bytes*(i + 1)/numBands;
+        std::memset(static_cast<uint8 *>(dst) + start, 0, end - start);
+    });
+}
+
 }
 
 }
@@ -4,6 +4,10 @@
 #include "IntTypes.hpp"
 
 #include <functional>
+#include <utility>
+#include <memory>
+#include <vector>
+#include <new>
 
 namespace Tungsten {
 
@@ -14,10 +18,74 @@ namespace ThreadUtils {
 extern ThreadPool *pool;
 
 uint32 idealThreadCount();
-void startThreads(int numThreads);
+uint32 numaNodeCount();
+// With pinThreads set, pool workers are bound to cores, spreading them
+// round-robin across NUMA nodes so that every socket gets an equal share
+void startThreads(int numThreads, bool pinThreads = false);
+// Returns false if the thread could not be pinned, e.g. because its core is
+// outside of the process's affinity mask. The thread then stays unpinned
+bool pinCurrentThread(uint32 threadId);
 
 void parallelFor(uint32 start, uint32 end, uint32 partitions, std::function<void(uint32)> func);
 
+// Calls func once for every pool thread id. If pool threads are pinned,
+// func(i) runs on pool thread i, so memory it touches first ends up on the
+// NUMA node of that thread. Otherwise, all calls run on the calling thread
+void forEachThread(std::function<void(uint32)> func);
+// Zeroes a block of memory. If pool threads are pinned, the block is split
+// into one band per thread, and each band is first touched by its own thread
+void zeroMemory(void *dst, size_t bytes);
+
+template<typename T>
+inline std::unique_ptr<T[]> distributedZeroAlloc(size_t size)
+{
+    std::unique_ptr<T[]> result(new T[size]);
+    zeroMemory(result.get(), size*sizeof(T));
+    return result;
+}
+
+// Allocator that default-initializes instead of value-initializing
+// elements that are inserted without a value. For trivial types, resizing
+// a vector then leaves the new memory untouched, so that
+// distributedResize can decide which thread touches it first
+template<typename T>
+struct DefaultInitAllocator : public std::allocator<T>
+{
+    template<typename U>
+    struct rebind
+    {
+        typedef DefaultInitAllocator<U> other;
+    };
+
+    DefaultInitAllocator() = default;
+    template<typename U>
+    DefaultInitAllocator(const DefaultInitAllocator<U> &) {}
+
+    template<typename U>
+    void construct(U *p)
+    {
+        ::new (static_cast<void *>(p)) U;
+    }
+    template<typename U, typename... Args>
+    void construct(U *p, Args &&... args)
+    {
+        ::new (static_cast<void *>(p)) U(std::forward<Args>(args)...);
+    }
+};
+
+template<typename T>
+using DistributedVector = std::vector<T, DefaultInitAllocator<T>>;
+
+// Resizes a vector of trivial elements and zeroes all of them with
+// zeroMemory, so that pages are spread across NUMA nodes if threads are
+// pinned
+template<typename T>
+inline void distributedResize(DistributedVector<T> &v, size_t size)
+{
+    v.resize(size);
+    zeroMemory(v.data(), size*sizeof(T));
+}
+
 }
 
 }
@@ -0,0 +1,107 @@
+#include "Version.hpp"
+
+#include "grids/BrickGrid.hpp"
+
+#include "io/FileUtils.hpp"
+#include "io/CliParser.hpp"
+#include "io/Path.hpp"
+
+#include <tinyformat/tinyformat.hpp>
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+
+using namespace Tungsten;
+
+static const int OPT_VERSION           = 1;
+static const int OPT_HELP              = 2;
+static const int OPT_RESOLUTION        = 3;
+static const int OPT_FORMAT            = 4;
+
+template<typename T>
+static bool readVoxels(const Path &path, size_t numVoxels, float scale, std::vector<float> &dst)
+{
+    InputStreamHandle in = FileUtils::openInputStream(path);
+    if (!in)
+        return false;
+
+    std::vector<T> voxels(numVoxels);
+    FileUtils::streamRead(in, voxels.data(), numVoxels);
+    if (!*in)
+        return false;
+
+    dst.resize(numVoxels);
+    for (size_t i = 0; i < numVoxels; ++i)
+        dst[i] = float(voxels[i])*scale;
+    return true;
+}
+
+int main(int argc, const char *argv[])
+{
+    CliParser parser("raw2bgrid", "[options] inputfile outputfile");
+    parser.addOption('h', "help", "Prints this help text", false, OPT_HELP);
+    parser.addOption('v', "version", "Prints version information", false, OPT_VERSION);
+    parser.addOption('r', "resolution", "Specifies the resolution of the input volume "
+            "as a comma separated list, e.g. 128,64,128", true, OPT_RESOLUTION);
+    parser.addOption('f', "format", "Specifies the voxel type of the input volume. Available "
+            "options: float, byte, ushort. Integer voxels are mapped to [0, 1] (default: float)",
+            true, OPT_FORMAT);
+
+    parser.parse(argc, argv);
+
+    if (argc < 2 || parser.isPresent(OPT_HELP)) {
+        parser.printHelpText();
+        return 0;
+    }
+    if (parser.isPresent(OPT_VERSION)) {
+        std::cout << "raw2bgrid, version " << VERSION_STRING << std::endl;
+        return 0;
+    }
+    if (parser.operands().size() != 2)
+        parser.fail("Need exactly one input and one output file");
+    if (!parser.isPresent(OPT_RESOLUTION))
+        parser.fail("Missing volume resolution. You need to specify -r");
+
+    Vec3i resolution(0);
+    std::stringstream ss(parser.param(OPT_RESOLUTION));
+    std::string substr;
+    for (int i = 0; i < 3 && ss.good(); ++i) {
+        std::getline(ss, substr, ',');
+        resolution[i] = std::atoi(substr.c_str());
+    }
+    if (resolution.min() <= 0)
+        parser.fail("Invalid volume resolution '%s'", parser.param(OPT_RESOLUTION));
+
+    Path src(parser.operands()[0]);
+    Path dst(parser.operands()[1]);
+    std::string format = parser.isPresent(OPT_FORMAT) ? parser.param(OPT_FORMAT) : "float";
+
+    size_t numVoxels = size_t(resolution.x())*size_t(resolution.y())*size_t(resolution.z());
+    std::vector<float> density;
+    bool success = false;
+    if (format == "float")
+        success = readVoxels<float>(src, numVoxels, 1.0f, density);
+    else if (format == "byte")
+        success = readVoxels<uint8>(src, numVoxels, 1.0f/255.0f, density);
+    else if (format == "ushort")
+        success = readVoxels<uint16>(src, numVoxels, 1.0f/65535.0f, density);
+    else
+        parser.fail("Unsupported voxel format '%s'", format);
+
+    if (!success)
+        parser.fail("Unable to read %d voxels from input file '%s'", numVoxels, src);
+
+    BrickGrid grid;
+    grid.buildFromDense(resolution, density.data(), nullptr);
+    if (!grid.saveBricks(dst))
+        parser.fail("Unable to write output file '%s'", dst);
+
+    size_t denseBytes = numVoxels*sizeof(float);
+    Vec3i brickCount = (resolution + BrickGrid::BrickSize - 1)/BrickGrid::BrickSize;
+    std::cout << tfm::format("Converted %dx%dx%d volume: %d of %d bricks allocated, "
+            "%.2f MB (dense: %.2f MB)", resolution.x(), resolution.y(), resolution.z(),
+            grid.brickCount(), brickCount.product(),
+            grid.memoryUsage()*1e-6, denseBytes*1e-6) << std::endl;
+
+    return 0;
+}
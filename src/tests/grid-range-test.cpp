@@ -0,0 +1,182 @@
+#include "grids/SparseVoxelRange.hpp"
+#include "grids/BrickGrid.hpp"
+
+#include "sampling/UniformSampler.hpp"
+
+#include <tinyformat/tinyformat.hpp>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <vector>
+#include <cmath>
+#include <map>
+
+using namespace Tungsten;
+
+static const int NumRegions = 2000;
+
+struct BlockOrder
+{
+    bool operator()(const Vec3i &a, const Vec3i &b) const
+    {
+        if (a.x() != b.x()) return a.x() < b.x();
+        if (a.y() != b.y()) return a.y() < b.y();
+        return a.z() < b.z();
+    }
+};
+
+// Tree with the structure of an OpenVDB float tree: 8^3 leaves, constant
+// tiles and a background value for everything else. Coordinates may be
+// negative, unlike in BrickGrid
+struct SparseTree
+{
+    static const int LeafSize = 8;
+
+    float background;
+    std::map<Vec3i, float, BlockOrder> tiles;
+    std::map<Vec3i, std::vector<float>, BlockOrder> leaves;
+
+    static Vec3i blockOrigin(Vec3i v)
+    {
+        return Vec3i(v.x() & ~(LeafSize - 1), v.y() & ~(LeafSize - 1), v.z() & ~(LeafSize - 1));
+    }
+
+    float value(Vec3i v) const
+    {
+        Vec3i origin = blockOrigin(v);
+        auto leaf = leaves.find(origin);
+        if (leaf != leaves.end()) {
+            Vec3i l = v - origin;
+            return leaf->second[l.x() + LeafSize*(l.y() + LeafSize*l.z())];
+        }
+        auto tile = tiles.find(origin);
+        return tile != tiles.end() ? tile->second : background;
+    }
+};
+
+static Vec2f bruteForceRange(Vec3i minV, Vec3i maxV, const std::function<float(Vec3i)> &voxel)
+{
+    Vec2f result(std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity());
+    for (int z = minV.z(); z <= maxV.z(); ++z) {
+        for (int y = minV.y(); y <= maxV.y(); ++y) {
+            for (int x = minV.x(); x <= maxV.x(); ++x) {
+                float d = voxel(Vec3i(x, y, z));
+                result.x() = min(result.x(), d);
+                result.y() = max(result.y(), d);
+            }
+        }
+    }
+    return result;
+}
+
+static Vec3i randomVoxel(UniformSampler &sampler, int lo, int hi)
+{
+    return Vec3i(lo + int(sampler.next1D()*(hi - lo)), lo + int(sampler.next1D()*(hi - lo)),
+            lo + int(sampler.next1D()*(hi - lo)));
+}
+
+// Queries the tree the same way VdbGrid::densityRange queries an OpenVDB
+// tree, and compares against the range of every voxel in the query
+static bool testSparseTree()
+{
+    UniformSampler sampler(0xBA5EBA11);
+
+    SparseTree tree;
+    tree.background = 0.25f;
+    for (int i = 0; i < 40; ++i) {
+        Vec3i origin = SparseTree::blockOrigin(randomVoxel(sampler, -32, 32));
+        if (sampler.next1D() < 0.3f) {
+            tree.tiles[origin] = 2.0f*sampler.next1D();
+        } else {
+            std::vector<float> &leaf = tree.leaves[origin];
+            leaf.resize(SparseTree::LeafSize*SparseTree::LeafSize*SparseTree::LeafSize);
+            for (float &d : leaf)
+                d = sampler.next1D() < 0.9f ? 0.25f : 4.0f*sampler.next1D() - 1.0f;
+        }
+    }
+
+    int failures = 0;
+    for (int i = 0; i < NumRegions; ++i) {
+        Vec3i minV = randomVoxel(sampler, -40, 40);
+        Vec3i maxV = minV + randomVoxel(sampler, 0, 20);
+
+        Vec2f range = SparseVoxelRange::compute(minV, maxV, SparseTree::LeafSize, [&](Vec3i origin, float &value) {
+            if (tree.leaves.count(origin))
+                return false;
+            value = tree.value(origin);
+            return true;
+        }, [&](Vec3i v) {
+            return tree.value(v);
+        });
+        Vec2f expected = bruteForceRange(minV, maxV, [&](Vec3i v) { return tree.value(v); });
+
+        if (range != expected && failures++ < 5)
+            std::cout << tfm::format("Sparse tree range of %s - %s is %s (expected %s)", minV, maxV, range, expected) << std::endl;
+    }
+
+    std::cout << tfm::format("Sparse tree: %d of %d ranges wrong", failures, NumRegions) << std::endl;
+    return failures == 0;
+}
+
+// The majorant grid relies on densityRange bounding every density lookup in
+// the region. Checks that for random regions, including ones that reach
+// outside of the volume, and also compares against the exact voxel range
+static bool testBrickGrid()
+{
+    UniformSampler sampler(0xDEADBEEF);
+
+    Vec3i resolution(37, 20, 29);
+    std::vector<float> density(resolution.product(), 0.0f);
+    for (int z = 0; z < resolution.z(); ++z)
+        for (int y = 0; y < resolution.y(); ++y)
+            for (int x = 0; x < resolution.x(); ++x)
+                if (x > 12 && y > 6 && sampler.next1D() < 0.5f)
+                    density[x + resolution.x()*(y + resolution.y()*z)] = sampler.next1D();
+    auto voxel = [&](Vec3i v) {
+        if (v.x() < 0 || v.y() < 0 || v.z() < 0 || v.x() >= resolution.x() || v.y() >= resolution.y() || v.z() >= resolution.z())
+            return 0.0f;
+        return density[v.x() + resolution.x()*(v.y() + resolution.y()*v.z())];
+    };
+
+    BrickGrid grid;
+    grid.buildFromDense(resolution, density.data(), nullptr);
+
+    int wrongRanges = 0, unboundedLookups = 0;
+    for (int i = 0; i < NumRegions; ++i) {
+        Vec3f minP = Vec3f(sampler.next1D(), sampler.next1D(), sampler.next1D())*Vec3f(resolution + 8) - 4.0f;
+        Vec3f size = Vec3f(sampler.next1D(), sampler.next1D(), sampler.next1D())*12.0f;
+        Box3f region(minP, minP + size);
+
+        Vec2f range = grid.densityRange(region);
+        Vec3i minV(int(std::floor(minP.x() - 0.5f)), int(std::floor(minP.y() - 0.5f)), int(std::floor(minP.z() - 0.5f)));
+        Vec3i maxV(int(std::floor(minP.x() + size.x() + 0.5f)), int(std::floor(minP.y() + size.y() + 0.5f)),
+                int(std::floor(minP.z() + size.z() + 0.5f)));
+        Vec2f expected = bruteForceRange(minV, maxV, voxel);
+        if (range != expected && wrongRanges++ < 5)
+            std::cout << tfm::format("Brick grid range of %s - %s is %s (expected %s)", minV, maxV, range, expected) << std::endl;
+
+        for (int j = 0; j < 50; ++j) {
+            Vec3f p = minP + size*Vec3f(sampler.next1D(), sampler.next1D(), sampler.next1D());
+            float d = grid.density(p);
+            if ((d < range.x() - 1e-6f || d > range.y() + 1e-6f) && unboundedLookups++ < 5)
+                std::cout << tfm::format("Density %f at %s is outside of the range %s", d, p, range) << std::endl;
+        }
+    }
+
+    std::cout << tfm::format("Brick grid: %d of %d ranges wrong, %d of %d lookups outside of their range",
+            wrongRanges, NumRegions, unboundedLookups, NumRegions*50) << std::endl;
+    return wrongRanges == 0 && unboundedLookups == 0;
+}
+
+int main()
+{
+    bool success = true;
+    success = testSparseTree() && success;
+    success = testBrickGrid() && success;
+
+    if (!success) {
+        std::cout << "FAILED" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,69 @@
+#include "cameras/OutputBuffer.hpp"
+
+#include "io/JsonDocument.hpp"
+#include "io/Scene.hpp"
+
+#include <tinyformat/tinyformat.hpp>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <cmath>
+
+using namespace Tungsten;
+
+static const int NumWriters = 16;
+static const int SamplesPerWriter = 20000;
+
+// Many threads add samples to the same pixel through addSampleConcurrent.
+// Writer t adds the value t, so the expected mean and variance of the
+// pixel are known in closed form and any lost update shows up in them
+static bool testSinglePixel(const char *json)
+{
+    Scene scene;
+    JsonDocument document(Path("output-buffer-test.json"), json);
+    OutputBufferSettings settings;
+    settings.fromJson(document, scene);
+
+    OutputBufferF buffer(Vec2u(4, 4), settings);
+
+    std::vector<std::thread> writers;
+    for (int t = 0; t < NumWriters; ++t) {
+        writers.emplace_back([&buffer, t]() {
+            for (int i = 0; i < SamplesPerWriter; ++i)
+                buffer.addSampleConcurrent(Vec2u(1, 2), float(t));
+        });
+    }
+    for (std::thread &t : writers)
+        t.join();
+
+    double n = double(NumWriters)*SamplesPerWriter;
+    double expectedMean = (NumWriters - 1)*0.5;
+    double expectedVariance = (double(NumWriters)*NumWriters - 1.0)/12.0*n/(n - 1.0);
+
+    double mean = buffer[1 + 2*4];
+    bool success = std::abs(mean - expectedMean) < 1e-2*expectedMean;
+    if (settings.sampleVariance()) {
+        double variance = buffer.variance(1, 2);
+        success = success && std::abs(variance - expectedVariance) < 1e-2*expectedVariance;
+        std::cout << tfm::format("%s: mean %f (expected %f), variance %f (expected %f)",
+                json, mean, expectedMean, variance, expectedVariance) << std::endl;
+    } else {
+        std::cout << tfm::format("%s: mean %f (expected %f)", json, mean, expectedMean) << std::endl;
+    }
+
+    return success;
+}
+
+int main()
+{
+    bool success = true;
+    success = testSinglePixel("{\"type\": \"depth\"}") && success;
+    success = testSinglePixel("{\"type\": \"depth\", \"sample_variance\": true}") && success;
+    success = testSinglePixel("{\"type\": \"depth\", \"two_buffer_variance\": true, \"sample_variance\": true}") && success;
+
+    if (!success) {
+        std::cout << "FAILED" << std::endl;
+        return 1;
+    }
+    return 0;
+}
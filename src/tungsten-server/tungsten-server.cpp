@@ -10,12 +10,16 @@
 #include <rapidjson/writer.h>
 #include <lodepng/lodepng.h>
 #include <civetweb/civetweb.h>
+#include <cstring>
+#include <cstdlib>
 #include <sstream>
+#include <map>
 
 using namespace Tungsten;
 
 static const int OPT_PORT    = 100;
 static const int OPT_LOGFILE = 101;
+static const int OPT_WAIT    = 102;
 
 static struct mg_context *context = nullptr;
 static StandaloneRenderer *renderer = nullptr;
@@ -97,34 +101,283 @@ int serveStatusJson(struct mg_connection *conn, void * /*cbdata*/)
     return 1;
 }
 
+// Reads a query parameter, returning false if it is absent
+bool queryString(struct mg_connection *conn, const char *name, std::string &dst)
+{
+    const char *query = mg_get_request_info(conn)->query_string;
+    if (!query)
+        return false;
+
+    char buf[4096];
+    if (mg_get_var(query, std::strlen(query), name, buf, sizeof(buf)) <= 0)
+        return false;
+    dst = buf;
+    return true;
+}
+
+// Reads an integer query parameter, returning the fallback if it is absent
+int queryInt(struct mg_connection *conn, const char *name, int fallback)
+{
+    std::string value;
+    if (!queryString(conn, name, value))
+        return fallback;
+    return std::atoi(value.c_str());
+}
+
+// Reads an unsigned 64 bit query parameter, returning the fallback if it is absent
+uint64 queryUint64(struct mg_connection *conn, const char *name, uint64 fallback)
+{
+    std::string value;
+    if (!queryString(conn, name, value))
+        return fallback;
+    return std::strtoull(value.c_str(), nullptr, 10);
+}
+
+std::string encodeBase64(const Tungsten::uint8 *src, size_t length)
+{
+    static const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    std::string result;
+    result.reserve(((length + 2)/3)*4);
+    for (size_t i = 0; i < length; i += 3) {
+        uint32 bits = uint32(src[i]) << 16;
+        if (i + 1 < length) bits |= uint32(src[i + 1]) << 8;
+        if (i + 2 < length) bits |= uint32(src[i + 2]);
+
+        result += alphabet[(bits >> 18) & 0x3F];
+        result += alphabet[(bits >> 12) & 0x3F];
+        result += i + 1 < length ? alphabet[(bits >> 6) & 0x3F] : '=';
+        result += i + 2 < length ? alphabet[bits & 0x3F] : '=';
+    }
+    return result;
+}
+
+// Encodes a rectangle of the snapshot, box filtered down by an integer factor
+std::shared_ptr<const std::string> encodeRegion(const FrameSnapshot &snapshot, uint32 x0, uint32 y0,
+        uint32 w, uint32 h, uint32 scale)
+{
+    uint32 outW = max((w + scale - 1)/scale, 1u);
+    uint32 outH = max((h + scale - 1)/scale, 1u);
+    std::unique_ptr<Vec3c[]> ldr(new Vec3c[outW*outH]);
+    for (uint32 y = 0; y < outH; ++y) {
+        for (uint32 x = 0; x < outW; ++x) {
+            Vec3u sum(0u);
+            uint32 count = 0;
+            for (uint32 dy = y*scale; dy < min((y + 1)*scale, h); ++dy) {
+                for (uint32 dx = x*scale; dx < min((x + 1)*scale, w); ++dx) {
+                    sum += Vec3u(snapshot.ldr[x0 + dx + (y0 + dy)*snapshot.resolution.x()]);
+                    count++;
+                }
+            }
+            ldr[x + y*outW] = Vec3c(sum/max(count, 1u));
+        }
+    }
+
+    Tungsten::uint8 *encoded = nullptr;
+    size_t encodedSize;
+    if (lodepng_encode_memory(&encoded, &encodedSize, &ldr[0].x(), outW, outH, LCT_RGB, 8) != 0)
+        return nullptr;
+
+    std::unique_ptr<Tungsten::uint8, void (*)(void *)> data(encoded, free);
+    return std::make_shared<const std::string>(reinterpret_cast<const char *>(data.get()), encodedSize);
+}
+
+// Serves the current frame as PNG, optionally downscaled via ?scale=N. The
+// snapshot only changes once per spp pass, so encoded images are cached
+// until a new snapshot arrives instead of being re-encoded for every poll
 int serveFrameBuffer(struct mg_connection *conn, void * /*cbdata*/)
 {
+    static std::mutex cacheMutex;
+    static uint64 cachedVersion = 0;
+    static std::map<uint32, std::shared_ptr<const std::string>> cachedImages;
+
     if (!renderer)
         return 0;
 
-    Vec2i res;
-    std::unique_ptr<Vec3c[]> ldr = renderer->frameBuffer(res);
-    if (!ldr)
+    std::shared_ptr<const FrameSnapshot> snapshot = renderer->snapshot();
+    if (!snapshot)
         return 0;
 
-    Tungsten::uint8 *encoded = nullptr;
-    size_t encodedSize;
-    if (lodepng_encode_memory(&encoded, &encodedSize, &ldr[0].x(), res.x(), res.y(), LCT_RGB, 8) != 0)
+    uint32 scale = clamp(queryInt(conn, "scale", 1), 1, 64);
+
+    std::shared_ptr<const std::string> image;
+    {
+        std::unique_lock<std::mutex> lock(cacheMutex);
+        if (cachedVersion != snapshot->version) {
+            cachedImages.clear();
+            cachedVersion = snapshot->version;
+        }
+        auto iter = cachedImages.find(scale);
+        if (iter != cachedImages.end())
+            image = iter->second;
+    }
+    if (!image) {
+        image = encodeRegion(*snapshot, 0, 0, snapshot->resolution.x(), snapshot->resolution.y(), scale);
+        if (!image)
+            return 0;
+
+        std::unique_lock<std::mutex> lock(cacheMutex);
+        if (cachedVersion == snapshot->version)
+            cachedImages[scale] = image;
+    }
+
+    serveData(conn, reinterpret_cast<const void *>(image->data()), image->size(), MIME_IMAGE);
+
+    return 1;
+}
+
+// Base64 encoded PNGs of snapshot tiles. Tiles are encoded when they are
+// first requested, and the encoding is reused by later snapshots for as
+// long as the tile doesn't change
+struct TileCache
+{
+    std::mutex mutex;
+    Vec2u resolution;
+    std::vector<uint64> tileVersion;
+    std::vector<std::shared_ptr<const std::string>> tiles;
+
+    std::shared_ptr<const std::string> fetch(const FrameSnapshot &snapshot, uint32 tileX, uint32 tileY)
+    {
+        if (resolution != snapshot.resolution) {
+            resolution = snapshot.resolution;
+            tileVersion.assign(snapshot.tileVersion.size(), 0);
+            tiles.clear();
+            tiles.resize(snapshot.tileVersion.size());
+        }
+
+        uint32 tile = tileX + tileY*snapshot.tilesX();
+        if (tiles[tile] && tileVersion[tile] == snapshot.tileVersion[tile])
+            return tiles[tile];
+
+        uint32 x = tileX*FrameSnapshot::TileSize;
+        uint32 y = tileY*FrameSnapshot::TileSize;
+        uint32 w = min(FrameSnapshot::TileSize, snapshot.resolution.x() - x);
+        uint32 h = min(FrameSnapshot::TileSize, snapshot.resolution.y() - y);
+        std::shared_ptr<const std::string> png = encodeRegion(snapshot, x, y, w, h, 1);
+        if (!png)
+            return nullptr;
+
+        tiles[tile] = std::make_shared<const std::string>(
+                encodeBase64(reinterpret_cast<const Tungsten::uint8 *>(png->data()), png->size()));
+        tileVersion[tile] = snapshot.tileVersion[tile];
+        return tiles[tile];
+    }
+};
+
+// Serves the tiles that changed after the snapshot version given by
+// ?since=N as a JSON list of base64 encoded PNGs. Clients pass the version
+// and generation of the last response they received to only fetch what is
+// new. If the generation doesn't match (a new scene or resolution, or no
+// generation given at all), every tile is sent
+int serveChangedTiles(struct mg_connection *conn, void * /*cbdata*/)
+{
+    static TileCache cache;
+
+    if (!renderer)
         return 0;
-    ldr.reset();
 
-    std::unique_ptr<Tungsten::uint8, void (*)(void *)> data(encoded, free);
-    serveData(conn, reinterpret_cast<const void *>(data.get()), encodedSize, MIME_IMAGE);
+    std::shared_ptr<const FrameSnapshot> snapshot = renderer->snapshot();
+    if (!snapshot)
+        return 0;
+
+    uint64 since = queryUint64(conn, "since", 0);
+    if (queryUint64(conn, "generation", 0) != snapshot->generation)
+        since = 0;
+
+    rapidjson::Document document;
+    document.SetObject();
+    rapidjson::Document::AllocatorType &allocator = document.GetAllocator();
+    document.AddMember("version", snapshot->version, allocator);
+    document.AddMember("generation", snapshot->generation, allocator);
+    document.AddMember("spp", snapshot->spp, allocator);
+    document.AddMember("width", snapshot->resolution.x(), allocator);
+    document.AddMember("height", snapshot->resolution.y(), allocator);
+    document.AddMember("tile_size", FrameSnapshot::TileSize, allocator);
+
+    // The encoded tiles are referenced by the document without copying, so
+    // they are kept alive here until the response is written
+    std::vector<std::shared_ptr<const std::string>> encodedTiles;
+    rapidjson::Value tiles(rapidjson::kArrayType);
+    {
+        std::unique_lock<std::mutex> lock(cache.mutex);
+        for (uint32 tileY = 0; tileY < snapshot->tilesY(); ++tileY) {
+            for (uint32 tileX = 0; tileX < snapshot->tilesX(); ++tileX) {
+                if (snapshot->tileVersion[tileX + tileY*snapshot->tilesX()] <= since)
+                    continue;
+
+                std::shared_ptr<const std::string> base64 = cache.fetch(*snapshot, tileX, tileY);
+                if (!base64)
+                    return 0;
+                encodedTiles.push_back(base64);
+
+                uint32 x = tileX*FrameSnapshot::TileSize;
+                uint32 y = tileY*FrameSnapshot::TileSize;
+                rapidjson::Value tile(rapidjson::kObjectType);
+                tile.AddMember("x", x, allocator);
+                tile.AddMember("y", y, allocator);
+                tile.AddMember("w", min(FrameSnapshot::TileSize, snapshot->resolution.x() - x), allocator);
+                tile.AddMember("h", min(FrameSnapshot::TileSize, snapshot->resolution.y() - y), allocator);
+                tile.AddMember("png", rapidjson::StringRef(base64->c_str(), base64->size()), allocator);
+                tiles.PushBack(tile, allocator);
+            }
+        }
+    }
+    document.AddMember("tiles", tiles, allocator);
+
+    rapidjson::GenericStringBuffer<rapidjson::UTF8<>> buffer;
+    rapidjson::Writer<rapidjson::GenericStringBuffer<rapidjson::UTF8<>>> jsonWriter(buffer);
+    document.Accept(jsonWriter);
+
+    serveData(conn, reinterpret_cast<const void *>(buffer.GetString()), buffer.GetSize(), MIME_JSON);
 
     return 1;
 }
 
+// Job queue endpoints. Scenes are identified by their path, with relative
+// paths resolved against the server's working directory; every endpoint
+// replies with the updated renderer status
+int serveSubmitJob(struct mg_connection *conn, void *cbdata)
+{
+    std::string scene;
+    if (!renderer || !queryString(conn, "scene", scene))
+        return 0;
+
+    renderer->submitScene(Path(scene), queryInt(conn, "position", -1));
+
+    return serveStatusJson(conn, cbdata);
+}
+
+int serveCancelJob(struct mg_connection *conn, void *cbdata)
+{
+    std::string scene;
+    if (!renderer || !queryString(conn, "scene", scene))
+        return 0;
+
+    if (!renderer->cancelScene(Path(scene)))
+        return 0;
+
+    return serveStatusJson(conn, cbdata);
+}
+
+int servePrioritizeJob(struct mg_connection *conn, void *cbdata)
+{
+    std::string scene;
+    if (!renderer || !queryString(conn, "scene", scene))
+        return 0;
+
+    if (!renderer->prioritizeScene(Path(scene), queryInt(conn, "position", 0)))
+        return 0;
+
+    return serveStatusJson(conn, cbdata);
+}
+
 int main(int argc, const char *argv[])
 {
     CliParser parser("tungsten_server", "[options] scene1 [scene2 [scene3...]]");
 
     parser.addOption('p', "port", "Port to listen on. Defaults to 8080", true, OPT_PORT);
     parser.addOption('l', "log-file", "Specifies a file to save the render log to", true, OPT_LOGFILE);
+    parser.addOption('w', "wait", "Keeps the server running after all scenes have rendered, waiting for new jobs to be submitted", false, OPT_WAIT);
 
     renderer = new StandaloneRenderer(parser, logStream);
 
@@ -139,7 +392,10 @@ int main(int argc, const char *argv[])
     if (parser.isPresent(OPT_LOGFILE))
         logFile = Path(parser.param(OPT_LOGFILE)).absolute();
 
+    if (parser.isPresent(OPT_WAIT))
+        renderer->enableJobQueue();
     renderer->setup();
+    renderer->enableSnapshots();
 
     std::string port = "8080";
     if (parser.isPresent(OPT_PORT))
@@ -161,6 +417,10 @@ int main(int argc, const char *argv[])
 
     mg_set_request_handler(context, "/log", &serveLogFile, nullptr);
     mg_set_request_handler(context, "/status", &serveStatusJson, nullptr);
+    mg_set_request_handler(context, "/jobs/submit", &serveSubmitJob, nullptr);
+    mg_set_request_handler(context, "/jobs/cancel", &serveCancelJob, nullptr);
+    mg_set_request_handler(context, "/jobs/prioritize", &servePrioritizeJob, nullptr);
+    mg_set_request_handler(context, "/render/tiles", &serveChangedTiles, nullptr);
     mg_set_request_handler(context, "/render", &serveFrameBuffer, nullptr);
 
     while (renderer->renderScene());
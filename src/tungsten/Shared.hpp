@@ -3,8 +3,12 @@
 
 #include "primitives/EmbreeUtil.hpp"
 
+#include "cameras/AtomicFramebuffer.hpp"
+
 #include "renderer/TraceableScene.hpp"
 
+#include "textures/TexturePager.hpp"
+
 #include "thread/ThreadUtils.hpp"
 
 #include "io/JsonLoadException.hpp"
@@ -19,10 +23,18 @@
 
 #include <tinyformat/tinyformat.hpp>
 #include <rapidjson/document.h>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
 #include <cstdlib>
+#include <fstream>
 #include <vector>
+#include <thread>
 #include <mutex>
 #include <deque>
+#if __linux__
+#include <unistd.h>
+#endif
 
 #ifdef OPENVDB_AVAILABLE
 #include <openvdb/openvdb.h>
@@ -42,9 +54,14 @@ static const int OPT_SEED              = 7;
 static const int OPT_TIMEOUT           = 8;
 static const int OPT_OUTPUT_FILE       = 9;
 static const int OPT_HDR_OUTPUT_FILE   = 10;
+static const int OPT_NUMA              = 12;
+static const int OPT_PRELOAD_MEMORY    = 13;
+static const int OPT_TEXTURE_CACHE     = 14;
+static const int OPT_TEXTURE_CACHE_DIR = 15;
 
 enum RenderState
 {
+    STATE_IDLE,
     STATE_LOADING,
     STATE_RENDERING,
 };
@@ -52,12 +69,25 @@ enum RenderState
 static const char *renderStateToString(RenderState state)
 {
     switch (state) {
+    case STATE_IDLE:      return "idle";
     case STATE_LOADING:   return "loading";
     case STATE_RENDERING: return "rendering";
     default:              return "unknown";
     }
 }
 
+// Resident memory of the process in bytes, or 0 if it can't be queried
+static uint64 residentMemory()
+{
+#if __linux__
+    uint64 totalPages, residentPages;
+    std::ifstream statm("/proc/self/statm");
+    if (statm >> totalPages >> residentPages)
+        return residentPages*uint64(sysconf(_SC_PAGESIZE));
+#endif
+    return 0;
+}
+
 struct RendererStatus
 {
     RenderState state;
@@ -95,6 +125,36 @@ struct RendererStatus
     }
 };
 
+// Tonemapped copy of the framebuffer, taken by the render thread after
+// every spp pass. Besides the
+// image, it records for every tile the snapshot version at which the tile
+// last changed, so that clients can fetch and encode only the parts of the
+// image that are out of date. Versions increase monotonically for the
+// lifetime of the renderer. The generation changes whenever a new scene
+// starts or the resolution changes, which invalidates everything a client
+// has received so far
+struct FrameSnapshot
+{
+    static const uint32 TileSize = 32;
+
+    uint64 version;
+    uint64 generation;
+    int spp;
+    Vec2u resolution;
+    std::unique_ptr<Vec3c[]> ldr;
+    std::vector<uint64> tileVersion;
+
+    uint32 tilesX() const
+    {
+        return (resolution.x() + TileSize - 1)/TileSize;
+    }
+
+    uint32 tilesY() const
+    {
+        return (resolution.y() + TileSize - 1)/TileSize;
+    }
+};
+
 class StandaloneRenderer
 {
     CliParser &_parser;
@@ -109,26 +169,309 @@ class StandaloneRenderer
     std::unique_ptr<Scene> _scene;
     std::unique_ptr<TraceableScene> _flattenedScene;
 
+    // A scene whose resources were loaded by the preload thread while the
+    // previous scene was rendering. Preloading is limited to I/O; the scene
+    // is made traceable on the render thread once the previous render is
+    // done, so that building BVHs doesn't compete with it for cores
+    struct PreloadedScene
+    {
+        Path path;
+        std::unique_ptr<Scene> scene;
+    };
+
+    // The next queued scene is preloaded in the background while the
+    // current one renders, as long as the process stays below the preload
+    // memory limit. All preload state is protected by the status mutex
+    uint64 _preloadMemoryLimit;
+    std::thread _preloadThread;
+    std::condition_variable _statusCond;
+    std::unique_ptr<PreloadedScene> _preloadedScene;
+    Path _rejectedPreload;
+    bool _preloading;
+    bool _stopPreloading;
+    // The current directory is process-wide. Scene loading and anything else
+    // that resolves paths relative to it changes it only while holding this
+    std::mutex _directoryMutex;
+
+    // Checkpoints are snapshotted by the render thread and written to disk
+    // by this thread while the next passes render. At most one checkpoint
+    // is in flight at a time
+    std::thread _checkpointThread;
+
+    bool _waitForJobs;
+    bool _cancelCurrent;
+
     std::mutex _statusMutex;
     std::mutex _logMutex;
     std::mutex _sceneMutex;
     RendererStatus _status;
 
+    // Snapshots are double buffered: Readers only ever see the front
+    // snapshot, and the render thread reuses the back snapshot for the next
+    // pass once no reader holds on to it anymore
+    bool _takeSnapshots;
+    uint64 _snapshotVersion;
+    uint64 _snapshotGeneration;
+    std::mutex _snapshotMutex;
+    std::shared_ptr<FrameSnapshot> _snapshot;
+    std::shared_ptr<FrameSnapshot> _backSnapshot;
+
     void writeLogLine(const std::string &s)
     {
         std::unique_lock<std::mutex> lock(_logMutex);
         _logStream << s << std::endl;
     }
 
+    void waitForCheckpoint()
+    {
+        if (_checkpointThread.joinable())
+            _checkpointThread.join();
+    }
+
+    void takeSnapshot(int spp)
+    {
+        const Camera &camera = *_scene->camera();
+        Vec2u res = camera.resolution();
+
+        std::shared_ptr<FrameSnapshot> next;
+        if (_backSnapshot && _backSnapshot.use_count() == 1 && _backSnapshot->resolution == res) {
+            next = std::move(_backSnapshot);
+        } else {
+            _backSnapshot.reset();
+            next = std::make_shared<FrameSnapshot>();
+            next->resolution = res;
+            next->ldr.reset(new Vec3c[res.product()]);
+            next->tileVersion.resize(next->tilesX()*next->tilesY());
+        }
+        next->version = ++_snapshotVersion;
+        next->spp = spp;
+
+        // Only the render thread ever replaces the front snapshot, so it can
+        // be read here without locking. Snapshots are cleared between scenes
+        const FrameSnapshot *prev = _snapshot && _snapshot->resolution == res ? _snapshot.get() : nullptr;
+        next->generation = prev ? prev->generation : ++_snapshotGeneration;
+
+        for (uint32 y = 0; y < res.y(); ++y)
+            for (uint32 x = 0; x < res.x(); ++x)
+                next->ldr[x + y*res.x()] = Vec3c(clamp(Vec3i(camera.get(x, y)*255.0f), Vec3i(0), Vec3i(255)));
+
+        for (uint32 tileY = 0; tileY < next->tilesY(); ++tileY) {
+            for (uint32 tileX = 0; tileX < next->tilesX(); ++tileX) {
+                uint32 tile = tileX + tileY*next->tilesX();
+                bool changed = (prev == nullptr);
+                uint32 xEnd = min((tileX + 1)*FrameSnapshot::TileSize, res.x());
+                uint32 yEnd = min((tileY + 1)*FrameSnapshot::TileSize, res.y());
+                for (uint32 y = tileY*FrameSnapshot::TileSize; y < yEnd && !changed; ++y)
+                    for (uint32 x = tileX*FrameSnapshot::TileSize; x < xEnd && !changed; ++x)
+                        changed = next->ldr[x + y*res.x()] != prev->ldr[x + y*res.x()];
+                next->tileVersion[tile] = changed ? next->version : prev->tileVersion[tile];
+            }
+        }
+
+        std::unique_lock<std::mutex> lock(_snapshotMutex);
+        _backSnapshot = std::move(_snapshot);
+        _snapshot = std::move(next);
+    }
+
+    void logResourceLoadTimes(const Scene &scene, double elapsed)
+    {
+        double total = 0.0;
+        for (const auto &t : scene.resourceLoadTimes()) {
+            total += t.second;
+            if (t.second >= 1e-3)
+                writeLogLine(tfm::format("Loaded %s in %s", t.first, StringUtils::durationToString(t.second)));
+        }
+        writeLogLine(tfm::format("Loaded %d resources in %s (%s summed over all resources)",
+                scene.resourceLoadTimes().size(), StringUtils::durationToString(elapsed),
+                StringUtils::durationToString(total)));
+    }
+
+    void logStageTimes(const Integrator &integrator)
+    {
+        for (const Integrator::StageTime &t : integrator.stageTimes())
+            writeLogLine(tfm::format("%s took %s", t.first, StringUtils::durationToString(t.second)));
+    }
+
+    void logTextureCacheStats()
+    {
+        if (!TexturePager::enabled())
+            return;
+
+        TexturePager::Stats stats = TexturePager::stats();
+        uint64 lookups = stats.hits + stats.misses;
+        writeLogLine(tfm::format("Texture cache: %d hits, %d misses (%.2f%% hit rate), %d evictions, "
+                "%.1f MB read, %.1f MB resident", stats.hits, stats.misses,
+                lookups ? stats.hits*100.0/lookups : 100.0, stats.evictions,
+                stats.bytesRead/(1024.0*1024.0), stats.residentBytes/(1024.0*1024.0)));
+    }
+
+    uint32 renderSeed() const
+    {
+        if (_parser.isPresent(OPT_SEED))
+            return std::atoi(_parser.param(OPT_SEED).c_str());
+        return 0xBA5EBA11;
+    }
+
+    void applySettingsOverrides(Scene &scene)
+    {
+        if (_parser.isPresent(OPT_SPP))
+            scene.rendererSettings().setSpp(std::atoi(_parser.param(OPT_SPP).c_str()));
+
+        if (_parser.isPresent(OPT_OUTPUT_FILE)) {
+            Path p(_parser.param(OPT_OUTPUT_FILE));
+            p.freezeWorkingDirectory();
+            scene.rendererSettings().setOutputFile(p);
+        }
+        if (_parser.isPresent(OPT_HDR_OUTPUT_FILE)) {
+            Path p(_parser.param(OPT_HDR_OUTPUT_FILE));
+            p.freezeWorkingDirectory();
+            scene.rendererSettings().setHdrOutputFile(p);
+        }
+        if (_parser.isPresent(OPT_OUTPUT_DIRECTORY))
+            scene.rendererSettings().setOutputDirectory(_outputDirectory);
+    }
+
+    Path sceneInputDirectory(const Path &scenePath) const
+    {
+        return _parser.isPresent(OPT_INPUT_DIRECTORY) ? _inputDirectory : scenePath.parent();
+    }
+
+    // Rough upper bound of the memory a scene needs once loaded: The size
+    // of all files it references plus the framebuffers that are allocated
+    // in prepareForRender
+    uint64 estimateSceneMemory(Scene &scene) const
+    {
+        uint64 result = 0;
+        for (const auto &resource : scene.resources())
+            if (resource.second)
+                result += FileUtils::fileSize(*resource.second);
+
+        const RendererSettings &settings = scene.rendererSettings();
+        Vec2u res = scene.camera()->resolution();
+        uint64 pixels = uint64(res.product());
+
+        // Color buffer and splat buffer, which most integrators request
+        uint64 bytesPerPixel = sizeof(Vec3f) + sizeof(uint32) + sizeof(Vec3f);
+        for (const auto &b : settings.renderOutputs()) {
+            uint64 elementSize = (b.type() == OutputDepth || b.type() == OutputVisibility) ? sizeof(float) : sizeof(Vec3f);
+            uint64 bufferCount = 1 + (b.twoBufferVariance() ? 1 : 0) + (b.sampleVariance() ? 1 : 0);
+            bytesPerPixel += elementSize*bufferCount + sizeof(uint32);
+        }
+        result += pixels*bytesPerPixel;
+
+        if (settings.localSplatAccumulation()) {
+            uint64 cachedPixels = pixels;
+            if (settings.splatCacheTiles() > 0)
+                cachedPixels = min(cachedPixels, uint64(settings.splatCacheTiles())*
+                        AtomicFramebuffer::TileSize*AtomicFramebuffer::TileSize);
+            result += (pixels + cachedPixels*_threadCount)*sizeof(Vec3d);
+        }
+
+        return result;
+    }
+
+    // The scene to preload next, or an empty path if there's nothing to do
+    Path nextPreloadCandidate() const
+    {
+        if (_status.state != STATE_RENDERING || _status.queuedScenes.empty() || _preloading)
+            return Path();
+        const Path &next = _status.queuedScenes.front();
+        if (next == _rejectedPreload || (_preloadedScene && _preloadedScene->path == next))
+            return Path();
+        return next;
+    }
+
+    void preloadLoop()
+    {
+        std::unique_lock<std::mutex> lock(_statusMutex);
+        while (true) {
+            Path scenePath;
+            _statusCond.wait(lock, [&]() {
+                return _stopPreloading || !(scenePath = nextPreloadCandidate()).empty();
+            });
+            if (_stopPreloading)
+                break;
+
+            // The preloaded scene is stale (e.g. the queue was reordered)
+            std::unique_ptr<PreloadedScene> stale = std::move(_preloadedScene);
+            _preloading = true;
+            lock.unlock();
+
+            stale.reset();
+            std::unique_ptr<PreloadedScene> preloaded = preloadScene(scenePath);
+
+            lock.lock();
+            _preloading = false;
+            if (preloaded)
+                _preloadedScene = std::move(preloaded);
+            else
+                _rejectedPreload = scenePath;
+            _statusCond.notify_all();
+        }
+    }
+
+    std::unique_ptr<PreloadedScene> preloadScene(const Path &scenePath)
+    {
+        Timer timer;
+        Path inputDirectory = sceneInputDirectory(scenePath);
+
+        std::unique_ptr<PreloadedScene> result(new PreloadedScene());
+        result->path = scenePath;
+        try {
+            {
+                std::unique_lock<std::mutex> lock(_directoryMutex);
+                result->scene.reset(Scene::load(scenePath, nullptr, &inputDirectory));
+            }
+
+            uint64 estimate = estimateSceneMemory(*result->scene);
+            uint64 resident = residentMemory();
+            if (resident + estimate > _preloadMemoryLimit) {
+                writeLogLine(tfm::format("Not preloading scene '%s': %d MB resident plus an estimated %d MB "
+                        "exceeds the preload memory limit", scenePath, resident >> 20, estimate >> 20));
+                return nullptr;
+            }
+
+            Timer loadTimer;
+            result->scene->loadResources();
+            loadTimer.stop();
+            logResourceLoadTimes(*result->scene, loadTimer.elapsed());
+            applySettingsOverrides(*result->scene);
+        } catch (const std::runtime_error &) {
+            // Let the render thread load the scene again and report the error
+            return nullptr;
+        }
+        timer.stop();
+
+        writeLogLine(tfm::format("Preloaded scene '%s' in %s", scenePath,
+                StringUtils::durationToString(timer.elapsed())));
+
+        return result;
+    }
+
+    void clearSnapshots()
+    {
+        std::unique_lock<std::mutex> lock(_snapshotMutex);
+        _snapshot.reset();
+        _backSnapshot.reset();
+    }
+
 public:
     StandaloneRenderer(CliParser &parser, std::ostream &logStream)
     : _parser(parser),
       _logStream(logStream),
       _checkpointInterval(0.0),
       _timeout(0.0),
-      _threadCount(max(ThreadUtils::idealThreadCount() - 1, 1u))
+      _threadCount(max(ThreadUtils::idealThreadCount() - 1, 1u)),
+      _preloadMemoryLimit(uint64(-1)),
+      _preloading(false),
+      _stopPreloading(false),
+      _waitForJobs(false),
+      _cancelCurrent(false),
+      _takeSnapshots(false),
+      _snapshotVersion(0),
+      _snapshotGeneration(0)
     {
-        _status.state = STATE_LOADING;
+        _status.state = STATE_IDLE;
         _status.currentSpp = _status.nextSpp = _status.totalSpp = 0;
 
         parser.addOption('h', "help", "Prints this help text", false, OPT_HELP);
@@ -143,11 +486,28 @@ public:
         parser.addOption('s', "seed", "Specifies the random seed to use", true, OPT_SEED);
         parser.addOption('o', "output-file", "Specifies the output file name. Overrides the setting in the scene file", true, OPT_OUTPUT_FILE);
         parser.addOption('e', "hdr-output-file", "Specifies the hdr output file name. Overrides the setting in the scene file", true, OPT_HDR_OUTPUT_FILE);
+        parser.addOption('\0', "preload-memory", "While rendering, the next queued scene is loaded in the background as long as the process uses less than this much memory (in MB). A value of 0 disables preloading. Default: unlimited", true, OPT_PRELOAD_MEMORY);
+        parser.addOption('\0', "texture-cache", "Limits the memory used by bitmap textures (in MB). Textures are converted to a tiled format in the texture cache directory and paged in on demand. A value of 0 (default) keeps all textures in memory", true, OPT_TEXTURE_CACHE);
+        parser.addOption('\0', "texture-cache-dir", "Specifies the directory for tiled texture files (default: texture_cache in the working directory)", true, OPT_TEXTURE_CACHE_DIR);
+        parser.addOption('\0', "numa", "Pins render threads to cores, spread evenly across NUMA nodes. Per-thread render data is allocated on the node of its thread, and framebuffer and photon map memory is spread evenly across nodes", false, OPT_NUMA);
+    }
+
+    ~StandaloneRenderer()
+    {
+        waitForCheckpoint();
+        if (_preloadThread.joinable()) {
+            {
+                std::unique_lock<std::mutex> lock(_statusMutex);
+                _stopPreloading = true;
+                _statusCond.notify_all();
+            }
+            _preloadThread.join();
+        }
     }
 
     void setup()
     {
-        if (_parser.operands().empty() || _parser.isPresent(OPT_HELP)) {
+        if ((_parser.operands().empty() && !_waitForJobs) || _parser.isPresent(OPT_HELP)) {
             _parser.printHelpText();
             std::exit(0);
         }
@@ -161,6 +521,12 @@ public:
             _checkpointInterval = StringUtils::parseDuration(_parser.param(OPT_CHECKPOINTS));
         if (_parser.isPresent(OPT_TIMEOUT))
             _timeout = StringUtils::parseDuration(_parser.param(OPT_TIMEOUT));
+        if (_parser.isPresent(OPT_PRELOAD_MEMORY))
+            _preloadMemoryLimit = uint64(max(std::atoll(_parser.param(OPT_PRELOAD_MEMORY).c_str()), 0ll)) << 20;
+        if (_parser.isPresent(OPT_TEXTURE_CACHE))
+            TexturePager::setBudget(uint64(max(std::atoll(_parser.param(OPT_TEXTURE_CACHE).c_str()), 0ll)) << 20);
+        TexturePager::setCacheDirectory(_parser.isPresent(OPT_TEXTURE_CACHE_DIR) ?
+                Path(_parser.param(OPT_TEXTURE_CACHE_DIR)) : Path("texture_cache"));
 
         EmbreeUtil::initDevice();
 
@@ -168,7 +534,11 @@ public:
         openvdb::initialize();
 #endif
 
-        ThreadUtils::startThreads(_threadCount);
+        bool pinThreads = _parser.isPresent(OPT_NUMA);
+        ThreadUtils::startThreads(_threadCount, pinThreads);
+        if (pinThreads)
+            writeLogLine(tfm::format("Pinning %d render threads across %d NUMA node(s)",
+                    _threadCount, ThreadUtils::numaNodeCount()));
 
         if (_parser.isPresent(OPT_INPUT_DIRECTORY)) {
             _inputDirectory = Path(_parser.param(OPT_INPUT_DIRECTORY));
@@ -184,52 +554,71 @@ public:
                 FileUtils::createDirectory(_outputDirectory, true);
         }
 
+        // Queued scenes are made absolute up front, since the current
+        // directory changes while other scenes load
         for (const std::string &p : _parser.operands())
-            _status.queuedScenes.emplace_back(p);
+            _status.queuedScenes.emplace_back(Path(p).absolute());
+
+        if (_preloadMemoryLimit > 0)
+            _preloadThread = std::thread(&StandaloneRenderer::preloadLoop, this);
     }
 
     bool renderScene()
     {
         Path currentScene;
+        std::unique_ptr<PreloadedScene> preloaded;
         {
             std::unique_lock<std::mutex> lock(_statusMutex);
-            if (_status.queuedScenes.empty())
+            if (_waitForJobs && _status.queuedScenes.empty()) {
+                _status.state = STATE_IDLE;
+                _statusCond.wait(lock, [&]() { return !_status.queuedScenes.empty(); });
+            }
+            if (_status.queuedScenes.empty()) {
+                _status.state = STATE_IDLE;
                 return false;
+            }
 
             _status.state = STATE_LOADING;
             _status.startSpp = _status.currentSpp = _status.nextSpp = _status.totalSpp = 0;
 
             currentScene = _status.currentScene = _status.queuedScenes.front();
             _status.queuedScenes.pop_front();
-        }
+            _cancelCurrent = false;
 
-        writeLogLine(tfm::format("Loading scene '%s'...", currentScene));
-        Path inputDirectory = _parser.isPresent(OPT_INPUT_DIRECTORY) ? _inputDirectory : Path(currentScene).parent();
-        try {
-            std::unique_lock<std::mutex> lock(_sceneMutex);
-            _scene.reset(Scene::load(Path(currentScene), nullptr, &inputDirectory));
-            _scene->loadResources();
-        } catch (const JsonLoadException &e) {
-            std::cerr << e.what() << std::endl;
+            _statusCond.wait(lock, [&]() { return !_preloading; });
+            preloaded = std::move(_preloadedScene);
+            _rejectedPreload = Path();
+        }
+        if (preloaded && !(preloaded->path == currentScene))
+            preloaded.reset();
 
+        Path inputDirectory = sceneInputDirectory(currentScene);
+        if (preloaded) {
+            writeLogLine(tfm::format("Using preloaded scene '%s'", currentScene));
             std::unique_lock<std::mutex> lock(_sceneMutex);
-            _scene.reset();
+            _scene = std::move(preloaded->scene);
+        } else {
+            writeLogLine(tfm::format("Loading scene '%s'...", currentScene));
+            try {
+                std::unique_lock<std::mutex> lock(_sceneMutex);
+                {
+                    std::unique_lock<std::mutex> directoryLock(_directoryMutex);
+                    _scene.reset(Scene::load(Path(currentScene), nullptr, &inputDirectory));
+                }
+                Timer loadTimer;
+                _scene->loadResources();
+                loadTimer.stop();
+                logResourceLoadTimes(*_scene, loadTimer.elapsed());
+            } catch (const JsonLoadException &e) {
+                std::cerr << e.what() << std::endl;
 
-            return true;
-        }
+                std::unique_lock<std::mutex> lock(_sceneMutex);
+                _scene.reset();
 
-        if (_parser.isPresent(OPT_SPP))
-            _scene->rendererSettings().setSpp(std::atoi(_parser.param(OPT_SPP).c_str()));
+                return true;
+            }
 
-        if (_parser.isPresent(OPT_OUTPUT_FILE)) {
-            Path p(_parser.param(OPT_OUTPUT_FILE));
-            p.freezeWorkingDirectory();
-            _scene->rendererSettings().setOutputFile(p);
-        }
-        if (_parser.isPresent(OPT_HDR_OUTPUT_FILE)) {
-            Path p(_parser.param(OPT_HDR_OUTPUT_FILE));
-            p.freezeWorkingDirectory();
-            _scene->rendererSettings().setHdrOutputFile(p);
+            applySettingsOverrides(*_scene);
         }
 
         {
@@ -238,19 +627,12 @@ public:
         }
 
         try {
-            DirectoryChange context(inputDirectory);
-
-            if (_parser.isPresent(OPT_OUTPUT_DIRECTORY))
-                _scene->rendererSettings().setOutputDirectory(_outputDirectory);
-
-            uint32 seed = 0xBA5EBA11;
-            if (_parser.isPresent(OPT_SEED))
-                seed = std::atoi(_parser.param(OPT_SEED).c_str());
-
             int maxSpp = _scene->rendererSettings().spp();
             {
                 std::unique_lock<std::mutex> lock(_sceneMutex);
-                _flattenedScene.reset(_scene->makeTraceable(seed));
+                std::unique_lock<std::mutex> directoryLock(_directoryMutex);
+                DirectoryChange context(inputDirectory);
+                _flattenedScene.reset(_scene->makeTraceable(renderSeed()));
             }
             Integrator &integrator = _flattenedScene->integrator();
             bool resumeRender = _scene->rendererSettings().enableResumeRender();
@@ -267,7 +649,13 @@ public:
 
             if (resumeRender && !_parser.isPresent(OPT_RESTART)) {
                 writeLogLine("Trying to resume render from saved state... ");
-                if (integrator.resumeRender(*_scene))
+                bool resumed;
+                {
+                    std::unique_lock<std::mutex> lock(_directoryMutex);
+                    DirectoryChange context(inputDirectory);
+                    resumed = integrator.resumeRender(*_scene);
+                }
+                if (resumed)
                     writeLogLine("Resume successful");
                 else
                     writeLogLine("Resume unsuccessful. Starting from 0 spp");
@@ -278,19 +666,29 @@ public:
             }
 
             writeLogLine("Starting render...");
+            if (_takeSnapshots)
+                takeSnapshot(integrator.currentSpp());
             Timer timer, checkpointTimer;
             double totalElapsed = 0.0;
+            bool cancelled = false;
             while (!integrator.done()) {
                 {
                     std::unique_lock<std::mutex> lock(_statusMutex);
+                    if (_cancelCurrent) {
+                        cancelled = true;
+                        break;
+                    }
                     _status.state = STATE_RENDERING;
                     _status.currentSpp = integrator.currentSpp();
                     _status.nextSpp = integrator.nextSpp();
+                    _statusCond.notify_all();
                 }
 
                 integrator.startRender([](){});
                 integrator.waitForCompletion();
                 writeLogLine(tfm::format("Completed %d/%d spp", integrator.currentSpp(), maxSpp));
+                if (_takeSnapshots)
+                    takeSnapshot(integrator.currentSpp());
                 timer.stop();
                 if (_timeout > 0.0 && timer.elapsed() > _timeout)
                     break;
@@ -299,26 +697,51 @@ public:
                     totalElapsed += checkpointTimer.elapsed();
                     writeLogLine(tfm::format("Saving checkpoint after %s",
                             StringUtils::durationToString(totalElapsed)));
-                    Timer ioTimer;
+                    Timer snapshotTimer;
                     checkpointTimer.start();
-                    integrator.saveCheckpoint();
-                    if (resumeRender)
-                        integrator.saveRenderResumeData(*_scene);
-                    ioTimer.stop();
-                    writeLogLine(tfm::format("Saving checkpoint took %s",
-                            StringUtils::durationToString(ioTimer.elapsed())));
+                    waitForCheckpoint();
+                    std::function<void()> writeCheckpoint;
+                    {
+                        std::unique_lock<std::mutex> lock(_directoryMutex);
+                        DirectoryChange context(inputDirectory);
+                        writeCheckpoint = integrator.snapshotCheckpoint(resumeRender ? _scene.get() : nullptr);
+                    }
+                    snapshotTimer.stop();
+                    writeLogLine(tfm::format("Checkpoint snapshot took %s",
+                            StringUtils::durationToString(snapshotTimer.elapsed())));
+                    _checkpointThread = std::thread([this, writeCheckpoint]() {
+                        Timer writeTimer;
+                        try {
+                            writeCheckpoint();
+                        } catch (std::runtime_error &e) {
+                            writeLogLine(tfm::format("Writing checkpoint failed: %s", e.what()));
+                            return;
+                        }
+                        writeTimer.stop();
+                        writeLogLine(tfm::format("Writing checkpoint took %s",
+                                StringUtils::durationToString(writeTimer.elapsed())));
+                    });
                 }
             }
             timer.stop();
+            waitForCheckpoint();
 
-            writeLogLine(tfm::format("Finished render. Render time %s",
-                    StringUtils::durationToString(timer.elapsed())));
+            if (cancelled) {
+                writeLogLine(tfm::format("Cancelled render of scene '%s'", currentScene));
+            } else {
+                writeLogLine(tfm::format("Finished render. Render time %s",
+                        StringUtils::durationToString(timer.elapsed())));
+                logStageTimes(integrator);
+                logTextureCacheStats();
 
-            integrator.saveOutputs();
-            if (_scene->rendererSettings().enableResumeRender())
-                integrator.saveRenderResumeData(*_scene);
+                {
+                    std::unique_lock<std::mutex> lock(_directoryMutex);
+                    DirectoryChange context(inputDirectory);
+                    integrator.saveOutputs();
+                    if (_scene->rendererSettings().enableResumeRender())
+                        integrator.saveRenderResumeData(*_scene);
+                }
 
-            {
                 std::unique_lock<std::mutex> lock(_statusMutex);
                 _status.completedScenes.push_back(currentScene);
             }
@@ -327,6 +750,8 @@ public:
                     currentScene, e.what()));
         }
 
+        waitForCheckpoint();
+        clearSnapshots();
         {
             std::unique_lock<std::mutex> lock(_sceneMutex);
             _flattenedScene.reset();
@@ -336,6 +761,55 @@ public:
         return true;
     }
 
+    // Adds a scene to the render queue. Negative positions append to the end.
+    // Relative paths are resolved against the current directory
+    void submitScene(const Path &scene, int position = -1)
+    {
+        std::unique_lock<std::mutex> lock(_statusMutex);
+        auto &queue = _status.queuedScenes;
+        if (position < 0 || position > int(queue.size()))
+            position = queue.size();
+        queue.insert(queue.begin() + position, scene.absolute());
+        _statusCond.notify_all();
+    }
+
+    // Removes a scene from the render queue, or stops rendering it if it is
+    // the current scene. Cancelling the current scene takes effect once the
+    // current pass completes; its outputs are not saved
+    bool cancelScene(const Path &path)
+    {
+        Path scene = path.absolute();
+        std::unique_lock<std::mutex> lock(_statusMutex);
+        auto &queue = _status.queuedScenes;
+        auto iter = std::find(queue.begin(), queue.end(), scene);
+        if (iter != queue.end()) {
+            queue.erase(iter);
+            _statusCond.notify_all();
+            return true;
+        }
+        if (_status.state != STATE_IDLE && _status.currentScene == scene) {
+            _cancelCurrent = true;
+            return true;
+        }
+        return false;
+    }
+
+    // Moves a queued scene to a new position in the render queue
+    bool prioritizeScene(const Path &path, int position)
+    {
+        Path scene = path.absolute();
+        std::unique_lock<std::mutex> lock(_statusMutex);
+        auto &queue = _status.queuedScenes;
+        auto iter = std::find(queue.begin(), queue.end(), scene);
+        if (iter == queue.end())
+            return false;
+        queue.erase(iter);
+        position = clamp(position, 0, int(queue.size()));
+        queue.insert(queue.begin() + position, scene);
+        _statusCond.notify_all();
+        return true;
+    }
+
     RendererStatus status()
     {
         std::unique_lock<std::mutex> lock(_statusMutex);
@@ -348,22 +822,23 @@ public:
         return _logMutex;
     }
 
-    std::unique_ptr<Vec3c[]> frameBuffer(Vec2i &resolution)
+    // Keeps renderScene waiting for new jobs once the queue runs empty,
+    // instead of returning false. Must be called before setup
+    void enableJobQueue()
     {
-        std::unique_lock<std::mutex> lock(_sceneMutex);
-        if (!_scene || !_flattenedScene)
-            return nullptr;
-
-        Vec2u res = _scene->camera()->resolution();
-        std::unique_ptr<Vec3c[]> ldr(new Vec3c[res.product()]);
-
-        for (uint32 y = 0; y < res.y(); ++y)
-            for (uint32 x = 0; x < res.x(); ++x)
-                ldr[x + y*res.x()] = Vec3c(clamp(Vec3i(_scene->camera()->get(x, y)*255.0f), Vec3i(0), Vec3i(255)));
+        _waitForJobs = true;
+    }
 
-        resolution = Vec2i(res);
+    // Enables taking a framebuffer snapshot after every spp pass
+    void enableSnapshots()
+    {
+        _takeSnapshots = true;
+    }
 
-        return std::move(ldr);
+    std::shared_ptr<const FrameSnapshot> snapshot()
+    {
+        std::unique_lock<std::mutex> lock(_snapshotMutex);
+        return _snapshot;
     }
 };
 